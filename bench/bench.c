@@ -0,0 +1,278 @@
+#define _CRT_SECURE_NO_WARNINGS
+
+#include "async.h"
+#include "clock.h"
+#include "dumper.h"
+#include "journal.h"
+#include "latency.h"
+#include "writer.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Runs dump_range against the in-process emulator for every combination of
+// block size, range size and link latency, and writes MB/s and p50/p99 of
+// every transfer phase as JSON.
+#define BENCH_START_ADDRESS 0x80000000ull
+
+static const uint32_t c_bench_block_sizes[] = { 0x10000, 0x40000, 0x100000 };
+static const uint64_t c_bench_range_sizes[] = { 0x400000, 0x2000000 };
+static const uint32_t c_bench_latencies_us[] = { 0, 50, 250 };
+
+typedef struct BenchOptions
+{
+    const char* results_path;
+    const char* scratch_path;
+    // Extra emulator keys, appended to the latency of every case
+    const char* emulate_spec;
+    uint32_t async_depth;
+    const char* writer_name;
+    WriterBackendType_t writer_backend;
+    // Only the first block size, range size and latency
+    int quick;
+} BenchOptions_t;
+
+typedef struct BenchCase
+{
+    uint32_t block_size;
+    uint64_t range_size;
+    uint32_t latency_us;
+    double seconds;
+    LatencyHistogram_t phases[PHASE_COUNT];
+} BenchCase_t;
+
+static void bench_remove_output(const char* path)
+{
+    char side_path[0x200];
+
+    remove(path);
+    snprintf(side_path, sizeof(side_path), "%s%s", path, JOURNAL_SUFFIX);
+    remove(side_path);
+    snprintf(side_path, sizeof(side_path), "%s%s", path, EXTENTS_SUFFIX);
+    remove(side_path);
+}
+
+static int32_t bench_run(const BenchOptions_t* options, BenchCase_t* bench_case)
+{
+    State_t state;
+    Options_t dump_options;
+    char spec[0x200];
+    char path[0x200];
+
+    memset(&state, 0, sizeof(state));
+    memset(&dump_options, 0, sizeof(dump_options));
+    dump_options.async_depth = options->async_depth;
+    dump_options.writer_backend = options->writer_backend;
+    apply_options(&state, &dump_options);
+
+    snprintf(spec,
+             sizeof(spec),
+             "latency_us=%u%s%s",
+             bench_case->latency_us,
+             options->emulate_spec ? "," : "",
+             options->emulate_spec ? options->emulate_spec : "");
+    if (init_emulator(&state, spec) < 0) {
+        close_state(&state);
+        return -1;
+    }
+
+    state.block_size = bench_case->block_size;
+    state.phase_latency = bench_case->phases;
+
+    snprintf(path,
+             sizeof(path),
+             "%s/bench-%x-%llx-%u.bin",
+             options->scratch_path,
+             bench_case->block_size,
+             (unsigned long long)bench_case->range_size,
+             bench_case->latency_us);
+    bench_remove_output(path);
+
+    dump_options.dump_mode = DUMP_MODE_RANGE;
+    dump_options.output_path = path;
+    dump_options.range.start_address = BENCH_START_ADDRESS;
+    dump_options.range.end_address = BENCH_START_ADDRESS + bench_case->range_size;
+
+    const uint64_t start_ns = clock_now_ns();
+    const int32_t result = dump_memory(&state, &dump_options);
+    bench_case->seconds = (double)(clock_now_ns() - start_ns) / 1e9;
+
+    close_state(&state);
+    bench_remove_output(path);
+
+    return result;
+}
+
+static double bench_mbps(const BenchCase_t* bench_case)
+{
+    return (double)bench_case->range_size / bench_case->seconds / 1e6;
+}
+
+static void bench_write_case(FILE* file, const BenchCase_t* bench_case, int last)
+{
+    fprintf(file,
+            "    {\"block_size\": %u, \"range_size\": %llu, \"latency_us\": %u, "
+            "\"seconds\": %.6f, \"mbps\": %.3f, \"phases\": {",
+            bench_case->block_size,
+            (unsigned long long)bench_case->range_size,
+            bench_case->latency_us,
+            bench_case->seconds,
+            bench_mbps(bench_case));
+
+    for (uint32_t i = 0; i < PHASE_COUNT; i++) {
+        const LatencyHistogram_t* histogram = &bench_case->phases[i];
+
+        fprintf(file,
+                "%s\"%s\": {\"count\": %llu, \"p50_us\": %.3f, \"p99_us\": %.3f, "
+                "\"max_us\": %.3f}",
+                i ? ", " : "",
+                c_phase_names[i],
+                (unsigned long long)histogram->count,
+                (double)latency_percentile(histogram, 0.5) / 1e3,
+                (double)latency_percentile(histogram, 0.99) / 1e3,
+                (double)histogram->max_ns / 1e3);
+    }
+
+    fprintf(file, "}}%s\n", last ? "" : ",");
+}
+
+static int32_t bench_write_results(const BenchOptions_t* options,
+                                   const BenchCase_t* cases,
+                                   uint32_t count)
+{
+    FILE* file = fopen(options->results_path, "w");
+    if (!file) {
+        printf("Failed to open %s\n", options->results_path);
+        return -1;
+    }
+
+    fprintf(file, "{\n");
+    fprintf(file, "  \"benchmark\": \"dump_range\",\n");
+    fprintf(file, "  \"async_depth\": %u,\n", options->async_depth);
+    fprintf(file, "  \"writer\": \"%s\",\n", options->writer_name);
+    fprintf(file, "  \"results\": [\n");
+    for (uint32_t i = 0; i < count; i++)
+        bench_write_case(file, &cases[i], i + 1 == count);
+    fprintf(file, "  ]\n}\n");
+
+    if (fclose(file) != 0) {
+        printf("Failed to write %s\n", options->results_path);
+        return -1;
+    }
+
+    return 0;
+}
+
+static void bench_print_case(const BenchCase_t* bench_case)
+{
+    printf("block 0x%X, range 0x%llX, latency %u us: %.2f MB/s",
+           bench_case->block_size,
+           (unsigned long long)bench_case->range_size,
+           bench_case->latency_us,
+           bench_mbps(bench_case));
+    for (uint32_t i = 0; i < PHASE_COUNT; i++)
+        printf(", %s p50 %.1f us",
+               c_phase_names[i],
+               (double)latency_percentile(&bench_case->phases[i], 0.5) / 1e3);
+    printf("\n");
+}
+
+static void bench_parse_flag(BenchOptions_t* options, const char* arg)
+{
+    if (!strncmp(arg, "--async", 7) && (arg[7] == '\0' || arg[7] == '=')) {
+        options->async_depth = arg[7] ? (uint32_t)atoi(arg + 8) : ASYNC_DEFAULT_DEPTH;
+        if (!options->async_depth || options->async_depth > ASYNC_MAX_DEPTH) {
+            printf("Invalid queue depth: %s\n", arg);
+            exit(-1);
+        }
+    } else if (!strncmp(arg, "--writer=", 9)) {
+        options->writer_name = arg + 9;
+        if (writer_parse_backend(options->writer_name, &options->writer_backend) < 0) {
+            printf("Unknown writer backend: %s\n", options->writer_name);
+            exit(-1);
+        }
+    } else if (!strncmp(arg, "--emulate=", 10)) {
+        options->emulate_spec = arg + 10;
+    } else if (!strncmp(arg, "--scratch=", 10)) {
+        options->scratch_path = arg + 10;
+    } else if (!strcmp(arg, "--quick")) {
+        options->quick = 1;
+    } else {
+        printf("Unknown option: %s\n", arg);
+        exit(-1);
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    BenchOptions_t options = { 0 };
+    options.scratch_path = ".";
+    options.writer_name = "stdio";
+
+    int positional = 0;
+    for (int i = 1; i < argc; i++) {
+        if (!strncmp(argv[i], "--", 2)) {
+            bench_parse_flag(&options, argv[i]);
+        } else {
+            options.results_path = argv[i];
+            positional++;
+        }
+    }
+
+    if (positional != 1) {
+        printf("Usage: %s <results.json>\n", argv[0]);
+        printf("Options:\n");
+        printf("  --async[=<depth>]        use the asynchronous transfer engine\n");
+        printf("  --writer=<backend>       stdio, direct, uring or mmap output file\n");
+        printf("  --emulate=<key=value,..> extra emulator settings, e.g. bandwidth_mbps=40\n");
+        printf("  --scratch=<directory>    where the dumps are written (default .)\n");
+        printf("  --quick                  a single small case\n");
+        return -1;
+    }
+
+    const uint32_t block_count = options.quick ? 1 : sizeof(c_bench_block_sizes) / sizeof(uint32_t);
+    const uint32_t range_count = options.quick ? 1 : sizeof(c_bench_range_sizes) / sizeof(uint64_t);
+    const uint32_t latency_count =
+        options.quick ? 1 : sizeof(c_bench_latencies_us) / sizeof(uint32_t);
+
+    const uint32_t count = block_count * range_count * latency_count;
+    BenchCase_t* cases = calloc(count, sizeof(BenchCase_t));
+    if (!cases) {
+        printf("Failed to allocate benchmark results\n");
+        return -1;
+    }
+
+    uint32_t done = 0;
+    for (uint32_t i = 0; i < block_count; i++) {
+        for (uint32_t j = 0; j < range_count; j++) {
+            for (uint32_t k = 0; k < latency_count; k++) {
+                BenchCase_t* bench_case = &cases[done];
+
+                bench_case->block_size = c_bench_block_sizes[i];
+                bench_case->range_size = c_bench_range_sizes[j];
+                bench_case->latency_us = c_bench_latencies_us[k];
+                if (bench_run(&options, bench_case) < 0) {
+                    printf("Benchmark case failed\n");
+                    free(cases);
+                    return -1;
+                }
+
+                done++;
+            }
+        }
+    }
+
+    printf("\n");
+    for (uint32_t i = 0; i < count; i++)
+        bench_print_case(&cases[i]);
+
+    const int32_t result = bench_write_results(&options, cases, count);
+    if (result == 0)
+        printf("Results written to %s\n", options.results_path);
+
+    free(cases);
+
+    return result;
+}
@@ -0,0 +1,23 @@
+#ifndef ASYNC_H
+#define ASYNC_H
+
+#include "dumper.h"
+
+#include <stdint.h>
+
+#define ASYNC_DEFAULT_DEPTH 2
+#define ASYNC_MAX_DEPTH 8
+
+// Reads [start_address, end_address) with up to state->async_depth blocks in
+// flight. Every block's full command sequence and receive buffers are posted
+// up front, so the device can start on the next block while the host is still
+// consuming the current one. Blocks are received straight into buffers from the
+// pool and delivered to the callback in order.
+int32_t async_read_range(State_t* state,
+                         uint64_t start_address,
+                         uint64_t end_address,
+                         BlockPool_t* pool,
+                         BlockCallback_t callback,
+                         void* ctx);
+
+#endif // ASYNC_H
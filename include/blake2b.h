@@ -0,0 +1,26 @@
+#ifndef BLAKE2B_H
+#define BLAKE2B_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define BLAKE2B_BLOCK_SIZE 128
+#define BLAKE2B_MAX_DIGEST_SIZE 64
+
+// Unkeyed BLAKE2b (RFC 7693)
+typedef struct Blake2b
+{
+    uint64_t h[8];
+    uint64_t t[2];
+    uint8_t buffer[BLAKE2B_BLOCK_SIZE];
+    size_t buffered;
+    size_t digest_size;
+} Blake2b_t;
+
+void blake2b_init(Blake2b_t* ctx, size_t digest_size);
+void blake2b_update(Blake2b_t* ctx, const void* data, size_t size);
+void blake2b_final(Blake2b_t* ctx, uint8_t* digest);
+
+void blake2b(uint8_t* digest, size_t digest_size, const void* data, size_t size);
+
+#endif // BLAKE2B_H
@@ -0,0 +1,15 @@
+#ifndef CLOCK_H
+#define CLOCK_H
+
+#include <stdint.h>
+
+// Monotonic time in nanoseconds
+uint64_t clock_now_ns(void);
+
+// Sleep for at least the given amount of microseconds
+void clock_sleep_us(uint64_t usec);
+
+// Sleep until the monotonic clock reaches the given deadline
+void clock_sleep_until_ns(uint64_t deadline_ns);
+
+#endif // CLOCK_H
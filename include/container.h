@@ -0,0 +1,119 @@
+#ifndef CONTAINER_H
+#define CONTAINER_H
+
+#include "pool.h"
+
+#include <stdint.h>
+#include <stdio.h>
+
+// Packed dump container. Every block is compressed on its own into a frame,
+// and an index at the end of the file maps address ranges to frames, so any
+// address can be read without decompressing the rest:
+//
+//   ContainerHeader_t
+//   frame data ...
+//   ContainerFrame_t[frame_count]
+//   ContainerFooter_t
+//
+// All fields are little-endian.
+#define CONTAINER_MAGIC "UDPACK01"
+#define CONTAINER_INDEX_MAGIC "UDINDEX1"
+#define CONTAINER_EXTENSION ".udp"
+#define CONTAINER_MAX_THREADS 16
+#define CONTAINER_DEFAULT_ZSTD_LEVEL 3
+
+typedef enum ContainerCodec
+{
+    CONTAINER_CODEC_STORED,
+    // All zero, no data is stored
+    CONTAINER_CODEC_ZERO,
+    CONTAINER_CODEC_LZ4,
+    CONTAINER_CODEC_ZSTD,
+} ContainerCodec_t;
+
+typedef struct ContainerHeader
+{
+    char magic[8];
+    uint64_t start_address;
+    uint64_t end_address;
+    uint32_t codec;
+    uint32_t block_size;
+} ContainerHeader_t;
+
+typedef struct ContainerFrame
+{
+    uint64_t address;
+    uint64_t offset;
+    uint32_t size;
+    uint32_t stored_size;
+    uint32_t codec;
+    uint32_t reserved;
+} ContainerFrame_t;
+
+typedef struct ContainerFooter
+{
+    uint64_t index_offset;
+    uint64_t frame_count;
+    char magic[8];
+} ContainerFooter_t;
+
+typedef struct ContainerStats
+{
+    const char* codec;
+    uint32_t threads;
+    uint64_t frames;
+    uint64_t bytes;
+    uint64_t stored_bytes;
+    // Summed over all workers
+    uint64_t compress_ns;
+} ContainerStats_t;
+
+typedef struct ContainerWriter ContainerWriter_t;
+
+// Starts threads workers that compress submitted blocks, returns them to the
+// pool and append the frames to path in address order
+ContainerWriter_t* container_writer_open(const char* path,
+                                         ContainerCodec_t codec,
+                                         int32_t level,
+                                         uint32_t threads,
+                                         uint64_t start_address,
+                                         uint64_t end_address,
+                                         uint32_t block_size,
+                                         BlockPool_t* pool);
+
+// Queues a block for compression, fails once the writer has failed
+int32_t container_writer_submit(ContainerWriter_t* writer, Block_t* block);
+
+// Waits for the workers and writes the index
+int32_t container_writer_close(ContainerWriter_t* writer, ContainerStats_t* stats);
+
+void container_print_stats(const char* output_path, const ContainerStats_t* stats);
+
+typedef struct ContainerReader
+{
+    FILE* file;
+    ContainerHeader_t header;
+    ContainerFrame_t* frames;
+    uint64_t frame_count;
+
+    // Last decompressed frame
+    uint8_t* cache;
+    uint64_t cache_capacity;
+    int64_t cache_frame;
+    uint8_t* stored;
+    uint64_t stored_capacity;
+} ContainerReader_t;
+
+ContainerReader_t* container_reader_open(const char* path);
+void container_reader_close(ContainerReader_t* reader);
+
+// Reads [address, address + size), which has to be inside the container
+int32_t container_read(ContainerReader_t* reader, uint64_t address, uint8_t* buf, uint64_t size);
+
+// Writes the raw contents of a container to a (sparse) .bin file
+int32_t container_unpack(const char* input_path, const char* output_path);
+
+int32_t container_parse_codec(const char* name, ContainerCodec_t* codec);
+const char* container_codec_name(ContainerCodec_t codec);
+
+#endif // CONTAINER_H
@@ -0,0 +1,50 @@
+#ifndef DEVICES_H
+#define DEVICES_H
+
+#include "dumper.h"
+
+#include <stdint.h>
+
+#define MAX_DEVICES 0x20
+// Aggregate throughput is printed this often while several devices are dumped
+#define DEVICES_REPORT_INTERVAL_US 2000000
+#define DEVICES_POLL_INTERVAL_US 100000
+// --wait rescans the bus this often even when hotplug events are available
+#define WAIT_RESCAN_INTERVAL_US 500000
+// A device that just appeared may need a moment before it can be opened
+#define WAIT_OPEN_ATTEMPTS 10
+#define WAIT_OPEN_DELAY_US 200000
+
+typedef struct DeviceInfo
+{
+    // "<bus>-<port>[.<port>...]", stays the same while the device is plugged into the same port
+    char path[MAX_DEVICE_ID];
+    // iSerialNumber, empty if the device has none or it could not be read
+    char serial[MAX_DEVICE_ID];
+    // Name of the per-device output directory: the serial, or the path if there is none
+    char id[MAX_DEVICE_ID];
+    uint16_t vendor_id;
+    uint16_t product_id;
+} DeviceInfo_t;
+
+// Lists up to capacity supported devices, returns their number or -1
+int32_t find_devices(libusb_context* ctx, DeviceInfo_t* devices, uint32_t capacity);
+
+// Whether the options select devices explicitly (--device) or the emulator
+// presents more than one
+int devices_requested(const Options_t* options);
+
+// Dumps every selected device at the same time, one worker thread and one
+// libusb context per device. With "--device=all" or a list of devices every
+// device writes to its own directory: dump_all into <output_directory>/<id>,
+// dump_index and dump_range into <dirname>/<id>/<basename>.
+int32_t dump_devices(const Options_t* options);
+
+// Stays resident and dumps every selected device as soon as it shows up, one
+// after another, until options->wait_count devices were dumped (0 for no
+// limit). Devices are found by hotplug events where libusb supports them, by
+// polling otherwise. A device is dumped again only after it left and came
+// back. Several devices get per-device outputs like dump_devices().
+int32_t wait_devices(const Options_t* options);
+
+#endif // DEVICES_H
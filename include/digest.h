@@ -0,0 +1,73 @@
+#ifndef DIGEST_H
+#define DIGEST_H
+
+#include "pool.h"
+#include "sha256.h"
+
+#include <stdint.h>
+
+// Integrity manifest kept in "<output>.hashes" next to a dump, with the
+// SHA-256 and XXH64 of every block as it was received and of the whole range
+// once the dump is complete:
+//
+//   range 0x80000000 0x81000000
+//   block 0x80000000 0x40000 <sha256> <xxh64>
+//   ...
+//   total <sha256> <xxh64>
+//
+// Later lines for the same address replace earlier ones, a resumed dump
+// appends to the manifest. The total matches sha256sum of the raw dump.
+#define DIGEST_SUFFIX ".hashes"
+#define DIGEST_MAX_THREADS 16
+// Chunk size for re-reading a dump
+#define DIGEST_READ_SIZE 0x100000
+
+// Takes ownership of a block, like BlockCallback_t
+typedef int32_t (*DigestSink_t)(void* ctx, Block_t* block);
+
+typedef struct DigestStats
+{
+    uint32_t threads;
+    uint64_t blocks;
+    uint64_t bytes;
+    // Per-block digests, summed over all workers
+    uint64_t block_ns;
+    // Digests of the whole range, which has to be hashed in order
+    uint64_t range_ns;
+    // The whole range had to be read back because the dump was resumed
+    int reread;
+    uint8_t sha256[SHA256_DIGEST_SIZE];
+    uint64_t xxh64;
+} DigestStats_t;
+
+typedef struct DigestWriter DigestWriter_t;
+
+// Starts threads workers that hash submitted blocks and pass them on to sink
+// in the order they were submitted. Without truncate an existing manifest is
+// continued.
+DigestWriter_t* digest_writer_open(const char* output_path,
+                                   uint64_t start_address,
+                                   uint64_t end_address,
+                                   uint32_t threads,
+                                   int truncate,
+                                   BlockPool_t* pool,
+                                   DigestSink_t sink,
+                                   void* sink_ctx);
+
+// Queues a block for hashing, fails once the writer has failed
+int32_t digest_writer_submit(DigestWriter_t* writer, Block_t* block);
+
+// Waits until every block has been hashed and handed to the sink
+int32_t digest_writer_drain(DigestWriter_t* writer);
+
+// Writes the total if the dump is complete. When blocks were missed, because
+// the dump was resumed, the dump at output_path is read back for it.
+int32_t digest_writer_close(DigestWriter_t* writer, int complete, DigestStats_t* stats);
+
+void digest_print_stats(const char* output_path, const DigestStats_t* stats);
+
+// Checks a raw, packed (.udp) or stored (.manifest) dump against its
+// integrity manifest, hashes_path defaults to "<dump_path>.hashes"
+int32_t digest_verify(const char* dump_path, const char* hashes_path, uint32_t threads);
+
+#endif // DIGEST_H
@@ -1,13 +1,41 @@
 #ifndef DUMPER_H
 #define DUMPER_H
 
+#include "container.h"
+#include "digest.h"
+#include "image.h"
+#include "latency.h"
+#include "metrics.h"
+#include "pool.h"
+#include "search.h"
+#include "store.h"
+#include "survey.h"
+#include "transport.h"
+#include "writer.h"
+
 #include <libusb-1.0/libusb.h>
 #include <stdio.h>
 
 #define DEBUG_PRINT 0
 #define BLOCK_SIZE 0x40000
+#define MIN_BLOCK_SIZE 0x10000
+#define MAX_BLOCK_SIZE 0x1000000
+// Extra room after every block for the trailing byte of the data transfer
+#define BLOCK_SLACK 0x10
+// Blocks received in place into a mapped output have no room for it: their data
+// transfer is split at a multiple of the largest bulk packet size, and the rest
+// of the block and the trailing byte go to a landing buffer
+#define LANDING_SIZE 0x400
+#define PROBE_PACKET_SIZE 0x40000
 #define ACK_PACKET_SIZE 0x400
+#define RETRY_DEFAULT_COUNT 3
+// Back-off before re-synchronizing, multiplied by the attempt number
+#define RETRY_DELAY_US 100000
 #define USB_CLASS_CDC_DATA 0x0A
+// USB 3 allows up to 7 tiers of hubs
+#define MAX_PORT_DEPTH 7
+// "<bus>-<port>.<port>..." or a serial number
+#define MAX_DEVICE_ID 0x40
 
 typedef struct Device
 {
@@ -16,17 +44,17 @@ typedef struct Device
 } Device_t;
 
 // Supported devices, add your own here
-const Device_t c_supported_devs[] = { { 0x04e8, 0x6601 },
+static const Device_t c_supported_devs[] = { { 0x04e8, 0x6601 },
                                       { 0x04e8, 0x685d },
                                       { 0x04e8, 0x68c3 },
                                       { 0x04e8, 0x6860 } };
 
-const char c_preamble[] = "PrEaMbLe\0";
-const char c_acknowledgment[] = "AcKnOwLeDgMeNt\0";
-const char c_postamble[] = "PoStAmBlE\0";
-const char c_powerdown[] = "PoWeRdOwN\0";
-const char c_dataxfer[] = "DaTaXfEr\0";
-const char c_probe[] = "PrObE\0";
+static const char c_preamble[] = "PrEaMbLe\0";
+static const char c_acknowledgment[] = "AcKnOwLeDgMeNt\0";
+static const char c_postamble[] = "PoStAmBlE\0";
+static const char c_powerdown[] = "PoWeRdOwN\0";
+static const char c_dataxfer[] = "DaTaXfEr\0";
+static const char c_probe[] = "PrObE\0";
 
 #define MAX_PROBE_ENTRIES 0x40
 #define MAX_DEVICE_NAME 0x10
@@ -53,6 +81,21 @@ typedef struct ProbeTable
     Mode_t mode;
 } ProbeTable_t;
 
+// Steps of a block transfer, and the output write that follows it
+typedef enum Phase
+{
+    PHASE_PREAMBLE,
+    PHASE_LOW_ADDRESS,
+    PHASE_HIGH_ADDRESS,
+    PHASE_DATA_XFER,
+    PHASE_WRITE,
+    PHASE_COUNT,
+} Phase_t;
+
+static const char* const c_phase_names[PHASE_COUNT] = {
+    "preamble", "low_address", "high_address", "dataxfer", "write",
+};
+
 typedef struct State
 {
     ProbeTable_t* probe_table;
@@ -64,23 +107,109 @@ typedef struct State
     int in_endpoint;
     int out_endpoint;
     int interface_claimed;
+    Transport_t* transport;
+    uint16_t vendor_id;
+    uint16_t product_id;
+    // Bytes requested per DaTaXfEr, BLOCK_SIZE unless tuned or overridden
+    uint32_t block_size;
+    // Blocks kept in flight by the asynchronous engine, 0 for blocking transfers
+    uint32_t async_depth;
+    WriterBackendType_t writer_backend;
+    uint32_t writer_buffers;
+    // Continue from <output>.journal instead of starting over
+    int resume;
+    // Leave zero blocks as holes in the output
+    int sparse;
+    // Compress into a packed container instead of a raw file
+    int packed;
+    ContainerCodec_t pack_codec;
+    int32_t pack_level;
+    uint32_t pack_threads;
+    // Record per-block and whole-range digests in <output>.hashes
+    int hash;
+    // Patterns to look for and minimum length of strings to extract into
+    // <output>.matches while the dump runs, NULL and 0 for none
+    const SearchPatterns_t* search;
+    uint32_t strings_min;
+    // Hash blocks into this chunk store and write manifests instead of raw files
+    const char* store_path;
+    // Attempts per block before a transfer error is fatal
+    uint32_t retries;
+    // Bytes received so far, guarded by stats_mutex when several devices are dumped at once
+    uint64_t received_bytes;
+    Mutex_t* stats_mutex;
+    // PHASE_COUNT latency histograms, only recorded into if set
+    LatencyHistogram_t* phase_latency;
+    // Status line and metrics export, NULL for none
+    Metrics_t* metrics;
+    // Reads from the device skip zero and constant regions of this survey, if set
+    const Survey_t* survey;
 } State_t;
 
-State_t g_usb_state;
-State_t* g_usb_state_ptr = &g_usb_state;
+extern State_t g_usb_state;
+extern State_t* g_usb_state_ptr;
 
 typedef enum DumpMode
 {
     DUMP_MODE_ALL,
     DUMP_MODE_INDEX,
     DUMP_MODE_RANGE,
+    DUMP_MODE_UNPACK,
+    DUMP_MODE_MATERIALIZE,
+    DUMP_MODE_VERIFY,
+    DUMP_MODE_SURVEY,
+    DUMP_MODE_RECEIVE,
+    DUMP_MODE_VIEW,
 } DumpMode_t;
 
 typedef struct Options
 {
     const char* output_file_name;
     char* output_path;
+    const char* input_path;
+    // Integrity manifest to verify against, <input_path>.hashes if NULL
+    const char* hashes_path;
     DumpMode_t dump_mode;
+    const char* emulate_spec;
+    // "all" or a comma separated list of bus-port paths and serial numbers
+    const char* device_selector;
+    uint32_t async_depth;
+    uint32_t block_size;
+    int tune;
+    const char* tune_cache_path;
+    WriterBackendType_t writer_backend;
+    uint32_t writer_buffers;
+    int resume;
+    int no_sparse;
+    int packed;
+    ContainerCodec_t pack_codec;
+    int32_t pack_level;
+    uint32_t pack_threads;
+    const char* store_path;
+    int hash;
+    // --search, with the pattern file or NULL for the built-in markers
+    int search;
+    const char* search_path;
+    uint32_t strings_min;
+    uint32_t retries;
+    int retries_set;
+    // dump_all writes a single image file instead of a directory
+    ImageFormat_t image_format;
+    // JSON, or Prometheus text for a .prom file, rewritten while the dump runs
+    const char* metrics_path;
+    int no_progress;
+    // Survey that guides the dump, and how fine a new one samples
+    const char* survey_path;
+    uint64_t survey_granularity;
+    uint32_t survey_samples;
+    // Address of the first byte of a raw dump that is viewed
+    uint64_t base_address;
+    int base_set;
+    // Hexdumps replace repeated lines by "*"
+    int squeeze;
+    // Wait for devices to show up and dump wait_count of them, 0 for no limit
+    int wait;
+    uint32_t wait_count;
 
     union
     {
@@ -93,8 +222,49 @@ typedef struct Options
     };
 } Options_t;
 
+// Receives every block of a range, in order, and takes ownership of it: the
+// block has to go back to its pool eventually. Returning a negative value stops
+// the transfer.
+typedef int32_t (*BlockCallback_t)(void* ctx, Block_t* block);
+
+int32_t send_packet(State_t* state, uint8_t* packet, uint32_t packet_size);
+// Returns the number of bytes received or -1
+int32_t receive_packet(State_t* state, uint8_t* packet, uint32_t packet_size);
+int32_t read_block(
+    State_t* state, uint64_t addr_low, uint64_t high_addr, uint8_t* recv_buf, int in_place);
+// Reads [start_address, end_address) block by block. A block that fails is
+// retried up to state->retries times, after draining the device so that the
+// next preamble starts from a clean state.
+int32_t read_range(State_t* state,
+                   uint64_t start_address,
+                   uint64_t end_address,
+                   BlockPool_t* pool,
+                   BlockCallback_t callback,
+                   void* ctx);
+void drain_device(State_t* state);
+
+int is_supported_device(uint16_t vendor_id, uint16_t product_id);
+// Formats the bus and port numbers of a device as "<bus>-<port>[.<port>...]"
+int32_t device_port_path(libusb_device* device, char* path, size_t size);
+// Opens the supported device at port_path, or the first one if port_path is NULL
+int init_device(State_t* state, const char* port_path);
+int init_emulator(State_t* state, const char* spec);
+void close_state(State_t* state);
+void apply_options(State_t* state, const Options_t* options);
+void print_probetable(const ProbeTable_t* probetable);
+int32_t select_block_size(State_t* state, const Options_t* options);
+int32_t dump_memory(State_t* state, const Options_t* options);
+int create_directory(const char* name);
+// Creates a pool of at least count buffers that fit a block of the current
+// block size, and enough of them to keep the reader's pipeline busy
+int32_t init_block_pool(State_t* state, BlockPool_t* pool, uint32_t count);
+
 #ifndef min
 #define min(a, b) (((a) < (b)) ? (a) : (b))
 #endif
 
+#ifndef max
+#define max(a, b) (((a) > (b)) ? (a) : (b))
+#endif
+
 #endif // DUMPER_H
\ No newline at end of file
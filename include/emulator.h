@@ -0,0 +1,70 @@
+#ifndef EMULATOR_H
+#define EMULATOR_H
+
+#include "dumper.h"
+#include "transport.h"
+
+#include <stdint.h>
+
+#define EMU_MAX_PACKET_SIZE 0x200
+#define EMU_PROBE_PACKET_SIZE 0x1000
+
+typedef enum EmuPattern
+{
+    EMU_PATTERN_ZERO,
+    // Every 64-bit word holds its own physical address
+    EMU_PATTERN_ADDRESS,
+    // 64 KiB regions that are either zero, address pattern or pseudo-random
+    EMU_PATTERN_MIXED,
+} EmuPattern_t;
+
+typedef struct EmuConfig
+{
+    // Served in response to PrObE, in the 32-bit or 64-bit ('+') layout
+    ProbeTable_t probe_table;
+    uint16_t vendor_id;
+    uint16_t product_id;
+
+    // Memory reads are served from this file (offset = address - image_base)
+    // or from the synthetic pattern when no image is given
+    const char* image_path;
+    uint64_t image_base;
+    EmuPattern_t pattern;
+
+    // Link model: fixed per-packet latency and an optional bandwidth cap
+    uint32_t latency_us;
+    uint64_t bandwidth;
+
+    // Largest DaTaXfEr window the bootloader accepts, 0 for no limit
+    uint32_t max_block;
+
+    // Every n-th data transfer is dropped, 0 to never fail
+    uint32_t fail_every;
+
+    // Number of identical devices presented to --device, named emu0, emu1, ...
+    uint32_t devices;
+} EmuConfig_t;
+
+void emu_default_config(EmuConfig_t* config);
+
+// Parses a comma separated list of key=value pairs on top of the defaults:
+// table=<file>, layout=32|64, image=<file>, base=<addr>, pattern=zero|address|mixed,
+// latency_us=<n>, bandwidth_mbps=<n>, pid=<id>, max_block=<size>, fail_every=<n>,
+// devices=<n>
+int32_t emu_parse_config(const char* spec, EmuConfig_t* config);
+
+// Loads a probe table from a text file with one "<name> <start> <end> [type]"
+// entry per line. "device <name>" and "layout 32|64" lines are also accepted.
+int32_t emu_load_probe_table(const char* path, ProbeTable_t* probe_table);
+
+// Serializes a probe table the way the bootloader sends it
+uint32_t emu_serialize_probe_table(const ProbeTable_t* probe_table,
+                                   uint8_t* packet,
+                                   uint32_t packet_size);
+
+// Fills buf with the emulated memory contents at [address, address + size)
+void emu_fill_pattern(EmuPattern_t pattern, uint64_t address, uint8_t* buf, uint64_t size);
+
+Transport_t* transport_emu_create(const EmuConfig_t* config);
+
+#endif // EMULATOR_H
@@ -4,9 +4,36 @@
 #define _CRT_SECURE_NO_WARNINGS
 
 #include <stdint.h>
+#include <stdio.h>
 
 #define HEXDUMP_COLS (16)
+// "<address>  <16 hex bytes in two groups>  |<ascii>|\n"
+#define HEXDUMP_LINE_SIZE (16 + 2 + HEXDUMP_COLS * 3 + 1 + 1 + HEXDUMP_COLS + 2 + 1)
+// Lines are formatted into a buffer of this size and written in one go
+#define HEXDUMP_BUFFER_SIZE 0x100000
 
+typedef struct Hexdump
+{
+    FILE* output;
+    char* buffer;
+    size_t used;
+    // Lines equal to the one before them are replaced by a single "*"
+    int squeeze;
+    int squeezing;
+    int has_previous;
+    uint8_t previous[HEXDUMP_COLS];
+    // Address after the last byte written
+    uint64_t end_address;
+} Hexdump_t;
+
+int32_t hexdump_init(Hexdump_t* dump, FILE* output, int squeeze);
+// Formats size bytes starting at address. Every call but the last one has to
+// pass whole lines, a multiple of HEXDUMP_COLS bytes.
+int32_t hexdump_write(Hexdump_t* dump, const uint8_t* data, uint64_t size, uint64_t address);
+// Writes what is still buffered and frees the buffer
+int32_t hexdump_finish(Hexdump_t* dump);
+
+// Packet traces for DEBUG_PRINT
 void hexdump(void* mem, uint32_t len, uint64_t base);
 
-#endif // HEXDUMP_H
\ No newline at end of file
+#endif // HEXDUMP_H
@@ -0,0 +1,56 @@
+#ifndef IMAGE_H
+#define IMAGE_H
+
+#include <stdint.h>
+
+// Single-file images of physical memory for analysis tools, written by
+// dump_all --image. Every segment is a disjoint range of physical memory.
+//
+//   elf:  ELF core file with one PT_LOAD per segment at its physical address
+//   lime: LiME file, a 32 byte range header in front of every segment
+//
+// The layout is known before anything is read, so the headers go first and
+// the data follows in one sequential pass. Zero blocks stay holes.
+#define IMAGE_MAX_SEGMENTS 0x40
+#define IMAGE_PAGE_SIZE 0x1000
+
+#define IMAGE_MACHINE_ARM 40
+#define IMAGE_MACHINE_AARCH64 183
+
+typedef enum ImageFormat
+{
+    IMAGE_FORMAT_NONE,
+    IMAGE_FORMAT_ELF,
+    IMAGE_FORMAT_LIME,
+} ImageFormat_t;
+
+typedef struct ImageSegment
+{
+    uint64_t start;
+    uint64_t end;
+    // Position of the segment's first byte in the image
+    uint64_t offset;
+} ImageSegment_t;
+
+typedef struct ImageLayout
+{
+    ImageFormat_t format;
+    // ELF e_machine
+    uint16_t machine;
+    // Sorted by address, filled in by the caller
+    ImageSegment_t segments[IMAGE_MAX_SEGMENTS];
+    uint32_t count;
+    // Size of the whole image
+    uint64_t size;
+} ImageLayout_t;
+
+int32_t image_parse_format(const char* name, ImageFormat_t* format);
+
+// Assigns the offsets of the segments and the size of the image
+void image_layout(ImageLayout_t* layout);
+
+// Creates the image at path with its headers, the data is written at the
+// segment offsets afterwards
+int32_t image_write_headers(const ImageLayout_t* layout, const char* path);
+
+#endif // IMAGE_H
@@ -0,0 +1,84 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#define JOURNAL_SUFFIX ".journal"
+#define EXTENTS_SUFFIX ".extents"
+// Completed blocks are flushed to the output and recorded at least this often
+#define JOURNAL_SYNC_BYTES 0x1000000
+
+typedef struct JournalRange
+{
+    uint64_t start;
+    uint64_t end;
+} JournalRange_t;
+
+// Record of the address ranges of [start, end) that already made it to the
+// output file, kept in "<output>.journal" next to it:
+//
+//   range 0x80000000 0x81000000
+//   done 0x80000000 0x80400000
+//   hole 0x80100000 0x80200000
+//   ...
+//   complete
+//
+// Holes are done ranges that were all zero and left unwritten (sparse).
+typedef struct Journal
+{
+    FILE* file;
+    uint64_t start;
+    uint64_t end;
+    int complete;
+
+    // Sorted, non-overlapping ranges that are on disk
+    JournalRange_t* ranges;
+    uint32_t count;
+    uint32_t capacity;
+    JournalRange_t* holes;
+    uint32_t hole_count;
+    uint32_t hole_capacity;
+
+    // Recorded since the last journal_sync()
+    JournalRange_t* pending;
+    uint32_t pending_count;
+    uint32_t pending_capacity;
+    JournalRange_t* pending_holes;
+    uint32_t pending_hole_count;
+    uint32_t pending_hole_capacity;
+    uint64_t pending_bytes;
+} Journal_t;
+
+// Opens the journal for output_path. With resume set an existing journal for
+// the same range is loaded, otherwise a new one is started.
+Journal_t* journal_open(const char* output_path, uint64_t start, uint64_t end, int resume);
+int32_t journal_close(Journal_t* journal);
+
+// Bytes of [start, end) already recorded
+uint64_t journal_done_bytes(const Journal_t* journal);
+
+// Returns the ranges that are still missing, the caller frees the array
+JournalRange_t* journal_gaps(const Journal_t* journal, uint32_t* count);
+
+// Remembers that [start, end) was handed to the output, as a hole if it was
+// all zero. It is only written to the journal by journal_sync(), after the
+// output has been flushed.
+int32_t journal_record(Journal_t* journal, uint64_t start, uint64_t end, int hole);
+int32_t journal_sync(Journal_t* journal);
+
+// Marks the whole range as dumped
+int32_t journal_complete(Journal_t* journal);
+
+// Writes "<output>.extents", the ranges that held data:
+//
+//   range 0x80000000 0x81000000
+//   data 0x80000000 0x80100000
+//   ...
+int32_t journal_write_extents(const Journal_t* journal, const char* output_path);
+
+// Reads the range a raw dump covers from its journal, or its extents file if
+// the journal is gone
+int32_t journal_read_range(const char* output_path, uint64_t* start, uint64_t* end);
+
+#endif // JOURNAL_H
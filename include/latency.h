@@ -0,0 +1,27 @@
+#ifndef LATENCY_H
+#define LATENCY_H
+
+#include <stdint.h>
+
+// Log-linear histogram of durations: eight buckets per power of two, so any
+// percentile is within about 6% of the real value, in constant memory.
+// Not thread safe, every histogram has a single recording thread.
+#define LATENCY_LINEAR_BUCKETS 16
+#define LATENCY_SUB_BUCKETS 8
+#define LATENCY_BUCKETS (LATENCY_LINEAR_BUCKETS + (64 - 4) * LATENCY_SUB_BUCKETS)
+
+typedef struct LatencyHistogram
+{
+    uint64_t buckets[LATENCY_BUCKETS];
+    uint64_t count;
+    uint64_t sum_ns;
+    uint64_t max_ns;
+} LatencyHistogram_t;
+
+void latency_record(LatencyHistogram_t* histogram, uint64_t ns);
+
+// Duration that a fraction (0.5 for p50) of the samples did not exceed, 0 if
+// there are none
+uint64_t latency_percentile(const LatencyHistogram_t* histogram, double fraction);
+
+#endif // LATENCY_H
@@ -0,0 +1,21 @@
+#ifndef LZ4BLOCK_H
+#define LZ4BLOCK_H
+
+#include <stdint.h>
+
+// Minimal LZ4 block format codec, compatible with LZ4_decompress_safe()
+#define LZ4_HASH_LOG 14
+#define LZ4_TABLE_SIZE ((1u << LZ4_HASH_LOG) * sizeof(uint32_t))
+
+// Worst case output size for size bytes of input
+uint32_t lz4_compress_bound(uint32_t size);
+
+// Compresses src into dst with a table of LZ4_TABLE_SIZE bytes as scratch.
+// Returns the compressed size or 0 if it does not fit into capacity.
+uint32_t lz4_compress(
+    const uint8_t* src, uint32_t size, uint8_t* dst, uint32_t capacity, uint32_t* table);
+
+// Returns the decompressed size or -1 on malformed input
+int64_t lz4_decompress(const uint8_t* src, uint32_t size, uint8_t* dst, uint32_t capacity);
+
+#endif // LZ4BLOCK_H
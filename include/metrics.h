@@ -0,0 +1,49 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include "latency.h"
+#include "pool.h"
+
+#include <stdint.h>
+
+// Status line redraw interval on a terminal, and how often a plain status line
+// is printed when the output goes to a file or pipe
+#define METRICS_LINE_INTERVAL_US 250000
+#define METRICS_LOG_INTERVAL_US 5000000
+#define METRICS_EXPORT_INTERVAL_US 1000000
+// Time constant of the moving average rate
+#define METRICS_RATE_WINDOW_US 5000000
+
+// Live telemetry of a dump: received bytes, current and average rate, ETA,
+// per-phase latencies, retries and transfer buffer occupancy. Updated from the
+// thread that reads from the device, which also redraws the status line and
+// rewrites the export file once in a while:
+//
+//   <path>.prom  Prometheus text format, e.g. for the node_exporter textfile collector
+//   <path>       JSON otherwise
+//
+// Every function accepts NULL and does nothing, so call sites need no checks.
+typedef struct Metrics Metrics_t;
+
+// export_path may be NULL. With a device_id, it becomes a label in the export
+// and is inserted into the file name: dump.prom becomes dump-<id>.prom.
+Metrics_t* metrics_create(const char* export_path, const char* device_id, int progress);
+// Writes the final export and ends the status line
+int32_t metrics_destroy(Metrics_t* metrics);
+
+// PHASE_COUNT histograms for State_t.phase_latency
+LatencyHistogram_t* metrics_phases(Metrics_t* metrics);
+
+// Bytes that will be read from the device, and those of them that already were
+// by an earlier run (--resume)
+void metrics_expect(Metrics_t* metrics, uint64_t bytes);
+void metrics_skip(Metrics_t* metrics, uint64_t bytes);
+
+// Hot path, called for every received block
+void metrics_received(Metrics_t* metrics, uint64_t bytes, BlockPool_t* pool);
+void metrics_retry(Metrics_t* metrics);
+
+// Ends the status line so that other output starts on a line of its own
+void metrics_break_line(Metrics_t* metrics);
+
+#endif // METRICS_H
@@ -0,0 +1,39 @@
+#ifndef PLAN_H
+#define PLAN_H
+
+#include "dumper.h"
+
+#include <stdint.h>
+
+// Probe table entries often overlap: "dram" covers "kernel" and "ramdisk".
+// dump_all reads every address only once. The entries are grouped into
+// disjoint spans: each span is read from the device once, and the other
+// entries in it are produced from that output on disk.
+
+typedef struct PlanSpan
+{
+    uint64_t start;
+    uint64_t end;
+    // Entry that covers the whole span and is dumped from the device, or -1 if
+    // no entry does and the span has to be dumped to a staging file first
+    int32_t primary;
+    // Probe table entries in the span, primary included, in table order
+    uint32_t entries[MAX_PROBE_ENTRIES];
+    uint32_t entry_count;
+} PlanSpan_t;
+
+typedef struct Plan
+{
+    // Sorted by address
+    PlanSpan_t spans[MAX_PROBE_ENTRIES];
+    uint32_t count;
+    // Sum of all entry sizes, and how much of it is read from the device
+    uint64_t entry_bytes;
+    uint64_t read_bytes;
+} Plan_t;
+
+// Entries are [start, end), like dump_all always read them
+int32_t plan_build(const ProbeTable_t* probe_table, Plan_t* plan);
+void plan_print(const ProbeTable_t* probe_table, const Plan_t* plan);
+
+#endif // PLAN_H
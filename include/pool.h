@@ -0,0 +1,71 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include "thread.h"
+
+#include <stdint.h>
+
+#define POOL_ALIGNMENT 0x1000
+#define POOL_DEFAULT_BLOCKS 8
+
+// A received block. The buffer is page aligned so that it can be handed to
+// O_DIRECT and io_uring writes as is.
+typedef struct Block
+{
+    // The block's own buffer, or its place in a mapped output (block_pool_place)
+    uint8_t* data;
+    uint8_t* buffer;
+    uint32_t capacity;
+    uint32_t size;
+    // Physical address of the first byte and its position in the output
+    uint64_t address;
+    uint64_t offset;
+    struct Block* next;
+} Block_t;
+
+// Fixed set of reusable transfer buffers shared by the USB side and the writer
+typedef struct BlockPool
+{
+    Block_t* blocks;
+    uint32_t count;
+    Block_t* free_list;
+    uint32_t free_count;
+    Mutex_t mutex;
+    Cond_t available;
+
+    // Backpressure: how long acquirers had to wait for a free buffer
+    uint64_t wait_ns;
+    uint64_t waits;
+
+    // Output mapped into memory, [map_start, map_end) can be received in place
+    uint8_t* mapping;
+    uint64_t map_start;
+    uint64_t map_end;
+} BlockPool_t;
+
+int32_t block_pool_init(BlockPool_t* pool, uint32_t count, uint32_t capacity);
+void block_pool_destroy(BlockPool_t* pool);
+
+// Blocks until a buffer is free
+Block_t* block_pool_acquire(BlockPool_t* pool);
+void block_pool_release(BlockPool_t* pool, Block_t* block);
+
+// Buffers that are not free: in flight on the USB side or waiting for the writer
+uint32_t block_pool_in_use(BlockPool_t* pool);
+
+// Lets blocks of [start_address, end_address) be received straight into
+// mapping, which holds the output from start_address on
+void block_pool_map(BlockPool_t* pool,
+                    uint8_t* mapping,
+                    uint64_t start_address,
+                    uint64_t end_address);
+
+// Points an addressed and sized block at its place in the mapping instead of
+// its own buffer, if the pool has one that covers it and the block is at least
+// min_size bytes. Returns whether it did.
+int block_pool_place(BlockPool_t* pool, Block_t* block, uint32_t min_size);
+
+void* aligned_buffer_alloc(uint64_t size);
+void aligned_buffer_free(void* buffer);
+
+#endif // POOL_H
@@ -0,0 +1,52 @@
+#ifndef READER_H
+#define READER_H
+
+#include "container.h"
+#include "store.h"
+
+#include <stdint.h>
+#include <stdio.h>
+
+// Dumps in any of the output formats, read back by address
+
+typedef enum DumpKind
+{
+    DUMP_KIND_RAW,
+    DUMP_KIND_PACKED,
+    DUMP_KIND_STORED,
+} DumpKind_t;
+
+typedef struct DumpSource
+{
+    const char* path;
+    DumpKind_t kind;
+    // Address of the first byte of a raw dump
+    uint64_t start_address;
+    // Shared by every reader of a stored dump
+    StoreView_t* view;
+} DumpSource_t;
+
+// One per thread, readers of the same source can be used concurrently
+typedef struct DumpReader
+{
+    const DumpSource_t* source;
+    FILE* file;
+    ContainerReader_t* container;
+} DumpReader_t;
+
+// Detects the format of the dump at path. Raw dumps do not record where they
+// start, start_address is used for them.
+int32_t dump_source_open(DumpSource_t* source, const char* path, uint64_t start_address);
+void dump_source_close(DumpSource_t* source);
+
+int32_t dump_reader_open(DumpReader_t* reader, const DumpSource_t* source);
+void dump_reader_close(DumpReader_t* reader);
+
+// Returns [address, address + size) of the dump, read into buf unless the
+// dump is mapped anyway, or NULL if the dump does not have all of it
+const uint8_t* dump_reader_read(DumpReader_t* reader,
+                                uint64_t address,
+                                uint64_t size,
+                                uint8_t* buf);
+
+#endif // READER_H
@@ -0,0 +1,104 @@
+#ifndef SEARCH_H
+#define SEARCH_H
+
+#include "pool.h"
+
+#include <stdint.h>
+
+// Search results kept in "<output>.matches" next to a dump, collected from the
+// blocks as they are received:
+//
+//   range 0x80000000 0x81000000
+//   match 0x80012340 Linux version
+//   string 0x80012340 0x5A Linux version 4.14.190 (builder@host) ...
+//
+// Matches name the pattern as it was written in the pattern file. Strings
+// longer than SEARCH_MAX_STRING are cut, their length is the full one. A
+// resumed dump appends to the results.
+#define SEARCH_SUFFIX ".matches"
+#define SEARCH_MAX_THREADS 16
+#define SEARCH_MAX_PATTERN 0x100
+// The automaton has 256 transitions per state, one state per pattern byte
+#define SEARCH_MAX_STATES 0x4000
+#define SEARCH_DEFAULT_MIN_STRING 8
+#define SEARCH_MAX_STRING 0x400
+#define SEARCH_NONE UINT32_MAX
+
+typedef struct SearchPattern
+{
+    uint8_t* bytes;
+    uint32_t size;
+    // As written in the pattern file, escapes included
+    char* name;
+    // Next pattern with the same bytes
+    uint32_t next;
+} SearchPattern_t;
+
+// Aho-Corasick automaton over a set of byte patterns
+typedef struct SearchPatterns
+{
+    SearchPattern_t* patterns;
+    uint32_t count;
+    uint32_t max_size;
+    uint32_t state_count;
+    // Full transition table, state * 256 + byte
+    uint32_t* next;
+    uint32_t* fail;
+    // First pattern that ends in a state
+    uint32_t* output;
+    // Closest state with an output along the suffix links, the state itself included
+    uint32_t* report;
+    // Bytes that leave the root state, everything else is skipped there
+    uint8_t first[256];
+} SearchPatterns_t;
+
+// Takes ownership of a block, like BlockCallback_t
+typedef int32_t (*SearchSink_t)(void* ctx, Block_t* block);
+
+typedef struct SearchStats
+{
+    uint32_t threads;
+    uint64_t blocks;
+    uint64_t bytes;
+    uint64_t matches;
+    uint64_t strings;
+    // Scanning, summed over all workers
+    uint64_t scan_ns;
+} SearchStats_t;
+
+typedef struct SearchWriter SearchWriter_t;
+
+// Loads one pattern per line, "#" starts a comment. Bytes are escaped as \xNN,
+// \n, \r, \t and \\ for a backslash. Without a path a built-in set of
+// markers is used: key headers, kernel banners and crash signatures.
+int32_t search_patterns_load(SearchPatterns_t* patterns, const char* path);
+void search_patterns_free(SearchPatterns_t* patterns);
+
+// Starts threads workers that search submitted blocks for patterns and, if
+// strings_min is not 0, printable strings of at least that length. Blocks are
+// passed on to sink in the order they were submitted. Matches and strings that
+// straddle two blocks are found when the blocks are adjacent. patterns may be
+// NULL to only extract strings. Without truncate existing results are
+// continued.
+SearchWriter_t* search_writer_open(const char* output_path,
+                                   uint64_t start_address,
+                                   uint64_t end_address,
+                                   const SearchPatterns_t* patterns,
+                                   uint32_t strings_min,
+                                   uint32_t threads,
+                                   int truncate,
+                                   BlockPool_t* pool,
+                                   SearchSink_t sink,
+                                   void* sink_ctx);
+
+// Queues a block for searching, fails once the writer has failed
+int32_t search_writer_submit(SearchWriter_t* writer, Block_t* block);
+
+// Waits until every block has been searched and handed to the sink
+int32_t search_writer_drain(SearchWriter_t* writer);
+
+int32_t search_writer_close(SearchWriter_t* writer, SearchStats_t* stats);
+
+void search_print_stats(const char* output_path, const SearchStats_t* stats);
+
+#endif // SEARCH_H
@@ -0,0 +1,27 @@
+#ifndef SHA256_H
+#define SHA256_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SHA256_BLOCK_SIZE 64
+#define SHA256_DIGEST_SIZE 32
+
+typedef struct Sha256
+{
+    uint32_t state[8];
+    uint64_t length;
+    uint8_t buffer[SHA256_BLOCK_SIZE];
+    size_t buffered;
+} Sha256_t;
+
+void sha256_init(Sha256_t* ctx);
+void sha256_update(Sha256_t* ctx, const void* data, size_t size);
+void sha256_final(Sha256_t* ctx, uint8_t* digest);
+
+void sha256(uint8_t* digest, const void* data, size_t size);
+
+// Name of the implementation in use, the SHA extensions or portable C
+const char* sha256_impl(void);
+
+#endif // SHA256_H
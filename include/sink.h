@@ -0,0 +1,72 @@
+#ifndef SINK_H
+#define SINK_H
+
+#include "writer.h"
+
+#include <stdint.h>
+
+// A dump can be streamed instead of written to a local file. The output name
+// selects the sink:
+//
+//   -                   stdout, the program's own output moves to stderr
+//   tcp:<host>:<port>   a collector (upload_dumper receive) on another host
+//   an existing FIFO    a named pipe
+//
+// The stream is a sequence of frames, each a SinkFrame_t header followed by
+// its payload. It starts with a BEGIN frame for the whole range and ends with
+// an END frame once every byte of it was sent, so that a collector can tell a
+// complete dump from one that broke off. Frames are sent in the order the
+// writer thread gets the blocks, a slow reader stalls it and, once the pool
+// runs out of buffers, the transfer from the device.
+#define SINK_MAGIC 0x46444D55
+#define SINK_VERSION 1
+#define SINK_STDOUT "-"
+#define SINK_TCP_PREFIX "tcp:"
+// Frames are not cut into pieces, the collector needs a buffer for the longest
+#define SINK_MAX_PAYLOAD 0x1000000
+
+typedef enum SinkFrameType
+{
+    SINK_FRAME_BEGIN = 1,
+    // length bytes of payload
+    SINK_FRAME_DATA,
+    // length zero bytes, no payload
+    SINK_FRAME_HOLE,
+    // Covers the whole range again, only sent once all of it was
+    SINK_FRAME_END,
+} SinkFrameType_t;
+
+// 32 bytes, little endian like the other dump formats
+#pragma pack(push, 1)
+typedef struct SinkFrame
+{
+    uint32_t magic;
+    uint16_t type;
+    uint16_t version;
+    // Bytes of the dumped range the frame covers
+    uint64_t address;
+    uint64_t length;
+    // BEGIN: longest DATA payload that follows, DATA: XXH64 of the payload
+    uint64_t value;
+} SinkFrame_t;
+#pragma pack(pop)
+
+// Whether path names a stream rather than a regular file
+int sink_is_stream(const char* path);
+
+// Keeps the real stdout for a "-" sink and sends everything the program prints
+// to stderr instead. Has to be called before anything is printed.
+int32_t sink_reserve_stdout(void);
+
+// A writer backend that sends [start_address, end_address) as frames of at
+// most max_payload bytes to the sink named by path
+WriterBackend_t* sink_backend_open(const char* path,
+                                   uint64_t start_address,
+                                   uint64_t end_address,
+                                   uint32_t max_payload);
+
+// Collector: reads one stream from source ("-" for stdin, tcp:[<host>:]<port>
+// to listen for a connection, or a path) and writes it to output_path
+int32_t sink_receive(const char* source, const char* output_path, WriterBackendType_t type);
+
+#endif // SINK_H
@@ -0,0 +1,56 @@
+#ifndef STORE_H
+#define STORE_H
+
+#include "writer.h"
+
+#include <stdint.h>
+
+// Content-addressed chunk store. Dumps are cut into chunks that are named by
+// their BLAKE2b-256 hash and stored once, under <store>/<hh>/<hash>, no matter
+// how many dumps contain them. Each dump becomes a manifest that maps its
+// addresses to chunks:
+//
+//   store /path/to/store
+//   range 0x80000000 0x81000000
+//   chunk 0x80000000 0x10000 0e5751c0...
+//   zero 0x80010000 0x30000
+//   ...
+//
+// All zero chunks are not stored at all. Later lines for the same addresses
+// replace earlier ones, so a resumed dump can simply append to its manifest.
+#define STORE_CHUNK_SIZE 0x10000
+#define STORE_HASH_SIZE 32
+#define STORE_MANIFEST_EXTENSION ".manifest"
+
+// A writer backend that hashes every block into the store at store_path and
+// appends it to the manifest at manifest_path. Without truncate an existing
+// manifest is continued.
+WriterBackend_t* store_backend_open(const char* store_path,
+                                    const char* manifest_path,
+                                    uint64_t start_address,
+                                    uint64_t end_address,
+                                    int truncate);
+
+// A manifest mapped into memory: chunk files are mapped straight from the
+// store where the page size allows it and copied otherwise, zero ranges cost
+// nothing
+typedef struct StoreView
+{
+    uint8_t* data;
+    uint64_t start_address;
+    uint64_t end_address;
+    // Bytes that at least one manifest line covers
+    uint64_t covered_bytes;
+    uint64_t mapped_size;
+} StoreView_t;
+
+// Maps the manifest at manifest_path, store_path overrides the store it names
+StoreView_t* store_view_open(const char* manifest_path, const char* store_path);
+void store_view_close(StoreView_t* view);
+
+// Writes the dump described by a manifest to a (sparse) .bin file
+int32_t store_materialize(const char* manifest_path,
+                          const char* store_path,
+                          const char* output_path);
+
+#endif // STORE_H
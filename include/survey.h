@@ -0,0 +1,76 @@
+#ifndef SURVEY_H
+#define SURVEY_H
+
+#include <stdint.h>
+
+#define SURVEY_DEFAULT_GRANULARITY 0x100000
+#define SURVEY_DEFAULT_SAMPLES 1
+#define SURVEY_SAMPLE_SIZE 0x1000
+// Cells per line of the heat map
+#define SURVEY_MAP_WIDTH 64
+
+// A survey samples a few pages of every cell of granularity bytes and tells
+// cells that hold data apart from those that look unused, so that a later dump
+// can skip the latter. Written to a text file:
+//
+//   survey 0x100000 1 0x1000              granularity, samples per cell, sample size
+//   populated 0x80000000 0x80400000
+//   zero 0x80400000 0x80600000
+//   constant 0x80600000 0x80700000 0xFF
+//   ...
+typedef enum SurveyKind
+{
+    // Not surveyed, always dumped
+    SURVEY_UNKNOWN,
+    SURVEY_ZERO,
+    // Every sampled byte has the same non-zero value, like erased flash (0xFF)
+    SURVEY_CONSTANT,
+    SURVEY_POPULATED,
+} SurveyKind_t;
+
+typedef struct SurveyRegion
+{
+    uint64_t start;
+    uint64_t end;
+    SurveyKind_t kind;
+    uint8_t value;
+} SurveyRegion_t;
+
+typedef struct Survey
+{
+    uint64_t granularity;
+    uint32_t samples;
+    uint32_t sample_size;
+
+    // Sorted and non-overlapping, adjacent cells of the same kind are merged
+    SurveyRegion_t* regions;
+    uint32_t count;
+    uint32_t capacity;
+} Survey_t;
+
+void survey_init(Survey_t* survey, uint64_t granularity, uint32_t samples, uint32_t sample_size);
+void survey_free(Survey_t* survey);
+
+// Appends a cell after the last one
+int32_t survey_add(
+    Survey_t* survey, uint64_t start, uint64_t end, SurveyKind_t kind, uint8_t value);
+
+// Kind of a sample, and its byte value if it is constant
+SurveyKind_t survey_classify(const uint8_t* data, uint32_t size, uint8_t* value);
+
+// Kind at address, where the run of that kind ends, and its byte value if it
+// is constant
+SurveyKind_t survey_lookup(
+    const Survey_t* survey, uint64_t address, uint64_t* run_end, uint8_t* value);
+
+int32_t survey_write(const Survey_t* survey, const char* path);
+int32_t survey_load(const char* path, Survey_t* survey);
+
+// Heat map of [start, end), one character per cell:
+//   # populated   . zero   = constant   ? not surveyed
+void survey_print_map(const Survey_t* survey, const char* name, uint64_t start, uint64_t end);
+
+// Bytes of each kind in the survey
+void survey_print_summary(const Survey_t* survey);
+
+#endif // SURVEY_H
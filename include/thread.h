@@ -0,0 +1,58 @@
+#ifndef THREAD_H
+#define THREAD_H
+
+#include <stdint.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+
+typedef void (*ThreadFunc_t)(void* arg);
+
+typedef struct Thread
+{
+#ifdef _WIN32
+    HANDLE handle;
+#else
+    pthread_t handle;
+#endif
+    ThreadFunc_t func;
+    void* arg;
+} Thread_t;
+
+typedef struct Mutex
+{
+#ifdef _WIN32
+    CRITICAL_SECTION handle;
+#else
+    pthread_mutex_t handle;
+#endif
+} Mutex_t;
+
+typedef struct Cond
+{
+#ifdef _WIN32
+    CONDITION_VARIABLE handle;
+#else
+    pthread_cond_t handle;
+#endif
+} Cond_t;
+
+int32_t thread_create(Thread_t* thread, ThreadFunc_t func, void* arg);
+void thread_join(Thread_t* thread);
+uint32_t thread_cpu_count(void);
+
+void mutex_init(Mutex_t* mutex);
+void mutex_destroy(Mutex_t* mutex);
+void mutex_lock(Mutex_t* mutex);
+void mutex_unlock(Mutex_t* mutex);
+
+void cond_init(Cond_t* cond);
+void cond_destroy(Cond_t* cond);
+void cond_wait(Cond_t* cond, Mutex_t* mutex);
+void cond_signal(Cond_t* cond);
+void cond_broadcast(Cond_t* cond);
+
+#endif // THREAD_H
@@ -0,0 +1,74 @@
+#ifndef TRANSPORT_H
+#define TRANSPORT_H
+
+#include <stdint.h>
+
+#define TRANSPORT_TIMEOUT_MS 1000
+
+typedef struct Transport Transport_t;
+typedef struct TransportTransfer TransportTransfer_t;
+
+typedef enum TransferDirection
+{
+    TRANSFER_OUT,
+    TRANSFER_IN,
+} TransferDirection_t;
+
+typedef void (*TransferCallback_t)(TransportTransfer_t* transfer);
+
+// An asynchronous bulk transfer. Transfers submitted in the same direction
+// complete in submission order, the callback runs from handle_events.
+struct TransportTransfer
+{
+    TransferDirection_t direction;
+    uint8_t* buffer;
+    uint32_t length;
+    uint32_t timeout_ms;
+    TransferCallback_t callback;
+    void* user_data;
+
+    int32_t status;
+    uint32_t transferred;
+
+    // Owned by the backend while the transfer is in flight
+    void* priv;
+    TransportTransfer_t* next;
+};
+
+// A bidirectional packet pipe to an upload mode device. All operations return
+// LIBUSB_SUCCESS or one of the negative libusb error codes, so that callers can
+// report failures with libusb_strerror regardless of the backend in use.
+struct Transport
+{
+    const char* name;
+    int32_t (*send)(Transport_t* transport,
+                    uint8_t* packet,
+                    uint32_t packet_size,
+                    uint32_t* transferred,
+                    uint32_t timeout_ms);
+    int32_t (*receive)(Transport_t* transport,
+                       uint8_t* packet,
+                       uint32_t packet_size,
+                       uint32_t* transferred,
+                       uint32_t timeout_ms);
+    // Optional asynchronous interface, NULL if the backend only supports
+    // blocking transfers
+    int32_t (*submit)(Transport_t* transport, TransportTransfer_t* transfer);
+    int32_t (*cancel)(Transport_t* transport, TransportTransfer_t* transfer);
+    int32_t (*handle_events)(Transport_t* transport, uint32_t timeout_ms);
+    void (*destroy)(Transport_t* transport);
+    void* priv;
+};
+
+typedef struct libusb_context libusb_context;
+typedef struct libusb_device_handle libusb_device_handle;
+
+// Bulk transfers on a claimed libusb interface
+Transport_t* transport_usb_create(libusb_context* ctx,
+                                  libusb_device_handle* handle,
+                                  int in_endpoint,
+                                  int out_endpoint);
+
+void transport_destroy(Transport_t* transport);
+
+#endif // TRANSPORT_H
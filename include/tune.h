@@ -0,0 +1,30 @@
+#ifndef TUNE_H
+#define TUNE_H
+
+#include "dumper.h"
+
+#include <stdint.h>
+
+// Every candidate block size is measured over this many bytes (at least a few
+// blocks) and has to succeed on every trial to be considered reliable
+#define TUNE_WINDOW_BYTES 0x800000
+#define TUNE_MIN_BLOCKS 4
+#define TUNE_TRIALS 2
+
+// Probes transfer sizes between MIN_BLOCK_SIZE and MAX_BLOCK_SIZE against the
+// device and returns the one with the best measured throughput
+int32_t tune_block_size(State_t* state, uint32_t* block_size, double* mbps);
+
+// Per-device cache of tuned block sizes, one "<vid>:<pid> <size> <MB/s>" line each
+const char* tune_default_cache_path(void);
+int32_t tune_cache_load(const char* path,
+                        uint16_t vendor_id,
+                        uint16_t product_id,
+                        uint32_t* block_size);
+int32_t tune_cache_store(const char* path,
+                         uint16_t vendor_id,
+                         uint16_t product_id,
+                         uint32_t block_size,
+                         double mbps);
+
+#endif // TUNE_H
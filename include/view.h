@@ -0,0 +1,19 @@
+#ifndef VIEW_H
+#define VIEW_H
+
+#include "dumper.h"
+
+#include <stdint.h>
+
+// Read size of the device and of dumps that are not mapped
+#define VIEW_CHUNK_SIZE 0x100000
+
+// Hexdumps options->range of the dump at options->input_path, or all of it if
+// no range is given. Raw dumps do not record where they start: the range in
+// their journal or extents file is used, or --base.
+int32_t view_file(const Options_t* options);
+
+// Hexdumps options->range as the device reads it right now
+int32_t view_device(State_t* state, const Options_t* options);
+
+#endif // VIEW_H
@@ -0,0 +1,111 @@
+#ifndef WRITER_H
+#define WRITER_H
+
+#include "journal.h"
+#include "latency.h"
+#include "pool.h"
+
+#include <stdint.h>
+
+// Longest run of contiguous blocks handed to the backend in a single write
+#define WRITER_MAX_RUN 64
+#define WRITER_STDIO_BUFFER_SIZE 0x400000
+
+// writer_open() flags: start from an empty file, leave zero blocks as holes
+#define WRITER_TRUNCATE 0x1
+#define WRITER_SPARSE 0x2
+
+typedef enum WriterBackendType
+{
+    WRITER_BACKEND_STDIO,
+    WRITER_BACKEND_DIRECT,
+    WRITER_BACKEND_URING,
+    WRITER_BACKEND_MMAP,
+} WriterBackendType_t;
+
+typedef struct WriterStats
+{
+    const char* backend;
+    uint64_t blocks;
+    uint64_t bytes;
+    // Zero blocks that were left as holes instead of being written
+    uint64_t hole_bytes;
+    // Coalesced write requests issued to the backend
+    uint64_t writes;
+    uint64_t write_ns;
+    // Writer waiting for blocks: the device link is the bottleneck
+    uint64_t idle_ns;
+    // USB side waiting for free buffers: the disk is the bottleneck
+    uint64_t producer_wait_ns;
+    uint64_t producer_waits;
+    uint32_t max_queue_depth;
+    uint64_t queue_depth_sum;
+    uint64_t queue_samples;
+} WriterStats_t;
+
+typedef struct WriterBackend WriterBackend_t;
+
+struct WriterBackend
+{
+    const char* name;
+    // Writes a run of blocks that are contiguous in the output. Every block is
+    // handed back through done() once the backend no longer needs its buffer,
+    // with a negative status if it could not be written.
+    int32_t (*write)(WriterBackend_t* backend, Block_t** blocks, uint32_t count);
+    // Waits for all outstanding writes and hands buffered data to the OS
+    int32_t (*flush)(WriterBackend_t* backend);
+    // Makes a range read back as zeros without writing it, extending the file
+    // or punching out existing data as needed
+    int32_t (*hole)(WriterBackend_t* backend, uint64_t offset, uint64_t size);
+    int32_t (*close)(WriterBackend_t* backend);
+    void (*done)(void* ctx, Block_t* block, int32_t status);
+    void* done_ctx;
+    // The whole output mapped into memory, blocks received into it in place
+    // need no write. NULL for backends that write from the block buffers.
+    uint8_t* mapping;
+    void* priv;
+};
+
+typedef struct Writer Writer_t;
+
+// Starts a writer thread that drains submitted blocks into path and returns
+// their buffers to the pool. Without WRITER_TRUNCATE an existing file is
+// written in place. Written blocks are recorded in the journal, if one is
+// given, every JOURNAL_SYNC_BYTES and when the writer is closed. size is the
+// final size of the output, for backends that preallocate it.
+Writer_t* writer_open(const char* path,
+                      WriterBackendType_t type,
+                      uint64_t size,
+                      uint32_t flags,
+                      BlockPool_t* pool,
+                      Journal_t* journal);
+
+// Same as writer_open() for a backend created by the caller, which the writer
+// takes over and closes. Only WRITER_SPARSE applies, the backend handles the
+// rest of the flags when it is opened.
+Writer_t* writer_start(WriterBackend_t* backend,
+                       uint32_t flags,
+                       BlockPool_t* pool,
+                       Journal_t* journal);
+
+// The output mapped into memory by the backend, or NULL
+uint8_t* writer_mapping(const Writer_t* writer);
+
+// Records how long every write to the backend takes from now on
+void writer_record_latency(Writer_t* writer, LatencyHistogram_t* histogram);
+
+// Queues a block for writing at block->offset, fails once the writer has failed
+int32_t writer_submit(Writer_t* writer, Block_t* block);
+
+// Drains the queue, stops the thread and closes the file
+int32_t writer_close(Writer_t* writer, WriterStats_t* stats);
+
+// Makes [offset, offset + size) of source_path the contents of path by sharing
+// the extents (reflink) instead of copying them. Fails on file systems without
+// reflinks and for ranges that are not aligned to their block size.
+int32_t writer_clone(const char* source_path, uint64_t offset, uint64_t size, const char* path);
+
+int32_t writer_parse_backend(const char* name, WriterBackendType_t* type);
+void writer_print_stats(const char* output_path, const WriterStats_t* stats);
+
+#endif // WRITER_H
@@ -0,0 +1,23 @@
+#ifndef XXH64_H
+#define XXH64_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// XXH64, a fast non-cryptographic hash that is compatible with xxhsum -H1
+typedef struct Xxh64
+{
+    uint64_t v[4];
+    uint64_t seed;
+    uint64_t length;
+    uint8_t buffer[32];
+    size_t buffered;
+} Xxh64_t;
+
+void xxh64_init(Xxh64_t* ctx, uint64_t seed);
+void xxh64_update(Xxh64_t* ctx, const void* data, size_t size);
+uint64_t xxh64_final(const Xxh64_t* ctx);
+
+uint64_t xxh64(const void* data, size_t size, uint64_t seed);
+
+#endif // XXH64_H
@@ -0,0 +1,13 @@
+#ifndef ZERO_H
+#define ZERO_H
+
+#include <stdint.h>
+
+// Returns 1 if every byte of data is zero. Uses AVX2, SSE2 or NEON when the
+// CPU has them, with a portable fallback.
+int zero_check(const uint8_t* data, uint64_t size);
+
+// Name of the implementation zero_check() dispatches to
+const char* zero_check_impl(void);
+
+#endif // ZERO_H
@@ -0,0 +1,297 @@
+#define _CRT_SECURE_NO_WARNINGS
+
+#include "async.h"
+#include "clock.h"
+#include "transport.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ASYNC_COMMAND_SIZE 1024
+
+typedef enum AsyncStep
+{
+    ASYNC_STEP_PREAMBLE,
+    ASYNC_STEP_PREAMBLE_ACK,
+    ASYNC_STEP_LOW_ADDRESS,
+    ASYNC_STEP_LOW_ADDRESS_ACK,
+    ASYNC_STEP_HIGH_ADDRESS,
+    ASYNC_STEP_HIGH_ADDRESS_ACK,
+    ASYNC_STEP_DATAXFER,
+    ASYNC_STEP_DATA,
+    // Rest of a block received in place, and the trailing byte
+    ASYNC_STEP_TAIL,
+    ASYNC_STEP_COUNT,
+} AsyncStep_t;
+
+static const char* c_async_step_errors[ASYNC_STEP_COUNT] = {
+    "Failed to send preamble packet",
+    "Failed to receive ack for preamble packet (dump_memory)",
+    "Failed to send low address packet",
+    "Failed to receive ack for low address packet",
+    "Failed to send high address packet",
+    "Failed to receive ack for high address packet",
+    "Failed to send data xfer packet",
+    "Failed to receive data packet",
+    "Failed to receive data packet",
+};
+
+typedef struct AsyncSlot
+{
+    TransportTransfer_t transfers[ASYNC_STEP_COUNT];
+    uint8_t commands[ASYNC_STEP_TAIL / 2][ASYNC_COMMAND_SIZE];
+    uint8_t acks[ASYNC_STEP_TAIL / 2 - 1][ACK_PACKET_SIZE];
+    Block_t* block;
+    // The block points into a mapped output, see LANDING_SIZE
+    int in_place;
+    uint32_t body_size;
+    uint8_t landing[LANDING_SIZE + 1];
+
+    uint64_t low_address;
+    uint64_t high_address;
+
+    // Per-phase latencies, if recorded: the link serves one transfer at a time,
+    // so a phase takes from the previous completion on any slot to its own
+    LatencyHistogram_t* phase_latency;
+    uint64_t* phase_ns;
+
+    // Bit per step that is still in flight
+    uint32_t in_flight;
+    int32_t failed_step;
+    int32_t status;
+    int busy;
+} AsyncSlot_t;
+
+static void async_transfer_done(TransportTransfer_t* transfer)
+{
+    AsyncSlot_t* slot = transfer->user_data;
+    const int32_t step = (int32_t)(transfer - slot->transfers);
+
+    slot->in_flight &= ~(1u << step);
+
+    if (slot->failed_step >= 0)
+        return;
+
+    if (transfer->status != LIBUSB_SUCCESS) {
+        slot->failed_step = step;
+        slot->status = transfer->status;
+        return;
+    }
+
+    // Acks are the odd steps before the data phase
+    if ((step & 1) && step != ASYNC_STEP_DATA &&
+        memcmp(transfer->buffer, c_acknowledgment, sizeof(c_acknowledgment)) != 0) {
+        slot->failed_step = step;
+        slot->status = LIBUSB_ERROR_IO;
+    }
+
+    // A short data transfer picked up a response meant for a later command
+    if ((step == ASYNC_STEP_DATA && transfer->transferred != slot->body_size) ||
+        (step == ASYNC_STEP_TAIL && transfer->transferred != slot->block->size - slot->body_size)) {
+        slot->failed_step = step;
+        slot->status = LIBUSB_ERROR_IO;
+    }
+
+    // Every phase ends with a receive, the data phase with the last one
+    const int last_receive = (step & 1) && !(step == ASYNC_STEP_DATA && slot->in_place);
+    if (slot->phase_latency && slot->failed_step < 0 && (last_receive || step == ASYNC_STEP_TAIL)) {
+        const uint64_t now_ns = clock_now_ns();
+        latency_record(&slot->phase_latency[min(step / 2, (int32_t)PHASE_DATA_XFER)],
+                       now_ns - *slot->phase_ns);
+        *slot->phase_ns = now_ns;
+    }
+}
+
+static void async_prepare_step(AsyncSlot_t* slot,
+                               AsyncStep_t step,
+                               uint8_t* buffer,
+                               uint32_t length,
+                               uint32_t timeout_ms)
+{
+    TransportTransfer_t* transfer = &slot->transfers[step];
+
+    memset(transfer, 0, sizeof(TransportTransfer_t));
+    transfer->direction = ((step & 1) || step == ASYNC_STEP_TAIL) ? TRANSFER_IN : TRANSFER_OUT;
+    transfer->buffer = buffer;
+    transfer->length = length;
+    transfer->timeout_ms = timeout_ms;
+    transfer->callback = async_transfer_done;
+    transfer->user_data = slot;
+}
+
+static int32_t async_arm_slot(State_t* state,
+                              BlockPool_t* pool,
+                              AsyncSlot_t* slot,
+                              uint64_t low_address,
+                              uint64_t high_address,
+                              uint32_t timeout_ms)
+{
+    slot->block = block_pool_acquire(pool);
+    slot->block->address = low_address;
+    slot->block->size = (uint32_t)(high_address - low_address);
+    slot->in_place = block_pool_place(pool, slot->block, LANDING_SIZE);
+    slot->body_size = slot->in_place ? slot->block->size & ~(uint32_t)(LANDING_SIZE - 1)
+                                     : slot->block->size;
+
+    slot->low_address = low_address;
+    slot->high_address = high_address;
+    slot->failed_step = -1;
+    slot->status = LIBUSB_SUCCESS;
+    slot->busy = 1;
+
+    memset(slot->commands, 0, sizeof(slot->commands));
+    memcpy(slot->commands[0], c_preamble, sizeof(c_preamble));
+    sprintf((char*)slot->commands[1], "%09llX", (unsigned long long)low_address);
+    sprintf((char*)slot->commands[2], "%09llX", (unsigned long long)high_address);
+    memcpy(slot->commands[3], c_dataxfer, sizeof(c_dataxfer));
+
+    for (uint32_t i = 0; i < ASYNC_STEP_TAIL / 2; i++) {
+        async_prepare_step(
+            slot, (AsyncStep_t)(i * 2), slot->commands[i], ASYNC_COMMAND_SIZE, timeout_ms);
+        if (i * 2 + 1 != ASYNC_STEP_DATA)
+            async_prepare_step(
+                slot, (AsyncStep_t)(i * 2 + 1), slot->acks[i], ACK_PACKET_SIZE, timeout_ms);
+    }
+
+    // +1 so that the transfer is terminated by the device's short packet
+    if (slot->in_place) {
+        async_prepare_step(slot, ASYNC_STEP_DATA, slot->block->data, slot->body_size, timeout_ms);
+        async_prepare_step(slot,
+                           ASYNC_STEP_TAIL,
+                           slot->landing,
+                           slot->block->size - slot->body_size + 1,
+                           timeout_ms);
+    } else {
+        async_prepare_step(
+            slot, ASYNC_STEP_DATA, slot->block->data, slot->block->size + 1, timeout_ms);
+    }
+
+    const uint32_t steps = slot->in_place ? ASYNC_STEP_COUNT : ASYNC_STEP_TAIL;
+    for (uint32_t step = 0; step < steps; step++) {
+        const int32_t result = state->transport->submit(state->transport, &slot->transfers[step]);
+        if (result != LIBUSB_SUCCESS) {
+            printf("Failed to submit transfer: %s\n", libusb_strerror(result));
+            slot->failed_step = (int32_t)step;
+            slot->status = result;
+            return -1;
+        }
+        slot->in_flight |= 1u << step;
+    }
+
+    return 0;
+}
+
+// Cancels everything that is still queued, waits for the callbacks and gives
+// the buffers back
+static void async_abort(State_t* state, BlockPool_t* pool, AsyncSlot_t* slots, uint32_t depth)
+{
+    for (uint32_t i = 0; i < depth; i++) {
+        for (uint32_t step = 0; step < ASYNC_STEP_COUNT; step++) {
+            if (slots[i].in_flight & (1u << step))
+                state->transport->cancel(state->transport, &slots[i].transfers[step]);
+        }
+    }
+
+    for (uint32_t i = 0; i < depth; i++) {
+        while (slots[i].in_flight) {
+            if (state->transport->handle_events(state->transport, TRANSPORT_TIMEOUT_MS) < 0)
+                return;
+        }
+
+        if (slots[i].block) {
+            block_pool_release(pool, slots[i].block);
+            slots[i].block = NULL;
+        }
+    }
+}
+
+int32_t async_read_range(State_t* state,
+                         uint64_t start_address,
+                         uint64_t end_address,
+                         BlockPool_t* pool,
+                         BlockCallback_t callback,
+                         void* ctx)
+{
+    int32_t result = 0;
+    const uint32_t depth = min(max(state->async_depth, 1u), (uint32_t)ASYNC_MAX_DEPTH);
+    // Queued transfers start their timeout on submission
+    const uint32_t timeout_ms = TRANSPORT_TIMEOUT_MS * depth;
+
+    AsyncSlot_t* slots = calloc(depth, sizeof(AsyncSlot_t));
+    if (!slots) {
+        printf("Failed to allocate transfer slots\n");
+        return -1;
+    }
+
+    uint64_t phase_ns = clock_now_ns();
+    for (uint32_t i = 0; i < depth; i++) {
+        slots[i].phase_latency = state->phase_latency;
+        slots[i].phase_ns = &phase_ns;
+    }
+
+    uint64_t next_address = start_address;
+    for (uint32_t i = 0; i < depth && next_address < end_address; i++) {
+        const uint64_t high_address = min(next_address + state->block_size, end_address);
+        if (async_arm_slot(state, pool, &slots[i], next_address, high_address, timeout_ms) < 0) {
+            result = -1;
+            goto abort;
+        }
+        next_address = high_address;
+    }
+
+    for (uint32_t head = 0; slots[head].busy; head = (head + 1) % depth) {
+        AsyncSlot_t* slot = &slots[head];
+
+        while (slot->in_flight && slot->failed_step < 0) {
+            const int32_t events =
+                state->transport->handle_events(state->transport, TRANSPORT_TIMEOUT_MS);
+            if (events < 0) {
+                printf("Failed to handle transfer events: %s\n", libusb_strerror(events));
+                result = -1;
+                goto abort;
+            }
+        }
+
+        if (slot->failed_step >= 0) {
+            printf("%s: %s\n",
+                   c_async_step_errors[slot->failed_step],
+                   libusb_strerror(slot->status));
+            result = -1;
+            goto abort;
+        }
+
+        Block_t* block = slot->block;
+        slot->block = NULL;
+        slot->busy = 0;
+
+        if (slot->in_place)
+            memcpy(block->data + slot->body_size,
+                   slot->landing,
+                   block->size - slot->body_size);
+
+        if (callback(ctx, block) < 0) {
+            result = -1;
+            goto abort;
+        }
+
+        if (next_address < end_address) {
+            const uint64_t high_address = min(next_address + state->block_size, end_address);
+            if (async_arm_slot(state, pool, slot, next_address, high_address, timeout_ms) < 0) {
+                result = -1;
+                goto abort;
+            }
+            next_address = high_address;
+        }
+    }
+
+    goto cleanup;
+
+abort:
+    async_abort(state, pool, slots, depth);
+
+cleanup:
+    free(slots);
+
+    return result;
+}
@@ -0,0 +1,148 @@
+#include "blake2b.h"
+
+#include <string.h>
+
+static const uint64_t c_blake2b_iv[8] = {
+    0x6A09E667F3BCC908ull, 0xBB67AE8584CAA73Bull, 0x3C6EF372FE94F82Bull, 0xA54FF53A5F1D36F1ull,
+    0x510E527FADE682D1ull, 0x9B05688C2B3E6C1Full, 0x1F83D9ABFB41BD6Bull, 0x5BE0CD19137E2179ull,
+};
+
+static const uint8_t c_blake2b_sigma[12][16] = {
+    { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15 },
+    { 14, 10, 4, 8, 9, 15, 13, 6, 1, 12, 0, 2, 11, 7, 5, 3 },
+    { 11, 8, 12, 0, 5, 2, 15, 13, 10, 14, 3, 6, 7, 1, 9, 4 },
+    { 7, 9, 3, 1, 13, 12, 11, 14, 2, 6, 5, 10, 4, 0, 15, 8 },
+    { 9, 0, 5, 7, 2, 4, 10, 15, 14, 1, 11, 12, 6, 8, 3, 13 },
+    { 2, 12, 6, 10, 0, 11, 8, 3, 4, 13, 7, 5, 15, 14, 1, 9 },
+    { 12, 5, 1, 15, 14, 13, 4, 10, 0, 7, 6, 3, 9, 2, 8, 11 },
+    { 13, 11, 7, 14, 12, 1, 3, 9, 5, 0, 15, 4, 8, 6, 2, 10 },
+    { 6, 15, 14, 9, 11, 3, 0, 8, 12, 2, 13, 7, 1, 4, 10, 5 },
+    { 10, 2, 8, 4, 7, 6, 1, 5, 15, 11, 9, 14, 3, 12, 13, 0 },
+    { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15 },
+    { 14, 10, 4, 8, 9, 15, 13, 6, 1, 12, 0, 2, 11, 7, 5, 3 },
+};
+
+static uint64_t blake2b_load64(const uint8_t* p)
+{
+    return (uint64_t)p[0] | ((uint64_t)p[1] << 8) | ((uint64_t)p[2] << 16) |
+           ((uint64_t)p[3] << 24) | ((uint64_t)p[4] << 32) | ((uint64_t)p[5] << 40) |
+           ((uint64_t)p[6] << 48) | ((uint64_t)p[7] << 56);
+}
+
+static uint64_t blake2b_rotr64(uint64_t x, uint32_t n)
+{
+    return (x >> n) | (x << (64 - n));
+}
+
+#define BLAKE2B_G(a, b, c, d, x, y)                \
+    do {                                           \
+        v[a] = v[a] + v[b] + (x);                  \
+        v[d] = blake2b_rotr64(v[d] ^ v[a], 32);    \
+        v[c] = v[c] + v[d];                        \
+        v[b] = blake2b_rotr64(v[b] ^ v[c], 24);    \
+        v[a] = v[a] + v[b] + (y);                  \
+        v[d] = blake2b_rotr64(v[d] ^ v[a], 16);    \
+        v[c] = v[c] + v[d];                        \
+        v[b] = blake2b_rotr64(v[b] ^ v[c], 63);    \
+    } while (0)
+
+static void blake2b_compress(Blake2b_t* ctx, const uint8_t* block, int last)
+{
+    uint64_t m[16];
+    uint64_t v[16];
+
+    for (uint32_t i = 0; i < 16; i++)
+        m[i] = blake2b_load64(block + i * 8);
+
+    for (uint32_t i = 0; i < 8; i++) {
+        v[i] = ctx->h[i];
+        v[i + 8] = c_blake2b_iv[i];
+    }
+    v[12] ^= ctx->t[0];
+    v[13] ^= ctx->t[1];
+    if (last)
+        v[14] = ~v[14];
+
+    for (uint32_t round = 0; round < 12; round++) {
+        const uint8_t* s = c_blake2b_sigma[round];
+        BLAKE2B_G(0, 4, 8, 12, m[s[0]], m[s[1]]);
+        BLAKE2B_G(1, 5, 9, 13, m[s[2]], m[s[3]]);
+        BLAKE2B_G(2, 6, 10, 14, m[s[4]], m[s[5]]);
+        BLAKE2B_G(3, 7, 11, 15, m[s[6]], m[s[7]]);
+        BLAKE2B_G(0, 5, 10, 15, m[s[8]], m[s[9]]);
+        BLAKE2B_G(1, 6, 11, 12, m[s[10]], m[s[11]]);
+        BLAKE2B_G(2, 7, 8, 13, m[s[12]], m[s[13]]);
+        BLAKE2B_G(3, 4, 9, 14, m[s[14]], m[s[15]]);
+    }
+
+    for (uint32_t i = 0; i < 8; i++)
+        ctx->h[i] ^= v[i] ^ v[i + 8];
+}
+
+static void blake2b_increment(Blake2b_t* ctx, uint64_t size)
+{
+    ctx->t[0] += size;
+    if (ctx->t[0] < size)
+        ctx->t[1]++;
+}
+
+void blake2b_init(Blake2b_t* ctx, size_t digest_size)
+{
+    memset(ctx, 0, sizeof(Blake2b_t));
+    memcpy(ctx->h, c_blake2b_iv, sizeof(ctx->h));
+
+    // Parameter block: digest length, no key, fanout and depth of 1
+    ctx->h[0] ^= 0x01010000ull ^ (uint64_t)digest_size;
+    ctx->digest_size = digest_size;
+}
+
+void blake2b_update(Blake2b_t* ctx, const void* data, size_t size)
+{
+    const uint8_t* in = data;
+
+    // The last block is only compressed in blake2b_final()
+    while (size) {
+        if (ctx->buffered == BLAKE2B_BLOCK_SIZE) {
+            blake2b_increment(ctx, BLAKE2B_BLOCK_SIZE);
+            blake2b_compress(ctx, ctx->buffer, 0);
+            ctx->buffered = 0;
+        }
+
+        // Whole blocks straight from the input while more data follows
+        if (!ctx->buffered) {
+            while (size > BLAKE2B_BLOCK_SIZE) {
+                blake2b_increment(ctx, BLAKE2B_BLOCK_SIZE);
+                blake2b_compress(ctx, in, 0);
+                in += BLAKE2B_BLOCK_SIZE;
+                size -= BLAKE2B_BLOCK_SIZE;
+            }
+        }
+
+        const size_t count = (size < BLAKE2B_BLOCK_SIZE - ctx->buffered)
+                                 ? size
+                                 : BLAKE2B_BLOCK_SIZE - ctx->buffered;
+        memcpy(ctx->buffer + ctx->buffered, in, count);
+        ctx->buffered += count;
+        in += count;
+        size -= count;
+    }
+}
+
+void blake2b_final(Blake2b_t* ctx, uint8_t* digest)
+{
+    blake2b_increment(ctx, ctx->buffered);
+    memset(ctx->buffer + ctx->buffered, 0, BLAKE2B_BLOCK_SIZE - ctx->buffered);
+    blake2b_compress(ctx, ctx->buffer, 1);
+
+    for (size_t i = 0; i < ctx->digest_size; i++)
+        digest[i] = (uint8_t)(ctx->h[i / 8] >> (8 * (i % 8)));
+}
+
+void blake2b(uint8_t* digest, size_t digest_size, const void* data, size_t size)
+{
+    Blake2b_t ctx;
+
+    blake2b_init(&ctx, digest_size);
+    blake2b_update(&ctx, data, size);
+    blake2b_final(&ctx, digest);
+}
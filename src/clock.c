@@ -0,0 +1,46 @@
+#include "clock.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <errno.h>
+#include <time.h>
+#endif
+
+uint64_t clock_now_ns(void)
+{
+#ifdef _WIN32
+    LARGE_INTEGER counter;
+    LARGE_INTEGER frequency;
+    QueryPerformanceCounter(&counter);
+    QueryPerformanceFrequency(&frequency);
+    return (uint64_t)((double)counter.QuadPart * 1e9 / (double)frequency.QuadPart);
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+void clock_sleep_us(uint64_t usec)
+{
+    if (!usec)
+        return;
+
+#ifdef _WIN32
+    Sleep((DWORD)((usec + 999) / 1000));
+#else
+    struct timespec ts;
+    ts.tv_sec = (time_t)(usec / 1000000);
+    ts.tv_nsec = (long)(usec % 1000000) * 1000;
+    while (nanosleep(&ts, &ts) != 0 && errno == EINTR)
+        ;
+#endif
+}
+
+void clock_sleep_until_ns(uint64_t deadline_ns)
+{
+    const uint64_t now = clock_now_ns();
+    if (deadline_ns > now)
+        clock_sleep_us((deadline_ns - now) / 1000);
+}
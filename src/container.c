@@ -0,0 +1,692 @@
+#define _CRT_SECURE_NO_WARNINGS
+#define _FILE_OFFSET_BITS 64
+
+#include "container.h"
+#include "clock.h"
+#include "dumper.h"
+#include "lz4block.h"
+#include "thread.h"
+#include "zero.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#ifdef _WIN32
+#define container_fseek _fseeki64
+#define container_ftell _ftelli64
+#else
+#define container_fseek fseeko
+#define container_ftell ftello
+#endif
+
+typedef struct ContainerJob
+{
+    // Owned until the block has been compressed
+    Block_t* block;
+    uint64_t address;
+    uint32_t size;
+
+    uint8_t* data;
+    uint32_t stored_size;
+    ContainerCodec_t codec;
+    int done;
+
+    struct ContainerJob* next_work;
+    struct ContainerJob* next;
+} ContainerJob_t;
+
+struct ContainerWriter
+{
+    FILE* file;
+    ContainerCodec_t codec;
+    int32_t level;
+    BlockPool_t* pool;
+
+    Thread_t* threads;
+    uint32_t thread_count;
+    Mutex_t mutex;
+    Cond_t work_ready;
+    Cond_t job_done;
+
+    // Jobs waiting for a worker, and all jobs in address order
+    ContainerJob_t* work_head;
+    ContainerJob_t* work_tail;
+    ContainerJob_t* order_head;
+    ContainerJob_t* order_tail;
+    // Compressed frames waiting for their turn are bounded as well
+    uint32_t jobs;
+    uint32_t max_jobs;
+    int writing;
+    int closing;
+    int failed;
+
+    // Only touched by the thread that is writing
+    uint64_t offset;
+    ContainerFrame_t* frames;
+    uint64_t frame_count;
+    uint64_t frame_capacity;
+
+    ContainerStats_t stats;
+};
+
+static int32_t container_store(ContainerJob_t* job, const uint8_t* data)
+{
+    job->data = malloc(job->size);
+    if (!job->data)
+        return -1;
+
+    memcpy(job->data, data, job->size);
+    job->stored_size = job->size;
+    job->codec = CONTAINER_CODEC_STORED;
+
+    return 0;
+}
+
+static int32_t container_compress(ContainerWriter_t* writer,
+                                  ContainerJob_t* job,
+                                  uint32_t* table,
+                                  void* zstd_ctx)
+{
+    const uint8_t* data = job->block->data;
+    uint32_t compressed_size = 0;
+
+    if (zero_check(data, job->size)) {
+        job->codec = CONTAINER_CODEC_ZERO;
+        return 0;
+    }
+
+    if (writer->codec == CONTAINER_CODEC_LZ4) {
+        const uint32_t capacity = lz4_compress_bound(job->size);
+        job->data = malloc(capacity);
+        if (job->data)
+            compressed_size = lz4_compress(data, job->size, job->data, capacity, table);
+    }
+#ifdef HAVE_ZSTD
+    else if (writer->codec == CONTAINER_CODEC_ZSTD) {
+        const size_t capacity = ZSTD_compressBound(job->size);
+        job->data = malloc(capacity);
+        if (job->data) {
+            const size_t result = ZSTD_compressCCtx(
+                zstd_ctx, job->data, capacity, data, job->size, writer->level);
+            compressed_size = ZSTD_isError(result) ? 0 : (uint32_t)result;
+        }
+    }
+#endif
+
+    // Frames that do not shrink are stored as is
+    if (!compressed_size || compressed_size >= job->size) {
+        free(job->data);
+        return container_store(job, data);
+    }
+
+    job->stored_size = compressed_size;
+    job->codec = writer->codec;
+
+    return 0;
+}
+
+static int32_t container_append_frame(ContainerWriter_t* writer, const ContainerJob_t* job)
+{
+    if (writer->frame_count == writer->frame_capacity) {
+        const uint64_t capacity = writer->frame_capacity ? writer->frame_capacity * 2 : 0x100;
+        ContainerFrame_t* frames = realloc(writer->frames, capacity * sizeof(ContainerFrame_t));
+        if (!frames)
+            return -1;
+        writer->frames = frames;
+        writer->frame_capacity = capacity;
+    }
+
+    if (job->stored_size &&
+        fwrite(job->data, 1, job->stored_size, writer->file) != job->stored_size)
+        return -1;
+
+    ContainerFrame_t* frame = &writer->frames[writer->frame_count++];
+    memset(frame, 0, sizeof(ContainerFrame_t));
+    frame->address = job->address;
+    frame->offset = writer->offset;
+    frame->size = job->size;
+    frame->stored_size = job->stored_size;
+    frame->codec = job->codec;
+
+    writer->offset += job->stored_size;
+    writer->stats.stored_bytes += job->stored_size;
+
+    return 0;
+}
+
+// Writes every finished frame at the head of the order list. Called with the
+// mutex held, only one thread writes at a time.
+static void container_drain(ContainerWriter_t* writer)
+{
+    while (!writer->writing && writer->order_head && writer->order_head->done) {
+        ContainerJob_t* ready = writer->order_head;
+        ContainerJob_t* last = ready;
+        while (last->next && last->next->done)
+            last = last->next;
+
+        writer->order_head = last->next;
+        if (!writer->order_head)
+            writer->order_tail = NULL;
+        last->next = NULL;
+
+        writer->writing = 1;
+        int failed = writer->failed;
+        mutex_unlock(&writer->mutex);
+
+        uint32_t count = 0;
+        while (ready) {
+            ContainerJob_t* job = ready;
+            ready = job->next;
+
+            if (!failed && container_append_frame(writer, job) < 0) {
+                printf("Failed to write frame at 0x%llX\n", (unsigned long long)job->address);
+                failed = 1;
+            }
+
+            free(job->data);
+            free(job);
+            count++;
+        }
+
+        mutex_lock(&writer->mutex);
+        writer->writing = 0;
+        writer->failed |= failed;
+        writer->jobs -= count;
+        cond_broadcast(&writer->job_done);
+    }
+}
+
+static void container_worker(void* arg)
+{
+    ContainerWriter_t* writer = arg;
+    uint32_t* table = malloc(LZ4_TABLE_SIZE);
+    void* zstd_ctx = NULL;
+
+#ifdef HAVE_ZSTD
+    zstd_ctx = ZSTD_createCCtx();
+#endif
+
+    mutex_lock(&writer->mutex);
+
+    for (;;) {
+        while (!writer->work_head && !writer->closing)
+            cond_wait(&writer->work_ready, &writer->mutex);
+
+        ContainerJob_t* job = writer->work_head;
+        if (!job)
+            break;
+
+        writer->work_head = job->next_work;
+        if (!writer->work_head)
+            writer->work_tail = NULL;
+
+        const int failed = writer->failed;
+        mutex_unlock(&writer->mutex);
+
+        const uint64_t start_ns = clock_now_ns();
+        int32_t result = -1;
+        if (!failed && table)
+            result = container_compress(writer, job, table, zstd_ctx);
+        const uint64_t compress_ns = clock_now_ns() - start_ns;
+
+        block_pool_release(writer->pool, job->block);
+        job->block = NULL;
+
+        mutex_lock(&writer->mutex);
+        if (result < 0 && !failed && !writer->failed)
+            printf("Failed to compress block at 0x%llX\n", (unsigned long long)job->address);
+        writer->failed |= (result < 0);
+        writer->stats.compress_ns += compress_ns;
+        job->done = 1;
+
+        container_drain(writer);
+    }
+
+    mutex_unlock(&writer->mutex);
+
+#ifdef HAVE_ZSTD
+    ZSTD_freeCCtx(zstd_ctx);
+#endif
+    free(table);
+}
+
+ContainerWriter_t* container_writer_open(const char* path,
+                                         ContainerCodec_t codec,
+                                         int32_t level,
+                                         uint32_t threads,
+                                         uint64_t start_address,
+                                         uint64_t end_address,
+                                         uint32_t block_size,
+                                         BlockPool_t* pool)
+{
+    ContainerHeader_t header;
+
+    ContainerWriter_t* writer = calloc(1, sizeof(ContainerWriter_t));
+    if (!writer) {
+        printf("Failed to allocate container writer\n");
+        return NULL;
+    }
+
+    writer->file = fopen(path, "wb");
+    if (!writer->file) {
+        printf("Failed to open %s\n", path);
+        free(writer);
+        return NULL;
+    }
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, CONTAINER_MAGIC, sizeof(header.magic));
+    header.start_address = start_address;
+    header.end_address = end_address;
+    header.codec = codec;
+    header.block_size = block_size;
+    if (fwrite(&header, sizeof(header), 1, writer->file) != 1) {
+        printf("Failed to write %s\n", path);
+        fclose(writer->file);
+        free(writer);
+        return NULL;
+    }
+
+    writer->codec = codec;
+    writer->level = level;
+    writer->pool = pool;
+    writer->offset = sizeof(header);
+    writer->thread_count = min(max(threads, 1u), (uint32_t)CONTAINER_MAX_THREADS);
+    writer->max_jobs = pool->count * 2;
+    writer->stats.codec = container_codec_name(codec);
+    writer->stats.threads = writer->thread_count;
+
+    mutex_init(&writer->mutex);
+    cond_init(&writer->work_ready);
+    cond_init(&writer->job_done);
+
+    writer->threads = calloc(writer->thread_count, sizeof(Thread_t));
+    for (uint32_t i = 0; writer->threads && i < writer->thread_count; i++) {
+        if (thread_create(&writer->threads[i], container_worker, writer) < 0) {
+            printf("Failed to start compression thread\n");
+            writer->thread_count = i;
+            break;
+        }
+    }
+
+    if (!writer->threads || !writer->thread_count) {
+        container_writer_close(writer, NULL);
+        return NULL;
+    }
+
+    return writer;
+}
+
+int32_t container_writer_submit(ContainerWriter_t* writer, Block_t* block)
+{
+    ContainerJob_t* job = calloc(1, sizeof(ContainerJob_t));
+
+    mutex_lock(&writer->mutex);
+
+    while (!writer->failed && writer->jobs >= writer->max_jobs)
+        cond_wait(&writer->job_done, &writer->mutex);
+
+    if (!job || writer->failed) {
+        mutex_unlock(&writer->mutex);
+        block_pool_release(writer->pool, block);
+        free(job);
+        return -1;
+    }
+
+    job->block = block;
+    job->address = block->address;
+    job->size = block->size;
+
+    if (writer->work_tail)
+        writer->work_tail->next_work = job;
+    else
+        writer->work_head = job;
+    writer->work_tail = job;
+
+    if (writer->order_tail)
+        writer->order_tail->next = job;
+    else
+        writer->order_head = job;
+    writer->order_tail = job;
+
+    writer->jobs++;
+    writer->stats.frames++;
+    writer->stats.bytes += block->size;
+
+    cond_signal(&writer->work_ready);
+    mutex_unlock(&writer->mutex);
+
+    return 0;
+}
+
+int32_t container_writer_close(ContainerWriter_t* writer, ContainerStats_t* stats)
+{
+    ContainerFooter_t footer;
+
+    mutex_lock(&writer->mutex);
+    writer->closing = 1;
+    cond_broadcast(&writer->work_ready);
+    mutex_unlock(&writer->mutex);
+
+    for (uint32_t i = 0; i < writer->thread_count; i++)
+        thread_join(&writer->threads[i]);
+
+    int32_t result = (writer->failed || !writer->thread_count) ? -1 : 0;
+
+    memset(&footer, 0, sizeof(footer));
+    footer.index_offset = writer->offset;
+    footer.frame_count = writer->frame_count;
+    memcpy(footer.magic, CONTAINER_INDEX_MAGIC, sizeof(footer.magic));
+
+    if (result == 0 &&
+        (fwrite(writer->frames, sizeof(ContainerFrame_t), writer->frame_count, writer->file) !=
+             writer->frame_count ||
+         fwrite(&footer, sizeof(footer), 1, writer->file) != 1))
+        result = -1;
+
+    if (fclose(writer->file) != 0)
+        result = -1;
+
+    if (stats)
+        *stats = writer->stats;
+
+    mutex_destroy(&writer->mutex);
+    cond_destroy(&writer->work_ready);
+    cond_destroy(&writer->job_done);
+    free(writer->threads);
+    free(writer->frames);
+    free(writer);
+
+    return result;
+}
+
+void container_print_stats(const char* output_path, const ContainerStats_t* stats)
+{
+    printf("%s : %.2f MiB packed into %.2f MiB (%s, %u threads), ratio %.2f, "
+           "compression took %.1f ms of CPU time\n",
+           output_path,
+           (double)stats->bytes / (1024 * 1024),
+           (double)stats->stored_bytes / (1024 * 1024),
+           stats->codec,
+           stats->threads,
+           stats->stored_bytes ? (double)stats->bytes / stats->stored_bytes : 0.0,
+           (double)stats->compress_ns / 1e6);
+}
+
+ContainerReader_t* container_reader_open(const char* path)
+{
+    ContainerFooter_t footer;
+
+    ContainerReader_t* reader = calloc(1, sizeof(ContainerReader_t));
+    if (!reader)
+        return NULL;
+    reader->cache_frame = -1;
+
+    reader->file = fopen(path, "rb");
+    if (!reader->file) {
+        printf("Failed to open %s\n", path);
+        free(reader);
+        return NULL;
+    }
+
+    if (fread(&reader->header, sizeof(reader->header), 1, reader->file) != 1 ||
+        memcmp(reader->header.magic, CONTAINER_MAGIC, sizeof(reader->header.magic)) != 0 ||
+        container_fseek(reader->file, -(int64_t)sizeof(footer), SEEK_END) != 0 ||
+        fread(&footer, sizeof(footer), 1, reader->file) != 1 ||
+        memcmp(footer.magic, CONTAINER_INDEX_MAGIC, sizeof(footer.magic)) != 0) {
+        printf("%s is not a packed dump\n", path);
+        container_reader_close(reader);
+        return NULL;
+    }
+
+    const uint64_t index_end = (uint64_t)container_ftell(reader->file) - sizeof(footer);
+    if (footer.index_offset > index_end ||
+        footer.frame_count > (index_end - footer.index_offset) / sizeof(ContainerFrame_t)) {
+        printf("%s has a corrupted index\n", path);
+        container_reader_close(reader);
+        return NULL;
+    }
+
+    reader->frame_count = footer.frame_count;
+    reader->frames = calloc(max(reader->frame_count, 1ull), sizeof(ContainerFrame_t));
+    if (!reader->frames ||
+        container_fseek(reader->file, (int64_t)footer.index_offset, SEEK_SET) != 0 ||
+        fread(reader->frames, sizeof(ContainerFrame_t), reader->frame_count, reader->file) !=
+            reader->frame_count) {
+        printf("Failed to read the index of %s\n", path);
+        container_reader_close(reader);
+        return NULL;
+    }
+
+    return reader;
+}
+
+void container_reader_close(ContainerReader_t* reader)
+{
+    if (!reader)
+        return;
+
+    if (reader->file)
+        fclose(reader->file);
+    free(reader->frames);
+    free(reader->cache);
+    free(reader->stored);
+    free(reader);
+}
+
+static int32_t container_reserve(uint8_t** buffer, uint64_t* capacity, uint64_t size)
+{
+    if (size <= *capacity)
+        return 0;
+
+    uint8_t* new_buffer = realloc(*buffer, size);
+    if (!new_buffer)
+        return -1;
+
+    *buffer = new_buffer;
+    *capacity = size;
+    return 0;
+}
+
+// Decompresses a frame into reader->cache
+static int32_t container_load_frame(ContainerReader_t* reader, uint64_t index)
+{
+    const ContainerFrame_t* frame = &reader->frames[index];
+
+    if (reader->cache_frame == (int64_t)index)
+        return 0;
+    reader->cache_frame = -1;
+
+    if (container_reserve(&reader->cache, &reader->cache_capacity, frame->size) < 0 ||
+        container_reserve(&reader->stored, &reader->stored_capacity, frame->stored_size) < 0) {
+        printf("Failed to allocate frame buffer\n");
+        return -1;
+    }
+
+    if (frame->codec == CONTAINER_CODEC_ZERO) {
+        memset(reader->cache, 0, frame->size);
+        reader->cache_frame = (int64_t)index;
+        return 0;
+    }
+
+    if (container_fseek(reader->file, (int64_t)frame->offset, SEEK_SET) != 0 ||
+        fread(reader->stored, 1, frame->stored_size, reader->file) != frame->stored_size) {
+        printf("Failed to read frame at 0x%llX\n", (unsigned long long)frame->address);
+        return -1;
+    }
+
+    int64_t size = -1;
+    switch (frame->codec) {
+        case CONTAINER_CODEC_STORED:
+            if (frame->stored_size == frame->size) {
+                memcpy(reader->cache, reader->stored, frame->size);
+                size = frame->size;
+            }
+            break;
+        case CONTAINER_CODEC_LZ4:
+            size = lz4_decompress(reader->stored, frame->stored_size, reader->cache, frame->size);
+            break;
+#ifdef HAVE_ZSTD
+        case CONTAINER_CODEC_ZSTD: {
+            const size_t result =
+                ZSTD_decompress(reader->cache, frame->size, reader->stored, frame->stored_size);
+            size = ZSTD_isError(result) ? -1 : (int64_t)result;
+            break;
+        }
+#endif
+        default:
+            printf("Unsupported codec %s\n", container_codec_name(frame->codec));
+            return -1;
+    }
+
+    if (size != frame->size) {
+        printf("Corrupted frame at 0x%llX\n", (unsigned long long)frame->address);
+        return -1;
+    }
+
+    reader->cache_frame = (int64_t)index;
+    return 0;
+}
+
+// Index of the frame that holds address, or -1
+static int64_t container_find_frame(const ContainerReader_t* reader, uint64_t address)
+{
+    uint64_t low = 0;
+    uint64_t high = reader->frame_count;
+
+    while (low < high) {
+        const uint64_t mid = low + (high - low) / 2;
+        if (reader->frames[mid].address <= address)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+
+    if (!low)
+        return -1;
+
+    const ContainerFrame_t* frame = &reader->frames[low - 1];
+    return (address < frame->address + frame->size) ? (int64_t)(low - 1) : -1;
+}
+
+int32_t container_read(ContainerReader_t* reader, uint64_t address, uint8_t* buf, uint64_t size)
+{
+    while (size) {
+        const int64_t index = container_find_frame(reader, address);
+        if (index < 0) {
+            printf("Address 0x%llX is not in the container\n", (unsigned long long)address);
+            return -1;
+        }
+
+        if (container_load_frame(reader, (uint64_t)index) < 0)
+            return -1;
+
+        const ContainerFrame_t* frame = &reader->frames[index];
+        const uint64_t frame_offset = address - frame->address;
+        const uint64_t count = min(size, frame->size - frame_offset);
+
+        memcpy(buf, reader->cache + frame_offset, count);
+        buf += count;
+        address += count;
+        size -= count;
+    }
+
+    return 0;
+}
+
+int32_t container_unpack(const char* input_path, const char* output_path)
+{
+    ContainerReader_t* reader = container_reader_open(input_path);
+    if (!reader)
+        return -1;
+
+    FILE* output = fopen(output_path, "wb");
+    if (!output) {
+        printf("Failed to open %s\n", output_path);
+        container_reader_close(reader);
+        return -1;
+    }
+
+    const uint64_t start_address = reader->header.start_address;
+    const uint64_t total_size = reader->header.end_address - start_address;
+    int32_t result = 0;
+
+    for (uint64_t i = 0; i < reader->frame_count && result == 0; i++) {
+        const ContainerFrame_t* frame = &reader->frames[i];
+
+        // Zero frames are skipped over and stay holes
+        if (frame->codec == CONTAINER_CODEC_ZERO)
+            continue;
+
+        if (container_load_frame(reader, i) < 0 ||
+            container_fseek(output, (int64_t)(frame->address - start_address), SEEK_SET) != 0 ||
+            fwrite(reader->cache, 1, frame->size, output) != frame->size)
+            result = -1;
+    }
+
+    // Extend the file if it ends in zeros
+    if (result == 0 && total_size && container_fseek(output, 0, SEEK_END) == 0 &&
+        (uint64_t)container_ftell(output) < total_size) {
+        const uint8_t zero = 0;
+        if (container_fseek(output, (int64_t)(total_size - 1), SEEK_SET) != 0 ||
+            fwrite(&zero, 1, 1, output) != 1)
+            result = -1;
+    }
+
+    if (fclose(output) != 0)
+        result = -1;
+
+    if (result < 0)
+        printf("Failed to unpack %s\n", input_path);
+    else
+        printf("Unpacked %s [0x%llX, 0x%llX) to %s\n",
+               input_path,
+               (unsigned long long)start_address,
+               (unsigned long long)reader->header.end_address,
+               output_path);
+
+    container_reader_close(reader);
+
+    return result;
+}
+
+int32_t container_parse_codec(const char* name, ContainerCodec_t* codec)
+{
+    if (!*name || !strcmp(name, "lz4")) {
+        *codec = CONTAINER_CODEC_LZ4;
+    } else if (!strcmp(name, "none")) {
+        *codec = CONTAINER_CODEC_STORED;
+    } else if (!strcmp(name, "zstd")) {
+#ifdef HAVE_ZSTD
+        *codec = CONTAINER_CODEC_ZSTD;
+#else
+        printf("zstd support was not compiled in\n");
+        return -1;
+#endif
+    } else {
+        return -1;
+    }
+
+    return 0;
+}
+
+const char* container_codec_name(ContainerCodec_t codec)
+{
+    switch (codec) {
+        case CONTAINER_CODEC_STORED:
+            return "none";
+        case CONTAINER_CODEC_ZERO:
+            return "zero";
+        case CONTAINER_CODEC_LZ4:
+            return "lz4";
+        case CONTAINER_CODEC_ZSTD:
+            return "zstd";
+        default:
+            return "unknown";
+    }
+}
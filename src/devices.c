@@ -0,0 +1,669 @@
+#define _CRT_SECURE_NO_WARNINGS
+
+#include "devices.h"
+#include "clock.h"
+#include "dumper.h"
+#include "emulator.h"
+#include "metrics.h"
+#include "search.h"
+#include "survey.h"
+#include "thread.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct DeviceJob
+{
+    DeviceInfo_t device;
+    Options_t options;
+    char output_path[0x200];
+    State_t state;
+    Thread_t thread;
+    int started;
+    // Cleared by the worker under the stats mutex once dump_memory returns
+    int running;
+    int32_t result;
+    uint64_t start_ns;
+    uint64_t end_ns;
+} DeviceJob_t;
+
+static void device_set_id(DeviceInfo_t* device)
+{
+    strcpy(device->id, device->serial[0] ? device->serial : device->path);
+
+    // The id names a directory, keep it to characters that are safe everywhere
+    for (char* c = device->id; *c; c++) {
+        if (!isalnum((unsigned char)*c) && *c != '-' && *c != '.' && *c != '_')
+            *c = '_';
+    }
+}
+
+int32_t find_devices(libusb_context* ctx, DeviceInfo_t* devices, uint32_t capacity)
+{
+    libusb_device** list;
+
+    ssize_t total_devices = libusb_get_device_list(ctx, &list);
+    if (total_devices < 0) {
+        printf("Failed to retrieve device list\n");
+        return -1;
+    }
+
+    uint32_t count = 0;
+    for (ssize_t i = 0; i < total_devices && count < capacity; i++) {
+        struct libusb_device_descriptor desc;
+        DeviceInfo_t* device = &devices[count];
+
+        if (libusb_get_device_descriptor(list[i], &desc) != LIBUSB_SUCCESS)
+            continue;
+
+        if (!is_supported_device(desc.idVendor, desc.idProduct))
+            continue;
+
+        memset(device, 0, sizeof(DeviceInfo_t));
+        if (device_port_path(list[i], device->path, sizeof(device->path)) < 0)
+            continue;
+
+        device->vendor_id = desc.idVendor;
+        device->product_id = desc.idProduct;
+
+        // Best effort, reading the serial needs permission to open the device
+        libusb_device_handle* handle;
+        if (desc.iSerialNumber && libusb_open(list[i], &handle) == LIBUSB_SUCCESS) {
+            if (libusb_get_string_descriptor_ascii(handle,
+                                                   desc.iSerialNumber,
+                                                   (unsigned char*)device->serial,
+                                                   sizeof(device->serial)) < 0)
+                device->serial[0] = '\0';
+            libusb_close(handle);
+        }
+
+        device_set_id(device);
+        count++;
+    }
+
+    libusb_free_device_list(list, 1);
+
+    return count;
+}
+
+static int32_t find_emulated_devices(const char* spec, DeviceInfo_t* devices, uint32_t capacity)
+{
+    EmuConfig_t config;
+    emu_default_config(&config);
+
+    if (emu_parse_config(spec, &config) < 0)
+        return -1;
+
+    const uint32_t count = min(config.devices, capacity);
+    for (uint32_t i = 0; i < count; i++) {
+        memset(&devices[i], 0, sizeof(DeviceInfo_t));
+        snprintf(devices[i].path, sizeof(devices[i].path), "emu%u", i);
+        devices[i].vendor_id = config.vendor_id;
+        devices[i].product_id = config.product_id;
+        device_set_id(&devices[i]);
+    }
+
+    return count;
+}
+
+static int device_matches(const DeviceInfo_t* device, const char* selector, size_t length)
+{
+    if (length == 3 && !strncmp(selector, "all", 3))
+        return 1;
+
+    return (strlen(device->path) == length && !strncmp(device->path, selector, length)) ||
+           (strlen(device->serial) == length && !strncmp(device->serial, selector, length));
+}
+
+// Keeps the devices that match any entry of the selector list, in the order they were found.
+// If strict is set, every entry has to match at least one device.
+static int32_t select_devices(const char* selectors,
+                              DeviceInfo_t* devices,
+                              uint32_t count,
+                              int strict)
+{
+    int selected[MAX_DEVICES] = { 0 };
+
+    for (const char* selector = selectors; *selector;) {
+        const char* separator = strchr(selector, ',');
+        const size_t length = separator ? (size_t)(separator - selector) : strlen(selector);
+        int matched = 0;
+
+        for (uint32_t i = 0; i < count; i++) {
+            if (device_matches(&devices[i], selector, length))
+                selected[i] = matched = 1;
+        }
+
+        if (!matched && strict) {
+            printf("No supported device matches %.*s\n", (int)length, selector);
+            return -1;
+        }
+
+        selector += length + (separator ? 1 : 0);
+    }
+
+    uint32_t kept = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        if (selected[i])
+            devices[kept++] = devices[i];
+    }
+
+    return kept;
+}
+
+static int32_t make_directory(const char* path)
+{
+    if (create_directory(path) < 0 && errno != EEXIST) {
+        printf("Failed to create directory %s\n", path);
+        return -1;
+    }
+
+    return 0;
+}
+
+static int32_t device_output_path(const Options_t* options, DeviceJob_t* job)
+{
+    const size_t size = sizeof(job->output_path);
+    int length;
+
+    // An image is a single file like the output of dump_range
+    if (options->dump_mode == DUMP_MODE_ALL && !options->image_format) {
+        // dump_memory creates the per-device directory itself
+        if (make_directory(options->output_path) < 0)
+            return -1;
+
+        length = snprintf(job->output_path, size, "%s/%s", options->output_path, job->device.id);
+    } else {
+        const char* name = strrchr(options->output_path, '/');
+#ifdef _WIN32
+        const char* backslash = strrchr(options->output_path, '\\');
+        if (backslash && (!name || backslash > name))
+            name = backslash;
+#endif
+        const int dir_length = name ? (int)(name - options->output_path) : 1;
+        const char* dir = name ? options->output_path : ".";
+        name = name ? name + 1 : options->output_path;
+
+        length = snprintf(job->output_path, size, "%.*s/%s", dir_length, dir, job->device.id);
+        if (length > 0 && (size_t)length < size && make_directory(job->output_path) < 0)
+            return -1;
+
+        length = snprintf(
+            job->output_path, size, "%.*s/%s/%s", dir_length, dir, job->device.id, name);
+    }
+
+    if (length < 0 || (size_t)length >= size) {
+        printf("Output path for %s is too long\n", job->device.id);
+        return -1;
+    }
+
+    return 0;
+}
+
+static void device_worker(void* arg)
+{
+    DeviceJob_t* job = arg;
+
+    job->start_ns = clock_now_ns();
+    job->result = dump_memory(&job->state, &job->options);
+
+    mutex_lock(job->state.stats_mutex);
+    job->end_ns = clock_now_ns();
+    job->running = 0;
+    mutex_unlock(job->state.stats_mutex);
+}
+
+int devices_requested(const Options_t* options)
+{
+    if (options->device_selector)
+        return 1;
+    if (!options->emulate_spec)
+        return 0;
+
+    EmuConfig_t config;
+    emu_default_config(&config);
+
+    return emu_parse_config(options->emulate_spec, &config) == 0 && config.devices > 1;
+}
+
+static double device_rate(uint64_t bytes, uint64_t elapsed_ns)
+{
+    return elapsed_ns ? (double)bytes * 1000.0 / (double)elapsed_ns : 0.0;
+}
+
+int32_t dump_devices(const Options_t* options)
+{
+    DeviceInfo_t devices[MAX_DEVICES];
+    int32_t count;
+
+    if (options->emulate_spec) {
+        count = find_emulated_devices(options->emulate_spec, devices, MAX_DEVICES);
+    } else {
+        libusb_context* ctx;
+
+        int result = libusb_init(&ctx);
+        if (result != LIBUSB_SUCCESS) {
+            printf("Failed to initialize libusb. libusb error: %d\n", result);
+            return -1;
+        }
+
+        count = find_devices(ctx, devices, MAX_DEVICES);
+        libusb_exit(ctx);
+    }
+
+    if (count > 0 && options->device_selector)
+        count = select_devices(options->device_selector, devices, count, 1);
+    if (count < 0)
+        return -1;
+    if (!count) {
+        printf("Device detection failed\n");
+        return -1;
+    }
+    // A survey describes the memory of one device
+    Survey_t survey = { 0 };
+    if (options->survey_path) {
+        if (count > 1) {
+            printf("--survey needs a single device\n");
+            return -1;
+        }
+        if (survey_load(options->survey_path, &survey) < 0)
+            return -1;
+    }
+    // Patterns are shared by all devices
+    SearchPatterns_t patterns = { 0 };
+    if (options->search && search_patterns_load(&patterns, options->search_path) < 0) {
+        survey_free(&survey);
+        return -1;
+    }
+
+    // A single explicitly selected device keeps the output paths as given
+    const int per_device = !options->device_selector || !strcmp(options->device_selector, "all") ||
+                           strchr(options->device_selector, ',');
+
+    DeviceJob_t* jobs = calloc(count, sizeof(DeviceJob_t));
+    if (!jobs) {
+        printf("Failed to allocate device jobs\n");
+        survey_free(&survey);
+        search_patterns_free(&patterns);
+        return -1;
+    }
+
+    Mutex_t stats_mutex;
+    mutex_init(&stats_mutex);
+
+    int32_t result = 0;
+
+    // Devices are opened and tuned one after another, only the dumps run concurrently
+    for (int32_t i = 0; i < count && result == 0; i++) {
+        DeviceJob_t* job = &jobs[i];
+
+        job->device = devices[i];
+        job->options = *options;
+        if (per_device) {
+            if (device_output_path(options, job) < 0) {
+                result = -1;
+                break;
+            }
+            job->options.output_path = job->output_path;
+        }
+
+        printf("[%s] %04x:%04x at %s%s%s\n",
+               job->device.id,
+               job->device.vendor_id,
+               job->device.product_id,
+               job->device.path,
+               job->device.serial[0] ? ", serial " : "",
+               job->device.serial);
+
+        apply_options(&job->state, options);
+        if (options->survey_path)
+            job->state.survey = &survey;
+        if (options->search)
+            job->state.search = &patterns;
+        if (options->emulate_spec)
+            result = init_emulator(&job->state, options->emulate_spec);
+        else
+            result = init_device(&job->state, job->device.path);
+        if (result < 0)
+            break;
+
+        print_probetable(job->state.probe_table);
+
+        if (select_block_size(&job->state, options) < 0) {
+            result = -1;
+            break;
+        }
+
+        // The combined progress below replaces the status lines
+        if (options->metrics_path) {
+            job->state.metrics = metrics_create(options->metrics_path, job->device.id, 0);
+            if (!job->state.metrics)
+                result = -1;
+            job->state.phase_latency = metrics_phases(job->state.metrics);
+        }
+    }
+
+    const uint64_t start_ns = clock_now_ns();
+
+    for (int32_t i = 0; i < count && result == 0; i++) {
+        DeviceJob_t* job = &jobs[i];
+
+        job->state.stats_mutex = &stats_mutex;
+        job->running = 1;
+        if (thread_create(&job->thread, device_worker, job) < 0) {
+            printf("Failed to start the worker for %s\n", job->device.id);
+            job->running = 0;
+            result = -1;
+            break;
+        }
+        job->started = 1;
+    }
+
+    // Report the combined progress until the last worker is done
+    uint64_t next_report_ns = start_ns + DEVICES_REPORT_INTERVAL_US * 1000ull;
+    for (int running = 1; running;) {
+        uint64_t received = 0;
+
+        clock_sleep_us(DEVICES_POLL_INTERVAL_US);
+
+        running = 0;
+        mutex_lock(&stats_mutex);
+        for (int32_t i = 0; i < count; i++) {
+            received += jobs[i].state.received_bytes;
+            running += jobs[i].running;
+        }
+        mutex_unlock(&stats_mutex);
+
+        const uint64_t now_ns = clock_now_ns();
+        if (running && now_ns >= next_report_ns) {
+            printf("%d of %d devices running, %llu MiB received, %.1f MB/s\n",
+                   running,
+                   count,
+                   received >> 20,
+                   device_rate(received, now_ns - start_ns));
+            next_report_ns += DEVICES_REPORT_INTERVAL_US * 1000ull;
+        }
+    }
+
+    uint64_t total_bytes = 0;
+    const uint64_t total_ns = clock_now_ns() - start_ns;
+
+    for (int32_t i = 0; i < count; i++) {
+        DeviceJob_t* job = &jobs[i];
+
+        if (job->started) {
+            thread_join(&job->thread);
+
+            const uint64_t bytes = job->state.received_bytes;
+            const uint64_t elapsed_ns = job->end_ns - job->start_ns;
+
+            printf("[%s] %s: %llu MiB in %.2f s, %.1f MB/s\n",
+                   job->device.id,
+                   job->result < 0 ? "failed" : "done",
+                   bytes >> 20,
+                   elapsed_ns / 1e9,
+                   device_rate(bytes, elapsed_ns));
+
+            total_bytes += bytes;
+            if (job->result < 0)
+                result = -1;
+        }
+
+        if (metrics_destroy(job->state.metrics) < 0)
+            result = -1;
+        close_state(&job->state);
+    }
+
+    if (total_bytes) {
+        printf("Total: %llu MiB from %d device%s in %.2f s, %.1f MB/s\n",
+               total_bytes >> 20,
+               count,
+               count == 1 ? "" : "s",
+               total_ns / 1e9,
+               device_rate(total_bytes, total_ns));
+    }
+
+    mutex_destroy(&stats_mutex);
+    free(jobs);
+    survey_free(&survey);
+    search_patterns_free(&patterns);
+
+    return result;
+}
+
+// Hotplug events only wake the wait loop up, devices are listed and opened
+// outside of the callback
+static int LIBUSB_CALL wait_hotplug(libusb_context* ctx,
+                                    libusb_device* device,
+                                    libusb_hotplug_event event,
+                                    void* user_data)
+{
+    int* changed = user_data;
+
+    *changed = 1;
+    return 0;
+}
+
+// Lists the selected devices that are present right now
+static int32_t wait_list_devices(const Options_t* options,
+                                 libusb_context* ctx,
+                                 DeviceInfo_t* devices)
+{
+    int32_t count = options->emulate_spec
+                        ? find_emulated_devices(options->emulate_spec, devices, MAX_DEVICES)
+                        : find_devices(ctx, devices, MAX_DEVICES);
+
+    if (count > 0 && options->device_selector)
+        count = select_devices(options->device_selector, devices, count, 0);
+
+    return count;
+}
+
+static int device_listed(const DeviceInfo_t* device, const DeviceInfo_t* devices, uint32_t count)
+{
+    for (uint32_t i = 0; i < count; i++) {
+        if (!strcmp(device->path, devices[i].path))
+            return 1;
+    }
+
+    return 0;
+}
+
+// Opens, tunes and dumps a device that just appeared, in the calling thread
+static int32_t wait_dump_device(const Options_t* options,
+                                const DeviceInfo_t* device,
+                                const Survey_t* survey,
+                                const SearchPatterns_t* patterns,
+                                int per_device,
+                                uint64_t found_ns)
+{
+    DeviceJob_t* job = calloc(1, sizeof(DeviceJob_t));
+    int32_t result = -1;
+
+    if (!job) {
+        printf("Failed to allocate the device job\n");
+        return -1;
+    }
+
+    job->device = *device;
+    job->options = *options;
+    if (per_device) {
+        if (device_output_path(options, job) < 0) {
+            free(job);
+            return -1;
+        }
+        job->options.output_path = job->output_path;
+    }
+
+    printf("[%s] %04x:%04x at %s%s%s\n",
+           job->device.id,
+           job->device.vendor_id,
+           job->device.product_id,
+           job->device.path,
+           job->device.serial[0] ? ", serial " : "",
+           job->device.serial);
+
+    // A device that just enumerated may not be accessible yet
+    for (uint32_t attempt = 1; attempt <= WAIT_OPEN_ATTEMPTS && result < 0; attempt++) {
+        if (attempt > 1) {
+            close_state(&job->state);
+            memset(&job->state, 0, sizeof(State_t));
+            clock_sleep_us(WAIT_OPEN_DELAY_US);
+        }
+
+        apply_options(&job->state, options);
+        job->state.survey = survey;
+        if (options->search)
+            job->state.search = patterns;
+        if (options->emulate_spec)
+            result = init_emulator(&job->state, options->emulate_spec);
+        else
+            result = init_device(&job->state, job->device.path);
+    }
+
+    if (result == 0) {
+        print_probetable(job->state.probe_table);
+        result = select_block_size(&job->state, options);
+    }
+
+    Metrics_t* metrics = NULL;
+    if (result == 0) {
+        metrics = metrics_create(
+            options->metrics_path, per_device ? job->device.id : NULL, !options->no_progress);
+        result = metrics ? 0 : -1;
+    }
+
+    if (result == 0) {
+        job->state.metrics = metrics;
+        job->state.phase_latency = metrics_phases(metrics);
+
+        printf("[%s] Dump started %.0f ms after the device appeared\n",
+               job->device.id,
+               (clock_now_ns() - found_ns) / 1e6);
+        result = dump_memory(&job->state, &job->options);
+    }
+    if (metrics_destroy(metrics) < 0)
+        result = -1;
+
+    printf("[%s] %s\n", job->device.id, result < 0 ? "failed" : "done");
+    close_state(&job->state);
+    free(job);
+
+    return result;
+}
+
+int32_t wait_devices(const Options_t* options)
+{
+    DeviceInfo_t devices[MAX_DEVICES];
+    // Dumped and still plugged in, they are dumped again once they come back
+    DeviceInfo_t dumped[MAX_DEVICES];
+    uint32_t dumped_count = 0;
+    libusb_context* ctx = NULL;
+    libusb_hotplug_callback_handle hotplug;
+    int hotplug_registered = 0;
+    int changed = 0;
+    Survey_t survey = { 0 };
+    SearchPatterns_t patterns = { 0 };
+    int32_t result = 0;
+
+    // A queue of devices gets per-device outputs like --device=all
+    const int per_device = options->wait_count != 1;
+
+    if (options->survey_path && (per_device || survey_load(options->survey_path, &survey) < 0)) {
+        if (per_device)
+            printf("--survey needs a single device\n");
+        return -1;
+    }
+    if (options->search && search_patterns_load(&patterns, options->search_path) < 0) {
+        survey_free(&survey);
+        return -1;
+    }
+
+    if (!options->emulate_spec) {
+        const int error = libusb_init(&ctx);
+        if (error != LIBUSB_SUCCESS) {
+            printf("Failed to initialize libusb. libusb error: %d\n", error);
+            survey_free(&survey);
+            search_patterns_free(&patterns);
+            return -1;
+        }
+
+        if (libusb_has_capability(LIBUSB_CAP_HAS_HOTPLUG) &&
+            libusb_hotplug_register_callback(ctx,
+                                             LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED |
+                                                 LIBUSB_HOTPLUG_EVENT_DEVICE_LEFT,
+                                             LIBUSB_HOTPLUG_NO_FLAGS,
+                                             LIBUSB_HOTPLUG_MATCH_ANY,
+                                             LIBUSB_HOTPLUG_MATCH_ANY,
+                                             LIBUSB_HOTPLUG_MATCH_ANY,
+                                             wait_hotplug,
+                                             &changed,
+                                             &hotplug) == LIBUSB_SUCCESS)
+            hotplug_registered = 1;
+        else
+            printf("No hotplug support, polling for devices\n");
+    }
+
+    printf("Waiting for a device in upload mode...\n");
+    fflush(stdout);
+
+    for (uint32_t dumps = 0; !options->wait_count || dumps < options->wait_count;) {
+        const int32_t count = wait_list_devices(options, ctx, devices);
+        if (count < 0) {
+            result = -1;
+            break;
+        }
+        const uint64_t found_ns = clock_now_ns();
+
+        // Forget the devices that left
+        uint32_t kept = 0;
+        for (uint32_t i = 0; i < dumped_count; i++) {
+            if (device_listed(&dumped[i], devices, count))
+                dumped[kept++] = dumped[i];
+        }
+        dumped_count = kept;
+
+        int32_t next = -1;
+        for (int32_t i = 0; i < count && next < 0; i++) {
+            if (!device_listed(&devices[i], dumped, dumped_count))
+                next = i;
+        }
+
+        if (next >= 0) {
+            // One failed device does not stop the queue
+            if (wait_dump_device(
+                    options, &devices[next], &survey, &patterns, per_device, found_ns) < 0)
+                result = -1;
+            if (dumped_count < MAX_DEVICES)
+                dumped[dumped_count++] = devices[next];
+
+            dumps++;
+            if (!options->wait_count || dumps < options->wait_count)
+                printf("Waiting for the next device...\n");
+            fflush(stdout);
+            continue;
+        }
+
+        // Rescanned once in a while even with hotplug, in case an event was missed
+        if (hotplug_registered) {
+            struct timeval timeout = { 0, WAIT_RESCAN_INTERVAL_US };
+            changed = 0;
+            libusb_handle_events_timeout_completed(ctx, &timeout, &changed);
+        } else {
+            clock_sleep_us(DEVICES_POLL_INTERVAL_US);
+        }
+    }
+
+    if (hotplug_registered)
+        libusb_hotplug_deregister_callback(ctx, hotplug);
+    if (ctx)
+        libusb_exit(ctx);
+    survey_free(&survey);
+    search_patterns_free(&patterns);
+
+    return result;
+}
@@ -0,0 +1,721 @@
+#define _CRT_SECURE_NO_WARNINGS
+
+#include "digest.h"
+#include "clock.h"
+#include "dumper.h"
+#include "reader.h"
+#include "thread.h"
+#include "xxh64.h"
+#include "zero.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define DIGEST_MAX_PATH 0x200
+#define DIGEST_MAX_LINE 0x100
+#define DIGEST_HEX_SIZE (SHA256_DIGEST_SIZE * 2 + 1)
+
+static void digest_hex(const uint8_t* sha, char* hex)
+{
+    for (uint32_t i = 0; i < SHA256_DIGEST_SIZE; i++)
+        sprintf(hex + i * 2, "%02x", sha[i]);
+}
+
+static int32_t digest_parse_hex(const char* hex, uint8_t* sha)
+{
+    if (strlen(hex) != SHA256_DIGEST_SIZE * 2)
+        return -1;
+
+    for (uint32_t i = 0; i < SHA256_DIGEST_SIZE; i++) {
+        unsigned int byte;
+        if (sscanf(hex + i * 2, "%2x", &byte) != 1)
+            return -1;
+        sha[i] = (uint8_t)byte;
+    }
+
+    return 0;
+}
+
+// Digests of [start_address, end_address), read in order
+static int32_t digest_read_range(DumpReader_t* reader,
+                                 uint64_t start_address,
+                                 uint64_t end_address,
+                                 uint8_t* sha,
+                                 uint64_t* xxh)
+{
+    Sha256_t sha_ctx;
+    Xxh64_t xxh_ctx;
+
+    uint8_t* buf = malloc(DIGEST_READ_SIZE);
+    if (!buf)
+        return -1;
+
+    sha256_init(&sha_ctx);
+    xxh64_init(&xxh_ctx, 0);
+
+    int32_t result = 0;
+    for (uint64_t address = start_address; address < end_address && result == 0;
+         address += DIGEST_READ_SIZE) {
+        const uint64_t size = min(end_address - address, (uint64_t)DIGEST_READ_SIZE);
+        const uint8_t* data = dump_reader_read(reader, address, size, buf);
+        if (!data) {
+            printf("Failed to read 0x%llX bytes at 0x%llX from %s\n",
+                   (unsigned long long)size,
+                   (unsigned long long)address,
+                   reader->source->path);
+            result = -1;
+            break;
+        }
+
+        sha256_update(&sha_ctx, data, (size_t)size);
+        xxh64_update(&xxh_ctx, data, (size_t)size);
+    }
+
+    sha256_final(&sha_ctx, sha);
+    *xxh = xxh64_final(&xxh_ctx);
+    free(buf);
+
+    return result;
+}
+
+// Writer
+
+typedef struct DigestJob
+{
+    // Owned until the block has been passed on
+    Block_t* block;
+    uint8_t sha256[SHA256_DIGEST_SIZE];
+    uint64_t xxh64;
+    int done;
+
+    struct DigestJob* next_work;
+    struct DigestJob* next;
+} DigestJob_t;
+
+struct DigestWriter
+{
+    FILE* file;
+    char output_path[DIGEST_MAX_PATH];
+    uint64_t start_address;
+    uint64_t end_address;
+    BlockPool_t* pool;
+    DigestSink_t sink;
+    void* sink_ctx;
+
+    Thread_t* threads;
+    uint32_t thread_count;
+    Mutex_t mutex;
+    Cond_t work_ready;
+    Cond_t job_done;
+
+    // Jobs waiting for a worker, and all jobs in submission order
+    DigestJob_t* work_head;
+    DigestJob_t* work_tail;
+    DigestJob_t* order_head;
+    DigestJob_t* order_tail;
+    uint32_t jobs;
+    int draining;
+    int closing;
+    int failed;
+
+    // Only touched by the draining thread. The range digests keep going as
+    // long as blocks arrive back to back from the start of the range.
+    Sha256_t range_sha256;
+    Xxh64_t range_xxh64;
+    uint64_t range_address;
+
+    DigestStats_t stats;
+};
+
+static int32_t digest_pass_on(DigestWriter_t* writer, DigestJob_t* job)
+{
+    Block_t* block = job->block;
+    char hex[DIGEST_HEX_SIZE];
+
+    if (block->address == writer->range_address) {
+        const uint64_t start_ns = clock_now_ns();
+        sha256_update(&writer->range_sha256, block->data, block->size);
+        xxh64_update(&writer->range_xxh64, block->data, block->size);
+        writer->range_address += block->size;
+        writer->stats.range_ns += clock_now_ns() - start_ns;
+    } else {
+        // Resumed, the total has to come from the finished dump
+        writer->range_address = UINT64_MAX;
+    }
+
+    digest_hex(job->sha256, hex);
+    if (fprintf(writer->file,
+                "block 0x%llX 0x%X %s %016llx\n",
+                (unsigned long long)block->address,
+                block->size,
+                hex,
+                (unsigned long long)job->xxh64) < 0) {
+        block_pool_release(writer->pool, block);
+        return -1;
+    }
+
+    return writer->sink(writer->sink_ctx, block);
+}
+
+// Passes on every hashed block at the head of the order list. Called with the
+// mutex held, only one thread drains at a time.
+static void digest_drain(DigestWriter_t* writer)
+{
+    while (!writer->draining && writer->order_head && writer->order_head->done) {
+        DigestJob_t* ready = writer->order_head;
+        DigestJob_t* last = ready;
+        while (last->next && last->next->done)
+            last = last->next;
+
+        writer->order_head = last->next;
+        if (!writer->order_head)
+            writer->order_tail = NULL;
+        last->next = NULL;
+
+        writer->draining = 1;
+        int failed = writer->failed;
+        mutex_unlock(&writer->mutex);
+
+        uint32_t count = 0;
+        while (ready) {
+            DigestJob_t* job = ready;
+            ready = job->next;
+
+            if (failed)
+                block_pool_release(writer->pool, job->block);
+            else if (digest_pass_on(writer, job) < 0)
+                failed = 1;
+
+            free(job);
+            count++;
+        }
+
+        mutex_lock(&writer->mutex);
+        writer->draining = 0;
+        writer->failed |= failed;
+        writer->jobs -= count;
+        cond_broadcast(&writer->job_done);
+    }
+}
+
+static void digest_worker(void* arg)
+{
+    DigestWriter_t* writer = arg;
+    // Zero blocks are common and all of the same size
+    uint32_t zero_size = 0;
+    uint8_t zero_sha256[SHA256_DIGEST_SIZE];
+    uint64_t zero_xxh64 = 0;
+
+    mutex_lock(&writer->mutex);
+
+    for (;;) {
+        while (!writer->work_head && !writer->closing)
+            cond_wait(&writer->work_ready, &writer->mutex);
+
+        DigestJob_t* job = writer->work_head;
+        if (!job)
+            break;
+
+        writer->work_head = job->next_work;
+        if (!writer->work_head)
+            writer->work_tail = NULL;
+
+        mutex_unlock(&writer->mutex);
+
+        const uint64_t start_ns = clock_now_ns();
+        const Block_t* block = job->block;
+        if (block->size == zero_size && zero_check(block->data, block->size)) {
+            memcpy(job->sha256, zero_sha256, sizeof(zero_sha256));
+            job->xxh64 = zero_xxh64;
+        } else {
+            sha256(job->sha256, block->data, block->size);
+            job->xxh64 = xxh64(block->data, block->size, 0);
+
+            if (zero_check(block->data, block->size)) {
+                zero_size = block->size;
+                memcpy(zero_sha256, job->sha256, sizeof(zero_sha256));
+                zero_xxh64 = job->xxh64;
+            }
+        }
+        const uint64_t block_ns = clock_now_ns() - start_ns;
+
+        mutex_lock(&writer->mutex);
+        writer->stats.block_ns += block_ns;
+        job->done = 1;
+
+        digest_drain(writer);
+    }
+
+    mutex_unlock(&writer->mutex);
+}
+
+DigestWriter_t* digest_writer_open(const char* output_path,
+                                   uint64_t start_address,
+                                   uint64_t end_address,
+                                   uint32_t threads,
+                                   int truncate,
+                                   BlockPool_t* pool,
+                                   DigestSink_t sink,
+                                   void* sink_ctx)
+{
+    char path[DIGEST_MAX_PATH];
+    snprintf(path, sizeof(path), "%s%s", output_path, DIGEST_SUFFIX);
+
+    DigestWriter_t* writer = calloc(1, sizeof(DigestWriter_t));
+    if (!writer) {
+        printf("Failed to allocate digest writer\n");
+        return NULL;
+    }
+
+    writer->file = truncate ? NULL : fopen(path, "ab");
+    if (!writer->file) {
+        writer->file = fopen(path, "wb");
+        if (writer->file)
+            fprintf(writer->file,
+                    "range 0x%llX 0x%llX\n",
+                    (unsigned long long)start_address,
+                    (unsigned long long)end_address);
+    }
+    if (!writer->file) {
+        printf("Failed to open %s\n", path);
+        free(writer);
+        return NULL;
+    }
+
+    snprintf(writer->output_path, sizeof(writer->output_path), "%s", output_path);
+    writer->start_address = start_address;
+    writer->end_address = end_address;
+    writer->pool = pool;
+    writer->sink = sink;
+    writer->sink_ctx = sink_ctx;
+    writer->range_address = start_address;
+    sha256_init(&writer->range_sha256);
+    xxh64_init(&writer->range_xxh64, 0);
+    writer->thread_count = min(max(threads, 1u), (uint32_t)DIGEST_MAX_THREADS);
+    writer->stats.threads = writer->thread_count;
+
+    mutex_init(&writer->mutex);
+    cond_init(&writer->work_ready);
+    cond_init(&writer->job_done);
+
+    writer->threads = calloc(writer->thread_count, sizeof(Thread_t));
+    for (uint32_t i = 0; writer->threads && i < writer->thread_count; i++) {
+        if (thread_create(&writer->threads[i], digest_worker, writer) < 0) {
+            printf("Failed to start hashing thread\n");
+            writer->thread_count = i;
+            break;
+        }
+    }
+
+    if (!writer->threads || !writer->thread_count) {
+        digest_writer_drain(writer);
+        digest_writer_close(writer, 0, NULL);
+        return NULL;
+    }
+
+    return writer;
+}
+
+int32_t digest_writer_submit(DigestWriter_t* writer, Block_t* block)
+{
+    DigestJob_t* job = calloc(1, sizeof(DigestJob_t));
+
+    mutex_lock(&writer->mutex);
+
+    if (!job || writer->failed) {
+        mutex_unlock(&writer->mutex);
+        block_pool_release(writer->pool, block);
+        free(job);
+        return -1;
+    }
+
+    job->block = block;
+
+    if (writer->work_tail)
+        writer->work_tail->next_work = job;
+    else
+        writer->work_head = job;
+    writer->work_tail = job;
+
+    if (writer->order_tail)
+        writer->order_tail->next = job;
+    else
+        writer->order_head = job;
+    writer->order_tail = job;
+
+    writer->jobs++;
+    writer->stats.blocks++;
+    writer->stats.bytes += block->size;
+
+    cond_signal(&writer->work_ready);
+    mutex_unlock(&writer->mutex);
+
+    return 0;
+}
+
+int32_t digest_writer_drain(DigestWriter_t* writer)
+{
+    mutex_lock(&writer->mutex);
+    writer->closing = 1;
+    cond_broadcast(&writer->work_ready);
+    mutex_unlock(&writer->mutex);
+
+    for (uint32_t i = 0; i < writer->thread_count; i++)
+        thread_join(&writer->threads[i]);
+    writer->thread_count = 0;
+
+    return writer->failed ? -1 : 0;
+}
+
+int32_t digest_writer_close(DigestWriter_t* writer, int complete, DigestStats_t* stats)
+{
+    int32_t result = writer->failed ? -1 : 0;
+
+    if (result == 0 && complete) {
+        if (writer->range_address == writer->end_address) {
+            sha256_final(&writer->range_sha256, writer->stats.sha256);
+            writer->stats.xxh64 = xxh64_final(&writer->range_xxh64);
+        } else {
+            DumpSource_t source;
+            DumpReader_t reader;
+            const uint64_t start_ns = clock_now_ns();
+
+            writer->stats.reread = 1;
+            result = dump_source_open(&source, writer->output_path, writer->start_address);
+            if (result == 0) {
+                result = dump_reader_open(&reader, &source);
+                if (result == 0) {
+                    result = digest_read_range(&reader,
+                                               writer->start_address,
+                                               writer->end_address,
+                                               writer->stats.sha256,
+                                               &writer->stats.xxh64);
+                    dump_reader_close(&reader);
+                }
+                dump_source_close(&source);
+            }
+            writer->stats.range_ns += clock_now_ns() - start_ns;
+        }
+
+        char hex[DIGEST_HEX_SIZE];
+        digest_hex(writer->stats.sha256, hex);
+        if (result == 0 && fprintf(writer->file,
+                                   "total %s %016llx\n",
+                                   hex,
+                                   (unsigned long long)writer->stats.xxh64) < 0)
+            result = -1;
+    }
+
+    if (fclose(writer->file) != 0)
+        result = -1;
+
+    if (stats)
+        *stats = writer->stats;
+
+    mutex_destroy(&writer->mutex);
+    cond_destroy(&writer->work_ready);
+    cond_destroy(&writer->job_done);
+    free(writer->threads);
+    free(writer);
+
+    return result;
+}
+
+void digest_print_stats(const char* output_path, const DigestStats_t* stats)
+{
+    char hex[DIGEST_HEX_SIZE];
+    digest_hex(stats->sha256, hex);
+
+    printf("%s : sha256 %s, xxh64 %016llx, %llu blocks hashed on %u threads (%s) in %.1f ms "
+           "of CPU time, whole range%s took %.1f ms\n",
+           output_path,
+           hex,
+           (unsigned long long)stats->xxh64,
+           (unsigned long long)stats->blocks,
+           stats->threads,
+           sha256_impl(),
+           (double)stats->block_ns / 1e6,
+           stats->reread ? " (read back)" : "",
+           (double)stats->range_ns / 1e6);
+}
+
+// Verification
+
+typedef struct DigestEntry
+{
+    uint64_t address;
+    uint32_t size;
+    uint8_t sha256[SHA256_DIGEST_SIZE];
+    uint64_t xxh64;
+    // Position in the manifest, later lines win
+    uint32_t line;
+} DigestEntry_t;
+
+typedef struct DigestManifest
+{
+    uint64_t start_address;
+    uint64_t end_address;
+    DigestEntry_t* entries;
+    uint32_t count;
+    int has_total;
+    uint8_t total_sha256[SHA256_DIGEST_SIZE];
+    uint64_t total_xxh64;
+} DigestManifest_t;
+
+static int digest_entry_compare(const void* a, const void* b)
+{
+    const DigestEntry_t* left = a;
+    const DigestEntry_t* right = b;
+
+    if (left->address != right->address)
+        return left->address < right->address ? -1 : 1;
+
+    return left->line < right->line ? -1 : (left->line > right->line);
+}
+
+static int32_t digest_manifest_load(DigestManifest_t* manifest, const char* path)
+{
+    char line[DIGEST_MAX_LINE];
+    char hex[DIGEST_HEX_SIZE];
+    unsigned long long address, size, xxh;
+    uint32_t capacity = 0;
+    uint32_t line_number = 1;
+
+    FILE* file = fopen(path, "rb");
+    if (!file) {
+        printf("Failed to open %s\n", path);
+        return -1;
+    }
+
+    if (!fgets(line, sizeof(line), file) ||
+        sscanf(line, "range %llx %llx", &address, &size) != 2 || address > size) {
+        printf("%s is not an integrity manifest\n", path);
+        fclose(file);
+        return -1;
+    }
+    manifest->start_address = address;
+    manifest->end_address = size;
+
+    // A line cut short by a crash is simply ignored
+    while (fgets(line, sizeof(line), file)) {
+        DigestEntry_t entry = { 0 };
+        entry.line = ++line_number;
+
+        if (!strchr(line, '\n'))
+            continue;
+
+        if (sscanf(line, "block %llx %llx %64s %llx", &address, &size, hex, &xxh) == 4 &&
+            digest_parse_hex(hex, entry.sha256) == 0) {
+            entry.address = address;
+            entry.size = (uint32_t)size;
+            entry.xxh64 = xxh;
+
+            if (manifest->count == capacity) {
+                capacity = capacity ? capacity * 2 : 0x100;
+                DigestEntry_t* entries =
+                    realloc(manifest->entries, capacity * sizeof(DigestEntry_t));
+                if (!entries) {
+                    printf("Failed to allocate manifest entries\n");
+                    fclose(file);
+                    return -1;
+                }
+                manifest->entries = entries;
+            }
+            manifest->entries[manifest->count++] = entry;
+        } else if (sscanf(line, "total %64s %llx", hex, &xxh) == 2 &&
+                   digest_parse_hex(hex, manifest->total_sha256) == 0) {
+            manifest->has_total = 1;
+            manifest->total_xxh64 = xxh;
+        }
+    }
+
+    fclose(file);
+
+    if (!manifest->count)
+        return 0;
+
+    // Keep only the last line for every address
+    qsort(manifest->entries, manifest->count, sizeof(DigestEntry_t), digest_entry_compare);
+
+    uint32_t kept = 0;
+    for (uint32_t i = 0; i < manifest->count; i++) {
+        if (kept && manifest->entries[kept - 1].address == manifest->entries[i].address)
+            kept--;
+        manifest->entries[kept++] = manifest->entries[i];
+    }
+    manifest->count = kept;
+
+    return 0;
+}
+
+typedef struct DigestVerify
+{
+    const DigestManifest_t* manifest;
+    const DumpSource_t* source;
+    Mutex_t mutex;
+    uint32_t next_entry;
+    uint32_t bad_blocks;
+    int total_failed;
+} DigestVerify_t;
+
+static void digest_verify_blocks(void* arg)
+{
+    DigestVerify_t* verify = arg;
+    const DigestManifest_t* manifest = verify->manifest;
+    DumpReader_t reader;
+    uint8_t sha[SHA256_DIGEST_SIZE];
+    uint32_t max_size = 0;
+    uint32_t bad_blocks = 0;
+
+    for (uint32_t i = 0; i < manifest->count; i++)
+        max_size = max(max_size, manifest->entries[i].size);
+
+    uint8_t* buf = malloc(max(max_size, 1u));
+    if (!buf || dump_reader_open(&reader, verify->source) < 0) {
+        free(buf);
+        mutex_lock(&verify->mutex);
+        verify->bad_blocks = UINT32_MAX;
+        mutex_unlock(&verify->mutex);
+        return;
+    }
+
+    for (;;) {
+        mutex_lock(&verify->mutex);
+        const uint32_t index = verify->next_entry++;
+        mutex_unlock(&verify->mutex);
+
+        if (index >= manifest->count)
+            break;
+
+        const DigestEntry_t* entry = &manifest->entries[index];
+        const uint8_t* data = dump_reader_read(&reader, entry->address, entry->size, buf);
+        if (!data) {
+            printf("Block at 0x%llX is missing from %s\n",
+                   (unsigned long long)entry->address,
+                   verify->source->path);
+            bad_blocks++;
+            continue;
+        }
+
+        sha256(sha, data, entry->size);
+        if (memcmp(sha, entry->sha256, sizeof(sha)) != 0 ||
+            xxh64(data, entry->size, 0) != entry->xxh64) {
+            printf("Block at 0x%llX (0x%X bytes) does not match\n",
+                   (unsigned long long)entry->address,
+                   entry->size);
+            bad_blocks++;
+        }
+    }
+
+    dump_reader_close(&reader);
+    free(buf);
+
+    mutex_lock(&verify->mutex);
+    if (verify->bad_blocks != UINT32_MAX)
+        verify->bad_blocks += bad_blocks;
+    mutex_unlock(&verify->mutex);
+}
+
+// The total has to be hashed in order, next to the block workers
+static void digest_verify_total(void* arg)
+{
+    DigestVerify_t* verify = arg;
+    const DigestManifest_t* manifest = verify->manifest;
+    DumpReader_t reader;
+    uint8_t sha[SHA256_DIGEST_SIZE];
+    uint64_t xxh;
+
+    int failed = dump_reader_open(&reader, verify->source) < 0;
+    if (!failed) {
+        failed = digest_read_range(
+                     &reader, manifest->start_address, manifest->end_address, sha, &xxh) < 0 ||
+                 memcmp(sha, manifest->total_sha256, sizeof(sha)) != 0 ||
+                 xxh != manifest->total_xxh64;
+        dump_reader_close(&reader);
+    }
+
+    verify->total_failed = failed;
+}
+
+int32_t digest_verify(const char* dump_path, const char* hashes_path, uint32_t threads)
+{
+    char default_path[DIGEST_MAX_PATH];
+    DigestManifest_t manifest = { 0 };
+    DigestVerify_t verify = { 0 };
+    DumpSource_t source;
+    Thread_t workers[DIGEST_MAX_THREADS];
+    Thread_t total_thread;
+
+    if (!hashes_path) {
+        snprintf(default_path, sizeof(default_path), "%s%s", dump_path, DIGEST_SUFFIX);
+        hashes_path = default_path;
+    }
+
+    if (digest_manifest_load(&manifest, hashes_path) < 0) {
+        free(manifest.entries);
+        return -1;
+    }
+
+    if (dump_source_open(&source, dump_path, manifest.start_address) < 0) {
+        free(manifest.entries);
+        return -1;
+    }
+
+    const uint64_t start_ns = clock_now_ns();
+    verify.manifest = &manifest;
+    verify.source = &source;
+    mutex_init(&verify.mutex);
+
+    const int total_started =
+        manifest.has_total && thread_create(&total_thread, digest_verify_total, &verify) == 0;
+    if (manifest.has_total && !total_started)
+        verify.total_failed = 1;
+
+    uint32_t started = 0;
+    threads = min(max(threads, 1u), (uint32_t)DIGEST_MAX_THREADS);
+    while (started < threads &&
+           thread_create(&workers[started], digest_verify_blocks, &verify) == 0)
+        started++;
+    // Whatever is left is verified right here
+    if (started < threads)
+        digest_verify_blocks(&verify);
+
+    for (uint32_t i = 0; i < started; i++)
+        thread_join(&workers[i]);
+    if (total_started)
+        thread_join(&total_thread);
+
+    uint64_t covered = 0;
+    for (uint32_t i = 0; i < manifest.count; i++)
+        covered += manifest.entries[i].size;
+
+    int32_t result = 0;
+    if (verify.bad_blocks == UINT32_MAX) {
+        printf("Failed to read %s\n", dump_path);
+        result = -1;
+    } else {
+        printf("%s : %u of %u blocks match (0x%llX of 0x%llX bytes), total %s, %.1f ms on %u "
+               "threads\n",
+               dump_path,
+               manifest.count - verify.bad_blocks,
+               manifest.count,
+               (unsigned long long)covered,
+               (unsigned long long)(manifest.end_address - manifest.start_address),
+               !manifest.has_total    ? "missing"
+               : verify.total_failed ? "does not match"
+                                     : "matches",
+               (double)(clock_now_ns() - start_ns) / 1e6,
+               threads);
+
+        if (verify.bad_blocks || verify.total_failed ||
+            (!manifest.has_total && !manifest.count))
+            result = -1;
+    }
+
+    mutex_destroy(&verify.mutex);
+    dump_source_close(&source);
+    free(manifest.entries);
+
+    return result;
+}
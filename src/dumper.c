@@ -1,8 +1,23 @@
 #define _CRT_SECURE_NO_WARNINGS
 
+#include "async.h"
+#include "clock.h"
+#include "container.h"
+#include "digest.h"
+#include "devices.h"
 #include "dumper.h"
+#include "emulator.h"
 #include "hexdump.h"
-
+#include "journal.h"
+#include "plan.h"
+#include "reader.h"
+#include "sink.h"
+#include "store.h"
+#include "transport.h"
+#include "tune.h"
+#include "view.h"
+
+#include <errno.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -10,18 +25,53 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 
-int32_t fill_probetable(ProbeTable_t* probetable);
+int32_t fill_probetable(State_t* state, ProbeTable_t* probetable);
 
 int create_directory(const char* name)
 {
 #ifdef __linux__
-    return mkdir(name, 777);
+    return mkdir(name, 0777);
 #else
     return _mkdir(name);
 #endif
 }
 
-int init_device(State_t* state)
+int init_probetable(State_t* state)
+{
+    // Receive probe table
+    state->probe_table = malloc(sizeof(ProbeTable_t));
+    state->probe_table->count = 0;
+
+    return fill_probetable(state, state->probe_table);
+}
+
+int is_supported_device(uint16_t vendor_id, uint16_t product_id)
+{
+    for (uint32_t i = 0; i < sizeof(c_supported_devs) / sizeof(c_supported_devs[0]); i++) {
+        if (vendor_id == c_supported_devs[i].vendor_id &&
+            product_id == c_supported_devs[i].product_id)
+            return 1;
+    }
+
+    return 0;
+}
+
+int32_t device_port_path(libusb_device* device, char* path, size_t size)
+{
+    uint8_t ports[MAX_PORT_DEPTH];
+
+    const int depth = libusb_get_port_numbers(device, ports, MAX_PORT_DEPTH);
+    if (depth < 0)
+        return -1;
+
+    int length = snprintf(path, size, "%u", libusb_get_bus_number(device));
+    for (int i = 0; i < depth && length > 0 && (size_t)length < size; i++)
+        length += snprintf(path + length, size - length, "%c%u", i ? '.' : '-', ports[i]);
+
+    return (length > 0 && (size_t)length < size) ? 0 : -1;
+}
+
+int init_device(State_t* state, const char* port_path)
 {
     libusb_device** devices;
     struct libusb_device_descriptor desc;
@@ -41,29 +91,33 @@ int init_device(State_t* state)
 
     for (uint32_t i = 0; i < total_devices; i++) {
         struct libusb_device_descriptor device_desc;
+        char path[MAX_DEVICE_ID];
+
         if (libusb_get_device_descriptor(devices[i], &device_desc) != LIBUSB_SUCCESS) {
             printf("Failed to retrieve device descriptor for device %d\n", i);
             continue;
         }
 
-        for (uint32_t j = 0; j < sizeof(c_supported_devs); j++) {
-            if (device_desc.idVendor != c_supported_devs[j].vendor_id)
-                continue;
-            if (device_desc.idProduct != c_supported_devs[j].product_id)
-                continue;
+        if (!is_supported_device(device_desc.idVendor, device_desc.idProduct))
+            continue;
 
-            state->device = devices[i];
-            libusb_ref_device(state->device);
-            break;
-        }
-        if (state->device)
-            break;
+        // Without a port path the first supported device is used
+        if (port_path &&
+            (device_port_path(devices[i], path, sizeof(path)) < 0 || strcmp(path, port_path)))
+            continue;
+
+        state->device = devices[i];
+        libusb_ref_device(state->device);
+        break;
     }
 
     libusb_free_device_list(devices, (int)total_devices);
 
     if (!state->device) {
-        printf("Device detection failed\n");
+        if (port_path)
+            printf("Device detection failed for %s\n", port_path);
+        else
+            printf("Device detection failed\n");
         return -1;
     }
 
@@ -80,6 +134,8 @@ int init_device(State_t* state)
     }
 
     printf("Found device %04x:%04x\n", desc.idVendor, desc.idProduct);
+    state->vendor_id = desc.idVendor;
+    state->product_id = desc.idProduct;
 
     result = libusb_get_config_descriptor(state->device, 0, &config);
     if (result != LIBUSB_SUCCESS || !config) {
@@ -148,15 +204,42 @@ int init_device(State_t* state)
         return -1;
     }
 
-    // Receive probe table
-    state->probe_table = malloc(sizeof(ProbeTable_t));
-    state->probe_table->count = 0;
+    state->transport = transport_usb_create(
+        state->ctx, state->handle, state->in_endpoint, state->out_endpoint);
+    if (!state->transport) {
+        printf("Failed to create USB transport\n");
+        return -1;
+    }
 
-    return fill_probetable(g_usb_state_ptr->probe_table);
+    return init_probetable(state);
+}
+
+int init_emulator(State_t* state, const char* spec)
+{
+    EmuConfig_t config;
+    emu_default_config(&config);
+
+    if (emu_parse_config(spec, &config) < 0)
+        return -1;
+
+    state->transport = transport_emu_create(&config);
+    if (!state->transport) {
+        printf("Failed to start device emulator\n");
+        return -1;
+    }
+
+    printf("Emulating device %04x:%04x\n", config.vendor_id, config.product_id);
+    state->vendor_id = config.vendor_id;
+    state->product_id = config.product_id;
+
+    return init_probetable(state);
 }
 
 void close_state(State_t* state)
 {
+    transport_destroy(state->transport);
+    state->transport = NULL;
+
     if (state->interface_claimed && state->handle) {
         libusb_release_interface(state->handle, state->interface_index);
         state->interface_claimed = 0;
@@ -178,15 +261,15 @@ void close_state(State_t* state)
 int32_t send_packet(State_t* state, uint8_t* packet, uint32_t packet_size)
 {
     int32_t result;
-    int32_t transferred;
+    uint32_t transferred;
 
 #if DEBUG_PRINT == 1
     printf("[send_packet]\n");
     hexdump(packet, packet_size, 0);
 #endif
 
-    result = libusb_bulk_transfer(
-        state->handle, state->out_endpoint, packet, packet_size, &transferred, 1000);
+    result = state->transport->send(
+        state->transport, packet, packet_size, &transferred, TRANSPORT_TIMEOUT_MS);
     if (result != LIBUSB_SUCCESS) {
         printf("Failed to send packet: %s\n", libusb_strerror(result));
         return -1;
@@ -198,10 +281,10 @@ int32_t send_packet(State_t* state, uint8_t* packet, uint32_t packet_size)
 int32_t receive_packet(State_t* state, uint8_t* packet, uint32_t packet_size)
 {
     int32_t result;
-    int32_t transferred;
+    uint32_t transferred;
 
-    result = libusb_bulk_transfer(
-        state->handle, state->in_endpoint, packet, packet_size, &transferred, 1000);
+    result = state->transport->receive(
+        state->transport, packet, packet_size, &transferred, TRANSPORT_TIMEOUT_MS);
     if (result != LIBUSB_SUCCESS) {
         printf("Failed to receive packet: %s\n", libusb_strerror(result));
         return -1;
@@ -212,7 +295,7 @@ int32_t receive_packet(State_t* state, uint8_t* packet, uint32_t packet_size)
     hexdump(packet, packet_size, 0);
 #endif
 
-    return 0;
+    return (int32_t)transferred;
 }
 
 int32_t receive_ack(State_t* state, char* message)
@@ -283,38 +366,42 @@ int32_t fill_probetable_parse(const uint8_t* curr_data_ptr, ProbeTable_t* probet
     return 0;
 }
 
-int32_t fill_probetable(ProbeTable_t* probetable)
+int32_t fill_probetable(State_t* state, ProbeTable_t* probetable)
 {
     uint8_t send_buf[1024] = { 0 };
     // 1. Send preamble packet
     memset(send_buf, 0, sizeof(send_buf));
     memcpy(send_buf, c_preamble, sizeof(c_preamble));
-    if (send_packet(g_usb_state_ptr, send_buf, sizeof(send_buf)) < 0) {
+    if (send_packet(state, send_buf, sizeof(send_buf)) < 0) {
         printf("Failed to send preamble packet (fill_probetable)\n");
         return -1;
     }
 
-    if (receive_ack(g_usb_state_ptr,
+    if (receive_ack(state,
                     "Failed to receive ack for preamble packet (fill_probetable)") < 0) {
         return -1;
     }
 
     memset(send_buf, 0, sizeof(send_buf));
     memcpy(send_buf, c_probe, sizeof(c_probe));
-    if (send_packet(g_usb_state_ptr, send_buf, sizeof(send_buf)) < 0) {
+    if (send_packet(state, send_buf, sizeof(send_buf)) < 0) {
         printf("Failed to send probe packet\n");
         return -1;
     }
 
-    uint8_t recv_buf[BLOCK_SIZE] = { 0 };
-    if (receive_packet(g_usb_state_ptr, recv_buf, sizeof(recv_buf)) < 0) {
+    uint8_t* recv_buf = calloc(1, PROBE_PACKET_SIZE);
+    if (!recv_buf || receive_packet(state, recv_buf, PROBE_PACKET_SIZE) < 0) {
         printf("Failed to receive probetable packet\n");
+        free(recv_buf);
         return -1;
     }
 
-    // hexdump(recv_buf, sizeof(recv_buf), 0);
+    // hexdump(recv_buf, PROBE_PACKET_SIZE, 0);
 
-    return fill_probetable_parse(recv_buf, probetable);
+    const int32_t result = fill_probetable_parse(recv_buf, probetable);
+    free(recv_buf);
+
+    return result;
 }
 
 void print_probetable(const ProbeTable_t* probetable)
@@ -339,227 +426,1228 @@ void print_probetable(const ProbeTable_t* probetable)
     }
 }
 
-int32_t dump_memory_range_to_file(const char* output_path,
-                                  const uint64_t start_address,
-                                  const uint64_t end_address)
+// Records the time since *start_ns and restarts the clock for the next phase
+static void record_phase(State_t* state, Phase_t phase, uint64_t* start_ns)
+{
+    if (!state->phase_latency)
+        return;
+
+    const uint64_t now_ns = clock_now_ns();
+    latency_record(&state->phase_latency[phase], now_ns - *start_ns);
+    *start_ns = now_ns;
+}
+
+// Runs the full command sequence for one block, recv_buf must hold at least
+// high_addr - addr_low + 1 bytes, or exactly the block if it is received in place
+int32_t read_block(State_t* state,
+                   const uint64_t addr_low,
+                   const uint64_t high_addr,
+                   uint8_t* recv_buf,
+                   int in_place)
 {
     uint8_t send_buf[1024] = { 0 };
-    FILE* output_file = fopen(output_path, "wb+");
-
-    for (uint64_t addr_low = start_address; addr_low < end_address; addr_low += BLOCK_SIZE) {
-        // Print progress once in a while
-        if ((addr_low - start_address) % (BLOCK_SIZE * 0x30) == 0)
-            printf("%s : %f%% complete\n",
-                   output_path,
-                   (double)(addr_low - start_address) / (end_address - start_address) * 100);
-
-        // 1. Send preamble packet
-        memset(send_buf, 0, sizeof(send_buf));
-        memcpy(send_buf, c_preamble, sizeof(c_preamble));
-        if (send_packet(g_usb_state_ptr, send_buf, sizeof(send_buf)) < 0) {
-            printf("Failed to send preamble packet\n");
-            return -1;
-        }
 
-        if (receive_ack(g_usb_state_ptr,
-                        "Failed to receive ack for preamble packet (dump_memory)") < 0) {
+    // 1. Send preamble packet
+    uint64_t phase_ns = clock_now_ns();
+    memset(send_buf, 0, sizeof(send_buf));
+    memcpy(send_buf, c_preamble, sizeof(c_preamble));
+    if (send_packet(state, send_buf, sizeof(send_buf)) < 0) {
+        printf("Failed to send preamble packet\n");
+        return -1;
+    }
+
+    if (receive_ack(state, "Failed to receive ack for preamble packet (dump_memory)") < 0) {
+        return -1;
+    }
+
+    record_phase(state, PHASE_PREAMBLE, &phase_ns);
+
+    // 2. Send low address
+    memset(send_buf, 0, sizeof(send_buf));
+    sprintf((char*)send_buf, "%09llX", addr_low);
+    if (send_packet(state, send_buf, sizeof(send_buf)) < 0) {
+        printf("Failed to send low address packet\n");
+        return -1;
+    }
+
+    if (receive_ack(state, "Failed to receive ack for low address packet") < 0) {
+        return -1;
+    }
+
+    record_phase(state, PHASE_LOW_ADDRESS, &phase_ns);
+
+    // 3. Send high address
+    memset(send_buf, 0, sizeof(send_buf));
+    sprintf((char*)send_buf, "%09llX", high_addr);
+    if (send_packet(state, send_buf, sizeof(send_buf)) < 0) {
+        printf("Failed to send high address packet\n");
+        return -1;
+    }
+
+    if (receive_ack(state, "Failed to receive ack for high address packet") < 0) {
+        return -1;
+    }
+
+    record_phase(state, PHASE_HIGH_ADDRESS, &phase_ns);
+
+    // 4. Receive data
+    memset(send_buf, 0, sizeof(send_buf));
+    memcpy(send_buf, c_dataxfer, sizeof(c_dataxfer));
+    if (send_packet(state, send_buf, sizeof(send_buf)) < 0) {
+        printf("Failed to send data xfer packet\n");
+        return -1;
+    }
+
+    const uint64_t recv_size = high_addr - addr_low;
+    // printf("Receiving %llu bytes\n", recv_size);
+    if (!in_place) {
+        if (receive_packet(state, recv_buf, recv_size + 1) != (int32_t)recv_size) {
+            printf("Failed to receive data packet\n");
             return -1;
         }
+        record_phase(state, PHASE_DATA_XFER, &phase_ns);
+        return 0;
+    }
+
+    // The same packets as a single transfer of recv_size + 1 bytes
+    uint8_t landing[LANDING_SIZE + 1];
+    const uint32_t body_size = (uint32_t)recv_size & ~(uint32_t)(LANDING_SIZE - 1);
+    const uint32_t tail_size = (uint32_t)recv_size - body_size;
+
+    if ((body_size && receive_packet(state, recv_buf, body_size) != (int32_t)body_size) ||
+        receive_packet(state, landing, tail_size + 1) != (int32_t)tail_size) {
+        printf("Failed to receive data packet\n");
+        return -1;
+    }
+    memcpy(recv_buf + body_size, landing, tail_size);
+    record_phase(state, PHASE_DATA_XFER, &phase_ns);
+
+    return 0;
+}
+
+int32_t init_block_pool(State_t* state, BlockPool_t* pool, uint32_t count)
+{
+    return block_pool_init(
+        pool, max(count, state->async_depth + 2), state->block_size + BLOCK_SLACK);
+}
 
-        const uint64_t high_addr = (uint64_t)(min(addr_low + BLOCK_SIZE, end_address));
+static int32_t read_range_once(State_t* state,
+                               const uint64_t start_address,
+                               const uint64_t end_address,
+                               BlockPool_t* pool,
+                               BlockCallback_t callback,
+                               void* ctx)
+{
+    if (state->async_depth && state->transport->submit)
+        return async_read_range(state, start_address, end_address, pool, callback, ctx);
+
+    for (uint64_t addr_low = start_address; addr_low < end_address;
+         addr_low += state->block_size) {
+        const uint64_t high_addr = (uint64_t)(min(addr_low + state->block_size, end_address));
         // printf("Dumping block: [0x%llX, 0x%llX)\n", addr_low, high_addr);
 
-        // 2. Send low address
-        memset(send_buf, 0, sizeof(send_buf));
-        sprintf((char*)send_buf, "%09llX", addr_low);
-        if (send_packet(g_usb_state_ptr, send_buf, sizeof(send_buf)) < 0) {
-            printf("Failed to send low address packet\n");
+        Block_t* block = block_pool_acquire(pool);
+        block->address = addr_low;
+        block->size = (uint32_t)(high_addr - addr_low);
+        const int in_place = block_pool_place(pool, block, LANDING_SIZE);
+
+        if (read_block(state, addr_low, high_addr, block->data, in_place) < 0) {
+            block_pool_release(pool, block);
             return -1;
         }
 
-        if (receive_ack(g_usb_state_ptr, "Failed to receive ack for low address packet") < 0) {
+        if (callback(ctx, block) < 0)
             return -1;
-        }
+    }
 
-        // 3. Send high address
-        memset(send_buf, 0, sizeof(send_buf));
-        sprintf((char*)send_buf, "%09llX", high_addr);
-        if (send_packet(g_usb_state_ptr, send_buf, sizeof(send_buf)) < 0) {
-            printf("Failed to send high address packet\n");
+    return 0;
+}
+
+typedef struct RangeProgress
+{
+    State_t* state;
+    BlockPool_t* pool;
+    BlockCallback_t callback;
+    void* ctx;
+    // First address that has not been delivered yet
+    uint64_t next_address;
+    int callback_failed;
+} RangeProgress_t;
+
+static int32_t track_block(void* ctx, Block_t* block)
+{
+    RangeProgress_t* progress = ctx;
+
+    progress->next_address = block->address + block->size;
+    if (progress->state->stats_mutex) {
+        mutex_lock(progress->state->stats_mutex);
+        progress->state->received_bytes += block->size;
+        mutex_unlock(progress->state->stats_mutex);
+    } else {
+        progress->state->received_bytes += block->size;
+    }
+    metrics_received(progress->state->metrics, block->size, progress->pool);
+
+    if (progress->callback(progress->ctx, block) < 0) {
+        progress->callback_failed = 1;
+        return -1;
+    }
+
+    return 0;
+}
+
+int32_t read_range(State_t* state,
+                   const uint64_t start_address,
+                   const uint64_t end_address,
+                   BlockPool_t* pool,
+                   BlockCallback_t callback,
+                   void* ctx)
+{
+    RangeProgress_t progress = { state, pool, callback, ctx, start_address, 0 };
+    uint32_t attempts = 0;
+
+    for (;;) {
+        const uint64_t retry_address = progress.next_address;
+        if (read_range_once(state, retry_address, end_address, pool, track_block, &progress) == 0)
+            return 0;
+
+        // Only the link is retried, not the consumer
+        if (progress.callback_failed)
             return -1;
-        }
 
-        if (receive_ack(g_usb_state_ptr, "Failed to receive ack for high address packet") < 0) {
+        // The budget is per block, progress resets it
+        attempts = (progress.next_address != retry_address) ? 1 : attempts + 1;
+        metrics_break_line(state->metrics);
+        if (attempts > state->retries) {
+            printf("Giving up on block at 0x%llX\n", progress.next_address);
             return -1;
         }
 
-        // 4. Receive data
-        uint8_t recv_buf[BLOCK_SIZE + 0x10] = { 0 };
+        printf("Retrying block at 0x%llX (%u/%u)\n",
+               progress.next_address,
+               attempts,
+               state->retries);
+        metrics_retry(state->metrics);
+
+        // Drop whatever the device still had queued, the next preamble resyncs it
+        clock_sleep_us(RETRY_DELAY_US * attempts);
+        drain_device(state);
+    }
+}
+
+void drain_device(State_t* state)
+{
+    uint8_t drain_buf[0x10000];
+    uint32_t transferred;
+
+    while (state->transport->receive(
+               state->transport, drain_buf, sizeof(drain_buf), &transferred, 100) ==
+           LIBUSB_SUCCESS)
+        ;
+}
+
+typedef struct FileOutput
+{
+    const char* output_path;
+    // Exactly one of them is set
+    Writer_t* writer;
+    ContainerWriter_t* container;
+    // Sees every block first, if searching is enabled
+    SearchWriter_t* search;
+    // Sees every block before it is written, if hashing is enabled
+    DigestWriter_t* digest;
+    uint64_t start_address;
+    uint64_t end_address;
+} FileOutput_t;
+
+int32_t write_block_to_file(void* ctx, Block_t* block)
+{
+    FileOutput_t* output = ctx;
+
+    if (output->container)
+        return container_writer_submit(output->container, block);
+
+    block->offset = block->address - output->start_address;
+    return writer_submit(output->writer, block);
+}
+
+// Blocks are hashed before they are written, the digest writer passes them on to
+// write_block_to_file()
+int32_t hash_block(void* ctx, Block_t* block)
+{
+    FileOutput_t* output = ctx;
+    return digest_writer_submit(output->digest, block);
+}
+
+static int32_t open_digest(State_t* state, FileOutput_t* output, BlockPool_t* pool, int truncate)
+{
+    if (!state->hash)
+        return 0;
+
+    output->digest = digest_writer_open(output->output_path,
+                                        output->start_address,
+                                        output->end_address,
+                                        state->pack_threads,
+                                        truncate,
+                                        pool,
+                                        write_block_to_file,
+                                        output);
+
+    return output->digest ? 0 : -1;
+}
+
+// Blocks are searched first, the search writer passes them on to hash_block()
+// or write_block_to_file()
+static int32_t search_block(void* ctx, Block_t* block)
+{
+    FileOutput_t* output = ctx;
+    return search_writer_submit(output->search, block);
+}
+
+// Where fetched blocks go first
+static BlockCallback_t output_callback(const FileOutput_t* output)
+{
+    if (output->search)
+        return search_block;
+    return output->digest ? hash_block : write_block_to_file;
+}
+
+// Opened after the digest writer, which it feeds
+static int32_t open_search(State_t* state, FileOutput_t* output, BlockPool_t* pool, int truncate)
+{
+    if (!state->search && !state->strings_min)
+        return 0;
+
+    output->search = search_writer_open(output->output_path,
+                                        output->start_address,
+                                        output->end_address,
+                                        state->search,
+                                        state->strings_min,
+                                        state->pack_threads,
+                                        truncate,
+                                        pool,
+                                        output->digest ? hash_block : write_block_to_file,
+                                        output);
+
+    return output->search ? 0 : -1;
+}
+
+static int32_t close_search(FileOutput_t* output)
+{
+    SearchStats_t stats;
+
+    if (!output->search)
+        return 0;
+
+    const int32_t result = search_writer_close(output->search, &stats);
+    output->search = NULL;
+    if (result < 0)
+        printf("Failed to write %s%s\n", output->output_path, SEARCH_SUFFIX);
+    else
+        search_print_stats(output->output_path, &stats);
+
+    return result;
+}
+
+static int32_t close_digest(FileOutput_t* output, int complete)
+{
+    DigestStats_t stats;
+
+    if (!output->digest)
+        return 0;
+
+    const int32_t result = digest_writer_close(output->digest, complete, &stats);
+    output->digest = NULL;
+    if (result < 0)
+        printf("Failed to write %s%s\n", output->output_path, DIGEST_SUFFIX);
+    else if (complete)
+        digest_print_stats(output->output_path, &stats);
 
-        memset(send_buf, 0, sizeof(send_buf));
-        memcpy(send_buf, c_dataxfer, sizeof(c_dataxfer));
-        if (send_packet(g_usb_state_ptr, send_buf, sizeof(send_buf)) < 0) {
-            printf("Failed to send data xfer packet\n");
+    return result;
+}
+
+// Produces the blocks of a region the survey found unused without reading it:
+// zero regions become holes like any other zero block
+static int32_t fill_range(State_t* state,
+                          const uint64_t start_address,
+                          const uint64_t end_address,
+                          const uint8_t value,
+                          BlockPool_t* pool,
+                          BlockCallback_t callback,
+                          void* ctx)
+{
+    metrics_skip(state->metrics, end_address - start_address);
+
+    for (uint64_t address = start_address; address < end_address;
+         address += state->block_size) {
+        Block_t* block = block_pool_acquire(pool);
+        block->address = address;
+        block->size = (uint32_t)min(end_address - address, (uint64_t)state->block_size);
+        memset(block->data, value, block->size);
+
+        if (callback(ctx, block) < 0)
             return -1;
+    }
+
+    return 0;
+}
+
+// Reads only the populated and not surveyed runs of the range from the device
+static int32_t read_surveyed_range(State_t* state,
+                                   const uint64_t start_address,
+                                   const uint64_t end_address,
+                                   BlockPool_t* pool,
+                                   BlockCallback_t callback,
+                                   void* ctx)
+{
+    uint64_t run_end;
+    uint8_t value;
+
+    for (uint64_t address = start_address; address < end_address; address = run_end) {
+        const SurveyKind_t kind = survey_lookup(state->survey, address, &run_end, &value);
+        run_end = min(run_end, end_address);
+
+        int32_t result;
+        if (kind == SURVEY_ZERO || kind == SURVEY_CONSTANT) {
+            result = fill_range(state, address, run_end, value, pool, callback, ctx);
+        } else {
+            result = read_range(state, address, run_end, pool, callback, ctx);
         }
 
-        const uint64_t recv_size = high_addr - addr_low;
-        // printf("Receiving %llu bytes\n", recv_size);
-        if (receive_packet(g_usb_state_ptr, recv_buf, recv_size + 1) < 0) {
-            printf("Failed to receive data packet\n");
+        if (result < 0)
             return -1;
+    }
+
+    return 0;
+}
+
+// Blocks of [start_address, end_address) come from the device, or from an
+// earlier dump of the range if source is set
+static int32_t fetch_range(State_t* state,
+                           const DumpSource_t* source,
+                           const uint64_t start_address,
+                           const uint64_t end_address,
+                           BlockPool_t* pool,
+                           BlockCallback_t callback,
+                           void* ctx)
+{
+    DumpReader_t reader;
+    int32_t result = 0;
+
+    if (!source && state->survey)
+        return read_surveyed_range(state, start_address, end_address, pool, callback, ctx);
+    if (!source)
+        return read_range(state, start_address, end_address, pool, callback, ctx);
+
+    if (dump_reader_open(&reader, source) < 0)
+        return -1;
+
+    for (uint64_t address = start_address; address < end_address && result == 0;
+         address += state->block_size) {
+        const uint32_t size = (uint32_t)min(end_address - address, (uint64_t)state->block_size);
+
+        Block_t* block = block_pool_acquire(pool);
+        block->address = address;
+        block->size = size;
+        block_pool_place(pool, block, 0);
+
+        const uint8_t* data = dump_reader_read(&reader, address, size, block->data);
+        if (!data) {
+            printf("Failed to read 0x%X bytes at 0x%llX from %s\n", size, address, source->path);
+            block_pool_release(pool, block);
+            result = -1;
+            break;
         }
 
-        fwrite(recv_buf, 1, recv_size, output_file);
-        fflush(output_file);
+        if (data != block->data)
+            memcpy(block->data, data, size);
+
+        result = callback(ctx, block);
     }
 
-    fclose(output_file);
+    dump_reader_close(&reader);
 
-    return 0;
+    return result;
 }
 
-int32_t dump_memory(const Options_t* options)
+static int32_t dump_range_to_container(State_t* state,
+                                       const DumpSource_t* source,
+                                       const char* output_path,
+                                       const uint64_t start_address,
+                                       const uint64_t end_address)
 {
-    switch (options->dump_mode) {
-        case DUMP_MODE_ALL:
-            // create directory if it doesn't exist
-            if (create_directory(options->output_path) < 0) {
-                printf("Failed to create directory\n");
-                return -1;
-            }
+    FileOutput_t output = { output_path, NULL, NULL, NULL, NULL, start_address, end_address };
+    BlockPool_t pool;
+    ContainerStats_t stats;
 
-            for (uint32_t i = 0; i < g_usb_state_ptr->probe_table->count; i++) {
-                const uint64_t start_address = g_usb_state_ptr->probe_table->entries[i].start;
-                // +1 to include the end address
-                const uint64_t end_address = g_usb_state_ptr->probe_table->entries[i].end;
+    if (state->resume) {
+        printf("Packed dumps cannot be resumed\n");
+        return -1;
+    }
 
-                if (start_address == 0 && end_address == 0) {
-                    printf("Invalid index\n");
-                    return -1;
-                }
+    // Every compression, hashing and search thread needs a block to work on
+    const uint32_t stages = 1 + !!state->hash + (state->search || state->strings_min);
+    const uint32_t workers = state->pack_threads * stages * 2;
+    if (init_block_pool(state, &pool, max(state->writer_buffers, workers)) < 0)
+        return -1;
 
-                char output_path[0x200] = { 0 };
-                snprintf(output_path,
-                         sizeof(output_path),
-                         "%s/%s-%d.bin",
-                         options->output_path,
-                         g_usb_state_ptr->probe_table->entries[i].name,
-                         i);
-
-                printf("Saving %s [0x%llx, 0x%llx] to %s\n",
-                       g_usb_state_ptr->probe_table->entries[i].name,
-                       start_address,
-                       end_address,
-                       output_path);
-
-                if (dump_memory_range_to_file(output_path, start_address, end_address) < 0)
-                    return -1;
-            }
-        case DUMP_MODE_INDEX:
-            const uint64_t start_address =
-                g_usb_state_ptr->probe_table->entries[options->index].start;
-            const uint64_t end_address = g_usb_state_ptr->probe_table->entries[options->index].end;
+    output.container = container_writer_open(output_path,
+                                             state->pack_codec,
+                                             state->pack_level,
+                                             state->pack_threads,
+                                             start_address,
+                                             end_address,
+                                             state->block_size,
+                                             &pool);
+    if (!output.container || open_digest(state, &output, &pool, 1) < 0 ||
+        open_search(state, &output, &pool, 1) < 0) {
+        if (output.digest) {
+            digest_writer_drain(output.digest);
+            close_digest(&output, 0);
+        }
+        if (output.container)
+            container_writer_close(output.container, NULL);
+        block_pool_destroy(&pool);
+        return -1;
+    }
 
-            if (start_address == 0 && end_address == 0) {
-                printf("Invalid index\n");
-                return -1;
-            }
+    int32_t result = fetch_range(
+        state, source, start_address, end_address, &pool, output_callback(&output), &output);
+    metrics_break_line(state->metrics);
+
+    if (output.search && search_writer_drain(output.search) < 0)
+        result = -1;
+    if (close_search(&output) < 0)
+        result = -1;
+    if (output.digest && digest_writer_drain(output.digest) < 0)
+        result = -1;
+    if (container_writer_close(output.container, &stats) < 0) {
+        printf("Failed to write %s\n", output_path);
+        result = -1;
+    }
+    container_print_stats(output_path, &stats);
 
-            return dump_memory_range_to_file(options->output_path, start_address, end_address);
-        case DUMP_MODE_RANGE:
-            return dump_memory_range_to_file(
-                options->output_path, options->range.start_address, options->range.end_address);
-        default:
-            printf("Invalid dump mode\n");
-            return -1;
+    if (close_digest(&output, result == 0) < 0)
+        result = -1;
+
+    block_pool_destroy(&pool);
+
+    return result;
+}
+
+// Streams the range as frames instead of writing a file. There is nothing to
+// resume from, a broken stream has to be dumped again.
+static int32_t dump_range_to_sink(State_t* state,
+                                  const char* output_path,
+                                  const uint64_t start_address,
+                                  const uint64_t end_address)
+{
+    FileOutput_t output = { output_path, NULL, NULL, NULL, NULL, start_address, end_address };
+    BlockPool_t pool;
+    WriterStats_t stats;
+
+    if (init_block_pool(state, &pool, state->writer_buffers) < 0)
+        return -1;
+
+    WriterBackend_t* backend =
+        sink_backend_open(output_path, start_address, end_address, state->block_size);
+    output.writer =
+        backend ? writer_start(backend, state->sparse ? WRITER_SPARSE : 0, &pool, NULL) : NULL;
+    if (!output.writer) {
+        block_pool_destroy(&pool);
+        return -1;
+    }
+    if (state->phase_latency)
+        writer_record_latency(output.writer, &state->phase_latency[PHASE_WRITE]);
+
+    int32_t result = fetch_range(
+        state, NULL, start_address, end_address, &pool, write_block_to_file, &output);
+    metrics_break_line(state->metrics);
+
+    if (writer_close(output.writer, &stats) < 0) {
+        printf("Failed to send %s\n", output_path);
+        result = -1;
     }
+    writer_print_stats(output_path, &stats);
+
+    block_pool_destroy(&pool);
+
+    return result;
 }
 
-Options_t parse_options(int argc, char* argv[])
+static int32_t dump_range_to_file(State_t* state,
+                                  const DumpSource_t* source,
+                                  const char* output_path,
+                                  const uint64_t start_address,
+                                  const uint64_t end_address)
 {
-    Options_t options = { 0 };
-    const char hex_prefix[] = "0x";
+    FileOutput_t output = { output_path, NULL, NULL, NULL, NULL, start_address, end_address };
+    BlockPool_t pool;
+    WriterStats_t stats;
+    uint32_t gap_count;
+    int32_t result = 0;
+
+    if (state->packed)
+        return dump_range_to_container(state, source, output_path, start_address, end_address);
+    if (!source && sink_is_stream(output_path))
+        return dump_range_to_sink(state, output_path, start_address, end_address);
+
+    Journal_t* journal = journal_open(output_path, start_address, end_address, state->resume);
+    if (!journal)
+        return -1;
+
+    const uint64_t done_bytes = journal_done_bytes(journal);
+    // Entries derived from an earlier dump are not read from the device
+    if (!source)
+        metrics_skip(state->metrics, done_bytes);
+    if (done_bytes == end_address - start_address) {
+        printf("%s is already complete\n", output_path);
+        return journal_close(journal);
+    }
+    if (done_bytes)
+        printf("Resuming %s, 0x%llX of 0x%llX bytes already dumped\n",
+               output_path,
+               done_bytes,
+               end_address - start_address);
+
+    // Collected up front, the writer thread updates the journal as it goes
+    JournalRange_t* gaps = journal_gaps(journal, &gap_count);
+    const uint32_t stages = !!state->hash + (state->search || state->strings_min);
+    const uint32_t buffers = max(state->writer_buffers, state->pack_threads * stages * 2);
+    if (!gaps || init_block_pool(state, &pool, buffers) < 0) {
+        free(gaps);
+        journal_close(journal);
+        return -1;
+    }
 
-    if (!strcmp(argv[1], "dump_all")) {
-        if (argc != 3) {
-            printf("Usage: %s dump_all <output_directory>\n", argv[0]);
-            exit(-1);
+    const uint32_t flags = (done_bytes ? 0 : WRITER_TRUNCATE) | (state->sparse ? WRITER_SPARSE : 0);
+    if (state->store_path) {
+        WriterBackend_t* backend = store_backend_open(
+            state->store_path, output_path, start_address, end_address, !done_bytes);
+        output.writer = backend ? writer_start(backend, flags, &pool, journal) : NULL;
+    } else {
+        output.writer = writer_open(output_path,
+                                    state->writer_backend,
+                                    end_address - start_address,
+                                    flags,
+                                    &pool,
+                                    journal);
+        if (output.writer)
+            block_pool_map(&pool, writer_mapping(output.writer), start_address, end_address);
+    }
+    if (output.writer && state->phase_latency)
+        writer_record_latency(output.writer, &state->phase_latency[PHASE_WRITE]);
+    if (!output.writer || open_digest(state, &output, &pool, !done_bytes) < 0 ||
+        open_search(state, &output, &pool, !done_bytes) < 0) {
+        if (output.digest) {
+            digest_writer_drain(output.digest);
+            close_digest(&output, 0);
         }
+        if (output.writer)
+            writer_close(output.writer, NULL);
+        block_pool_destroy(&pool);
+        free(gaps);
+        journal_close(journal);
+        return -1;
+    }
+
+    for (uint32_t i = 0; i < gap_count && result == 0; i++)
+        result = fetch_range(state,
+                             source,
+                             gaps[i].start,
+                             gaps[i].end,
+                             &pool,
+                             output_callback(&output),
+                             &output);
+    metrics_break_line(state->metrics);
+
+    if (output.search && search_writer_drain(output.search) < 0)
+        result = -1;
+    if (close_search(&output) < 0)
+        result = -1;
+    if (output.digest && digest_writer_drain(output.digest) < 0)
+        result = -1;
+    if (writer_close(output.writer, &stats) < 0) {
+        printf("Failed to write %s\n", output_path);
+        result = -1;
+    }
+    writer_print_stats(output_path, &stats);
+
+    // A manifest already lists its zero ranges
+    if (result == 0 && (journal_complete(journal) < 0 ||
+                        (!state->store_path && journal_write_extents(journal, output_path) < 0)))
+        result = -1;
+    if (journal_close(journal) < 0)
+        result = -1;
+
+    // Resumed dumps are read back for the total once they are complete
+    if (close_digest(&output, result == 0) < 0)
+        result = -1;
+
+    if (result < 0)
+        printf("%s is incomplete, run again with --resume to continue\n", output_path);
+
+    block_pool_destroy(&pool);
+    free(gaps);
+
+    return result;
+}
+
+int32_t dump_memory_range_to_file(State_t* state,
+                                  const char* output_path,
+                                  const uint64_t start_address,
+                                  const uint64_t end_address)
+{
+    return dump_range_to_file(state, NULL, output_path, start_address, end_address);
+}
+
+// Makes output_path a copy of [start_address, end_address) of a complete raw
+// dump without copying any data, if the file system supports reflinks. The
+// journal and extent map are derived from those of the dump.
+static int32_t clone_range_to_file(const DumpSource_t* source,
+                                   const uint64_t source_end,
+                                   const char* output_path,
+                                   const uint64_t start_address,
+                                   const uint64_t end_address)
+{
+    Journal_t* source_journal = journal_open(source->path, source->start_address, source_end, 1);
+    if (!source_journal)
+        return -1;
+
+    if (!source_journal->complete || writer_clone(source->path,
+                                                  start_address - source->start_address,
+                                                  end_address - start_address,
+                                                  output_path) < 0) {
+        journal_close(source_journal);
+        return -1;
+    }
+
+    Journal_t* journal = journal_open(output_path, start_address, end_address, 0);
+    int32_t result = journal ? 0 : -1;
+
+    uint64_t address = start_address;
+    for (uint32_t i = 0; i < source_journal->hole_count && result == 0; i++) {
+        const uint64_t hole_start = max(source_journal->holes[i].start, start_address);
+        const uint64_t hole_end = min(source_journal->holes[i].end, end_address);
+        if (hole_start >= hole_end)
+            continue;
+
+        if (hole_start > address)
+            result = journal_record(journal, address, hole_start, 0);
+        if (result == 0)
+            result = journal_record(journal, hole_start, hole_end, 1);
+        address = hole_end;
+    }
+    if (result == 0 && address < end_address)
+        result = journal_record(journal, address, end_address, 0);
+
+    if (result == 0 &&
+        (journal_complete(journal) < 0 || journal_write_extents(journal, output_path) < 0))
+        result = -1;
+    if (journal && journal_close(journal) < 0)
+        result = -1;
+    journal_close(source_journal);
+
+    return result;
+}
+
+// Produces an output from a dump on disk that covers its range, in the same
+// format as if it had been read from the device
+static int32_t derive_range_to_file(State_t* state,
+                                    const DumpSource_t* source,
+                                    const uint64_t source_end,
+                                    const char* output_path,
+                                    const uint64_t start_address,
+                                    const uint64_t end_address)
+{
+    if (!state->resume && source->kind == DUMP_KIND_RAW && !state->packed && !state->store_path &&
+        !state->hash && !state->search && !state->strings_min &&
+        clone_range_to_file(source, source_end, output_path, start_address, end_address) == 0) {
+        printf("Cloned %s from %s\n", output_path, source->path);
+        return 0;
+    }
+
+    printf("Copying %s from %s\n", output_path, source->path);
+    return dump_range_to_file(state, source, output_path, start_address, end_address);
+}
+
+// Spans that no entry covers completely are read into a raw file first
+static int32_t dump_staging_file(State_t* state,
+                                 const char* output_path,
+                                 const uint64_t start_address,
+                                 const uint64_t end_address)
+{
+    const int packed = state->packed;
+    const char* store_path = state->store_path;
+    const int hash = state->hash;
+    const SearchPatterns_t* search = state->search;
+    const uint32_t strings_min = state->strings_min;
+
+    state->packed = 0;
+    state->store_path = NULL;
+    state->hash = 0;
+    state->search = NULL;
+    state->strings_min = 0;
+
+    const int32_t result =
+        dump_memory_range_to_file(state, output_path, start_address, end_address);
+
+    state->packed = packed;
+    state->store_path = store_path;
+    state->hash = hash;
+    state->search = search;
+    state->strings_min = strings_min;
+
+    return result;
+}
+
+static void remove_staging_file(const char* output_path)
+{
+    char path[0x200];
+
+    remove(output_path);
+    snprintf(path, sizeof(path), "%s%s", output_path, JOURNAL_SUFFIX);
+    remove(path);
+    snprintf(path, sizeof(path), "%s%s", output_path, EXTENTS_SUFFIX);
+    remove(path);
+}
+
+static void entry_output_path(const State_t* state,
+                              const Options_t* options,
+                              const uint32_t index,
+                              char* output_path,
+                              const size_t size)
+{
+    snprintf(output_path,
+             size,
+             "%s/%s-%d%s",
+             options->output_path,
+             state->probe_table->entries[index].name,
+             index,
+             state->store_path ? STORE_MANIFEST_EXTENSION
+             : state->packed  ? CONTAINER_EXTENSION
+                              : ".bin");
+}
+
+typedef struct ImageOutput
+{
+    const char* output_path;
+    Writer_t* writer;
+    const ImageSegment_t* segment;
+} ImageOutput_t;
+
+static int32_t write_block_to_image(void* ctx, Block_t* block)
+{
+    ImageOutput_t* output = ctx;
+
+    block->offset = output->segment->offset + (block->address - output->segment->start);
+    return writer_submit(output->writer, block);
+}
+
+// Streams the spans of the plan into a single ELF core or LiME file. The
+// journal covers everything from the first span to the end of the last one,
+// the space between spans is recorded as done when the image is created.
+static int32_t dump_image(State_t* state, const Options_t* options)
+{
+    ImageOutput_t output = { options->output_path, NULL, NULL };
+    ImageLayout_t layout;
+    Plan_t plan;
+    BlockPool_t pool;
+    WriterStats_t stats;
+    uint32_t gap_count;
+    int32_t result = 0;
+
+    if (plan_build(state->probe_table, &plan) < 0)
+        return -1;
+    plan_print(state->probe_table, &plan);
+    metrics_expect(state->metrics, plan.read_bytes);
+
+    memset(&layout, 0, sizeof(layout));
+    layout.format = options->image_format;
+    layout.machine =
+        (state->probe_table->mode == MODE_64) ? IMAGE_MACHINE_AARCH64 : IMAGE_MACHINE_ARM;
+    for (uint32_t i = 0; i < plan.count; i++) {
+        if (plan.spans[i].end == plan.spans[i].start)
+            continue;
+        layout.segments[layout.count].start = plan.spans[i].start;
+        layout.segments[layout.count].end = plan.spans[i].end;
+        layout.count++;
+    }
+    if (!layout.count) {
+        printf("Nothing to dump\n");
+        return -1;
+    }
+    image_layout(&layout);
 
-        options.dump_mode = DUMP_MODE_ALL;
-        options.output_path = argv[2];
-    } else if (!strcmp(argv[1], "dump_index")) {
-        if (argc != 4) {
-            printf("Usage: %s dump_index <output_file> <index>\n", argv[0]);
-            exit(-1);
+    const uint64_t start_address = layout.segments[0].start;
+    const uint64_t end_address = layout.segments[layout.count - 1].end;
+    Journal_t* journal =
+        journal_open(output.output_path, start_address, end_address, state->resume);
+    if (!journal)
+        return -1;
+
+    const uint64_t done_bytes = journal_done_bytes(journal);
+    if (done_bytes == end_address - start_address) {
+        printf("%s is already complete\n", output.output_path);
+        metrics_skip(state->metrics, plan.read_bytes);
+        return journal_close(journal);
+    }
+
+    if (done_bytes) {
+        printf("Resuming %s\n", output.output_path);
+    } else {
+        if (image_write_headers(&layout, output.output_path) < 0) {
+            journal_close(journal);
+            return -1;
         }
+        for (uint32_t i = 1; i < layout.count; i++) {
+            const uint64_t gap_start = layout.segments[i - 1].end;
+            const uint64_t gap_end = layout.segments[i].start;
 
-        options.dump_mode = DUMP_MODE_INDEX;
-        options.output_path = argv[2];
-        options.index = atoi(argv[3]);
-    } else if (!strcmp(argv[1], "dump_range")) {
-        if (argc != 5) {
-            printf("Usage: %s dump_range <output_file> <start_address> <end_address>\n", argv[0]);
-            exit(-1);
+            if (gap_end > gap_start && journal_record(journal, gap_start, gap_end, 0) < 0)
+                result = -1;
         }
+        if (result < 0 || journal_sync(journal) < 0) {
+            journal_close(journal);
+            return -1;
+        }
+    }
 
-        options.dump_mode = DUMP_MODE_RANGE;
-        options.output_path = argv[2];
+    printf("Writing %u segments, 0x%llx bytes, to %s\n",
+           layout.count,
+           layout.size,
+           output.output_path);
 
-        if (strlen(argv[3]) > 2) {
-            options.range.start_address =
-                strtoull(!strcmp(hex_prefix, argv[3]) ? argv[3] + 2 : argv[3], NULL, 16);
+    JournalRange_t* gaps = journal_gaps(journal, &gap_count);
+    if (!gaps || init_block_pool(state, &pool, state->writer_buffers) < 0) {
+        free(gaps);
+        journal_close(journal);
+        return -1;
+    }
+    // Only segments have gaps left, the rest of them is already in the image
+    uint64_t missing_bytes = 0;
+    for (uint32_t i = 0; i < gap_count; i++)
+        missing_bytes += gaps[i].end - gaps[i].start;
+    metrics_skip(state->metrics, plan.read_bytes - missing_bytes);
+
+    // The headers are already in place, the writer only adds the data
+    output.writer = writer_open(output.output_path,
+                                state->writer_backend,
+                                layout.size,
+                                state->sparse ? WRITER_SPARSE : 0,
+                                &pool,
+                                journal);
+    if (!output.writer) {
+        block_pool_destroy(&pool);
+        free(gaps);
+        journal_close(journal);
+        return -1;
+    }
+    uint8_t* mapping = writer_mapping(output.writer);
+
+    // Gaps never cross the space between segments, but may cross two touching ones
+    for (uint32_t i = 0; i < layout.count && result == 0; i++) {
+        const ImageSegment_t* segment = &layout.segments[i];
+
+        output.segment = segment;
+        if (mapping)
+            block_pool_map(&pool, mapping + segment->offset, segment->start, segment->end);
+
+        for (uint32_t j = 0; j < gap_count && result == 0; j++) {
+            const uint64_t start = max(gaps[j].start, segment->start);
+            const uint64_t end = min(gaps[j].end, segment->end);
+
+            if (start < end)
+                result = fetch_range(
+                    state, NULL, start, end, &pool, write_block_to_image, &output);
         }
-        if (strlen(argv[4]) > 2) {
-            // +1 to include the end address
-            options.range.end_address =
-                strtoull(!strcmp(hex_prefix, argv[4]) ? argv[4] + 2 : argv[4], NULL, 16) + 1;
+    }
+    metrics_break_line(state->metrics);
+
+    if (writer_close(output.writer, &stats) < 0) {
+        printf("Failed to write %s\n", output.output_path);
+        result = -1;
+    }
+    writer_print_stats(output.output_path, &stats);
+
+    if (result == 0 && journal_complete(journal) < 0)
+        result = -1;
+    if (journal_close(journal) < 0)
+        result = -1;
+
+    if (result < 0)
+        printf("%s is incomplete, run again with --resume to continue\n", output.output_path);
+
+    block_pool_destroy(&pool);
+    free(gaps);
+
+    return result;
+}
+
+// Reads every span of the plan once and produces the entries that overlap it
+// from its output
+static int32_t dump_all(State_t* state, const Options_t* options)
+{
+    Plan_t plan;
+
+    if (options->image_format)
+        return dump_image(state, options);
+
+    // create directory if it doesn't exist
+    if (create_directory(options->output_path) < 0 && errno != EEXIST) {
+        printf("Failed to create directory\n");
+        return -1;
+    }
+
+    if (plan_build(state->probe_table, &plan) < 0)
+        return -1;
+    plan_print(state->probe_table, &plan);
+    metrics_expect(state->metrics, plan.read_bytes);
+
+    for (uint32_t i = 0; i < plan.count; i++) {
+        const PlanSpan_t* span = &plan.spans[i];
+        char source_path[0x200] = { 0 };
+        DumpSource_t source;
+        int32_t result = 0;
+
+        if (span->primary >= 0) {
+            entry_output_path(state, options, span->primary, source_path, sizeof(source_path));
+            printf("Saving %s [0x%llx, 0x%llx] to %s\n",
+                   state->probe_table->entries[span->primary].name,
+                   span->start,
+                   span->end,
+                   source_path);
+            result = dump_memory_range_to_file(state, source_path, span->start, span->end);
+        } else {
+            snprintf(source_path,
+                     sizeof(source_path),
+                     "%s/span-%llx-%llx.bin",
+                     options->output_path,
+                     span->start,
+                     span->end);
+            printf("Saving [0x%llx, 0x%llx] to %s\n", span->start, span->end, source_path);
+            result = dump_staging_file(state, source_path, span->start, span->end);
         }
 
-        if (!options.range.end_address || options.range.start_address > options.range.end_address) {
-            printf("Invalid address range: 0x%llX, 0x%llX\n",
-                   options.range.start_address,
-                   options.range.end_address);
-            exit(-1);
+        if (result < 0)
+            return -1;
+        if (span->entry_count == 1 && span->primary >= 0)
+            continue;
+
+        if (dump_source_open(&source, source_path, span->start) < 0)
+            return -1;
+
+        for (uint32_t j = 0; j < span->entry_count && result == 0; j++) {
+            const uint32_t index = span->entries[j];
+            char output_path[0x200] = { 0 };
+
+            if ((int32_t)index == span->primary)
+                continue;
+
+            entry_output_path(state, options, index, output_path, sizeof(output_path));
+            printf("Saving %s [0x%llx, 0x%llx] to %s\n",
+                   state->probe_table->entries[index].name,
+                   state->probe_table->entries[index].start,
+                   state->probe_table->entries[index].end,
+                   output_path);
+            result = derive_range_to_file(state,
+                                          &source,
+                                          span->end,
+                                          output_path,
+                                          state->probe_table->entries[index].start,
+                                          state->probe_table->entries[index].end);
         }
-    } else {
-        printf("Invalid dump mode\n");
-        exit(-1);
+
+        dump_source_close(&source);
+        if (result < 0)
+            return -1;
+
+        if (span->primary < 0)
+            remove_staging_file(source_path);
     }
 
-    return options;
+    return 0;
+}
+
+typedef struct SurveySample
+{
+    BlockPool_t* pool;
+    SurveyKind_t kind;
+    uint8_t value;
+} SurveySample_t;
+
+static int32_t classify_sample(void* ctx, Block_t* block)
+{
+    SurveySample_t* sample = ctx;
+
+    sample->kind = survey_classify(block->data, block->size, &sample->value);
+    block_pool_release(sample->pool, block);
+
+    return 0;
 }
 
-int main(int argc, char* argv[])
+// Reads a few pages of every cell of every span and prints a map of where the
+// data is
+static int32_t survey_memory(State_t* state, const Options_t* options)
 {
-    if (argc < 3) {
-        printf("Usage: %s dump_all <output_directory>\n", argv[0]);
-        printf("Usage: %s dump_index <output_file> <index>\n", argv[0]);
-        printf("Usage: %s dump_range <output_file> <start_address> <end_address>\n", argv[0]);
+    Plan_t plan;
+    Survey_t survey;
+    BlockPool_t pool;
+    int32_t result = 0;
+
+    const uint64_t granularity =
+        options->survey_granularity ? options->survey_granularity : SURVEY_DEFAULT_GRANULARITY;
+    const uint32_t samples =
+        options->survey_samples ? options->survey_samples : SURVEY_DEFAULT_SAMPLES;
+
+    if (plan_build(state->probe_table, &plan) < 0)
         return -1;
+    if (init_block_pool(state, &pool, 2) < 0)
+        return -1;
+    survey_init(&survey, granularity, samples, SURVEY_SAMPLE_SIZE);
+
+    uint64_t sample_bytes = 0;
+    for (uint32_t i = 0; i < plan.count; i++) {
+        const uint64_t cells = (plan.spans[i].end - plan.spans[i].start + granularity - 1) /
+                               granularity;
+        sample_bytes += cells * samples * SURVEY_SAMPLE_SIZE;
     }
+    metrics_expect(state->metrics, sample_bytes);
+
+    for (uint32_t i = 0; i < plan.count && result == 0; i++) {
+        const PlanSpan_t* span = &plan.spans[i];
+
+        for (uint64_t cell = span->start; cell < span->end && result == 0; cell += granularity) {
+            const uint64_t cell_size = min(span->end - cell, granularity);
+            const uint32_t size = (uint32_t)min(cell_size, (uint64_t)SURVEY_SAMPLE_SIZE);
+            SurveyKind_t kind = SURVEY_UNKNOWN;
+            uint8_t value = 0;
+
+            // Samples are spread evenly, one in the middle of the cell by default
+            for (uint32_t j = 0; j < samples; j++) {
+                SurveySample_t sample = { &pool, SURVEY_UNKNOWN, 0 };
+                uint64_t offset = cell_size * (2 * j + 1) / (2 * samples);
+                offset = min(offset & ~(uint64_t)(SURVEY_SAMPLE_SIZE - 1), cell_size - size);
+
+                result = read_range(
+                    state, cell + offset, cell + offset + size, &pool, classify_sample, &sample);
+                if (result < 0)
+                    break;
+
+                // Samples that disagree make the cell populated
+                if (j == 0) {
+                    kind = sample.kind;
+                    value = sample.value;
+                } else if (sample.kind != kind || sample.value != value) {
+                    kind = SURVEY_POPULATED;
+                }
+            }
 
-    Options_t options = parse_options(argc, argv);
-    if (options.dump_mode == DUMP_MODE_RANGE) {
-        printf("Dumping a total of %llu (0x%llx) bytes from 0x%llX to 0x%llX\n",
-               options.range.end_address - options.range.start_address,
-               options.range.end_address - options.range.start_address,
-               options.range.start_address,
-               options.range.end_address);
+            if (result == 0)
+                result = survey_add(&survey, cell, cell + cell_size, kind, value);
+        }
     }
+    metrics_break_line(state->metrics);
 
-    if (init_device(g_usb_state_ptr) < 0)
-        return -1;
+    if (result == 0) {
+        for (uint32_t i = 0; i < plan.count; i++) {
+            const PlanSpan_t* span = &plan.spans[i];
+            const char* name =
+                span->primary >= 0 ? state->probe_table->entries[span->primary].name : "span";
 
-    print_probetable(g_usb_state_ptr->probe_table);
+            survey_print_map(&survey, name, span->start, span->end);
+        }
+        survey_print_summary(&survey);
 
-    if (dump_memory(&options) < 0)
-        return -1;
+        result = survey_write(&survey, options->output_path);
+        if (result == 0)
+            printf("Saved survey to %s\n", options->output_path);
+    }
+
+    survey_free(&survey);
+    block_pool_destroy(&pool);
+
+    return result;
+}
 
-    printf("Dumped memory to %s\n", options.output_file_name);
+int32_t select_block_size(State_t* state, const Options_t* options)
+{
+    const char* cache_path =
+        options->tune_cache_path ? options->tune_cache_path : tune_default_cache_path();
+
+    state->block_size = BLOCK_SIZE;
+
+    if (options->block_size) {
+        state->block_size = options->block_size;
+    } else if (options->tune) {
+        double mbps;
+        if (tune_block_size(state, &state->block_size, &mbps) < 0)
+            return -1;
 
-    close_state(g_usb_state_ptr);
+        printf("Selected block size 0x%X (%.2f MB/s)\n", state->block_size, mbps);
+        tune_cache_store(cache_path, state->vendor_id, state->product_id, state->block_size, mbps);
+    } else if (tune_cache_load(
+                   cache_path, state->vendor_id, state->product_id, &state->block_size) == 0) {
+        printf("Using tuned block size 0x%X for %04x:%04x\n",
+               state->block_size,
+               state->vendor_id,
+               state->product_id);
+    }
 
     return 0;
-}
\ No newline at end of file
+}
+
+void apply_options(State_t* state, const Options_t* options)
+{
+    state->async_depth = options->async_depth;
+    state->writer_backend = options->writer_backend;
+    state->writer_buffers =
+        options->writer_buffers ? options->writer_buffers : POOL_DEFAULT_BLOCKS;
+    state->resume = options->resume;
+    state->sparse = !options->no_sparse;
+    state->packed = options->packed;
+    state->pack_codec = options->pack_codec;
+    state->pack_level =
+        options->pack_level ? options->pack_level : CONTAINER_DEFAULT_ZSTD_LEVEL;
+    state->pack_threads = options->pack_threads
+                              ? options->pack_threads
+                              : min(thread_cpu_count(), (uint32_t)CONTAINER_MAX_THREADS);
+    state->store_path = options->store_path;
+    state->hash = options->hash;
+    state->strings_min = options->strings_min;
+    state->retries = options->retries_set ? options->retries : RETRY_DEFAULT_COUNT;
+}
+
+int32_t dump_memory(State_t* state, const Options_t* options)
+{
+    switch (options->dump_mode) {
+        case DUMP_MODE_ALL:
+            return dump_all(state, options);
+        case DUMP_MODE_INDEX:
+            const uint64_t start_address =
+                state->probe_table->entries[options->index].start;
+            const uint64_t end_address = state->probe_table->entries[options->index].end;
+
+            if (start_address == 0 && end_address == 0) {
+                printf("Invalid index\n");
+                return -1;
+            }
+
+            metrics_expect(state->metrics, end_address - start_address);
+            return dump_memory_range_to_file(
+                state, options->output_path, start_address, end_address);
+        case DUMP_MODE_SURVEY:
+            return survey_memory(state, options);
+        case DUMP_MODE_VIEW:
+            return view_device(state, options);
+        case DUMP_MODE_RANGE:
+            metrics_expect(state->metrics,
+                           options->range.end_address - options->range.start_address);
+            return dump_memory_range_to_file(
+                state,
+                options->output_path, options->range.start_address, options->range.end_address);
+        default:
+            printf("Invalid dump mode\n");
+            return -1;
+    }
+}
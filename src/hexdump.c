@@ -1,48 +1,154 @@
 #include "hexdump.h"
 
-#include <ctype.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
-void hexdump(void* mem, uint32_t len, uint64_t base)
+#define HEXDUMP_ADDRESS_DIGITS 16
+#define HEXDUMP_HEX_OFFSET (HEXDUMP_ADDRESS_DIGITS + 2)
+#define HEXDUMP_ASCII_OFFSET (HEXDUMP_HEX_OFFSET + HEXDUMP_COLS * 3 + 2)
+
+static const char c_hex_digits[] = "0123456789abcdef";
+
+// Two digits per byte and the character shown for it, built on first use
+static uint16_t g_hex_pairs[256];
+static char g_printable[256];
+static int g_tables_ready;
+
+static void hexdump_build_tables(void)
 {
-    unsigned int i, j;
-    char buffer[256] = { 0 };
-    char str[80] = { 0 };
+    for (uint32_t i = 0; i < 256; i++) {
+        const char pair[2] = { c_hex_digits[i >> 4], c_hex_digits[i & 0xF] };
+        memcpy(&g_hex_pairs[i], pair, sizeof(pair));
+        g_printable[i] = (i >= 0x20 && i < 0x7F) ? (char)i : '.';
+    }
+    g_tables_ready = 1;
+}
 
-    printf("[*] Dumping %08x bytes at address %llx:\n", len, (unsigned long long)mem);
+static int32_t hexdump_flush(Hexdump_t* dump)
+{
+    if (dump->used && fwrite(dump->buffer, 1, dump->used, dump->output) != dump->used) {
+        printf("Failed to write the hexdump\n");
+        return -1;
+    }
 
-    for (i = 0; i < len + ((len % HEXDUMP_COLS) ? (HEXDUMP_COLS - len % HEXDUMP_COLS) : 0); i++) {
-        if (i % HEXDUMP_COLS == 0) {
-            sprintf(str, "[*] 0x%08x (+0x%04x): ", (unsigned int)(i + base), i);
-            strcat(buffer, str);
-        }
+    dump->used = 0;
+    return 0;
+}
 
-        if (i < len) {
-            sprintf(str, "%02x ", 0xFF & ((char*)mem)[i]);
-            strcat(buffer, str);
-        } else {
-            sprintf(str, "   ");
-            strcat(buffer, str);
-        }
+int32_t hexdump_init(Hexdump_t* dump, FILE* output, int squeeze)
+{
+    memset(dump, 0, sizeof(Hexdump_t));
+    dump->output = output;
+    dump->squeeze = squeeze;
+
+    dump->buffer = malloc(HEXDUMP_BUFFER_SIZE);
+    if (!dump->buffer) {
+        printf("Failed to allocate the hexdump buffer\n");
+        return -1;
+    }
+
+    if (!g_tables_ready)
+        hexdump_build_tables();
+
+    return 0;
+}
+
+static char* hexdump_address(char* out, uint64_t address)
+{
+    for (int32_t shift = HEXDUMP_ADDRESS_DIGITS * 4 - 8; shift >= 0; shift -= 8) {
+        memcpy(out, &g_hex_pairs[(address >> shift) & 0xFF], 2);
+        out += 2;
+    }
+
+    return out;
+}
+
+// Formats one line of up to HEXDUMP_COLS bytes, returns its length
+static size_t hexdump_line(char* out, const uint8_t* data, uint32_t size, uint64_t address)
+{
+    char* hex = out + HEXDUMP_HEX_OFFSET;
+    char* ascii = out + HEXDUMP_ASCII_OFFSET;
+
+    hexdump_address(out, address);
+    memset(out + HEXDUMP_ADDRESS_DIGITS, ' ', HEXDUMP_ASCII_OFFSET - HEXDUMP_ADDRESS_DIGITS);
 
-        if (i % HEXDUMP_COLS == (HEXDUMP_COLS - 1)) {
-            for (j = i - (HEXDUMP_COLS - 1); j <= i; j++) {
-                if (j >= len) {
-                    sprintf(str, " ");
-                    strcat(buffer, str);
-
-                } else if (isprint(((char*)mem)[j])) {
-                    sprintf(str, "%c", 0xFF & ((char*)mem)[j]);
-                    strcat(buffer, str);
-                } else {
-                    sprintf(str, ".");
-                    strcat(buffer, str);
+    for (uint32_t i = 0; i < size; i++) {
+        // An extra space between the two groups of eight
+        memcpy(hex + i * 3 + (i >= HEXDUMP_COLS / 2), &g_hex_pairs[data[i]], 2);
+        ascii[i + 1] = g_printable[data[i]];
+    }
+    ascii[0] = '|';
+    ascii[size + 1] = '|';
+    ascii[size + 2] = '\n';
+
+    return HEXDUMP_ASCII_OFFSET + size + 3;
+}
+
+int32_t hexdump_write(Hexdump_t* dump, const uint8_t* data, uint64_t size, uint64_t address)
+{
+    for (uint64_t offset = 0; offset < size; offset += HEXDUMP_COLS) {
+        const uint8_t* line = data + offset;
+        const uint32_t line_size =
+            (uint32_t)((size - offset < HEXDUMP_COLS) ? size - offset : HEXDUMP_COLS);
+
+        if (dump->squeeze && line_size == HEXDUMP_COLS) {
+            if (dump->has_previous && !memcmp(line, dump->previous, HEXDUMP_COLS)) {
+                if (!dump->squeezing) {
+                    dump->buffer[dump->used++] = '*';
+                    dump->buffer[dump->used++] = '\n';
+                    dump->squeezing = 1;
                 }
+            } else {
+                memcpy(dump->previous, line, HEXDUMP_COLS);
+                dump->has_previous = 1;
+                dump->squeezing = 0;
             }
-
-            printf("%s\n", buffer);
-            memset(&buffer[0], 0, sizeof(buffer));
+        } else {
+            dump->squeezing = 0;
         }
+
+        if (!dump->squeezing)
+            dump->used +=
+                hexdump_line(dump->buffer + dump->used, line, line_size, address + offset);
+
+        if (dump->used > HEXDUMP_BUFFER_SIZE - HEXDUMP_LINE_SIZE && hexdump_flush(dump) < 0)
+            return -1;
+    }
+    dump->end_address = address + size;
+
+    return 0;
+}
+
+int32_t hexdump_finish(Hexdump_t* dump)
+{
+    // Like hexdump -C, a squeezed tail is closed by the address it ends at
+    if (dump->squeezing) {
+        char* out = hexdump_address(dump->buffer + dump->used, dump->end_address);
+        *out++ = '\n';
+        dump->used = out - dump->buffer;
+    }
+
+    int32_t result = hexdump_flush(dump);
+    if (fflush(dump->output) != 0) {
+        printf("Failed to write the hexdump\n");
+        result = -1;
     }
+
+    free(dump->buffer);
+    dump->buffer = NULL;
+
+    return result;
+}
+
+void hexdump(void* mem, uint32_t len, uint64_t base)
+{
+    Hexdump_t dump;
+
+    printf("[*] Dumping %08x bytes at address %llx:\n", len, (unsigned long long)mem);
+
+    if (hexdump_init(&dump, stdout, 0) < 0)
+        return;
+    hexdump_write(&dump, mem, len, base);
+    hexdump_finish(&dump);
 }
@@ -0,0 +1,188 @@
+#define _CRT_SECURE_NO_WARNINGS
+#define _FILE_OFFSET_BITS 64
+
+#include "image.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#define image_fseek _fseeki64
+#else
+#define image_fseek fseeko
+#endif
+
+#define ELF_HEADER_SIZE 64
+#define ELF_PHDR_SIZE 56
+#define ELF_CLASS64 2
+#define ELF_DATA2LSB 1
+#define ELF_VERSION_CURRENT 1
+#define ELF_TYPE_CORE 4
+#define ELF_PT_LOAD 1
+#define ELF_PF_RWX 7
+
+#define LIME_MAGIC 0x4C694D45
+#define LIME_VERSION 1
+#define LIME_HEADER_SIZE 32
+
+// Little-endian hosts only, like the rest of the dump formats
+#pragma pack(push, 1)
+typedef struct ElfHeader
+{
+    uint8_t ident[16];
+    uint16_t type;
+    uint16_t machine;
+    uint32_t version;
+    uint64_t entry;
+    uint64_t phoff;
+    uint64_t shoff;
+    uint32_t flags;
+    uint16_t ehsize;
+    uint16_t phentsize;
+    uint16_t phnum;
+    uint16_t shentsize;
+    uint16_t shnum;
+    uint16_t shstrndx;
+} ElfHeader_t;
+
+typedef struct ElfProgramHeader
+{
+    uint32_t type;
+    uint32_t flags;
+    uint64_t offset;
+    uint64_t vaddr;
+    uint64_t paddr;
+    uint64_t filesz;
+    uint64_t memsz;
+    uint64_t align;
+} ElfProgramHeader_t;
+
+typedef struct LimeHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint64_t start;
+    // Inclusive
+    uint64_t end;
+    uint8_t reserved[8];
+} LimeHeader_t;
+#pragma pack(pop)
+
+int32_t image_parse_format(const char* name, ImageFormat_t* format)
+{
+    if (!strcmp(name, "elf"))
+        *format = IMAGE_FORMAT_ELF;
+    else if (!strcmp(name, "lime"))
+        *format = IMAGE_FORMAT_LIME;
+    else
+        return -1;
+
+    return 0;
+}
+
+void image_layout(ImageLayout_t* layout)
+{
+    uint64_t offset = 0;
+
+    if (layout->format == IMAGE_FORMAT_ELF)
+        offset = ELF_HEADER_SIZE + (uint64_t)layout->count * ELF_PHDR_SIZE;
+
+    for (uint32_t i = 0; i < layout->count; i++) {
+        ImageSegment_t* segment = &layout->segments[i];
+
+        if (layout->format == IMAGE_FORMAT_ELF) {
+            // Segments start on a page boundary, or as far into one as their address
+            offset = (offset + IMAGE_PAGE_SIZE - 1) & ~(uint64_t)(IMAGE_PAGE_SIZE - 1);
+            offset += segment->start & (IMAGE_PAGE_SIZE - 1);
+        } else {
+            offset += LIME_HEADER_SIZE;
+        }
+
+        segment->offset = offset;
+        offset += segment->end - segment->start;
+    }
+
+    layout->size = offset;
+}
+
+static int32_t image_write_elf(const ImageLayout_t* layout, FILE* file)
+{
+    ElfHeader_t header;
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.ident, "\x7f" "ELF", 4);
+    header.ident[4] = ELF_CLASS64;
+    header.ident[5] = ELF_DATA2LSB;
+    header.ident[6] = ELF_VERSION_CURRENT;
+    header.type = ELF_TYPE_CORE;
+    header.machine = layout->machine;
+    header.version = ELF_VERSION_CURRENT;
+    header.phoff = ELF_HEADER_SIZE;
+    header.ehsize = ELF_HEADER_SIZE;
+    header.phentsize = ELF_PHDR_SIZE;
+    header.phnum = (uint16_t)layout->count;
+
+    if (fwrite(&header, sizeof(header), 1, file) != 1)
+        return -1;
+
+    for (uint32_t i = 0; i < layout->count; i++) {
+        const ImageSegment_t* segment = &layout->segments[i];
+        ElfProgramHeader_t phdr;
+
+        // Physical memory without page tables: virtual and physical addresses match
+        memset(&phdr, 0, sizeof(phdr));
+        phdr.type = ELF_PT_LOAD;
+        phdr.flags = ELF_PF_RWX;
+        phdr.offset = segment->offset;
+        phdr.vaddr = segment->start;
+        phdr.paddr = segment->start;
+        phdr.filesz = segment->end - segment->start;
+        phdr.memsz = segment->end - segment->start;
+        phdr.align = IMAGE_PAGE_SIZE;
+
+        if (fwrite(&phdr, sizeof(phdr), 1, file) != 1)
+            return -1;
+    }
+
+    return 0;
+}
+
+static int32_t image_write_lime(const ImageLayout_t* layout, FILE* file)
+{
+    for (uint32_t i = 0; i < layout->count; i++) {
+        const ImageSegment_t* segment = &layout->segments[i];
+        LimeHeader_t header;
+
+        memset(&header, 0, sizeof(header));
+        header.magic = LIME_MAGIC;
+        header.version = LIME_VERSION;
+        header.start = segment->start;
+        header.end = segment->end - 1;
+
+        if (image_fseek(file, (int64_t)(segment->offset - LIME_HEADER_SIZE), SEEK_SET) != 0 ||
+            fwrite(&header, sizeof(header), 1, file) != 1)
+            return -1;
+    }
+
+    return 0;
+}
+
+int32_t image_write_headers(const ImageLayout_t* layout, const char* path)
+{
+    FILE* file = fopen(path, "wb");
+    if (!file) {
+        printf("Failed to open %s\n", path);
+        return -1;
+    }
+
+    int32_t result = (layout->format == IMAGE_FORMAT_ELF) ? image_write_elf(layout, file)
+                                                          : image_write_lime(layout, file);
+    if (fclose(file) != 0)
+        result = -1;
+
+    if (result < 0)
+        printf("Failed to write the headers of %s\n", path);
+
+    return result;
+}
@@ -0,0 +1,332 @@
+#define _CRT_SECURE_NO_WARNINGS
+
+#include "journal.h"
+#include "dumper.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define JOURNAL_MAX_LINE 0x100
+
+// Adds [start, end) to a sorted list of ranges, merging it with its neighbours
+static int32_t range_add(JournalRange_t** ranges,
+                         uint32_t* count,
+                         uint32_t* capacity,
+                         uint64_t start,
+                         uint64_t end)
+{
+    if (start >= end)
+        return 0;
+
+    // Ranges are usually added in order, so search from the back
+    uint32_t i = *count;
+    while (i > 0 && (*ranges)[i - 1].end >= start)
+        i--;
+
+    if (i < *count && (*ranges)[i].start <= end) {
+        JournalRange_t* range = &(*ranges)[i];
+        range->start = min(range->start, start);
+        range->end = max(range->end, end);
+
+        uint32_t last = i + 1;
+        while (last < *count && (*ranges)[last].start <= range->end) {
+            range->end = max(range->end, (*ranges)[last].end);
+            last++;
+        }
+
+        memmove(&(*ranges)[i + 1],
+                &(*ranges)[last],
+                (*count - last) * sizeof(JournalRange_t));
+        *count -= last - i - 1;
+        return 0;
+    }
+
+    if (*count == *capacity) {
+        const uint32_t new_capacity = *capacity ? *capacity * 2 : 0x10;
+        JournalRange_t* new_ranges = realloc(*ranges, new_capacity * sizeof(JournalRange_t));
+        if (!new_ranges) {
+            printf("Failed to allocate journal ranges\n");
+            return -1;
+        }
+        *ranges = new_ranges;
+        *capacity = new_capacity;
+    }
+
+    memmove(&(*ranges)[i + 1], &(*ranges)[i], (*count - i) * sizeof(JournalRange_t));
+    (*ranges)[i].start = start;
+    (*ranges)[i].end = end;
+    (*count)++;
+
+    return 0;
+}
+
+static int32_t journal_load(Journal_t* journal, FILE* file)
+{
+    char line[JOURNAL_MAX_LINE];
+    unsigned long long start, end;
+
+    if (!fgets(line, sizeof(line), file) ||
+        sscanf(line, "range %llx %llx", &start, &end) != 2) {
+        printf("Journal is corrupted\n");
+        return -1;
+    }
+
+    if (start != journal->start || end != journal->end) {
+        printf("Journal is for range [0x%llX, 0x%llX), not [0x%llX, 0x%llX)\n",
+               start,
+               end,
+               (unsigned long long)journal->start,
+               (unsigned long long)journal->end);
+        return -1;
+    }
+
+    // A line cut short by a crash is simply ignored
+    while (fgets(line, sizeof(line), file)) {
+        if (!strncmp(line, "complete", 8)) {
+            journal->complete = 1;
+        } else if (sscanf(line, "done %llx %llx", &start, &end) == 2 && strchr(line, '\n')) {
+            if (range_add(&journal->ranges,
+                          &journal->count,
+                          &journal->capacity,
+                          max(start, journal->start),
+                          min(end, journal->end)) < 0)
+                return -1;
+        } else if (sscanf(line, "hole %llx %llx", &start, &end) == 2 && strchr(line, '\n')) {
+            if (range_add(&journal->holes,
+                          &journal->hole_count,
+                          &journal->hole_capacity,
+                          max(start, journal->start),
+                          min(end, journal->end)) < 0)
+                return -1;
+        }
+    }
+
+    return 0;
+}
+
+Journal_t* journal_open(const char* output_path, uint64_t start, uint64_t end, int resume)
+{
+    char path[0x200];
+    snprintf(path, sizeof(path), "%s%s", output_path, JOURNAL_SUFFIX);
+
+    Journal_t* journal = calloc(1, sizeof(Journal_t));
+    if (!journal) {
+        printf("Failed to allocate journal\n");
+        return NULL;
+    }
+    journal->start = start;
+    journal->end = end;
+
+    FILE* existing = resume ? fopen(path, "rb") : NULL;
+    if (existing) {
+        const int32_t result = journal_load(journal, existing);
+        fclose(existing);
+        if (result < 0) {
+            journal_close(journal);
+            return NULL;
+        }
+
+        journal->file = fopen(path, "ab");
+    } else {
+        journal->file = fopen(path, "wb");
+        if (journal->file)
+            fprintf(journal->file,
+                    "range 0x%llX 0x%llX\n",
+                    (unsigned long long)start,
+                    (unsigned long long)end);
+    }
+
+    if (!journal->file || fflush(journal->file) != 0) {
+        printf("Failed to open journal %s\n", path);
+        journal_close(journal);
+        return NULL;
+    }
+
+    return journal;
+}
+
+int32_t journal_close(Journal_t* journal)
+{
+    int32_t result = 0;
+
+    if (!journal)
+        return 0;
+
+    if (journal->file && fclose(journal->file) != 0)
+        result = -1;
+
+    free(journal->ranges);
+    free(journal->holes);
+    free(journal->pending);
+    free(journal->pending_holes);
+    free(journal);
+
+    return result;
+}
+
+uint64_t journal_done_bytes(const Journal_t* journal)
+{
+    uint64_t bytes = 0;
+
+    if (journal->complete)
+        return journal->end - journal->start;
+
+    for (uint32_t i = 0; i < journal->count; i++)
+        bytes += journal->ranges[i].end - journal->ranges[i].start;
+
+    return bytes;
+}
+
+JournalRange_t* journal_gaps(const Journal_t* journal, uint32_t* count)
+{
+    JournalRange_t* gaps = calloc(journal->count + 1, sizeof(JournalRange_t));
+    if (!gaps) {
+        printf("Failed to allocate journal ranges\n");
+        return NULL;
+    }
+
+    *count = 0;
+    if (journal->complete)
+        return gaps;
+
+    uint64_t address = journal->start;
+    for (uint32_t i = 0; i <= journal->count; i++) {
+        const uint64_t gap_end = (i < journal->count) ? journal->ranges[i].start : journal->end;
+        if (gap_end > address) {
+            gaps[*count].start = address;
+            gaps[*count].end = gap_end;
+            (*count)++;
+        }
+        if (i < journal->count)
+            address = journal->ranges[i].end;
+    }
+
+    return gaps;
+}
+
+int32_t journal_record(Journal_t* journal, uint64_t start, uint64_t end, int hole)
+{
+    journal->pending_bytes += end - start;
+
+    if (hole && range_add(&journal->pending_holes,
+                          &journal->pending_hole_count,
+                          &journal->pending_hole_capacity,
+                          start,
+                          end) < 0)
+        return -1;
+
+    return range_add(
+        &journal->pending, &journal->pending_count, &journal->pending_capacity, start, end);
+}
+
+int32_t journal_sync(Journal_t* journal)
+{
+    for (uint32_t i = 0; i < journal->pending_count; i++) {
+        const JournalRange_t* range = &journal->pending[i];
+
+        fprintf(journal->file,
+                "done 0x%llX 0x%llX\n",
+                (unsigned long long)range->start,
+                (unsigned long long)range->end);
+
+        const int32_t result = range_add(
+            &journal->ranges, &journal->count, &journal->capacity, range->start, range->end);
+        if (result < 0)
+            return -1;
+    }
+
+    for (uint32_t i = 0; i < journal->pending_hole_count; i++) {
+        const JournalRange_t* range = &journal->pending_holes[i];
+
+        fprintf(journal->file,
+                "hole 0x%llX 0x%llX\n",
+                (unsigned long long)range->start,
+                (unsigned long long)range->end);
+
+        const int32_t result = range_add(&journal->holes,
+                                         &journal->hole_count,
+                                         &journal->hole_capacity,
+                                         range->start,
+                                         range->end);
+        if (result < 0)
+            return -1;
+    }
+
+    journal->pending_count = 0;
+    journal->pending_hole_count = 0;
+    journal->pending_bytes = 0;
+
+    return fflush(journal->file) == 0 ? 0 : -1;
+}
+
+int32_t journal_complete(Journal_t* journal)
+{
+    if (journal_sync(journal) < 0)
+        return -1;
+
+    journal->complete = 1;
+    fprintf(journal->file, "complete\n");
+
+    return fflush(journal->file) == 0 ? 0 : -1;
+}
+
+int32_t journal_write_extents(const Journal_t* journal, const char* output_path)
+{
+    char path[0x200];
+    snprintf(path, sizeof(path), "%s%s", output_path, EXTENTS_SUFFIX);
+
+    FILE* file = fopen(path, "wb");
+    if (!file) {
+        printf("Failed to open extent map %s\n", path);
+        return -1;
+    }
+
+    fprintf(file,
+            "range 0x%llX 0x%llX\n",
+            (unsigned long long)journal->start,
+            (unsigned long long)journal->end);
+
+    // Data extents are the gaps between the holes
+    uint64_t address = journal->start;
+    for (uint32_t i = 0; i <= journal->hole_count; i++) {
+        const uint64_t data_end =
+            (i < journal->hole_count) ? journal->holes[i].start : journal->end;
+        if (data_end > address)
+            fprintf(file,
+                    "data 0x%llX 0x%llX\n",
+                    (unsigned long long)address,
+                    (unsigned long long)data_end);
+        if (i < journal->hole_count)
+            address = journal->holes[i].end;
+    }
+
+    return fclose(file) == 0 ? 0 : -1;
+}
+
+int32_t journal_read_range(const char* output_path, uint64_t* start, uint64_t* end)
+{
+    static const char* const suffixes[] = { JOURNAL_SUFFIX, EXTENTS_SUFFIX };
+    char path[0x200];
+    char line[JOURNAL_MAX_LINE];
+    unsigned long long range_start, range_end;
+
+    for (uint32_t i = 0; i < sizeof(suffixes) / sizeof(suffixes[0]); i++) {
+        snprintf(path, sizeof(path), "%s%s", output_path, suffixes[i]);
+
+        FILE* file = fopen(path, "rb");
+        if (!file)
+            continue;
+
+        const int found = fgets(line, sizeof(line), file) &&
+                          sscanf(line, "range %llx %llx", &range_start, &range_end) == 2;
+        fclose(file);
+        if (found) {
+            *start = range_start;
+            *end = range_end;
+            return 0;
+        }
+    }
+
+    return -1;
+}
@@ -0,0 +1,58 @@
+#include "latency.h"
+
+static uint32_t latency_bucket(uint64_t ns)
+{
+    if (ns < LATENCY_LINEAR_BUCKETS)
+        return (uint32_t)ns;
+
+    uint32_t exponent = 63;
+    while (!(ns >> exponent))
+        exponent--;
+
+    // The three bits after the leading one pick the sub-bucket
+    const uint32_t sub_bucket = (uint32_t)(ns >> (exponent - 3)) & (LATENCY_SUB_BUCKETS - 1);
+    return LATENCY_LINEAR_BUCKETS + (exponent - 4) * LATENCY_SUB_BUCKETS + sub_bucket;
+}
+
+// Middle of the range of durations that fall into a bucket
+static uint64_t latency_bucket_value(uint32_t bucket)
+{
+    if (bucket < LATENCY_LINEAR_BUCKETS)
+        return bucket;
+
+    const uint32_t exponent = (bucket - LATENCY_LINEAR_BUCKETS) / LATENCY_SUB_BUCKETS + 4;
+    const uint64_t sub_bucket = (bucket - LATENCY_LINEAR_BUCKETS) % LATENCY_SUB_BUCKETS;
+    const uint64_t width = 1ull << (exponent - 3);
+
+    return (LATENCY_SUB_BUCKETS + sub_bucket) * width + width / 2;
+}
+
+void latency_record(LatencyHistogram_t* histogram, uint64_t ns)
+{
+    histogram->buckets[latency_bucket(ns)]++;
+    histogram->count++;
+    histogram->sum_ns += ns;
+    if (ns > histogram->max_ns)
+        histogram->max_ns = ns;
+}
+
+uint64_t latency_percentile(const LatencyHistogram_t* histogram, double fraction)
+{
+    if (!histogram->count)
+        return 0;
+
+    uint64_t rank = (uint64_t)(fraction * (double)histogram->count + 0.5);
+    if (rank < 1)
+        rank = 1;
+
+    uint64_t seen = 0;
+    for (uint32_t i = 0; i < LATENCY_BUCKETS; i++) {
+        seen += histogram->buckets[i];
+        if (seen >= rank) {
+            const uint64_t value = latency_bucket_value(i);
+            return (value < histogram->max_ns) ? value : histogram->max_ns;
+        }
+    }
+
+    return histogram->max_ns;
+}
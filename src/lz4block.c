@@ -0,0 +1,205 @@
+#include "lz4block.h"
+
+#include <string.h>
+
+#define LZ4_MIN_MATCH 4
+// The last 5 bytes are always literals and the last match starts at least 12
+// bytes before the end of the block
+#define LZ4_LAST_LITERALS 5
+#define LZ4_MF_LIMIT 12
+#define LZ4_MAX_OFFSET 0xFFFF
+// Searches faster through data that does not compress
+#define LZ4_SKIP_SHIFT 6
+
+static uint32_t lz4_read32(const uint8_t* p)
+{
+    uint32_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+static uint32_t lz4_hash(uint32_t value)
+{
+    return (value * 2654435761u) >> (32 - LZ4_HASH_LOG);
+}
+
+// Writes the remainder of a length that did not fit into the token
+static uint8_t* lz4_write_length(uint8_t* op, const uint8_t* oend, uint32_t length)
+{
+    while (length >= 0xFF) {
+        if (op >= oend)
+            return NULL;
+        *op++ = 0xFF;
+        length -= 0xFF;
+    }
+
+    if (op >= oend)
+        return NULL;
+    *op++ = (uint8_t)length;
+
+    return op;
+}
+
+// Emits literals followed by an optional match, returns NULL if dst is full
+static uint8_t* lz4_write_sequence(uint8_t* op,
+                                   const uint8_t* oend,
+                                   const uint8_t* literals,
+                                   uint32_t literal_length,
+                                   uint32_t offset,
+                                   uint32_t match_length)
+{
+    if (op >= oend)
+        return NULL;
+
+    uint8_t* token = op++;
+    *token = (uint8_t)(((literal_length < 15) ? literal_length : 15) << 4);
+    if (literal_length >= 15 && !(op = lz4_write_length(op, oend, literal_length - 15)))
+        return NULL;
+
+    if ((uint64_t)(oend - op) < literal_length)
+        return NULL;
+    memcpy(op, literals, literal_length);
+    op += literal_length;
+
+    if (!offset)
+        return op;
+
+    if (oend - op < 2)
+        return NULL;
+    *op++ = (uint8_t)offset;
+    *op++ = (uint8_t)(offset >> 8);
+
+    match_length -= LZ4_MIN_MATCH;
+    *token |= (uint8_t)((match_length < 15) ? match_length : 15);
+    if (match_length >= 15 && !(op = lz4_write_length(op, oend, match_length - 15)))
+        return NULL;
+
+    return op;
+}
+
+uint32_t lz4_compress_bound(uint32_t size)
+{
+    return size + size / 255 + 16;
+}
+
+uint32_t lz4_compress(
+    const uint8_t* src, uint32_t size, uint8_t* dst, uint32_t capacity, uint32_t* table)
+{
+    const uint8_t* ip = src;
+    const uint8_t* anchor = src;
+    const uint8_t* const iend = src + size;
+    uint8_t* op = dst;
+    const uint8_t* const oend = dst + capacity;
+
+    memset(table, 0, LZ4_TABLE_SIZE);
+
+    if (size > LZ4_MF_LIMIT) {
+        const uint8_t* const mflimit = iend - LZ4_MF_LIMIT;
+        const uint8_t* const matchlimit = iend - LZ4_LAST_LITERALS;
+
+        while (ip < mflimit) {
+            const uint32_t sequence = lz4_read32(ip);
+            const uint32_t hash = lz4_hash(sequence);
+            const uint8_t* ref = src + table[hash];
+            table[hash] = (uint32_t)(ip - src);
+
+            if (ref >= ip || ip - ref > LZ4_MAX_OFFSET || lz4_read32(ref) != sequence) {
+                ip += 1 + ((ip - anchor) >> LZ4_SKIP_SHIFT);
+                continue;
+            }
+
+            while (ip > anchor && ref > src && ip[-1] == ref[-1]) {
+                ip--;
+                ref--;
+            }
+
+            const uint8_t* match_end = ip + LZ4_MIN_MATCH;
+            const uint8_t* ref_end = ref + LZ4_MIN_MATCH;
+            while (match_end < matchlimit && *match_end == *ref_end) {
+                match_end++;
+                ref_end++;
+            }
+
+            op = lz4_write_sequence(op,
+                                    oend,
+                                    anchor,
+                                    (uint32_t)(ip - anchor),
+                                    (uint32_t)(ip - ref),
+                                    (uint32_t)(match_end - ip));
+            if (!op)
+                return 0;
+
+            ip = anchor = match_end;
+        }
+    }
+
+    op = lz4_write_sequence(op, oend, anchor, (uint32_t)(iend - anchor), 0, 0);
+
+    return op ? (uint32_t)(op - dst) : 0;
+}
+
+static int32_t lz4_read_length(const uint8_t** ip, const uint8_t* iend, uint32_t* length)
+{
+    uint8_t byte;
+
+    do {
+        if (*ip >= iend)
+            return -1;
+        byte = *(*ip)++;
+        *length += byte;
+    } while (byte == 0xFF);
+
+    return 0;
+}
+
+int64_t lz4_decompress(const uint8_t* src, uint32_t size, uint8_t* dst, uint32_t capacity)
+{
+    const uint8_t* ip = src;
+    const uint8_t* const iend = src + size;
+    uint8_t* op = dst;
+    const uint8_t* const oend = dst + capacity;
+
+    while (ip < iend) {
+        const uint8_t token = *ip++;
+
+        uint32_t literal_length = token >> 4;
+        if (literal_length == 15 && lz4_read_length(&ip, iend, &literal_length) < 0)
+            return -1;
+        if ((uint64_t)(iend - ip) < literal_length || (uint64_t)(oend - op) < literal_length)
+            return -1;
+
+        memcpy(op, ip, literal_length);
+        op += literal_length;
+        ip += literal_length;
+
+        // The last sequence has no match
+        if (ip == iend)
+            break;
+
+        if (iend - ip < 2)
+            return -1;
+        const uint32_t offset = ip[0] | ((uint32_t)ip[1] << 8);
+        ip += 2;
+        if (!offset || offset > (uint64_t)(op - dst))
+            return -1;
+
+        uint32_t match_length = token & 15;
+        if (match_length == 15 && lz4_read_length(&ip, iend, &match_length) < 0)
+            return -1;
+        match_length += LZ4_MIN_MATCH;
+        if ((uint64_t)(oend - op) < match_length)
+            return -1;
+
+        // Overlapping matches repeat the last offset bytes
+        const uint8_t* match = op - offset;
+        if (offset >= match_length) {
+            memcpy(op, match, match_length);
+            op += match_length;
+        } else {
+            for (uint32_t i = 0; i < match_length; i++)
+                *op++ = match[i];
+        }
+    }
+
+    return op - dst;
+}
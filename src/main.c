@@ -0,0 +1,463 @@
+#define _CRT_SECURE_NO_WARNINGS
+
+#include "async.h"
+#include "container.h"
+#include "devices.h"
+#include "digest.h"
+#include "dumper.h"
+#include "image.h"
+#include "metrics.h"
+#include "search.h"
+#include "sink.h"
+#include "store.h"
+#include "survey.h"
+#include "thread.h"
+#include "view.h"
+#include "writer.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+State_t g_usb_state;
+State_t* g_usb_state_ptr = &g_usb_state;
+
+// Returns the value of a "--name" or "--name=value" flag, or NULL if arg is another flag
+const char* flag_value(const char* arg, const char* name)
+{
+    const size_t name_len = strlen(name);
+    if (strncmp(arg, name, name_len) != 0)
+        return NULL;
+
+    if (arg[name_len] == '\0')
+        return "";
+
+    return (arg[name_len] == '=') ? arg + name_len + 1 : NULL;
+}
+
+void parse_flag(Options_t* options, const char* arg)
+{
+    const char* value;
+
+    if ((value = flag_value(arg, "--emulate"))) {
+        options->emulate_spec = value;
+    } else if ((value = flag_value(arg, "--device"))) {
+        if (!*value) {
+            printf("--device needs a selector\n");
+            exit(-1);
+        }
+        options->device_selector = value;
+    } else if ((value = flag_value(arg, "--async"))) {
+        options->async_depth = *value ? (uint32_t)atoi(value) : ASYNC_DEFAULT_DEPTH;
+        if (!options->async_depth || options->async_depth > ASYNC_MAX_DEPTH) {
+            printf("Invalid queue depth: %s\n", value);
+            exit(-1);
+        }
+    } else if ((value = flag_value(arg, "--block-size"))) {
+        options->block_size = (uint32_t)strtoul(value, NULL, 0);
+        if (options->block_size < MIN_BLOCK_SIZE || options->block_size > MAX_BLOCK_SIZE ||
+            options->block_size % 0x200) {
+            printf("Invalid block size: %s\n", value);
+            exit(-1);
+        }
+    } else if ((value = flag_value(arg, "--writer"))) {
+        if (writer_parse_backend(value, &options->writer_backend) < 0) {
+            printf("Unknown writer backend: %s\n", value);
+            exit(-1);
+        }
+    } else if ((value = flag_value(arg, "--buffers"))) {
+        options->writer_buffers = (uint32_t)atoi(value);
+        if (!options->writer_buffers) {
+            printf("Invalid buffer count: %s\n", value);
+            exit(-1);
+        }
+    } else if ((value = flag_value(arg, "--compress-level"))) {
+        options->pack_level = atoi(value);
+    } else if ((value = flag_value(arg, "--compress"))) {
+        if (container_parse_codec(value, &options->pack_codec) < 0) {
+            printf("Unknown codec: %s\n", value);
+            exit(-1);
+        }
+        options->packed = 1;
+    } else if ((value = flag_value(arg, "--threads"))) {
+        options->pack_threads = (uint32_t)atoi(value);
+        if (!options->pack_threads || options->pack_threads > CONTAINER_MAX_THREADS) {
+            printf("Invalid thread count: %s\n", value);
+            exit(-1);
+        }
+    } else if ((value = flag_value(arg, "--store"))) {
+        if (!*value) {
+            printf("--store needs a directory\n");
+            exit(-1);
+        }
+        options->store_path = value;
+    } else if ((value = flag_value(arg, "--image"))) {
+        if (image_parse_format(value, &options->image_format) < 0) {
+            printf("Unknown image format: %s\n", value);
+            exit(-1);
+        }
+    } else if ((value = flag_value(arg, "--hash"))) {
+        options->hash = 1;
+    } else if ((value = flag_value(arg, "--search"))) {
+        options->search = 1;
+        options->search_path = *value ? value : NULL;
+    } else if ((value = flag_value(arg, "--strings"))) {
+        options->strings_min = *value ? (uint32_t)atoi(value) : SEARCH_DEFAULT_MIN_STRING;
+        if (!options->strings_min) {
+            printf("Invalid string length: %s\n", value);
+            exit(-1);
+        }
+    } else if ((value = flag_value(arg, "--no-sparse"))) {
+        options->no_sparse = 1;
+    } else if ((value = flag_value(arg, "--resume"))) {
+        options->resume = 1;
+    } else if ((value = flag_value(arg, "--retries"))) {
+        options->retries = (uint32_t)atoi(value);
+        options->retries_set = 1;
+    } else if ((value = flag_value(arg, "--metrics"))) {
+        if (!*value) {
+            printf("--metrics needs a file\n");
+            exit(-1);
+        }
+        options->metrics_path = value;
+    } else if ((value = flag_value(arg, "--no-progress"))) {
+        options->no_progress = 1;
+    } else if ((value = flag_value(arg, "--survey"))) {
+        if (!*value) {
+            printf("--survey needs a file\n");
+            exit(-1);
+        }
+        options->survey_path = value;
+    } else if ((value = flag_value(arg, "--granularity"))) {
+        options->survey_granularity = strtoull(value, NULL, 0);
+        if (!options->survey_granularity || options->survey_granularity % SURVEY_SAMPLE_SIZE) {
+            printf("Invalid granularity: %s\n", value);
+            exit(-1);
+        }
+    } else if ((value = flag_value(arg, "--samples"))) {
+        options->survey_samples = (uint32_t)atoi(value);
+        if (!options->survey_samples) {
+            printf("Invalid sample count: %s\n", value);
+            exit(-1);
+        }
+    } else if ((value = flag_value(arg, "--wait"))) {
+        options->wait = 1;
+        if (!*value) {
+            options->wait_count = 1;
+        } else if (!strcmp(value, "forever")) {
+            options->wait_count = 0;
+        } else {
+            options->wait_count = (uint32_t)atoi(value);
+            if (!options->wait_count) {
+                printf("Invalid device count: %s\n", value);
+                exit(-1);
+            }
+        }
+    } else if ((value = flag_value(arg, "--base"))) {
+        options->base_address = strtoull(value, NULL, 16);
+        options->base_set = 1;
+    } else if ((value = flag_value(arg, "--squeeze"))) {
+        options->squeeze = 1;
+    } else if ((value = flag_value(arg, "--tune-cache"))) {
+        options->tune_cache_path = value;
+    } else if ((value = flag_value(arg, "--tune"))) {
+        options->tune = 1;
+    } else {
+        printf("Unknown option: %s\n", arg);
+        exit(-1);
+    }
+}
+
+// Parses an inclusive address range into options->range
+void parse_range(Options_t* options, const char* start, const char* end)
+{
+    const char hex_prefix[] = "0x";
+
+    if (strlen(start) > 2) {
+        options->range.start_address =
+            strtoull(!strcmp(hex_prefix, start) ? start + 2 : start, NULL, 16);
+    }
+    if (strlen(end) > 2) {
+        // +1 to include the end address
+        options->range.end_address =
+            strtoull(!strcmp(hex_prefix, end) ? end + 2 : end, NULL, 16) + 1;
+    }
+
+    if (!options->range.end_address ||
+        options->range.start_address > options->range.end_address) {
+        printf("Invalid address range: 0x%llX, 0x%llX\n",
+               options->range.start_address,
+               options->range.end_address);
+        exit(-1);
+    }
+}
+
+Options_t parse_options(int argc, char* argv[])
+{
+    Options_t options = { 0 };
+
+    // Flags may appear anywhere, move the positional arguments to the front
+    int positional = 1;
+    for (int i = 1; i < argc; i++) {
+        if (!strncmp(argv[i], "--", 2))
+            parse_flag(&options, argv[i]);
+        else
+            argv[positional++] = argv[i];
+    }
+    argc = positional;
+
+    if (argc < 2) {
+        printf("Invalid dump mode\n");
+        exit(-1);
+    } else if (!strcmp(argv[1], "dump_all")) {
+        if (argc != 3) {
+            printf("Usage: %s dump_all <output_directory>\n", argv[0]);
+            exit(-1);
+        }
+
+        options.dump_mode = DUMP_MODE_ALL;
+        options.output_path = argv[2];
+    } else if (!strcmp(argv[1], "dump_index")) {
+        if (argc != 4) {
+            printf("Usage: %s dump_index <output_file> <index>\n", argv[0]);
+            exit(-1);
+        }
+
+        options.dump_mode = DUMP_MODE_INDEX;
+        options.output_path = argv[2];
+        options.index = atoi(argv[3]);
+    } else if (!strcmp(argv[1], "dump_range")) {
+        if (argc != 5) {
+            printf("Usage: %s dump_range <output_file> <start_address> <end_address>\n", argv[0]);
+            exit(-1);
+        }
+
+        options.dump_mode = DUMP_MODE_RANGE;
+        options.output_path = argv[2];
+        parse_range(&options, argv[3], argv[4]);
+    } else if (!strcmp(argv[1], "unpack")) {
+        if (argc != 4) {
+            printf("Usage: %s unpack <packed_file> <output_file>\n", argv[0]);
+            exit(-1);
+        }
+
+        options.dump_mode = DUMP_MODE_UNPACK;
+        options.input_path = argv[2];
+        options.output_path = argv[3];
+    } else if (!strcmp(argv[1], "materialize")) {
+        if (argc != 4) {
+            printf("Usage: %s materialize <manifest> <output_file>\n", argv[0]);
+            exit(-1);
+        }
+
+        options.dump_mode = DUMP_MODE_MATERIALIZE;
+        options.input_path = argv[2];
+        options.output_path = argv[3];
+    } else if (!strcmp(argv[1], "verify")) {
+        if (argc != 3 && argc != 4) {
+            printf("Usage: %s verify <dump_file> [<hashes_file>]\n", argv[0]);
+            exit(-1);
+        }
+
+        options.dump_mode = DUMP_MODE_VERIFY;
+        options.input_path = argv[2];
+        options.hashes_path = (argc == 4) ? argv[3] : NULL;
+    } else if (!strcmp(argv[1], "survey")) {
+        if (argc != 3) {
+            printf("Usage: %s survey <survey_file>\n", argv[0]);
+        printf("Usage: %s receive -|tcp:[<host>:]<port>|<fifo> <output_file>\n", argv[0]);
+        printf("Usage: %s view [<dump_file>] [<start_address> <end_address>]\n", argv[0]);
+            exit(-1);
+        }
+
+        options.dump_mode = DUMP_MODE_SURVEY;
+        options.output_path = argv[2];
+    } else if (!strcmp(argv[1], "receive")) {
+        if (argc != 4) {
+            printf("Usage: %s receive <stream> <output_file>\n", argv[0]);
+            exit(-1);
+        }
+
+        options.dump_mode = DUMP_MODE_RECEIVE;
+        options.input_path = argv[2];
+        options.output_path = argv[3];
+    } else if (!strcmp(argv[1], "view")) {
+        if (argc < 3 || argc > 5) {
+            printf("Usage: %s view [<dump_file>] [<start_address> <end_address>]\n", argv[0]);
+            exit(-1);
+        }
+
+        // A range alone is read from the device, a dump file alone is shown whole
+        options.dump_mode = DUMP_MODE_VIEW;
+        options.no_progress = 1;
+        if (argc != 4)
+            options.input_path = argv[2];
+        if (argc != 3)
+            parse_range(&options, argv[argc - 2], argv[argc - 1]);
+    } else {
+        printf("Invalid dump mode\n");
+        exit(-1);
+    }
+
+    return options;
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc < 3) {
+        printf("Usage: %s dump_all <output_directory>\n", argv[0]);
+        printf("Usage: %s --image=elf|lime dump_all <output_file>\n", argv[0]);
+        printf("Usage: %s dump_index <output_file> <index>\n", argv[0]);
+        printf("Usage: %s dump_range <output_file> <start_address> <end_address>\n", argv[0]);
+        printf("Usage: %s unpack <packed_file> <output_file>\n", argv[0]);
+        printf("Usage: %s materialize <manifest> <output_file>\n", argv[0]);
+        printf("Usage: %s verify <dump_file> [<hashes_file>]\n", argv[0]);
+        printf("Usage: %s survey <survey_file>\n", argv[0]);
+        printf("Usage: %s receive -|tcp:[<host>:]<port>|<fifo> <output_file>\n", argv[0]);
+        printf("Usage: %s view [<dump_file>] [<start_address> <end_address>]\n", argv[0]);
+        printf("Options:\n");
+        printf("  --emulate[=<key=value,...>]  use the in-process device emulator\n");
+        printf("  --device=all|<sel>[,<sel>]   dump devices by bus-port path or serial\n");
+        printf("  --wait[=<count>|forever]     dump devices as soon as they enter upload mode\n");
+        printf("  --async[=<depth>]            keep up to <depth> blocks in flight\n");
+        printf("  --block-size=<size>          bytes requested per data transfer\n");
+        printf("  --tune                       measure and cache the fastest block size\n");
+        printf("  --tune-cache=<path>          block size cache (default ~/.upload_dumper_tune)\n");
+        printf("  --writer=<backend>           stdio, direct, uring or mmap output file\n");
+        printf("  --buffers=<count>            transfer buffers shared with the writer thread\n");
+        printf("  --no-sparse                  write zero blocks instead of leaving holes\n");
+        printf("  --compress[=lz4|zstd|none]   write a packed, indexed container\n");
+        printf("  --compress-level=<level>     zstd compression level\n");
+        printf("  --threads=<count>            compression, hashing and verification threads\n");
+        printf("  --store=<directory>          deduplicate into a chunk store, write manifests\n");
+        printf("  --image=elf|lime             dump_all into one ELF core or LiME file\n");
+        printf("  --hash                       SHA-256 and XXH64 digests in <output>.hashes\n");
+        printf("  --search[=<file>]            find patterns while dumping, in <output>.matches\n");
+        printf("  --strings[=<length>]         extract printable strings into <output>.matches\n");
+        printf("  --resume                     continue dumps recorded in <output>.journal\n");
+        printf("  --retries=<count>            attempts per failed block (default 3)\n");
+        printf("  --metrics=<file>             keep live metrics in a JSON or .prom file\n");
+        printf("  --no-progress                no status line\n");
+        printf("  --survey=<file>              only read what a survey found populated\n");
+        printf("  --granularity=<bytes>        survey cell size (default 1 MiB)\n");
+        printf("  --samples=<count>            pages sampled per survey cell (default 1)\n");
+        printf("  --base=<address>             address of the first byte of a viewed raw dump\n");
+        printf("  --squeeze                    view repeated lines as a single \"*\"\n");
+        return -1;
+    }
+
+    Options_t options = parse_options(argc, argv);
+    if (options.dump_mode == DUMP_MODE_UNPACK)
+        return container_unpack(options.input_path, options.output_path);
+    if (options.dump_mode == DUMP_MODE_MATERIALIZE)
+        return store_materialize(options.input_path, options.store_path, options.output_path);
+    if (options.dump_mode == DUMP_MODE_VERIFY)
+        return digest_verify(options.input_path,
+                             options.hashes_path,
+                             options.pack_threads ? options.pack_threads : thread_cpu_count());
+    if (options.dump_mode == DUMP_MODE_RECEIVE)
+        return sink_receive(options.input_path, options.output_path, options.writer_backend);
+    if (options.dump_mode == DUMP_MODE_VIEW && options.input_path)
+        return view_file(&options);
+
+    if (options.packed && options.store_path) {
+        printf("--compress and --store cannot be combined\n");
+        return -1;
+    }
+    if (options.image_format &&
+        (options.dump_mode != DUMP_MODE_ALL || options.packed || options.store_path ||
+         options.hash || options.search || options.strings_min)) {
+        printf("--image only works with a plain dump_all\n");
+        return -1;
+    }
+    if (options.survey_path && options.dump_mode == DUMP_MODE_SURVEY) {
+        printf("--survey guides dumps, not another survey\n");
+        return -1;
+    }
+
+    // Output names like "-" and tcp:<host>:<port> stream the dump
+    if (options.output_path && sink_is_stream(options.output_path)) {
+        if (options.dump_mode != DUMP_MODE_RANGE && options.dump_mode != DUMP_MODE_INDEX) {
+            printf("Only dump_range and dump_index can be streamed\n");
+            return -1;
+        }
+        if (options.packed || options.store_path || options.hash || options.search ||
+            options.strings_min || options.resume || devices_requested(&options) ||
+            (options.wait && options.wait_count != 1)) {
+            printf("Streams do not work with --compress, --store, --hash, --search, --strings, "
+                   "--resume, --device or --wait=<count>\n");
+            return -1;
+        }
+        if (!strcmp(options.output_path, SINK_STDOUT) && sink_reserve_stdout() < 0)
+            return -1;
+    }
+
+    if (options.dump_mode == DUMP_MODE_RANGE) {
+        printf("Dumping a total of %llu (0x%llx) bytes from 0x%llX to 0x%llX\n",
+               options.range.end_address - options.range.start_address,
+               options.range.end_address - options.range.start_address,
+               options.range.start_address,
+               options.range.end_address);
+    }
+
+    if (options.wait)
+        return wait_devices(&options);
+    if (devices_requested(&options))
+        return dump_devices(&options);
+
+    apply_options(g_usb_state_ptr, &options);
+
+    Survey_t survey;
+    if (options.survey_path) {
+        if (survey_load(options.survey_path, &survey) < 0)
+            return -1;
+        g_usb_state_ptr->survey = &survey;
+    }
+
+    SearchPatterns_t patterns;
+    if (options.search) {
+        if (search_patterns_load(&patterns, options.search_path) < 0)
+            return -1;
+        g_usb_state_ptr->search = &patterns;
+    }
+
+    if (options.emulate_spec) {
+        if (init_emulator(g_usb_state_ptr, options.emulate_spec) < 0)
+            return -1;
+    } else if (init_device(g_usb_state_ptr, NULL) < 0) {
+        return -1;
+    }
+
+    print_probetable(g_usb_state_ptr->probe_table);
+
+    if (select_block_size(g_usb_state_ptr, &options) < 0)
+        return -1;
+
+    // Only from here on, tuning is not part of the dump
+    Metrics_t* metrics = metrics_create(options.metrics_path, NULL, !options.no_progress);
+    if (!metrics)
+        return -1;
+    g_usb_state_ptr->metrics = metrics;
+    g_usb_state_ptr->phase_latency = metrics_phases(metrics);
+
+    const int32_t result = dump_memory(g_usb_state_ptr, &options);
+    g_usb_state_ptr->metrics = NULL;
+    g_usb_state_ptr->phase_latency = NULL;
+    if (g_usb_state_ptr->survey) {
+        g_usb_state_ptr->survey = NULL;
+        survey_free(&survey);
+    }
+    if (g_usb_state_ptr->search) {
+        g_usb_state_ptr->search = NULL;
+        search_patterns_free(&patterns);
+    }
+    if (metrics_destroy(metrics) < 0 || result < 0)
+        return -1;
+
+    printf("Dumped memory to %s\n", options.output_file_name);
+
+    close_state(g_usb_state_ptr);
+
+    return 0;
+}
\ No newline at end of file
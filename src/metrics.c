@@ -0,0 +1,455 @@
+#define _CRT_SECURE_NO_WARNINGS
+
+#include "metrics.h"
+#include "clock.h"
+#include "dumper.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <io.h>
+#define metrics_isatty(file) _isatty(_fileno(file))
+#else
+#include <unistd.h>
+#define metrics_isatty(file) isatty(fileno(file))
+#endif
+
+#define METRICS_PREFIX "upload_dumper_"
+#define METRICS_PROMETHEUS_EXTENSION ".prom"
+
+struct Metrics
+{
+    char export_path[0x200];
+    int prometheus;
+    char device_id[MAX_DEVICE_ID];
+    // Redraw a status line, or print one every METRICS_LOG_INTERVAL_US if stdout is not a terminal
+    int progress;
+    int terminal;
+    int line_open;
+    int line_length;
+
+    uint64_t start_ns;
+    uint64_t expected_bytes;
+    uint64_t skipped_bytes;
+    uint64_t received_bytes;
+    uint64_t retries;
+
+    // Moving average, in bytes per second
+    double rate;
+    uint64_t sample_ns;
+    uint64_t sample_bytes;
+    uint64_t next_line_ns;
+    uint64_t next_export_ns;
+
+    // Transfer buffers when last sampled, and how long the USB side waited for one
+    uint32_t buffers_in_use;
+    uint32_t buffers;
+    uint64_t buffer_wait_ns;
+
+    LatencyHistogram_t phases[PHASE_COUNT];
+};
+
+Metrics_t* metrics_create(const char* export_path, const char* device_id, int progress)
+{
+    Metrics_t* metrics = calloc(1, sizeof(Metrics_t));
+    if (!metrics) {
+        printf("Failed to allocate metrics\n");
+        return NULL;
+    }
+
+    if (export_path) {
+        const size_t size = sizeof(metrics->export_path);
+        const char* extension = strrchr(export_path, '.');
+        const char* name = strrchr(export_path, '/');
+        if (extension && name && extension < name)
+            extension = NULL;
+        metrics->prometheus = extension && !strcmp(extension, METRICS_PROMETHEUS_EXTENSION);
+
+        const int stem_length =
+            extension ? (int)(extension - export_path) : (int)strlen(export_path);
+        const int length = device_id ? snprintf(metrics->export_path,
+                                                size,
+                                                "%.*s-%s%s",
+                                                stem_length,
+                                                export_path,
+                                                device_id,
+                                                extension ? extension : "")
+                                     : snprintf(metrics->export_path, size, "%s", export_path);
+        if (length < 0 || (size_t)length >= size) {
+            printf("Metrics path %s is too long\n", export_path);
+            free(metrics);
+            return NULL;
+        }
+    }
+
+    if (device_id)
+        snprintf(metrics->device_id, sizeof(metrics->device_id), "%s", device_id);
+
+    metrics->progress = progress;
+    metrics->terminal = metrics_isatty(stdout);
+    metrics->start_ns = clock_now_ns();
+    metrics->sample_ns = metrics->start_ns;
+    metrics->next_line_ns = metrics->start_ns;
+    metrics->next_export_ns = metrics->start_ns;
+
+    return metrics;
+}
+
+LatencyHistogram_t* metrics_phases(Metrics_t* metrics)
+{
+    return metrics ? metrics->phases : NULL;
+}
+
+void metrics_expect(Metrics_t* metrics, uint64_t bytes)
+{
+    if (metrics)
+        metrics->expected_bytes += bytes;
+}
+
+void metrics_skip(Metrics_t* metrics, uint64_t bytes)
+{
+    if (metrics)
+        metrics->skipped_bytes += bytes;
+}
+
+void metrics_retry(Metrics_t* metrics)
+{
+    if (metrics)
+        metrics->retries++;
+}
+
+static double metrics_average_rate(const Metrics_t* metrics, uint64_t now_ns)
+{
+    const uint64_t elapsed_ns = now_ns - metrics->start_ns;
+    return elapsed_ns ? (double)metrics->received_bytes * 1e9 / (double)elapsed_ns : 0.0;
+}
+
+// Seconds until the expected bytes are in at the moving average rate, -1 if unknown
+static double metrics_eta(const Metrics_t* metrics)
+{
+    const uint64_t done = metrics->skipped_bytes + metrics->received_bytes;
+
+    if (!metrics->expected_bytes || metrics->rate <= 0)
+        return -1;
+    if (done >= metrics->expected_bytes)
+        return 0;
+
+    return (double)(metrics->expected_bytes - done) / metrics->rate;
+}
+
+static double metrics_p50_ms(const Metrics_t* metrics, Phase_t phase)
+{
+    return (double)latency_percentile(&metrics->phases[phase], 0.5) / 1e6;
+}
+
+static void metrics_print_line(Metrics_t* metrics, uint64_t now_ns)
+{
+    char eta[0x20] = "--:--";
+    char line[0x100];
+
+    const double eta_seconds = metrics_eta(metrics);
+    if (eta_seconds >= 0) {
+        const uint64_t seconds = (uint64_t)(eta_seconds + 0.5);
+        snprintf(eta,
+                 sizeof(eta),
+                 "%llu:%02llu:%02llu",
+                 seconds / 3600,
+                 seconds / 60 % 60,
+                 seconds % 60);
+    }
+
+    const uint64_t done = metrics->skipped_bytes + metrics->received_bytes;
+    const double percent =
+        metrics->expected_bytes ? (double)done * 100.0 / (double)metrics->expected_bytes : 0.0;
+    // Device turnaround, link and disk, to tell which one is slow
+    const double command_ms = metrics_p50_ms(metrics, PHASE_PREAMBLE) +
+                              metrics_p50_ms(metrics, PHASE_LOW_ADDRESS) +
+                              metrics_p50_ms(metrics, PHASE_HIGH_ADDRESS);
+
+    int length = snprintf(line,
+                          sizeof(line),
+                          "%5.1f%% %llu/%llu MiB %.1f MB/s (avg %.1f) ETA %s | cmd %.2f ms "
+                          "xfer %.2f ms write %.2f ms | buffers %u/%u | retries %llu",
+                          percent,
+                          done >> 20,
+                          metrics->expected_bytes >> 20,
+                          metrics->rate / 1e6,
+                          metrics_average_rate(metrics, now_ns) / 1e6,
+                          eta,
+                          command_ms,
+                          metrics_p50_ms(metrics, PHASE_DATA_XFER),
+                          metrics_p50_ms(metrics, PHASE_WRITE),
+                          metrics->buffers_in_use,
+                          metrics->buffers,
+                          metrics->retries);
+    if (length < 0)
+        return;
+    length = (length < (int)sizeof(line)) ? length : (int)sizeof(line) - 1;
+
+    if (metrics->terminal) {
+        // Pad with spaces to clear what is left of a longer previous line
+        const int padding = (metrics->line_length > length) ? metrics->line_length - length : 0;
+        printf("\r%s%*s", line, padding, "");
+        metrics->line_length = length;
+        metrics->line_open = 1;
+    } else {
+        printf("%s\n", line);
+    }
+    fflush(stdout);
+}
+
+void metrics_break_line(Metrics_t* metrics)
+{
+    if (!metrics || !metrics->line_open)
+        return;
+
+    printf("\n");
+    metrics->line_open = 0;
+    metrics->line_length = 0;
+}
+
+static void metrics_write_json(const Metrics_t* metrics, FILE* file, uint64_t now_ns)
+{
+    fprintf(file, "{\n");
+    if (metrics->device_id[0])
+        fprintf(file, "  \"device\": \"%s\",\n", metrics->device_id);
+    fprintf(file, "  \"elapsed_seconds\": %.3f,\n", (double)(now_ns - metrics->start_ns) / 1e9);
+    fprintf(file, "  \"expected_bytes\": %llu,\n", metrics->expected_bytes);
+    fprintf(file, "  \"skipped_bytes\": %llu,\n", metrics->skipped_bytes);
+    fprintf(file, "  \"received_bytes\": %llu,\n", metrics->received_bytes);
+    fprintf(file, "  \"rate_bytes_per_second\": %.0f,\n", metrics->rate);
+    fprintf(file,
+            "  \"average_rate_bytes_per_second\": %.0f,\n",
+            metrics_average_rate(metrics, now_ns));
+    fprintf(file, "  \"eta_seconds\": %.1f,\n", metrics_eta(metrics));
+    fprintf(file, "  \"retries\": %llu,\n", metrics->retries);
+    fprintf(file, "  \"buffers_in_use\": %u,\n", metrics->buffers_in_use);
+    fprintf(file, "  \"buffers\": %u,\n", metrics->buffers);
+    fprintf(file, "  \"buffer_wait_seconds\": %.6f,\n", (double)metrics->buffer_wait_ns / 1e9);
+    fprintf(file, "  \"phases\": {\n");
+    for (uint32_t i = 0; i < PHASE_COUNT; i++) {
+        const LatencyHistogram_t* histogram = &metrics->phases[i];
+
+        fprintf(file,
+                "    \"%s\": {\"count\": %llu, \"p50_us\": %.3f, \"p99_us\": %.3f, "
+                "\"max_us\": %.3f}%s\n",
+                c_phase_names[i],
+                histogram->count,
+                (double)latency_percentile(histogram, 0.5) / 1e3,
+                (double)latency_percentile(histogram, 0.99) / 1e3,
+                (double)histogram->max_ns / 1e3,
+                (i + 1 < PHASE_COUNT) ? "," : "");
+    }
+    fprintf(file, "  }\n}\n");
+}
+
+static void metrics_write_prometheus_value(const Metrics_t* metrics,
+                                           FILE* file,
+                                           const char* name,
+                                           const char* type,
+                                           const char* help,
+                                           double value)
+{
+    fprintf(file, "# HELP " METRICS_PREFIX "%s %s\n", name, help);
+    fprintf(file, "# TYPE " METRICS_PREFIX "%s %s\n", name, type);
+    if (metrics->device_id[0])
+        fprintf(file, METRICS_PREFIX "%s{device=\"%s\"} %.17g\n", name, metrics->device_id, value);
+    else
+        fprintf(file, METRICS_PREFIX "%s %.17g\n", name, value);
+}
+
+static void metrics_write_prometheus(const Metrics_t* metrics, FILE* file, uint64_t now_ns)
+{
+    static const double c_quantiles[] = { 0.5, 0.99 };
+    char device_label[MAX_DEVICE_ID + 0x10] = "";
+
+    if (metrics->device_id[0])
+        snprintf(device_label, sizeof(device_label), "device=\"%s\",", metrics->device_id);
+
+    metrics_write_prometheus_value(metrics,
+                                   file,
+                                   "elapsed_seconds",
+                                   "gauge",
+                                   "Time since the dump started",
+                                   (double)(now_ns - metrics->start_ns) / 1e9);
+    metrics_write_prometheus_value(metrics,
+                                   file,
+                                   "expected_bytes",
+                                   "gauge",
+                                   "Bytes to read from the device",
+                                   (double)metrics->expected_bytes);
+    metrics_write_prometheus_value(metrics,
+                                   file,
+                                   "skipped_bytes",
+                                   "gauge",
+                                   "Bytes already dumped by an earlier run",
+                                   (double)metrics->skipped_bytes);
+    metrics_write_prometheus_value(metrics,
+                                   file,
+                                   "received_bytes_total",
+                                   "counter",
+                                   "Bytes received from the device",
+                                   (double)metrics->received_bytes);
+    metrics_write_prometheus_value(metrics,
+                                   file,
+                                   "rate_bytes_per_second",
+                                   "gauge",
+                                   "Moving average receive rate",
+                                   metrics->rate);
+    metrics_write_prometheus_value(metrics,
+                                   file,
+                                   "eta_seconds",
+                                   "gauge",
+                                   "Estimated time left, -1 if unknown",
+                                   metrics_eta(metrics));
+    metrics_write_prometheus_value(metrics,
+                                   file,
+                                   "retries_total",
+                                   "counter",
+                                   "Blocks requested again after a transfer error",
+                                   (double)metrics->retries);
+    metrics_write_prometheus_value(metrics,
+                                   file,
+                                   "buffers_in_use",
+                                   "gauge",
+                                   "Transfer buffers in flight or waiting for the writer",
+                                   (double)metrics->buffers_in_use);
+    metrics_write_prometheus_value(metrics,
+                                   file,
+                                   "buffers",
+                                   "gauge",
+                                   "Transfer buffers",
+                                   (double)metrics->buffers);
+    metrics_write_prometheus_value(metrics,
+                                   file,
+                                   "buffer_wait_seconds_total",
+                                   "counter",
+                                   "Time the device side waited for a free buffer",
+                                   (double)metrics->buffer_wait_ns / 1e9);
+
+    fprintf(file,
+            "# HELP " METRICS_PREFIX "phase_seconds Duration of the steps of a block transfer\n");
+    fprintf(file, "# TYPE " METRICS_PREFIX "phase_seconds summary\n");
+    for (uint32_t i = 0; i < PHASE_COUNT; i++) {
+        const LatencyHistogram_t* histogram = &metrics->phases[i];
+
+        for (uint32_t j = 0; j < sizeof(c_quantiles) / sizeof(c_quantiles[0]); j++)
+            fprintf(file,
+                    METRICS_PREFIX "phase_seconds{%sphase=\"%s\",quantile=\"%g\"} %.9f\n",
+                    device_label,
+                    c_phase_names[i],
+                    c_quantiles[j],
+                    (double)latency_percentile(histogram, c_quantiles[j]) / 1e9);
+        fprintf(file,
+                METRICS_PREFIX "phase_seconds_sum{%sphase=\"%s\"} %.9f\n",
+                device_label,
+                c_phase_names[i],
+                (double)histogram->sum_ns / 1e9);
+        fprintf(file,
+                METRICS_PREFIX "phase_seconds_count{%sphase=\"%s\"} %llu\n",
+                device_label,
+                c_phase_names[i],
+                histogram->count);
+    }
+}
+
+// Written next to the file and renamed over it, so readers never see half of it
+static int32_t metrics_export(const Metrics_t* metrics, uint64_t now_ns)
+{
+    char temp_path[0x220];
+
+    if (!metrics->export_path[0])
+        return 0;
+
+    snprintf(temp_path, sizeof(temp_path), "%s.tmp", metrics->export_path);
+    FILE* file = fopen(temp_path, "w");
+    if (!file) {
+        printf("Failed to open %s\n", temp_path);
+        return -1;
+    }
+
+    if (metrics->prometheus)
+        metrics_write_prometheus(metrics, file, now_ns);
+    else
+        metrics_write_json(metrics, file, now_ns);
+
+    if (fclose(file) != 0) {
+        printf("Failed to write %s\n", temp_path);
+        remove(temp_path);
+        return -1;
+    }
+
+#ifdef _WIN32
+    remove(metrics->export_path);
+#endif
+    if (rename(temp_path, metrics->export_path) != 0) {
+        printf("Failed to replace %s\n", metrics->export_path);
+        remove(temp_path);
+        return -1;
+    }
+
+    return 0;
+}
+
+void metrics_received(Metrics_t* metrics, uint64_t bytes, BlockPool_t* pool)
+{
+    if (!metrics)
+        return;
+
+    metrics->received_bytes += bytes;
+
+    const uint64_t now_ns = clock_now_ns();
+    if (now_ns < metrics->next_line_ns && now_ns < metrics->next_export_ns)
+        return;
+
+    const uint64_t interval_ns = now_ns - metrics->sample_ns;
+    if (interval_ns >= METRICS_LINE_INTERVAL_US * 1000ull) {
+        const double rate =
+            (double)(metrics->received_bytes - metrics->sample_bytes) * 1e9 / (double)interval_ns;
+        const double weight =
+            (double)interval_ns / (double)(interval_ns + METRICS_RATE_WINDOW_US * 1000ull);
+
+        metrics->rate = metrics->sample_bytes ? metrics->rate + weight * (rate - metrics->rate)
+                                              : rate;
+        metrics->sample_ns = now_ns;
+        metrics->sample_bytes = metrics->received_bytes;
+    }
+
+    if (pool) {
+        metrics->buffers_in_use = block_pool_in_use(pool);
+        metrics->buffers = pool->count;
+        metrics->buffer_wait_ns = pool->wait_ns;
+    }
+
+    if (now_ns >= metrics->next_line_ns) {
+        if (metrics->progress)
+            metrics_print_line(metrics, now_ns);
+        metrics->next_line_ns = now_ns + (metrics->terminal ? METRICS_LINE_INTERVAL_US
+                                                            : METRICS_LOG_INTERVAL_US) *
+                                             1000ull;
+    }
+
+    if (now_ns >= metrics->next_export_ns) {
+        metrics_export(metrics, now_ns);
+        metrics->next_export_ns = now_ns + METRICS_EXPORT_INTERVAL_US * 1000ull;
+    }
+}
+
+int32_t metrics_destroy(Metrics_t* metrics)
+{
+    if (!metrics)
+        return 0;
+
+    const uint64_t now_ns = clock_now_ns();
+    if (metrics->progress && metrics->received_bytes) {
+        metrics_print_line(metrics, now_ns);
+        metrics_break_line(metrics);
+    }
+
+    const int32_t result = metrics_export(metrics, now_ns);
+    free(metrics);
+
+    return result;
+}
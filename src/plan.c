@@ -0,0 +1,113 @@
+#include "plan.h"
+#include "dumper.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct PlanEntry
+{
+    uint64_t start;
+    uint64_t end;
+    uint32_t index;
+} PlanEntry_t;
+
+static int plan_entry_compare(const void* a, const void* b)
+{
+    const PlanEntry_t* left = a;
+    const PlanEntry_t* right = b;
+
+    if (left->start != right->start)
+        return (left->start < right->start) ? -1 : 1;
+    // Larger entries first, so that the first entry of a span is the best primary
+    if (left->end != right->end)
+        return (left->end > right->end) ? -1 : 1;
+    return (left->index < right->index) ? -1 : 1;
+}
+
+static int plan_index_compare(const void* a, const void* b)
+{
+    const uint32_t left = *(const uint32_t*)a;
+    const uint32_t right = *(const uint32_t*)b;
+
+    return (left > right) - (left < right);
+}
+
+int32_t plan_build(const ProbeTable_t* probe_table, Plan_t* plan)
+{
+    PlanEntry_t entries[MAX_PROBE_ENTRIES];
+
+    memset(plan, 0, sizeof(Plan_t));
+
+    for (uint32_t i = 0; i < probe_table->count; i++) {
+        const ProbeTableEntry_t* entry = &probe_table->entries[i];
+
+        if ((entry->start == 0 && entry->end == 0) || entry->end < entry->start) {
+            printf("Invalid probe table entry %u: [0x%llx, 0x%llx]\n", i, entry->start, entry->end);
+            return -1;
+        }
+
+        entries[i].start = entry->start;
+        entries[i].end = entry->end;
+        entries[i].index = i;
+        plan->entry_bytes += entry->end - entry->start;
+    }
+
+    qsort(entries, probe_table->count, sizeof(PlanEntry_t), plan_entry_compare);
+
+    PlanSpan_t* span = NULL;
+    for (uint32_t i = 0; i < probe_table->count; i++) {
+        const PlanEntry_t* entry = &entries[i];
+
+        // Entries that only touch stay apart, merging them would not save anything
+        if (!span || entry->start >= span->end) {
+            span = &plan->spans[plan->count++];
+            span->start = entry->start;
+            span->end = entry->end;
+            span->primary = (int32_t)entry->index;
+        } else if (entry->end > span->end) {
+            // Overlaps the span without being inside it
+            span->end = entry->end;
+            span->primary = -1;
+        }
+
+        span->entries[span->entry_count++] = entry->index;
+    }
+
+    for (uint32_t i = 0; i < plan->count; i++) {
+        span = &plan->spans[i];
+        qsort(span->entries, span->entry_count, sizeof(uint32_t), plan_index_compare);
+        plan->read_bytes += span->end - span->start;
+    }
+
+    return 0;
+}
+
+void plan_print(const ProbeTable_t* probe_table, const Plan_t* plan)
+{
+    printf("Dump plan:\n");
+    for (uint32_t i = 0; i < plan->count; i++) {
+        const PlanSpan_t* span = &plan->spans[i];
+
+        printf("Span %u: [0x%llx, 0x%llx) read into %s",
+               i,
+               span->start,
+               span->end,
+               span->primary < 0 ? "a staging file" : probe_table->entries[span->primary].name);
+
+        const char* separator = ", copied to ";
+        for (uint32_t j = 0; j < span->entry_count; j++) {
+            if ((int32_t)span->entries[j] == span->primary)
+                continue;
+            printf("%s%s", separator, probe_table->entries[span->entries[j]].name);
+            separator = ", ";
+        }
+        printf("\n");
+    }
+
+    const uint64_t saved = plan->entry_bytes - plan->read_bytes;
+    printf("Reading 0x%llx of 0x%llx bytes, %llu MiB saved by overlapping entries\n",
+           plan->read_bytes,
+           plan->entry_bytes,
+           saved >> 20);
+}
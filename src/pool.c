@@ -0,0 +1,142 @@
+#include "pool.h"
+#include "clock.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+
+void* aligned_buffer_alloc(uint64_t size)
+{
+    const uint64_t aligned_size = (size + POOL_ALIGNMENT - 1) & ~(uint64_t)(POOL_ALIGNMENT - 1);
+
+#ifdef _WIN32
+    return _aligned_malloc(aligned_size, POOL_ALIGNMENT);
+#else
+    void* buffer = NULL;
+    if (posix_memalign(&buffer, POOL_ALIGNMENT, aligned_size) != 0)
+        return NULL;
+    return buffer;
+#endif
+}
+
+void aligned_buffer_free(void* buffer)
+{
+#ifdef _WIN32
+    _aligned_free(buffer);
+#else
+    free(buffer);
+#endif
+}
+
+int32_t block_pool_init(BlockPool_t* pool, uint32_t count, uint32_t capacity)
+{
+    memset(pool, 0, sizeof(BlockPool_t));
+    mutex_init(&pool->mutex);
+    cond_init(&pool->available);
+
+    pool->blocks = calloc(count, sizeof(Block_t));
+    if (!pool->blocks) {
+        printf("Failed to allocate block pool\n");
+        block_pool_destroy(pool);
+        return -1;
+    }
+    pool->count = count;
+
+    for (uint32_t i = 0; i < count; i++) {
+        Block_t* block = &pool->blocks[i];
+        block->buffer = block->data = aligned_buffer_alloc(capacity);
+        if (!block->buffer) {
+            printf("Failed to allocate block pool buffers\n");
+            block_pool_destroy(pool);
+            return -1;
+        }
+        block->capacity = capacity;
+        block->next = pool->free_list;
+        pool->free_list = block;
+    }
+    pool->free_count = count;
+
+    return 0;
+}
+
+void block_pool_destroy(BlockPool_t* pool)
+{
+    if (pool->blocks) {
+        for (uint32_t i = 0; i < pool->count; i++)
+            aligned_buffer_free(pool->blocks[i].buffer);
+        free(pool->blocks);
+        pool->blocks = NULL;
+    }
+
+    mutex_destroy(&pool->mutex);
+    cond_destroy(&pool->available);
+}
+
+Block_t* block_pool_acquire(BlockPool_t* pool)
+{
+    mutex_lock(&pool->mutex);
+
+    if (!pool->free_list) {
+        const uint64_t start_ns = clock_now_ns();
+        while (!pool->free_list)
+            cond_wait(&pool->available, &pool->mutex);
+        pool->wait_ns += clock_now_ns() - start_ns;
+        pool->waits++;
+    }
+
+    Block_t* block = pool->free_list;
+    pool->free_list = block->next;
+    pool->free_count--;
+
+    mutex_unlock(&pool->mutex);
+
+    block->next = NULL;
+    block->data = block->buffer;
+    block->size = 0;
+    return block;
+}
+
+void block_pool_release(BlockPool_t* pool, Block_t* block)
+{
+    mutex_lock(&pool->mutex);
+
+    block->next = pool->free_list;
+    pool->free_list = block;
+    pool->free_count++;
+
+    cond_signal(&pool->available);
+    mutex_unlock(&pool->mutex);
+}
+
+uint32_t block_pool_in_use(BlockPool_t* pool)
+{
+    mutex_lock(&pool->mutex);
+    const uint32_t in_use = pool->count - pool->free_count;
+    mutex_unlock(&pool->mutex);
+
+    return in_use;
+}
+
+void block_pool_map(BlockPool_t* pool,
+                    uint8_t* mapping,
+                    uint64_t start_address,
+                    uint64_t end_address)
+{
+    pool->mapping = mapping;
+    pool->map_start = start_address;
+    pool->map_end = end_address;
+}
+
+int block_pool_place(BlockPool_t* pool, Block_t* block, uint32_t min_size)
+{
+    if (!pool->mapping || block->size < min_size || block->address < pool->map_start ||
+        block->address + block->size > pool->map_end)
+        return 0;
+
+    block->data = pool->mapping + (block->address - pool->map_start);
+    return 1;
+}
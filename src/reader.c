@@ -0,0 +1,110 @@
+#define _CRT_SECURE_NO_WARNINGS
+#define _FILE_OFFSET_BITS 64
+
+#include "reader.h"
+#include "container.h"
+#include "store.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#define reader_fseek _fseeki64
+#else
+#define reader_fseek fseeko
+#endif
+
+int32_t dump_source_open(DumpSource_t* source, const char* path, uint64_t start_address)
+{
+    char magic[8] = { 0 };
+
+    FILE* file = fopen(path, "rb");
+    if (!file) {
+        printf("Failed to open %s\n", path);
+        return -1;
+    }
+    const size_t magic_size = fread(magic, 1, sizeof(magic), file);
+    fclose(file);
+
+    memset(source, 0, sizeof(DumpSource_t));
+    source->path = path;
+    source->start_address = start_address;
+
+    if (magic_size == sizeof(magic) && !memcmp(magic, CONTAINER_MAGIC, sizeof(magic))) {
+        source->kind = DUMP_KIND_PACKED;
+    } else if (magic_size >= 6 && !memcmp(magic, "store ", 6)) {
+        source->kind = DUMP_KIND_STORED;
+        source->view = store_view_open(path, NULL);
+        if (!source->view)
+            return -1;
+    } else {
+        source->kind = DUMP_KIND_RAW;
+    }
+
+    return 0;
+}
+
+void dump_source_close(DumpSource_t* source)
+{
+    store_view_close(source->view);
+    source->view = NULL;
+}
+
+int32_t dump_reader_open(DumpReader_t* reader, const DumpSource_t* source)
+{
+    memset(reader, 0, sizeof(DumpReader_t));
+    reader->source = source;
+
+    if (source->kind == DUMP_KIND_RAW) {
+        reader->file = fopen(source->path, "rb");
+        if (!reader->file) {
+            printf("Failed to open %s\n", source->path);
+            return -1;
+        }
+    } else if (source->kind == DUMP_KIND_PACKED) {
+        reader->container = container_reader_open(source->path);
+        if (!reader->container)
+            return -1;
+    }
+
+    return 0;
+}
+
+void dump_reader_close(DumpReader_t* reader)
+{
+    if (reader->file)
+        fclose(reader->file);
+    if (reader->container)
+        container_reader_close(reader->container);
+}
+
+const uint8_t* dump_reader_read(DumpReader_t* reader, uint64_t address, uint64_t size, uint8_t* buf)
+{
+    const DumpSource_t* source = reader->source;
+
+    switch (source->kind) {
+        case DUMP_KIND_RAW:
+            if (address < source->start_address ||
+                reader_fseek(reader->file, (int64_t)(address - source->start_address), SEEK_SET) !=
+                    0 ||
+                fread(buf, 1, size, reader->file) != size)
+                return NULL;
+            return buf;
+        case DUMP_KIND_PACKED: {
+            const ContainerHeader_t* header = &reader->container->header;
+            if (address < header->start_address || address > header->end_address ||
+                size > header->end_address - address ||
+                container_read(reader->container, address, buf, size) < 0)
+                return NULL;
+            return buf;
+        }
+        case DUMP_KIND_STORED:
+            if (address < source->view->start_address || address > source->view->end_address ||
+                size > source->view->end_address - address)
+                return NULL;
+            return source->view->data + (address - source->view->start_address);
+        default:
+            return NULL;
+    }
+}
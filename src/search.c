@@ -0,0 +1,849 @@
+#define _CRT_SECURE_NO_WARNINGS
+
+#include "search.h"
+#include "clock.h"
+#include "dumper.h"
+#include "thread.h"
+#include "zero.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SEARCH_MAX_PATH 0x200
+#define SEARCH_MAX_LINE 0x400
+
+// Markers worth finding in any dump
+static const char* const c_search_default_patterns[] = {
+    "-----BEGIN ",
+    "ssh-rsa ",
+    "ssh-ed25519 ",
+    "ANDROID!",
+    "\\x7fELF",
+    "Linux version ",
+    "Kernel panic - not syncing",
+    "Unable to handle kernel",
+    "Internal error: ",
+    "Call trace:",
+};
+
+// Same as isprint() in the C locale, without a function call per byte
+static uint8_t g_printable[256];
+static int g_printable_ready;
+
+static void search_build_printable(void)
+{
+    for (uint32_t i = 0; i < 256; i++)
+        g_printable[i] = i >= 0x20 && i < 0x7F;
+    g_printable_ready = 1;
+}
+
+// Patterns
+
+static int search_hex_digit(char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
+
+// Decodes the escapes of a pattern, returns its size or -1
+static int32_t search_unescape(const char* text, uint8_t* bytes)
+{
+    uint32_t size = 0;
+
+    for (const char* c = text; *c; c++) {
+        if (size == SEARCH_MAX_PATTERN)
+            return -1;
+
+        if (*c != '\\') {
+            bytes[size++] = (uint8_t)*c;
+            continue;
+        }
+
+        switch (*++c) {
+            case 'n':
+                bytes[size++] = '\n';
+                break;
+            case 'r':
+                bytes[size++] = '\r';
+                break;
+            case 't':
+                bytes[size++] = '\t';
+                break;
+            case '\\':
+                bytes[size++] = '\\';
+                break;
+            case 'x': {
+                const int high = search_hex_digit(c[1]);
+                const int low = high < 0 ? -1 : search_hex_digit(c[2]);
+                if (low < 0)
+                    return -1;
+                bytes[size++] = (uint8_t)(high << 4 | low);
+                c += 2;
+                break;
+            }
+            default:
+                return -1;
+        }
+    }
+
+    return (int32_t)size;
+}
+
+static int32_t search_add_pattern(SearchPatterns_t* patterns, const char* text, uint32_t capacity)
+{
+    uint8_t bytes[SEARCH_MAX_PATTERN];
+
+    const int32_t size = search_unescape(text, bytes);
+    if (size <= 0) {
+        printf("Invalid search pattern: %s\n", text);
+        return -1;
+    }
+    if (patterns->count == capacity) {
+        printf("Too many search patterns\n");
+        return -1;
+    }
+
+    SearchPattern_t* pattern = &patterns->patterns[patterns->count];
+    pattern->bytes = malloc(size);
+    pattern->name = malloc(strlen(text) + 1);
+    if (!pattern->bytes || !pattern->name) {
+        free(pattern->bytes);
+        free(pattern->name);
+        printf("Failed to allocate a search pattern\n");
+        return -1;
+    }
+    memcpy(pattern->bytes, bytes, size);
+    strcpy(pattern->name, text);
+    pattern->size = (uint32_t)size;
+    pattern->next = SEARCH_NONE;
+
+    patterns->count++;
+    patterns->max_size = max(patterns->max_size, (uint32_t)size);
+
+    return 0;
+}
+
+// Builds the trie of all patterns, then turns it into a full transition table
+// breadth first: a missing transition follows the suffix link of its state.
+static int32_t search_build(SearchPatterns_t* patterns)
+{
+    uint32_t capacity = 1;
+    for (uint32_t i = 0; i < patterns->count; i++)
+        capacity += patterns->patterns[i].size;
+    if (capacity > SEARCH_MAX_STATES) {
+        printf("Search patterns are too long, %u bytes at most\n", SEARCH_MAX_STATES - 1);
+        return -1;
+    }
+
+    patterns->next = calloc((size_t)capacity * 256, sizeof(uint32_t));
+    patterns->fail = calloc(capacity, sizeof(uint32_t));
+    patterns->output = malloc(capacity * sizeof(uint32_t));
+    patterns->report = malloc(capacity * sizeof(uint32_t));
+    uint32_t* queue = malloc(capacity * sizeof(uint32_t));
+    if (!patterns->next || !patterns->fail || !patterns->output || !patterns->report || !queue) {
+        printf("Failed to allocate the search automaton\n");
+        free(queue);
+        return -1;
+    }
+
+    // 0 is the root, no other state has a transition back to it in the trie
+    patterns->state_count = 1;
+    patterns->output[0] = SEARCH_NONE;
+    for (uint32_t i = 0; i < patterns->count; i++) {
+        SearchPattern_t* pattern = &patterns->patterns[i];
+        uint32_t state = 0;
+
+        for (uint32_t j = 0; j < pattern->size; j++) {
+            uint32_t* next = &patterns->next[state * 256 + pattern->bytes[j]];
+            if (!*next) {
+                *next = patterns->state_count++;
+                patterns->output[*next] = SEARCH_NONE;
+            }
+            state = *next;
+        }
+
+        pattern->next = patterns->output[state];
+        patterns->output[state] = i;
+    }
+
+    uint32_t head = 0, tail = 0;
+    patterns->report[0] = SEARCH_NONE;
+    for (uint32_t byte = 0; byte < 256; byte++) {
+        const uint32_t child = patterns->next[byte];
+        if (child) {
+            patterns->first[byte] = 1;
+            patterns->fail[child] = 0;
+            queue[tail++] = child;
+        }
+    }
+
+    while (head < tail) {
+        const uint32_t state = queue[head++];
+        const uint32_t fail = patterns->fail[state];
+
+        patterns->report[state] =
+            patterns->output[state] != SEARCH_NONE ? state : patterns->report[fail];
+
+        for (uint32_t byte = 0; byte < 256; byte++) {
+            uint32_t* next = &patterns->next[state * 256 + byte];
+            if (*next) {
+                patterns->fail[*next] = patterns->next[fail * 256 + byte];
+                queue[tail++] = *next;
+            } else {
+                *next = patterns->next[fail * 256 + byte];
+            }
+        }
+    }
+
+    free(queue);
+
+    return 0;
+}
+
+int32_t search_patterns_load(SearchPatterns_t* patterns, const char* path)
+{
+    const uint32_t default_count =
+        sizeof(c_search_default_patterns) / sizeof(c_search_default_patterns[0]);
+    uint32_t capacity = default_count;
+    char line[SEARCH_MAX_LINE];
+    int32_t result = 0;
+
+    memset(patterns, 0, sizeof(SearchPatterns_t));
+
+    FILE* file = NULL;
+    if (path) {
+        file = fopen(path, "rb");
+        if (!file) {
+            printf("Failed to open %s\n", path);
+            return -1;
+        }
+
+        capacity = 0;
+        while (fgets(line, sizeof(line), file))
+            capacity++;
+        rewind(file);
+    }
+
+    patterns->patterns = calloc(max(capacity, 1u), sizeof(SearchPattern_t));
+    if (!patterns->patterns) {
+        printf("Failed to allocate search patterns\n");
+        if (file)
+            fclose(file);
+        return -1;
+    }
+
+    if (!file) {
+        for (uint32_t i = 0; i < default_count && result == 0; i++)
+            result = search_add_pattern(patterns, c_search_default_patterns[i], capacity);
+    } else {
+        while (result == 0 && fgets(line, sizeof(line), file)) {
+            line[strcspn(line, "\r\n")] = '\0';
+            if (line[0] && line[0] != '#')
+                result = search_add_pattern(patterns, line, capacity);
+        }
+        fclose(file);
+
+        if (result == 0 && !patterns->count) {
+            printf("%s has no search patterns\n", path);
+            result = -1;
+        }
+    }
+
+    if (result == 0)
+        result = search_build(patterns);
+    if (result < 0)
+        search_patterns_free(patterns);
+
+    return result;
+}
+
+void search_patterns_free(SearchPatterns_t* patterns)
+{
+    for (uint32_t i = 0; patterns->patterns && i < patterns->count; i++) {
+        free(patterns->patterns[i].bytes);
+        free(patterns->patterns[i].name);
+    }
+
+    free(patterns->patterns);
+    free(patterns->next);
+    free(patterns->fail);
+    free(patterns->output);
+    free(patterns->report);
+    memset(patterns, 0, sizeof(SearchPatterns_t));
+}
+
+// Writer
+
+typedef struct SearchMatch
+{
+    uint32_t offset;
+    uint32_t pattern;
+} SearchMatch_t;
+
+typedef struct SearchString
+{
+    uint32_t offset;
+    uint32_t size;
+} SearchString_t;
+
+typedef struct SearchJob
+{
+    // Owned until the block has been passed on
+    Block_t* block;
+    SearchMatch_t* matches;
+    uint32_t match_count;
+    uint32_t match_capacity;
+    // Strings that neither start nor end at the edges of the block
+    SearchString_t* strings;
+    uint32_t string_count;
+    uint32_t string_capacity;
+    // Printable bytes at the start and at the end of the block, they may
+    // continue a string of the previous block or go on in the next one
+    uint32_t lead;
+    uint32_t trail;
+    int done;
+    int failed;
+
+    struct SearchJob* next_work;
+    struct SearchJob* next;
+} SearchJob_t;
+
+struct SearchWriter
+{
+    FILE* file;
+    const SearchPatterns_t* patterns;
+    uint32_t strings_min;
+    BlockPool_t* pool;
+    SearchSink_t sink;
+    void* sink_ctx;
+
+    Thread_t* threads;
+    uint32_t thread_count;
+    Mutex_t mutex;
+    Cond_t work_ready;
+
+    // Jobs waiting for a worker, and all jobs in submission order
+    SearchJob_t* work_head;
+    SearchJob_t* work_tail;
+    SearchJob_t* order_head;
+    SearchJob_t* order_tail;
+    int draining;
+    int closing;
+    int failed;
+
+    // Only touched by the draining thread. The last bytes before next_address
+    // for matches that straddle blocks, and the string that may go on in the
+    // next block.
+    uint64_t next_address;
+    uint8_t carry[SEARCH_MAX_PATTERN];
+    uint32_t carry_size;
+    uint64_t pending_address;
+    uint32_t pending_size;
+    char pending[SEARCH_MAX_STRING];
+
+    SearchStats_t stats;
+};
+
+static int32_t search_add_match(SearchJob_t* job, uint32_t offset, uint32_t pattern)
+{
+    if (job->match_count == job->match_capacity) {
+        const uint32_t capacity = job->match_capacity ? job->match_capacity * 2 : 0x10;
+        SearchMatch_t* matches = realloc(job->matches, capacity * sizeof(SearchMatch_t));
+        if (!matches)
+            return -1;
+        job->matches = matches;
+        job->match_capacity = capacity;
+    }
+
+    job->matches[job->match_count].offset = offset;
+    job->matches[job->match_count].pattern = pattern;
+    job->match_count++;
+
+    return 0;
+}
+
+static int32_t search_add_string(SearchJob_t* job, uint32_t offset, uint32_t size)
+{
+    if (job->string_count == job->string_capacity) {
+        const uint32_t capacity = job->string_capacity ? job->string_capacity * 2 : 0x10;
+        SearchString_t* strings = realloc(job->strings, capacity * sizeof(SearchString_t));
+        if (!strings)
+            return -1;
+        job->strings = strings;
+        job->string_capacity = capacity;
+    }
+
+    job->strings[job->string_count].offset = offset;
+    job->strings[job->string_count].size = size;
+    job->string_count++;
+
+    return 0;
+}
+
+static int32_t search_patterns_in(const SearchPatterns_t* patterns,
+                                  const uint8_t* data,
+                                  uint32_t size,
+                                  SearchJob_t* job)
+{
+    const uint32_t* next = patterns->next;
+    const uint32_t* report = patterns->report;
+    uint32_t state = 0;
+
+    for (uint32_t i = 0; i < size; i++) {
+        // Most bytes cannot start a match at all
+        if (!state) {
+            while (i < size && !patterns->first[data[i]])
+                i++;
+            if (i == size)
+                break;
+        }
+
+        state = next[state * 256 + data[i]];
+
+        for (uint32_t found = report[state]; found != SEARCH_NONE;
+             found = report[patterns->fail[found]]) {
+            for (uint32_t id = patterns->output[found]; id != SEARCH_NONE;
+                 id = patterns->patterns[id].next) {
+                if (search_add_match(job, i + 1 - patterns->patterns[id].size, id) < 0)
+                    return -1;
+            }
+        }
+    }
+
+    return 0;
+}
+
+static int32_t search_strings_in(const uint8_t* data,
+                                 uint32_t size,
+                                 uint32_t strings_min,
+                                 SearchJob_t* job)
+{
+    uint32_t lead = 0;
+    while (lead < size && g_printable[data[lead]])
+        lead++;
+    job->lead = lead;
+    job->trail = lead;
+    if (lead == size)
+        return 0;
+
+    uint32_t end = size;
+    while (g_printable[data[end - 1]])
+        end--;
+    job->trail = size - end;
+
+    for (uint32_t i = lead; i < end;) {
+        while (i < end && !g_printable[data[i]])
+            i++;
+
+        const uint32_t start = i;
+        while (i < end && g_printable[data[i]])
+            i++;
+
+        if (i - start >= strings_min && search_add_string(job, start, i - start) < 0)
+            return -1;
+    }
+
+    return 0;
+}
+
+static void search_block(const SearchWriter_t* writer, SearchJob_t* job)
+{
+    const Block_t* block = job->block;
+
+    // Zero bytes are not printable, and usually start no pattern either
+    if (zero_check(block->data, block->size) &&
+        (!writer->patterns || !writer->patterns->first[0]))
+        return;
+
+    if (writer->patterns &&
+        search_patterns_in(writer->patterns, block->data, block->size, job) < 0)
+        job->failed = 1;
+    if (writer->strings_min &&
+        search_strings_in(block->data, block->size, writer->strings_min, job) < 0)
+        job->failed = 1;
+}
+
+static int32_t search_write_string(SearchWriter_t* writer,
+                                   uint64_t address,
+                                   uint32_t size,
+                                   const char* text)
+{
+    writer->stats.strings++;
+
+    return fprintf(writer->file,
+                   "string 0x%llX 0x%X %.*s\n",
+                   (unsigned long long)address,
+                   size,
+                   (int)min(size, (uint32_t)SEARCH_MAX_STRING),
+                   text) < 0
+               ? -1
+               : 0;
+}
+
+static int32_t search_write_match(SearchWriter_t* writer, uint64_t address, uint32_t pattern)
+{
+    writer->stats.matches++;
+
+    return fprintf(writer->file,
+                   "match 0x%llX %s\n",
+                   (unsigned long long)address,
+                   writer->patterns->patterns[pattern].name) < 0
+               ? -1
+               : 0;
+}
+
+static int32_t search_close_pending(SearchWriter_t* writer)
+{
+    const uint32_t size = writer->pending_size;
+
+    writer->pending_size = 0;
+    if (size < writer->strings_min || !size)
+        return 0;
+
+    return search_write_string(writer, writer->pending_address, size, writer->pending);
+}
+
+static void search_extend_pending(SearchWriter_t* writer,
+                                  uint64_t address,
+                                  const uint8_t* data,
+                                  uint32_t size)
+{
+    if (!writer->pending_size)
+        writer->pending_address = address;
+
+    if (writer->pending_size < SEARCH_MAX_STRING)
+        memcpy(writer->pending + writer->pending_size,
+               data,
+               min(size, SEARCH_MAX_STRING - writer->pending_size));
+    writer->pending_size += size;
+}
+
+// Matches that start in the carried bytes of the previous block and end in
+// this one
+static int32_t search_straddling(SearchWriter_t* writer, const Block_t* block)
+{
+    const SearchPatterns_t* patterns = writer->patterns;
+    uint8_t window[SEARCH_MAX_PATTERN * 2];
+    SearchJob_t found = { 0 };
+    int32_t result = 0;
+
+    const uint32_t head = min(block->size, patterns->max_size - 1);
+    memcpy(window, writer->carry, writer->carry_size);
+    memcpy(window + writer->carry_size, block->data, head);
+
+    if (search_patterns_in(patterns, window, writer->carry_size + head, &found) < 0)
+        result = -1;
+
+    for (uint32_t i = 0; i < found.match_count && result == 0; i++) {
+        const SearchMatch_t* match = &found.matches[i];
+        const uint32_t end = match->offset + patterns->patterns[match->pattern].size;
+
+        if (match->offset < writer->carry_size && end > writer->carry_size)
+            result = search_write_match(
+                writer, block->address - writer->carry_size + match->offset, match->pattern);
+    }
+    free(found.matches);
+
+    return result;
+}
+
+// Keeps the last max_size - 1 bytes of everything passed on so far
+static void search_update_carry(SearchWriter_t* writer, const Block_t* block)
+{
+    const uint32_t keep = writer->patterns->max_size - 1;
+
+    if (block->size >= keep) {
+        memcpy(writer->carry, block->data + block->size - keep, keep);
+    } else {
+        const uint32_t old = min(writer->carry_size, keep - block->size);
+        memmove(writer->carry, writer->carry + writer->carry_size - old, old);
+        memcpy(writer->carry + old, block->data, block->size);
+        writer->carry_size = old + block->size;
+        return;
+    }
+    writer->carry_size = keep;
+}
+
+static int32_t search_pass_on(SearchWriter_t* writer, SearchJob_t* job)
+{
+    Block_t* block = job->block;
+    int32_t result = job->failed ? -1 : 0;
+
+    // Blocks that do not follow each other, after a resume, share nothing
+    if (block->address != writer->next_address) {
+        writer->carry_size = 0;
+        if (search_close_pending(writer) < 0)
+            result = -1;
+    }
+
+    if (result == 0 && writer->patterns) {
+        if (writer->carry_size && search_straddling(writer, block) < 0)
+            result = -1;
+
+        for (uint32_t i = 0; i < job->match_count && result == 0; i++)
+            result = search_write_match(
+                writer, block->address + job->matches[i].offset, job->matches[i].pattern);
+
+        search_update_carry(writer, block);
+    }
+
+    if (result == 0 && writer->strings_min) {
+        search_extend_pending(writer, block->address, block->data, job->lead);
+
+        if (job->lead < block->size) {
+            result = search_close_pending(writer);
+
+            for (uint32_t i = 0; i < job->string_count && result == 0; i++) {
+                const SearchString_t* string = &job->strings[i];
+                result = search_write_string(writer,
+                                             block->address + string->offset,
+                                             string->size,
+                                             (const char*)block->data + string->offset);
+            }
+
+            search_extend_pending(writer,
+                                  block->address + block->size - job->trail,
+                                  block->data + block->size - job->trail,
+                                  job->trail);
+        }
+    }
+    writer->next_address = block->address + block->size;
+
+    if (result < 0) {
+        block_pool_release(writer->pool, block);
+        return -1;
+    }
+
+    return writer->sink(writer->sink_ctx, block);
+}
+
+// Passes on every searched block at the head of the order list. Called with
+// the mutex held, only one thread drains at a time.
+static void search_drain(SearchWriter_t* writer)
+{
+    while (!writer->draining && writer->order_head && writer->order_head->done) {
+        SearchJob_t* ready = writer->order_head;
+        SearchJob_t* last = ready;
+        while (last->next && last->next->done)
+            last = last->next;
+
+        writer->order_head = last->next;
+        if (!writer->order_head)
+            writer->order_tail = NULL;
+        last->next = NULL;
+
+        writer->draining = 1;
+        int failed = writer->failed;
+        mutex_unlock(&writer->mutex);
+
+        while (ready) {
+            SearchJob_t* job = ready;
+            ready = job->next;
+
+            if (failed)
+                block_pool_release(writer->pool, job->block);
+            else if (search_pass_on(writer, job) < 0)
+                failed = 1;
+
+            free(job->matches);
+            free(job->strings);
+            free(job);
+        }
+
+        mutex_lock(&writer->mutex);
+        writer->draining = 0;
+        writer->failed |= failed;
+    }
+}
+
+static void search_worker(void* arg)
+{
+    SearchWriter_t* writer = arg;
+
+    mutex_lock(&writer->mutex);
+
+    for (;;) {
+        while (!writer->work_head && !writer->closing)
+            cond_wait(&writer->work_ready, &writer->mutex);
+
+        SearchJob_t* job = writer->work_head;
+        if (!job)
+            break;
+
+        writer->work_head = job->next_work;
+        if (!writer->work_head)
+            writer->work_tail = NULL;
+
+        mutex_unlock(&writer->mutex);
+
+        const uint64_t start_ns = clock_now_ns();
+        search_block(writer, job);
+        const uint64_t scan_ns = clock_now_ns() - start_ns;
+
+        mutex_lock(&writer->mutex);
+        writer->stats.scan_ns += scan_ns;
+        job->done = 1;
+
+        search_drain(writer);
+    }
+
+    mutex_unlock(&writer->mutex);
+}
+
+SearchWriter_t* search_writer_open(const char* output_path,
+                                   uint64_t start_address,
+                                   uint64_t end_address,
+                                   const SearchPatterns_t* patterns,
+                                   uint32_t strings_min,
+                                   uint32_t threads,
+                                   int truncate,
+                                   BlockPool_t* pool,
+                                   SearchSink_t sink,
+                                   void* sink_ctx)
+{
+    char path[SEARCH_MAX_PATH];
+    snprintf(path, sizeof(path), "%s%s", output_path, SEARCH_SUFFIX);
+
+    SearchWriter_t* writer = calloc(1, sizeof(SearchWriter_t));
+    if (!writer) {
+        printf("Failed to allocate search writer\n");
+        return NULL;
+    }
+
+    writer->file = truncate ? NULL : fopen(path, "ab");
+    if (!writer->file) {
+        writer->file = fopen(path, "wb");
+        if (writer->file)
+            fprintf(writer->file,
+                    "range 0x%llX 0x%llX\n",
+                    (unsigned long long)start_address,
+                    (unsigned long long)end_address);
+    }
+    if (!writer->file) {
+        printf("Failed to open %s\n", path);
+        free(writer);
+        return NULL;
+    }
+
+    if (!g_printable_ready)
+        search_build_printable();
+
+    writer->patterns = patterns;
+    writer->strings_min = strings_min;
+    writer->pool = pool;
+    writer->sink = sink;
+    writer->sink_ctx = sink_ctx;
+    writer->next_address = start_address;
+    writer->thread_count = min(max(threads, 1u), (uint32_t)SEARCH_MAX_THREADS);
+    writer->stats.threads = writer->thread_count;
+
+    mutex_init(&writer->mutex);
+    cond_init(&writer->work_ready);
+
+    writer->threads = calloc(writer->thread_count, sizeof(Thread_t));
+    for (uint32_t i = 0; writer->threads && i < writer->thread_count; i++) {
+        if (thread_create(&writer->threads[i], search_worker, writer) < 0) {
+            printf("Failed to start search thread\n");
+            writer->thread_count = i;
+            break;
+        }
+    }
+
+    if (!writer->threads || !writer->thread_count) {
+        search_writer_drain(writer);
+        search_writer_close(writer, NULL);
+        return NULL;
+    }
+
+    return writer;
+}
+
+int32_t search_writer_submit(SearchWriter_t* writer, Block_t* block)
+{
+    SearchJob_t* job = calloc(1, sizeof(SearchJob_t));
+
+    mutex_lock(&writer->mutex);
+
+    if (!job || writer->failed) {
+        mutex_unlock(&writer->mutex);
+        block_pool_release(writer->pool, block);
+        free(job);
+        return -1;
+    }
+
+    job->block = block;
+
+    if (writer->work_tail)
+        writer->work_tail->next_work = job;
+    else
+        writer->work_head = job;
+    writer->work_tail = job;
+
+    if (writer->order_tail)
+        writer->order_tail->next = job;
+    else
+        writer->order_head = job;
+    writer->order_tail = job;
+
+    writer->stats.blocks++;
+    writer->stats.bytes += block->size;
+
+    cond_signal(&writer->work_ready);
+    mutex_unlock(&writer->mutex);
+
+    return 0;
+}
+
+int32_t search_writer_drain(SearchWriter_t* writer)
+{
+    mutex_lock(&writer->mutex);
+    writer->closing = 1;
+    cond_broadcast(&writer->work_ready);
+    mutex_unlock(&writer->mutex);
+
+    for (uint32_t i = 0; i < writer->thread_count; i++)
+        thread_join(&writer->threads[i]);
+    writer->thread_count = 0;
+
+    return writer->failed ? -1 : 0;
+}
+
+int32_t search_writer_close(SearchWriter_t* writer, SearchStats_t* stats)
+{
+    int32_t result = writer->failed ? -1 : 0;
+
+    // A string at the very end of the range
+    if (result == 0 && search_close_pending(writer) < 0)
+        result = -1;
+    if (fclose(writer->file) != 0)
+        result = -1;
+
+    if (stats)
+        *stats = writer->stats;
+
+    mutex_destroy(&writer->mutex);
+    cond_destroy(&writer->work_ready);
+    free(writer->threads);
+    free(writer);
+
+    return result;
+}
+
+void search_print_stats(const char* output_path, const SearchStats_t* stats)
+{
+    printf("%s%s : %llu matches, %llu strings in %llu blocks searched on %u threads in %.1f ms "
+           "of CPU time\n",
+           output_path,
+           SEARCH_SUFFIX,
+           (unsigned long long)stats->matches,
+           (unsigned long long)stats->strings,
+           (unsigned long long)stats->blocks,
+           stats->threads,
+           (double)stats->scan_ns / 1e6);
+}
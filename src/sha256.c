@@ -0,0 +1,245 @@
+#include "sha256.h"
+
+#include <string.h>
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#include <cpuid.h>
+#include <immintrin.h>
+#define SHA256_HAVE_SHANI 1
+#endif
+
+typedef void (*Sha256Blocks_t)(uint32_t* state, const uint8_t* data, size_t blocks);
+
+static const uint32_t c_sha256_k[64] = {
+    0x428A2F98, 0x71374491, 0xB5C0FBCF, 0xE9B5DBA5, 0x3956C25B, 0x59F111F1, 0x923F82A4,
+    0xAB1C5ED5, 0xD807AA98, 0x12835B01, 0x243185BE, 0x550C7DC3, 0x72BE5D74, 0x80DEB1FE,
+    0x9BDC06A7, 0xC19BF174, 0xE49B69C1, 0xEFBE4786, 0x0FC19DC6, 0x240CA1CC, 0x2DE92C6F,
+    0x4A7484AA, 0x5CB0A9DC, 0x76F988DA, 0x983E5152, 0xA831C66D, 0xB00327C8, 0xBF597FC7,
+    0xC6E00BF3, 0xD5A79147, 0x06CA6351, 0x14292967, 0x27B70A85, 0x2E1B2138, 0x4D2C6DFC,
+    0x53380D13, 0x650A7354, 0x766A0ABB, 0x81C2C92E, 0x92722C85, 0xA2BFE8A1, 0xA81A664B,
+    0xC24B8B70, 0xC76C51A3, 0xD192E819, 0xD6990624, 0xF40E3585, 0x106AA070, 0x19A4C116,
+    0x1E376C08, 0x2748774C, 0x34B0BCB5, 0x391C0CB3, 0x4ED8AA4A, 0x5B9CCA4F, 0x682E6FF3,
+    0x748F82EE, 0x78A5636F, 0x84C87814, 0x8CC70208, 0x90BEFFFA, 0xA4506CEB, 0xBEF9A3F7,
+    0xC67178F2,
+};
+
+static const uint32_t c_sha256_iv[8] = {
+    0x6A09E667, 0xBB67AE85, 0x3C6EF372, 0xA54FF53A, 0x510E527F, 0x9B05688C, 0x1F83D9AB, 0x5BE0CD19,
+};
+
+static uint32_t sha256_rotr(uint32_t x, uint32_t n)
+{
+    return (x >> n) | (x << (32 - n));
+}
+
+static void sha256_blocks_scalar(uint32_t* state, const uint8_t* data, size_t blocks)
+{
+    uint32_t w[64];
+
+    for (; blocks; blocks--, data += SHA256_BLOCK_SIZE) {
+        for (uint32_t i = 0; i < 16; i++)
+            w[i] = ((uint32_t)data[i * 4] << 24) | ((uint32_t)data[i * 4 + 1] << 16) |
+                   ((uint32_t)data[i * 4 + 2] << 8) | data[i * 4 + 3];
+
+        for (uint32_t i = 16; i < 64; i++) {
+            const uint32_t s0 =
+                sha256_rotr(w[i - 15], 7) ^ sha256_rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+            const uint32_t s1 =
+                sha256_rotr(w[i - 2], 17) ^ sha256_rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+            w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+        }
+
+        uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+        uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+
+        for (uint32_t i = 0; i < 64; i++) {
+            const uint32_t s1 = sha256_rotr(e, 6) ^ sha256_rotr(e, 11) ^ sha256_rotr(e, 25);
+            const uint32_t t1 = h + s1 + ((e & f) ^ (~e & g)) + c_sha256_k[i] + w[i];
+            const uint32_t s0 = sha256_rotr(a, 2) ^ sha256_rotr(a, 13) ^ sha256_rotr(a, 22);
+            const uint32_t t2 = s0 + ((a & b) ^ (a & c) ^ (b & c));
+
+            h = g;
+            g = f;
+            f = e;
+            e = d + t1;
+            d = c;
+            c = b;
+            b = a;
+            a = t1 + t2;
+        }
+
+        state[0] += a;
+        state[1] += b;
+        state[2] += c;
+        state[3] += d;
+        state[4] += e;
+        state[5] += f;
+        state[6] += g;
+        state[7] += h;
+    }
+}
+
+#ifdef SHA256_HAVE_SHANI
+// Four rounds per step, the state is kept as ABEF and CDGH as the
+// instructions expect it
+__attribute__((target("sha,sse4.1"))) static void sha256_blocks_shani(uint32_t* state,
+                                                                      const uint8_t* data,
+                                                                      size_t blocks)
+{
+    const __m128i byte_swap = _mm_set_epi64x(0x0C0D0E0F08090A0Bll, 0x0405060700010203ll);
+    __m128i msg[4];
+
+    __m128i tmp = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)&state[0]), 0xB1);
+    __m128i state1 = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)&state[4]), 0x1B);
+    __m128i state0 = _mm_alignr_epi8(tmp, state1, 8);
+    state1 = _mm_blend_epi16(state1, tmp, 0xF0);
+
+    for (; blocks; blocks--, data += SHA256_BLOCK_SIZE) {
+        const __m128i abef = state0;
+        const __m128i cdgh = state1;
+
+        for (uint32_t i = 0; i < 16; i++) {
+            __m128i* current = &msg[i % 4];
+
+            if (i < 4) {
+                *current = _mm_shuffle_epi8(
+                    _mm_loadu_si128((const __m128i*)(data + i * 16)), byte_swap);
+            } else {
+                const __m128i previous = msg[(i + 3) % 4];
+                *current = _mm_sha256msg1_epu32(*current, msg[(i + 1) % 4]);
+                *current =
+                    _mm_add_epi32(*current, _mm_alignr_epi8(previous, msg[(i + 2) % 4], 4));
+                *current = _mm_sha256msg2_epu32(*current, previous);
+            }
+
+            __m128i round =
+                _mm_add_epi32(*current, _mm_loadu_si128((const __m128i*)&c_sha256_k[i * 4]));
+            state1 = _mm_sha256rnds2_epu32(state1, state0, round);
+            round = _mm_shuffle_epi32(round, 0x0E);
+            state0 = _mm_sha256rnds2_epu32(state0, state1, round);
+        }
+
+        state0 = _mm_add_epi32(state0, abef);
+        state1 = _mm_add_epi32(state1, cdgh);
+    }
+
+    tmp = _mm_shuffle_epi32(state0, 0x1B);
+    state1 = _mm_shuffle_epi32(state1, 0xB1);
+    _mm_storeu_si128((__m128i*)&state[0], _mm_blend_epi16(tmp, state1, 0xF0));
+    _mm_storeu_si128((__m128i*)&state[4], _mm_alignr_epi8(state1, tmp, 8));
+}
+
+static int sha256_cpu_has_shani(void)
+{
+    unsigned int eax, ebx, ecx, edx;
+
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx) || !(ecx & bit_SSE4_1))
+        return 0;
+    if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx))
+        return 0;
+
+    return (ebx & bit_SHA) != 0;
+}
+#endif
+
+static Sha256Blocks_t sha256_select(const char** name)
+{
+#ifdef SHA256_HAVE_SHANI
+    if (sha256_cpu_has_shani()) {
+        *name = "sha-ni";
+        return sha256_blocks_shani;
+    }
+#endif
+    *name = "scalar";
+    return sha256_blocks_scalar;
+}
+
+static Sha256Blocks_t g_sha256_blocks;
+static const char* g_sha256_name;
+
+static void sha256_blocks(uint32_t* state, const uint8_t* data, size_t blocks)
+{
+    // Selecting twice from different threads is harmless
+    if (!g_sha256_blocks)
+        g_sha256_blocks = sha256_select(&g_sha256_name);
+
+    g_sha256_blocks(state, data, blocks);
+}
+
+void sha256_init(Sha256_t* ctx)
+{
+    memcpy(ctx->state, c_sha256_iv, sizeof(ctx->state));
+    ctx->length = 0;
+    ctx->buffered = 0;
+}
+
+void sha256_update(Sha256_t* ctx, const void* data, size_t size)
+{
+    const uint8_t* in = data;
+
+    ctx->length += size;
+
+    if (ctx->buffered) {
+        const size_t count = (size < SHA256_BLOCK_SIZE - ctx->buffered)
+                                 ? size
+                                 : SHA256_BLOCK_SIZE - ctx->buffered;
+        memcpy(ctx->buffer + ctx->buffered, in, count);
+        ctx->buffered += count;
+        in += count;
+        size -= count;
+
+        if (ctx->buffered < SHA256_BLOCK_SIZE)
+            return;
+
+        sha256_blocks(ctx->state, ctx->buffer, 1);
+        ctx->buffered = 0;
+    }
+
+    // Whole blocks straight from the input
+    const size_t blocks = size / SHA256_BLOCK_SIZE;
+    if (blocks) {
+        sha256_blocks(ctx->state, in, blocks);
+        in += blocks * SHA256_BLOCK_SIZE;
+        size -= blocks * SHA256_BLOCK_SIZE;
+    }
+
+    memcpy(ctx->buffer, in, size);
+    ctx->buffered = size;
+}
+
+void sha256_final(Sha256_t* ctx, uint8_t* digest)
+{
+    const uint64_t bits = ctx->length * 8;
+
+    // 0x80, zeros up to 56 mod 64, then the big-endian bit length
+    ctx->buffer[ctx->buffered++] = 0x80;
+    if (ctx->buffered > SHA256_BLOCK_SIZE - 8) {
+        memset(ctx->buffer + ctx->buffered, 0, SHA256_BLOCK_SIZE - ctx->buffered);
+        sha256_blocks(ctx->state, ctx->buffer, 1);
+        ctx->buffered = 0;
+    }
+    memset(ctx->buffer + ctx->buffered, 0, SHA256_BLOCK_SIZE - 8 - ctx->buffered);
+    for (uint32_t i = 0; i < 8; i++)
+        ctx->buffer[SHA256_BLOCK_SIZE - 1 - i] = (uint8_t)(bits >> (8 * i));
+    sha256_blocks(ctx->state, ctx->buffer, 1);
+
+    for (uint32_t i = 0; i < SHA256_DIGEST_SIZE; i++)
+        digest[i] = (uint8_t)(ctx->state[i / 4] >> (24 - 8 * (i % 4)));
+}
+
+void sha256(uint8_t* digest, const void* data, size_t size)
+{
+    Sha256_t ctx;
+
+    sha256_init(&ctx);
+    sha256_update(&ctx, data, size);
+    sha256_final(&ctx, digest);
+}
+
+const char* sha256_impl(void)
+{
+    if (!g_sha256_blocks)
+        g_sha256_blocks = sha256_select(&g_sha256_name);
+
+    return g_sha256_name;
+}
@@ -0,0 +1,553 @@
+#define _CRT_SECURE_NO_WARNINGS
+#define _FILE_OFFSET_BITS 64
+#ifdef __linux__
+#define _GNU_SOURCE
+#endif
+
+#include "sink.h"
+#include "pool.h"
+#include "writer.h"
+#include "xxh64.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+
+#define SINK_MAX_HOST 0x100
+
+int sink_is_stream(const char* path)
+{
+    if (!strcmp(path, SINK_STDOUT) || !strncmp(path, SINK_TCP_PREFIX, strlen(SINK_TCP_PREFIX)))
+        return 1;
+
+#ifndef _WIN32
+    struct stat st;
+    if (stat(path, &st) == 0 && S_ISFIFO(st.st_mode))
+        return 1;
+#endif
+
+    return 0;
+}
+
+#ifndef _WIN32
+
+// The real stdout once sink_reserve_stdout() moved the program's output away
+static int g_sink_stdout_fd = -1;
+
+int32_t sink_reserve_stdout(void)
+{
+    fflush(stdout);
+
+    g_sink_stdout_fd = dup(STDOUT_FILENO);
+    if (g_sink_stdout_fd < 0 || dup2(STDERR_FILENO, STDOUT_FILENO) < 0) {
+        fprintf(stderr, "Failed to redirect stdout\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+static int32_t sink_write_all(int fd, struct iovec* iov, int count)
+{
+    while (count) {
+        const ssize_t written = writev(fd, iov, count);
+        if (written < 0 && errno == EINTR)
+            continue;
+        if (written <= 0)
+            return -1;
+
+        // Skip what went out, finish a vector that only partly did
+        size_t remaining = (size_t)written;
+        while (count && remaining >= iov->iov_len) {
+            remaining -= iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count) {
+            iov->iov_base = (uint8_t*)iov->iov_base + remaining;
+            iov->iov_len -= remaining;
+        }
+    }
+
+    return 0;
+}
+
+// Returns 1 once size bytes were read, 0 at the end of the stream before the
+// first byte and -1 otherwise
+static int32_t sink_read_all(int fd, void* data, size_t size)
+{
+    size_t done = 0;
+
+    while (done < size) {
+        const ssize_t got = read(fd, (uint8_t*)data + done, size - done);
+        if (got < 0 && errno == EINTR)
+            continue;
+        if (got < 0)
+            return -1;
+        if (got == 0)
+            return done ? -1 : 0;
+
+        done += (size_t)got;
+    }
+
+    return 1;
+}
+
+// Splits "[<host>:]<port>", host may be in brackets for IPv6
+static int32_t sink_split_address(const char* spec, char* host, const char** port)
+{
+    const char* colon = strrchr(spec, ':');
+
+    host[0] = '\0';
+    if (!colon) {
+        *port = spec;
+        return 0;
+    }
+
+    size_t length = (size_t)(colon - spec);
+    if (length >= 2 && spec[0] == '[' && spec[length - 1] == ']') {
+        spec++;
+        length -= 2;
+    }
+    if (length >= SINK_MAX_HOST)
+        return -1;
+
+    memcpy(host, spec, length);
+    host[length] = '\0';
+    *port = colon + 1;
+
+    return 0;
+}
+
+// Connects to tcp:<host>:<port>, or accepts a single connection on
+// tcp:[<host>:]<port> if listen is set
+static int sink_open_tcp(const char* spec, int listen_mode)
+{
+    char host[SINK_MAX_HOST];
+    const char* port;
+    struct addrinfo hints;
+    struct addrinfo* addresses;
+    int fd = -1;
+
+    if (sink_split_address(spec, host, &port) < 0 || !*port || (!listen_mode && !host[0])) {
+        printf("Invalid TCP address: %s\n", spec);
+        return -1;
+    }
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = listen_mode ? AI_PASSIVE : 0;
+
+    const int error = getaddrinfo(host[0] ? host : NULL, port, &hints, &addresses);
+    if (error != 0) {
+        printf("Failed to resolve %s: %s\n", spec, gai_strerror(error));
+        return -1;
+    }
+
+    for (struct addrinfo* address = addresses; address && fd < 0; address = address->ai_next) {
+        fd = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+        if (fd < 0)
+            continue;
+
+        int connected;
+        if (listen_mode) {
+            const int reuse = 1;
+            setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+            connected = bind(fd, address->ai_addr, address->ai_addrlen) == 0 && listen(fd, 1) == 0;
+        } else {
+            connected = connect(fd, address->ai_addr, address->ai_addrlen) == 0;
+        }
+
+        if (!connected) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(addresses);
+
+    if (fd < 0) {
+        printf("Failed to %s %s\n", listen_mode ? "listen on" : "connect to", spec);
+        return -1;
+    }
+    if (!listen_mode)
+        return fd;
+
+    printf("Waiting for a stream on %s\n", spec);
+    const int client = accept(fd, NULL, NULL);
+    close(fd);
+    if (client < 0)
+        printf("Failed to accept a connection on %s\n", spec);
+
+    return client;
+}
+
+static int sink_open_fd(const char* path, int output)
+{
+    if (!strcmp(path, SINK_STDOUT)) {
+        if (!output)
+            return dup(STDIN_FILENO);
+        return dup(g_sink_stdout_fd >= 0 ? g_sink_stdout_fd : STDOUT_FILENO);
+    }
+
+    if (!strncmp(path, SINK_TCP_PREFIX, strlen(SINK_TCP_PREFIX)))
+        return sink_open_tcp(path + strlen(SINK_TCP_PREFIX), !output);
+
+    // Opening a FIFO blocks until the other end is opened too
+    if (output)
+        printf("Waiting for a reader on %s\n", path);
+    const int fd = open(path, output ? O_WRONLY : O_RDONLY);
+    if (fd < 0)
+        printf("Failed to open %s\n", path);
+
+    return fd;
+}
+
+// Writer backend
+
+typedef struct SinkBackend
+{
+    WriterBackend_t backend;
+    int fd;
+    const char* path;
+    uint64_t start_address;
+    uint64_t end_address;
+    // Covered by DATA and HOLE frames so far
+    uint64_t sent_bytes;
+    uint64_t frames;
+    uint64_t wire_bytes;
+    SinkFrame_t headers[WRITER_MAX_RUN];
+    struct iovec iov[WRITER_MAX_RUN * 2];
+} SinkBackend_t;
+
+static void sink_frame(SinkFrame_t* frame,
+                       SinkFrameType_t type,
+                       uint64_t address,
+                       uint64_t length,
+                       uint64_t value)
+{
+    frame->magic = SINK_MAGIC;
+    frame->type = (uint16_t)type;
+    frame->version = SINK_VERSION;
+    frame->address = address;
+    frame->length = length;
+    frame->value = value;
+}
+
+static int32_t sink_send(SinkBackend_t* sink, struct iovec* iov, int count)
+{
+    for (int i = 0; i < count; i++)
+        sink->wire_bytes += iov[i].iov_len;
+
+    if (sink_write_all(sink->fd, iov, count) < 0) {
+        printf("Failed to send to %s\n", sink->path);
+        return -1;
+    }
+
+    return 0;
+}
+
+// Sends a frame without payload
+static int32_t sink_send_frame(
+    SinkBackend_t* sink, SinkFrameType_t type, uint64_t address, uint64_t length, uint64_t value)
+{
+    SinkFrame_t frame;
+    struct iovec iov = { &frame, sizeof(frame) };
+
+    sink_frame(&frame, type, address, length, value);
+    sink->frames++;
+
+    return sink_send(sink, &iov, 1);
+}
+
+// A run goes out in a single vectored write, a header before every block
+static int32_t sink_write(WriterBackend_t* backend, Block_t** blocks, uint32_t count)
+{
+    SinkBackend_t* sink = backend->priv;
+
+    for (uint32_t i = 0; i < count; i++) {
+        sink_frame(&sink->headers[i],
+                   SINK_FRAME_DATA,
+                   sink->start_address + blocks[i]->offset,
+                   blocks[i]->size,
+                   xxh64(blocks[i]->data, blocks[i]->size, 0));
+        sink->iov[i * 2].iov_base = &sink->headers[i];
+        sink->iov[i * 2].iov_len = sizeof(SinkFrame_t);
+        sink->iov[i * 2 + 1].iov_base = blocks[i]->data;
+        sink->iov[i * 2 + 1].iov_len = blocks[i]->size;
+    }
+
+    const int32_t result = sink_send(sink, sink->iov, (int)count * 2);
+    for (uint32_t i = 0; i < count; i++) {
+        if (result == 0)
+            sink->sent_bytes += blocks[i]->size;
+        backend->done(backend->done_ctx, blocks[i], result);
+    }
+    sink->frames += count;
+
+    return result;
+}
+
+static int32_t sink_flush(WriterBackend_t* backend)
+{
+    // Nothing is buffered on this side
+    return 0;
+}
+
+static int32_t sink_hole(WriterBackend_t* backend, uint64_t offset, uint64_t size)
+{
+    SinkBackend_t* sink = backend->priv;
+
+    if (sink_send_frame(sink, SINK_FRAME_HOLE, sink->start_address + offset, size, 0) < 0)
+        return -1;
+
+    sink->sent_bytes += size;
+    return 0;
+}
+
+static int32_t sink_close(WriterBackend_t* backend)
+{
+    SinkBackend_t* sink = backend->priv;
+    const uint64_t size = sink->end_address - sink->start_address;
+    int32_t result = 0;
+
+    // Without END the collector knows that the stream broke off
+    if (sink->sent_bytes == size)
+        result = sink_send_frame(sink, SINK_FRAME_END, sink->start_address, size, 0);
+    if (close(sink->fd) != 0)
+        result = -1;
+
+    printf("%s : %llu frames, %.2f MiB sent\n",
+           sink->path,
+           (unsigned long long)sink->frames,
+           (double)sink->wire_bytes / (1024 * 1024));
+
+    free(sink);
+
+    return result;
+}
+
+WriterBackend_t* sink_backend_open(const char* path,
+                                   uint64_t start_address,
+                                   uint64_t end_address,
+                                   uint32_t max_payload)
+{
+    SinkBackend_t* sink = calloc(1, sizeof(SinkBackend_t));
+    if (!sink) {
+        printf("Failed to allocate the sink\n");
+        return NULL;
+    }
+
+    // A collector that goes away fails the next write instead of killing us
+    signal(SIGPIPE, SIG_IGN);
+
+    sink->fd = sink_open_fd(path, 1);
+    if (sink->fd < 0) {
+        free(sink);
+        return NULL;
+    }
+
+    sink->path = path;
+    sink->start_address = start_address;
+    sink->end_address = end_address;
+
+    if (sink_send_frame(
+            sink, SINK_FRAME_BEGIN, start_address, end_address - start_address, max_payload) <
+        0) {
+        close(sink->fd);
+        free(sink);
+        return NULL;
+    }
+
+    sink->backend.name = "stream";
+    sink->backend.write = sink_write;
+    sink->backend.flush = sink_flush;
+    sink->backend.hole = sink_hole;
+    sink->backend.close = sink_close;
+    sink->backend.priv = sink;
+
+    return &sink->backend;
+}
+
+// Collector
+
+static int32_t sink_read_frame(int fd, SinkFrame_t* frame, const char* source)
+{
+    const int32_t result = sink_read_all(fd, frame, sizeof(SinkFrame_t));
+    if (result <= 0)
+        return result;
+
+    if (frame->magic != SINK_MAGIC || frame->version != SINK_VERSION) {
+        printf("%s is not a dump stream\n", source);
+        return -1;
+    }
+
+    return 1;
+}
+
+static int32_t sink_receive_frames(int fd,
+                                   const char* source,
+                                   const SinkFrame_t* begin,
+                                   BlockPool_t* pool,
+                                   Writer_t* writer,
+                                   uint64_t* received_bytes)
+{
+    const uint64_t start_address = begin->address;
+    const uint64_t end_address = begin->address + begin->length;
+    SinkFrame_t frame;
+
+    for (;;) {
+        const int32_t result = sink_read_frame(fd, &frame, source);
+        if (result < 0)
+            return -1;
+        if (result == 0) {
+            printf("%s ended after 0x%llX of 0x%llX bytes\n",
+                   source,
+                   (unsigned long long)*received_bytes,
+                   (unsigned long long)begin->length);
+            return -1;
+        }
+
+        if (frame.type == SINK_FRAME_END) {
+            if (frame.length == begin->length && *received_bytes == begin->length)
+                return 0;
+
+            printf("%s ended with 0x%llX of 0x%llX bytes\n",
+                   source,
+                   (unsigned long long)*received_bytes,
+                   (unsigned long long)begin->length);
+            return -1;
+        }
+
+        if ((frame.type != SINK_FRAME_DATA && frame.type != SINK_FRAME_HOLE) ||
+            frame.address < start_address || frame.length > end_address - frame.address ||
+            (frame.type == SINK_FRAME_DATA && frame.length > pool->blocks[0].capacity)) {
+            printf("Invalid frame at 0x%llX in %s\n", (unsigned long long)frame.address, source);
+            return -1;
+        }
+
+        // Holes are fed to the writer as zero blocks, which it leaves as holes again
+        for (uint64_t done = 0; done < frame.length;) {
+            Block_t* block = block_pool_acquire(pool);
+            block->address = frame.address + done;
+            block->offset = block->address - start_address;
+            const uint64_t remaining = frame.length - done;
+            block->size = (uint32_t)(remaining < block->capacity ? remaining : block->capacity);
+
+            if (frame.type == SINK_FRAME_HOLE) {
+                memset(block->data, 0, block->size);
+            } else if (sink_read_all(fd, block->data, block->size) <= 0) {
+                printf("%s ended in the frame at 0x%llX\n",
+                       source,
+                       (unsigned long long)frame.address);
+                block_pool_release(pool, block);
+                return -1;
+            } else if (xxh64(block->data, block->size, 0) != frame.value) {
+                printf("Frame at 0x%llX in %s is corrupt\n",
+                       (unsigned long long)frame.address,
+                       source);
+                block_pool_release(pool, block);
+                return -1;
+            }
+
+            done += block->size;
+            if (writer_submit(writer, block) < 0)
+                return -1;
+        }
+        *received_bytes += frame.length;
+    }
+}
+
+int32_t sink_receive(const char* source, const char* output_path, WriterBackendType_t type)
+{
+    SinkFrame_t begin;
+    BlockPool_t pool;
+    WriterStats_t stats;
+    uint64_t received_bytes = 0;
+
+    const int fd = sink_open_fd(source, 0);
+    if (fd < 0)
+        return -1;
+
+    const int32_t found = sink_read_frame(fd, &begin, source);
+    if (found <= 0 || begin.type != SINK_FRAME_BEGIN || !begin.length ||
+        begin.value > SINK_MAX_PAYLOAD) {
+        if (found >= 0)
+            printf("%s does not start with a dump\n", source);
+        close(fd);
+        return -1;
+    }
+    printf("Receiving [0x%llX, 0x%llX) from %s\n",
+           (unsigned long long)begin.address,
+           (unsigned long long)(begin.address + begin.length),
+           source);
+
+    const uint32_t capacity =
+        (uint32_t)(begin.value > POOL_ALIGNMENT ? begin.value : POOL_ALIGNMENT);
+    if (block_pool_init(&pool, POOL_DEFAULT_BLOCKS, capacity) < 0) {
+        close(fd);
+        return -1;
+    }
+
+    Writer_t* writer = writer_open(
+        output_path, type, begin.length, WRITER_TRUNCATE | WRITER_SPARSE, &pool, NULL);
+    if (!writer) {
+        block_pool_destroy(&pool);
+        close(fd);
+        return -1;
+    }
+
+    int32_t result = sink_receive_frames(fd, source, &begin, &pool, writer, &received_bytes);
+    close(fd);
+
+    if (writer_close(writer, &stats) < 0) {
+        printf("Failed to write %s\n", output_path);
+        result = -1;
+    }
+    writer_print_stats(output_path, &stats);
+    block_pool_destroy(&pool);
+
+    if (result < 0) {
+        printf("%s is incomplete\n", output_path);
+        return -1;
+    }
+
+    printf("Received 0x%llX bytes into %s\n", (unsigned long long)received_bytes, output_path);
+    return 0;
+}
+
+#else
+
+int32_t sink_reserve_stdout(void)
+{
+    printf("Streaming is not supported on Windows\n");
+    return -1;
+}
+
+WriterBackend_t* sink_backend_open(const char* path,
+                                   uint64_t start_address,
+                                   uint64_t end_address,
+                                   uint32_t max_payload)
+{
+    printf("Streaming is not supported on Windows\n");
+    return NULL;
+}
+
+int32_t sink_receive(const char* source, const char* output_path, WriterBackendType_t type)
+{
+    printf("Streaming is not supported on Windows\n");
+    return -1;
+}
+
+#endif
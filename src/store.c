@@ -0,0 +1,663 @@
+#define _CRT_SECURE_NO_WARNINGS
+#define _FILE_OFFSET_BITS 64
+#ifdef __linux__
+#define _GNU_SOURCE
+#endif
+
+#include "store.h"
+#include "blake2b.h"
+#include "dumper.h"
+#include "zero.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#ifdef _WIN32
+#include <direct.h>
+#include <process.h>
+#define store_fseek _fseeki64
+#define store_ftell _ftelli64
+#define store_getpid _getpid
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#define store_fseek fseeko
+#define store_ftell ftello
+#define store_getpid getpid
+#endif
+
+#define STORE_MAX_PATH 0x200
+#define STORE_MAX_LINE 0x300
+
+static int32_t store_mkdir(const char* path)
+{
+#ifdef _WIN32
+    const int result = _mkdir(path);
+#else
+    const int result = mkdir(path, 0755);
+#endif
+    if (result != 0 && errno != EEXIST) {
+        printf("Failed to create directory %s\n", path);
+        return -1;
+    }
+
+    return 0;
+}
+
+static void store_hash_hex(const uint8_t* hash, char* hex)
+{
+    for (uint32_t i = 0; i < STORE_HASH_SIZE; i++)
+        sprintf(hex + i * 2, "%02x", hash[i]);
+}
+
+static int32_t store_parse_hash(const char* hex, uint8_t* hash)
+{
+    for (uint32_t i = 0; i < STORE_HASH_SIZE; i++) {
+        unsigned int byte;
+        if (sscanf(hex + i * 2, "%2x", &byte) != 1)
+            return -1;
+        hash[i] = (uint8_t)byte;
+    }
+
+    return 0;
+}
+
+static void store_chunk_path(const char* store_path, const char* hex, char* path, size_t size)
+{
+    snprintf(path, size, "%s/%.2s/%s", store_path, hex, hex);
+}
+
+// Writer backend
+
+typedef struct StoreBackend
+{
+    WriterBackend_t backend;
+    FILE* manifest;
+    char store_path[STORE_MAX_PATH];
+    uint64_t start_address;
+    uint64_t end_address;
+    // One bit per <hh> directory that is known to exist
+    uint8_t directories[0x20];
+
+    // Adjacent zero chunks are merged into a single manifest line
+    uint64_t zero_address;
+    uint64_t zero_size;
+
+    uint64_t chunks;
+    uint64_t new_chunks;
+    uint64_t new_bytes;
+    uint64_t dedup_bytes;
+    uint64_t zero_bytes;
+} StoreBackend_t;
+
+static int32_t store_flush_zero(StoreBackend_t* store)
+{
+    if (!store->zero_size)
+        return 0;
+
+    const int result = fprintf(store->manifest,
+                               "zero 0x%llX 0x%llX\n",
+                               (unsigned long long)store->zero_address,
+                               (unsigned long long)store->zero_size);
+    store->zero_size = 0;
+
+    return result < 0 ? -1 : 0;
+}
+
+static int32_t store_add_zero(StoreBackend_t* store, uint64_t address, uint64_t size)
+{
+    store->zero_bytes += size;
+
+    if (store->zero_size && store->zero_address + store->zero_size == address) {
+        store->zero_size += size;
+        return 0;
+    }
+
+    if (store_flush_zero(store) < 0)
+        return -1;
+
+    store->zero_address = address;
+    store->zero_size = size;
+
+    return 0;
+}
+
+// Stores a chunk unless the store already has it. Chunks appear atomically
+// under their final name, so concurrent dumps into the same store are safe.
+static int32_t store_put_chunk(StoreBackend_t* store,
+                               const uint8_t* data,
+                               uint32_t size,
+                               const uint8_t* hash,
+                               const char* hex)
+{
+    char path[STORE_MAX_PATH];
+    char temp_path[STORE_MAX_PATH + 0x20];
+    struct stat st;
+
+    const uint8_t directory = hash[0];
+    if (!(store->directories[directory / 8] & (1 << (directory % 8)))) {
+        snprintf(path, sizeof(path), "%s/%.2s", store->store_path, hex);
+        if (store_mkdir(path) < 0)
+            return -1;
+        store->directories[directory / 8] |= (uint8_t)(1 << (directory % 8));
+    }
+
+    store_chunk_path(store->store_path, hex, path, sizeof(path));
+    if (stat(path, &st) == 0 && (uint64_t)st.st_size == size) {
+        store->dedup_bytes += size;
+        return 0;
+    }
+
+    snprintf(temp_path, sizeof(temp_path), "%s.%d.tmp", path, (int)store_getpid());
+    FILE* file = fopen(temp_path, "wb");
+    if (!file) {
+        printf("Failed to create %s\n", temp_path);
+        return -1;
+    }
+
+    int32_t result = (fwrite(data, 1, size, file) == size) ? 0 : -1;
+    if (fclose(file) != 0)
+        result = -1;
+
+    // Another dump may have stored the same chunk in the meantime
+    if (result == 0 && rename(temp_path, path) != 0 && stat(path, &st) != 0)
+        result = -1;
+
+    if (result < 0) {
+        printf("Failed to store chunk %s\n", path);
+        remove(temp_path);
+        return -1;
+    }
+
+    store->new_chunks++;
+    store->new_bytes += size;
+
+    return 0;
+}
+
+static int32_t store_write_block(StoreBackend_t* store, const Block_t* block)
+{
+    uint8_t hash[STORE_HASH_SIZE];
+    char hex[STORE_HASH_SIZE * 2 + 1];
+
+    for (uint32_t offset = 0; offset < block->size; offset += STORE_CHUNK_SIZE) {
+        const uint8_t* data = block->data + offset;
+        const uint32_t size = min(block->size - offset, (uint32_t)STORE_CHUNK_SIZE);
+        const uint64_t address = block->address + offset;
+
+        store->chunks++;
+
+        if (zero_check(data, size)) {
+            if (store_add_zero(store, address, size) < 0)
+                return -1;
+            continue;
+        }
+
+        blake2b(hash, sizeof(hash), data, size);
+        store_hash_hex(hash, hex);
+
+        if (store_put_chunk(store, data, size, hash, hex) < 0 || store_flush_zero(store) < 0 ||
+            fprintf(store->manifest,
+                    "chunk 0x%llX 0x%X %s\n",
+                    (unsigned long long)address,
+                    size,
+                    hex) < 0)
+            return -1;
+    }
+
+    return 0;
+}
+
+static int32_t store_write(WriterBackend_t* backend, Block_t** blocks, uint32_t count)
+{
+    StoreBackend_t* store = backend->priv;
+    int32_t result = 0;
+
+    for (uint32_t i = 0; i < count; i++) {
+        if (!result)
+            result = store_write_block(store, blocks[i]);
+        backend->done(backend->done_ctx, blocks[i], result);
+    }
+
+    return result;
+}
+
+static int32_t store_flush(WriterBackend_t* backend)
+{
+    StoreBackend_t* store = backend->priv;
+
+    if (store_flush_zero(store) < 0)
+        return -1;
+
+    return fflush(store->manifest) == 0 ? 0 : -1;
+}
+
+static int32_t store_hole(WriterBackend_t* backend, uint64_t offset, uint64_t size)
+{
+    StoreBackend_t* store = backend->priv;
+    return store_add_zero(store, store->start_address + offset, size);
+}
+
+static int32_t store_close(WriterBackend_t* backend)
+{
+    StoreBackend_t* store = backend->priv;
+    int32_t result = store_flush_zero(store);
+
+    if (fclose(store->manifest) != 0)
+        result = -1;
+
+    printf("%s : %llu chunks, %llu new (%.2f MiB), %.2f MiB deduplicated, %.2f MiB zero\n",
+           store->store_path,
+           (unsigned long long)store->chunks,
+           (unsigned long long)store->new_chunks,
+           (double)store->new_bytes / (1024 * 1024),
+           (double)store->dedup_bytes / (1024 * 1024),
+           (double)store->zero_bytes / (1024 * 1024));
+
+    free(store);
+
+    return result;
+}
+
+WriterBackend_t* store_backend_open(const char* store_path,
+                                    const char* manifest_path,
+                                    uint64_t start_address,
+                                    uint64_t end_address,
+                                    int truncate)
+{
+    if (store_mkdir(store_path) < 0)
+        return NULL;
+
+    StoreBackend_t* store = calloc(1, sizeof(StoreBackend_t));
+    if (!store)
+        return NULL;
+
+    // Manifests name the store absolutely so that they can be moved around
+#ifdef _WIN32
+    const int resolved =
+        _fullpath(store->store_path, store_path, sizeof(store->store_path)) != NULL;
+#else
+    char* resolved_path = realpath(store_path, NULL);
+    const int resolved = resolved_path && strlen(resolved_path) < sizeof(store->store_path);
+    if (resolved)
+        strcpy(store->store_path, resolved_path);
+    free(resolved_path);
+#endif
+    if (!resolved) {
+        printf("Failed to resolve %s\n", store_path);
+        free(store);
+        return NULL;
+    }
+
+    store->start_address = start_address;
+    store->end_address = end_address;
+
+    store->manifest = truncate ? NULL : fopen(manifest_path, "ab");
+    if (!store->manifest) {
+        store->manifest = fopen(manifest_path, "wb");
+        if (store->manifest)
+            fprintf(store->manifest,
+                    "store %s\nrange 0x%llX 0x%llX\n",
+                    store->store_path,
+                    (unsigned long long)start_address,
+                    (unsigned long long)end_address);
+    }
+    if (!store->manifest || fflush(store->manifest) != 0) {
+        printf("Failed to open %s\n", manifest_path);
+        if (store->manifest)
+            fclose(store->manifest);
+        free(store);
+        return NULL;
+    }
+
+    store->backend.name = "store";
+    store->backend.write = store_write;
+    store->backend.flush = store_flush;
+    store->backend.hole = store_hole;
+    store->backend.close = store_close;
+    store->backend.priv = store;
+
+    return &store->backend;
+}
+
+// Manifest views
+
+typedef struct StoreEntry
+{
+    uint64_t address;
+    uint64_t size;
+    uint8_t hash[STORE_HASH_SIZE];
+    int zero;
+    // Position in the manifest, later lines win
+    uint32_t line;
+} StoreEntry_t;
+
+typedef struct Manifest
+{
+    char store_path[STORE_MAX_PATH];
+    uint64_t start_address;
+    uint64_t end_address;
+    StoreEntry_t* entries;
+    uint32_t count;
+} Manifest_t;
+
+static int store_entry_compare(const void* a, const void* b)
+{
+    const StoreEntry_t* left = a;
+    const StoreEntry_t* right = b;
+
+    if (left->address != right->address)
+        return left->address < right->address ? -1 : 1;
+
+    return left->line < right->line ? -1 : (left->line > right->line);
+}
+
+static int32_t manifest_add(Manifest_t* manifest, uint32_t* capacity, const StoreEntry_t* entry)
+{
+    if (entry->address < manifest->start_address || entry->size > manifest->end_address ||
+        entry->address > manifest->end_address - entry->size) {
+        printf("Manifest line %u is outside of the range\n", entry->line);
+        return -1;
+    }
+
+    if (manifest->count == *capacity) {
+        const uint32_t new_capacity = *capacity ? *capacity * 2 : 0x100;
+        StoreEntry_t* entries = realloc(manifest->entries, new_capacity * sizeof(StoreEntry_t));
+        if (!entries) {
+            printf("Failed to allocate manifest entries\n");
+            return -1;
+        }
+        manifest->entries = entries;
+        *capacity = new_capacity;
+    }
+
+    manifest->entries[manifest->count++] = *entry;
+
+    return 0;
+}
+
+static int32_t manifest_load(Manifest_t* manifest, const char* path, const char* store_path)
+{
+    char line[STORE_MAX_LINE];
+    char store_line[STORE_MAX_LINE];
+    char hex[STORE_HASH_SIZE * 2 + 1];
+    unsigned long long address, size;
+    uint32_t capacity = 0;
+    uint32_t line_number = 2;
+    int32_t result = 0;
+
+    FILE* file = fopen(path, "rb");
+    if (!file) {
+        printf("Failed to open %s\n", path);
+        return -1;
+    }
+
+    if (!fgets(store_line, sizeof(store_line), file) || strncmp(store_line, "store ", 6) != 0 ||
+        !fgets(line, sizeof(line), file) ||
+        sscanf(line, "range %llx %llx", &address, &size) != 2 || address > size) {
+        printf("%s is not a manifest\n", path);
+        fclose(file);
+        return -1;
+    }
+    manifest->start_address = address;
+    manifest->end_address = size;
+
+    store_line[strcspn(store_line, "\r\n")] = '\0';
+    snprintf(manifest->store_path,
+             sizeof(manifest->store_path),
+             "%s",
+             store_path ? store_path : store_line + 6);
+
+    // A line cut short by a crash is simply ignored
+    while (result == 0 && fgets(line, sizeof(line), file)) {
+        StoreEntry_t entry = { 0 };
+        entry.line = ++line_number;
+
+        if (!strchr(line, '\n'))
+            continue;
+
+        if (sscanf(line, "chunk %llx %llx %64s", &address, &size, hex) == 3 &&
+            strlen(hex) == STORE_HASH_SIZE * 2 && store_parse_hash(hex, entry.hash) == 0) {
+            entry.address = address;
+            entry.size = size;
+            result = manifest_add(manifest, &capacity, &entry);
+        } else if (sscanf(line, "zero %llx %llx", &address, &size) == 2) {
+            entry.address = address;
+            entry.size = size;
+            entry.zero = 1;
+            result = manifest_add(manifest, &capacity, &entry);
+        }
+    }
+
+    fclose(file);
+
+    if (result == 0 && manifest->count)
+        qsort(manifest->entries, manifest->count, sizeof(StoreEntry_t), store_entry_compare);
+
+    return result;
+}
+
+// Places one chunk file at data, by mapping it if possible
+static int32_t store_view_load_chunk(StoreView_t* view,
+                                     const Manifest_t* manifest,
+                                     const StoreEntry_t* entry,
+                                     uint64_t data_end)
+{
+    char hex[STORE_HASH_SIZE * 2 + 1];
+    char path[STORE_MAX_PATH];
+    struct stat st;
+
+    store_hash_hex(entry->hash, hex);
+    store_chunk_path(manifest->store_path, hex, path, sizeof(path));
+
+    if (stat(path, &st) != 0 || (uint64_t)st.st_size != entry->size) {
+        printf("Chunk %s is missing from the store\n", path);
+        return -1;
+    }
+
+    const uint64_t offset = entry->address - view->start_address;
+
+#ifndef _WIN32
+    // The mapping covers whole pages, past the end of the chunk there may
+    // already be data from an overlapping line
+    const uint64_t page_size = (uint64_t)sysconf(_SC_PAGESIZE);
+    if (offset % page_size == 0 &&
+        (entry->size % page_size == 0 || data_end <= entry->address + entry->size)) {
+        const int fd = open(path, O_RDONLY);
+        if (fd < 0) {
+            printf("Failed to open %s\n", path);
+            return -1;
+        }
+
+        void* mapped = mmap(view->data + offset,
+                            entry->size,
+                            PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE | MAP_FIXED,
+                            fd,
+                            0);
+        close(fd);
+        if (mapped != MAP_FAILED)
+            return 0;
+    }
+#else
+    (void)data_end;
+#endif
+
+    FILE* file = fopen(path, "rb");
+    if (!file) {
+        printf("Failed to open %s\n", path);
+        return -1;
+    }
+
+    const int32_t result =
+        (fread(view->data + offset, 1, entry->size, file) == entry->size) ? 0 : -1;
+    fclose(file);
+    if (result < 0)
+        printf("Failed to read %s\n", path);
+
+    return result;
+}
+
+StoreView_t* store_view_open(const char* manifest_path, const char* store_path)
+{
+    Manifest_t manifest = { 0 };
+
+    if (manifest_load(&manifest, manifest_path, store_path) < 0) {
+        free(manifest.entries);
+        return NULL;
+    }
+
+    StoreView_t* view = calloc(1, sizeof(StoreView_t));
+    if (!view) {
+        free(manifest.entries);
+        return NULL;
+    }
+    view->start_address = manifest.start_address;
+    view->end_address = manifest.end_address;
+
+    const uint64_t size = manifest.end_address - manifest.start_address;
+    if (size) {
+#ifdef _WIN32
+        view->mapped_size = size;
+        view->data = calloc(1, (size_t)size);
+        if (!view->data) {
+#else
+        // Reserved, not committed: pages that are never written read as zeros for free
+        const uint64_t page_size = (uint64_t)sysconf(_SC_PAGESIZE);
+        view->mapped_size = (size + page_size - 1) / page_size * page_size;
+        view->data = mmap(NULL,
+                          view->mapped_size,
+                          PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE,
+                          -1,
+                          0);
+        if (view->data == MAP_FAILED) {
+            view->data = NULL;
+#endif
+            printf("Failed to reserve 0x%llX bytes for %s\n",
+                   (unsigned long long)size,
+                   manifest_path);
+            store_view_close(view);
+            free(manifest.entries);
+            return NULL;
+        }
+    }
+
+    uint64_t covered_end = manifest.start_address;
+    uint64_t data_end = manifest.start_address;
+
+    for (uint32_t i = 0; i < manifest.count; i++) {
+        const StoreEntry_t* entry = &manifest.entries[i];
+        const uint64_t entry_end = entry->address + entry->size;
+
+        if (entry_end > covered_end) {
+            view->covered_bytes += entry_end - max(entry->address, covered_end);
+            covered_end = entry_end;
+        }
+
+        if (entry->zero) {
+            // Only data from an earlier line has to be cleared
+            if (entry->address < data_end)
+                memset(view->data + (entry->address - view->start_address),
+                       0,
+                       min(entry_end, data_end) - entry->address);
+            continue;
+        }
+
+        if (store_view_load_chunk(view, &manifest, entry, data_end) < 0) {
+            store_view_close(view);
+            free(manifest.entries);
+            return NULL;
+        }
+        data_end = max(data_end, entry_end);
+    }
+
+    free(manifest.entries);
+
+    return view;
+}
+
+void store_view_close(StoreView_t* view)
+{
+    if (!view)
+        return;
+
+    if (view->data) {
+#ifdef _WIN32
+        free(view->data);
+#else
+        munmap(view->data, view->mapped_size);
+#endif
+    }
+
+    free(view);
+}
+
+int32_t store_materialize(const char* manifest_path,
+                          const char* store_path,
+                          const char* output_path)
+{
+    StoreView_t* view = store_view_open(manifest_path, store_path);
+    if (!view)
+        return -1;
+
+    const uint64_t total_size = view->end_address - view->start_address;
+    if (view->covered_bytes != total_size) {
+        printf("%s covers only 0x%llX of 0x%llX bytes, finish it with --resume first\n",
+               manifest_path,
+               (unsigned long long)view->covered_bytes,
+               (unsigned long long)total_size);
+        store_view_close(view);
+        return -1;
+    }
+
+    FILE* output = fopen(output_path, "wb");
+    if (!output) {
+        printf("Failed to open %s\n", output_path);
+        store_view_close(view);
+        return -1;
+    }
+
+    int32_t result = 0;
+    for (uint64_t offset = 0; offset < total_size && result == 0; offset += STORE_CHUNK_SIZE) {
+        const uint64_t size = min(total_size - offset, (uint64_t)STORE_CHUNK_SIZE);
+
+        // Zero chunks are skipped over and stay holes
+        if (zero_check(view->data + offset, size))
+            continue;
+
+        if (store_fseek(output, (int64_t)offset, SEEK_SET) != 0 ||
+            fwrite(view->data + offset, 1, size, output) != size)
+            result = -1;
+    }
+
+    // Extend the file if it ends in zeros
+    if (result == 0 && total_size && store_fseek(output, 0, SEEK_END) == 0 &&
+        (uint64_t)store_ftell(output) < total_size) {
+        const uint8_t zero = 0;
+        if (store_fseek(output, (int64_t)(total_size - 1), SEEK_SET) != 0 ||
+            fwrite(&zero, 1, 1, output) != 1)
+            result = -1;
+    }
+
+    if (fclose(output) != 0)
+        result = -1;
+
+    if (result < 0)
+        printf("Failed to materialize %s\n", manifest_path);
+    else
+        printf("Materialized %s [0x%llX, 0x%llX) to %s\n",
+               manifest_path,
+               (unsigned long long)view->start_address,
+               (unsigned long long)view->end_address,
+               output_path);
+
+    store_view_close(view);
+
+    return result;
+}
@@ -0,0 +1,246 @@
+#define _CRT_SECURE_NO_WARNINGS
+
+#include "survey.h"
+#include "zero.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SURVEY_MAX_LINE 0x100
+
+static const char* c_survey_kind_names[] = { "unknown", "zero", "constant", "populated" };
+static const char c_survey_kind_cells[] = { '?', '.', '=', '#' };
+
+void survey_init(Survey_t* survey, uint64_t granularity, uint32_t samples, uint32_t sample_size)
+{
+    memset(survey, 0, sizeof(Survey_t));
+    survey->granularity = granularity;
+    survey->samples = samples;
+    survey->sample_size = sample_size;
+}
+
+void survey_free(Survey_t* survey)
+{
+    free(survey->regions);
+    survey->regions = NULL;
+    survey->count = 0;
+    survey->capacity = 0;
+}
+
+int32_t survey_add(
+    Survey_t* survey, uint64_t start, uint64_t end, SurveyKind_t kind, uint8_t value)
+{
+    if (survey->count) {
+        SurveyRegion_t* last = &survey->regions[survey->count - 1];
+
+        if (start < last->end) {
+            printf("Survey region [0x%llX, 0x%llX) is out of order\n",
+                   (unsigned long long)start,
+                   (unsigned long long)end);
+            return -1;
+        }
+        if (start == last->end && kind == last->kind &&
+            (kind != SURVEY_CONSTANT || value == last->value)) {
+            last->end = end;
+            return 0;
+        }
+    }
+
+    if (survey->count == survey->capacity) {
+        const uint32_t new_capacity = survey->capacity ? survey->capacity * 2 : 0x40;
+        SurveyRegion_t* new_regions =
+            realloc(survey->regions, new_capacity * sizeof(SurveyRegion_t));
+        if (!new_regions) {
+            printf("Failed to allocate survey regions\n");
+            return -1;
+        }
+        survey->regions = new_regions;
+        survey->capacity = new_capacity;
+    }
+
+    SurveyRegion_t* region = &survey->regions[survey->count++];
+    region->start = start;
+    region->end = end;
+    region->kind = kind;
+    region->value = (kind == SURVEY_CONSTANT) ? value : 0;
+
+    return 0;
+}
+
+SurveyKind_t survey_classify(const uint8_t* data, uint32_t size, uint8_t* value)
+{
+    if (zero_check(data, size))
+        return SURVEY_ZERO;
+
+    for (uint32_t i = 1; i < size; i++) {
+        if (data[i] != data[0])
+            return SURVEY_POPULATED;
+    }
+
+    *value = data[0];
+    return SURVEY_CONSTANT;
+}
+
+SurveyKind_t survey_lookup(
+    const Survey_t* survey, uint64_t address, uint64_t* run_end, uint8_t* value)
+{
+    uint32_t low = 0;
+    uint32_t high = survey->count;
+
+    // First region that ends after address
+    while (low < high) {
+        const uint32_t middle = low + (high - low) / 2;
+        if (survey->regions[middle].end <= address)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+
+    if (low == survey->count) {
+        *run_end = UINT64_MAX;
+        return SURVEY_UNKNOWN;
+    }
+
+    const SurveyRegion_t* region = &survey->regions[low];
+    if (region->start > address) {
+        *run_end = region->start;
+        return SURVEY_UNKNOWN;
+    }
+
+    *run_end = region->end;
+    *value = region->value;
+    return region->kind;
+}
+
+int32_t survey_write(const Survey_t* survey, const char* path)
+{
+    FILE* file = fopen(path, "w");
+    if (!file) {
+        printf("Failed to open %s\n", path);
+        return -1;
+    }
+
+    fprintf(file,
+            "survey 0x%llX %u 0x%X\n",
+            (unsigned long long)survey->granularity,
+            survey->samples,
+            survey->sample_size);
+    for (uint32_t i = 0; i < survey->count; i++) {
+        const SurveyRegion_t* region = &survey->regions[i];
+
+        fprintf(file,
+                "%s 0x%llX 0x%llX",
+                c_survey_kind_names[region->kind],
+                (unsigned long long)region->start,
+                (unsigned long long)region->end);
+        if (region->kind == SURVEY_CONSTANT)
+            fprintf(file, " 0x%02X", region->value);
+        fprintf(file, "\n");
+    }
+
+    if (fclose(file) != 0) {
+        printf("Failed to write %s\n", path);
+        return -1;
+    }
+
+    return 0;
+}
+
+int32_t survey_load(const char* path, Survey_t* survey)
+{
+    char line[SURVEY_MAX_LINE];
+    char kind_name[0x20];
+    unsigned long long granularity, start, end;
+    unsigned int samples, sample_size, value;
+
+    FILE* file = fopen(path, "r");
+    if (!file) {
+        printf("Failed to open %s\n", path);
+        return -1;
+    }
+
+    if (!fgets(line, sizeof(line), file) ||
+        sscanf(line, "survey %llx %u %x", &granularity, &samples, &sample_size) != 3) {
+        printf("%s is not a survey\n", path);
+        fclose(file);
+        return -1;
+    }
+    survey_init(survey, granularity, samples, sample_size);
+
+    int32_t result = 0;
+    while (result == 0 && fgets(line, sizeof(line), file)) {
+        value = 0;
+        if (sscanf(line, "%31s %llx %llx %x", kind_name, &start, &end, &value) < 3 ||
+            start >= end) {
+            printf("Invalid survey line: %s", line);
+            result = -1;
+            break;
+        }
+
+        SurveyKind_t kind = SURVEY_UNKNOWN;
+        for (uint32_t i = 0; i < sizeof(c_survey_kind_names) / sizeof(c_survey_kind_names[0]);
+             i++) {
+            if (!strcmp(kind_name, c_survey_kind_names[i]))
+                kind = (SurveyKind_t)i;
+        }
+
+        // Unknown ranges are simply not listed
+        if (kind != SURVEY_UNKNOWN)
+            result = survey_add(survey, start, end, kind, (uint8_t)value);
+    }
+
+    fclose(file);
+    if (result < 0)
+        survey_free(survey);
+
+    return result;
+}
+
+void survey_print_map(const Survey_t* survey, const char* name, uint64_t start, uint64_t end)
+{
+    printf("Survey of %s [0x%llX, 0x%llX), 0x%llX bytes per cell\n",
+           name,
+           (unsigned long long)start,
+           (unsigned long long)end,
+           (unsigned long long)survey->granularity);
+
+    uint32_t column = 0;
+    for (uint64_t address = start; address < end; address += survey->granularity) {
+        uint64_t run_end;
+        uint8_t value;
+
+        if (column == 0)
+            printf("  0x%010llX ", (unsigned long long)address);
+
+        // A cell that is populated anywhere counts as populated
+        SurveyKind_t kind = survey_lookup(survey, address, &run_end, &value);
+        const uint64_t cell_end = address + survey->granularity;
+        while (run_end < cell_end && run_end < end) {
+            const SurveyKind_t next = survey_lookup(survey, run_end, &run_end, &value);
+            if (next > kind)
+                kind = next;
+        }
+        putchar(c_survey_kind_cells[kind]);
+
+        if (++column == SURVEY_MAP_WIDTH) {
+            putchar('\n');
+            column = 0;
+        }
+    }
+    if (column)
+        putchar('\n');
+}
+
+void survey_print_summary(const Survey_t* survey)
+{
+    uint64_t bytes[sizeof(c_survey_kind_names) / sizeof(c_survey_kind_names[0])] = { 0 };
+
+    for (uint32_t i = 0; i < survey->count; i++)
+        bytes[survey->regions[i].kind] += survey->regions[i].end - survey->regions[i].start;
+
+    printf("Populated: %llu MiB, zero: %llu MiB, constant: %llu MiB\n",
+           (unsigned long long)(bytes[SURVEY_POPULATED] >> 20),
+           (unsigned long long)(bytes[SURVEY_ZERO] >> 20),
+           (unsigned long long)(bytes[SURVEY_CONSTANT] >> 20));
+}
@@ -0,0 +1,130 @@
+#include "thread.h"
+
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+static DWORD WINAPI thread_trampoline(LPVOID arg)
+#else
+static void* thread_trampoline(void* arg)
+#endif
+{
+    Thread_t* thread = arg;
+    thread->func(thread->arg);
+    return 0;
+}
+
+int32_t thread_create(Thread_t* thread, ThreadFunc_t func, void* arg)
+{
+    thread->func = func;
+    thread->arg = arg;
+
+#ifdef _WIN32
+    thread->handle = CreateThread(NULL, 0, thread_trampoline, thread, 0, NULL);
+    return thread->handle ? 0 : -1;
+#else
+    return pthread_create(&thread->handle, NULL, thread_trampoline, thread) == 0 ? 0 : -1;
+#endif
+}
+
+void thread_join(Thread_t* thread)
+{
+#ifdef _WIN32
+    WaitForSingleObject(thread->handle, INFINITE);
+    CloseHandle(thread->handle);
+#else
+    pthread_join(thread->handle, NULL);
+#endif
+}
+
+uint32_t thread_cpu_count(void)
+{
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwNumberOfProcessors ? info.dwNumberOfProcessors : 1;
+#else
+    const long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return count > 0 ? (uint32_t)count : 1;
+#endif
+}
+
+void mutex_init(Mutex_t* mutex)
+{
+#ifdef _WIN32
+    InitializeCriticalSection(&mutex->handle);
+#else
+    pthread_mutex_init(&mutex->handle, NULL);
+#endif
+}
+
+void mutex_destroy(Mutex_t* mutex)
+{
+#ifdef _WIN32
+    DeleteCriticalSection(&mutex->handle);
+#else
+    pthread_mutex_destroy(&mutex->handle);
+#endif
+}
+
+void mutex_lock(Mutex_t* mutex)
+{
+#ifdef _WIN32
+    EnterCriticalSection(&mutex->handle);
+#else
+    pthread_mutex_lock(&mutex->handle);
+#endif
+}
+
+void mutex_unlock(Mutex_t* mutex)
+{
+#ifdef _WIN32
+    LeaveCriticalSection(&mutex->handle);
+#else
+    pthread_mutex_unlock(&mutex->handle);
+#endif
+}
+
+void cond_init(Cond_t* cond)
+{
+#ifdef _WIN32
+    InitializeConditionVariable(&cond->handle);
+#else
+    pthread_cond_init(&cond->handle, NULL);
+#endif
+}
+
+void cond_destroy(Cond_t* cond)
+{
+#ifndef _WIN32
+    pthread_cond_destroy(&cond->handle);
+#endif
+}
+
+void cond_wait(Cond_t* cond, Mutex_t* mutex)
+{
+#ifdef _WIN32
+    SleepConditionVariableCS(&cond->handle, &mutex->handle, INFINITE);
+#else
+    pthread_cond_wait(&cond->handle, &mutex->handle);
+#endif
+}
+
+void cond_signal(Cond_t* cond)
+{
+#ifdef _WIN32
+    WakeConditionVariable(&cond->handle);
+#else
+    pthread_cond_signal(&cond->handle);
+#endif
+}
+
+void cond_broadcast(Cond_t* cond)
+{
+#ifdef _WIN32
+    WakeAllConditionVariable(&cond->handle);
+#else
+    pthread_cond_broadcast(&cond->handle);
+#endif
+}
@@ -0,0 +1,7 @@
+#include "transport.h"
+
+void transport_destroy(Transport_t* transport)
+{
+    if (transport && transport->destroy)
+        transport->destroy(transport);
+}
@@ -0,0 +1,644 @@
+#define _CRT_SECURE_NO_WARNINGS
+#define _FILE_OFFSET_BITS 64
+
+#include "clock.h"
+#include "emulator.h"
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#define emu_fseek _fseeki64
+#else
+#define emu_fseek fseeko
+#endif
+
+typedef enum EmuStage
+{
+    EMU_STAGE_IDLE,
+    EMU_STAGE_COMMAND,
+    EMU_STAGE_HIGH_ADDRESS,
+    EMU_STAGE_DATAXFER,
+} EmuStage_t;
+
+typedef struct Emulator
+{
+    Transport_t transport;
+    EmuConfig_t config;
+    FILE* image;
+
+    EmuStage_t stage;
+    uint64_t low_address;
+    uint64_t high_address;
+
+    // Pending IN data. Responses that end on a max packet size boundary are
+    // terminated with a zero length packet, just like the bootloader does.
+    uint8_t* response;
+    uint64_t response_capacity;
+    uint64_t response_size;
+    uint64_t response_offset;
+    int response_needs_zlp;
+    int zlp_pending;
+
+    int powered_down;
+    uint64_t link_free_ns;
+    uint64_t data_transfers;
+    // Set while completing transfers that were queued ahead of time, those do
+    // not pay the host turnaround latency again
+    int pipelined;
+
+    // Submitted asynchronous transfers, per direction in submission order
+    TransportTransfer_t* out_queue;
+    TransportTransfer_t* in_queue;
+    // Cancelled transfers waiting for their callback
+    TransportTransfer_t* cancel_queue;
+} Emulator_t;
+
+static const ProbeTableEntry_t c_default_entries[] = {
+    { 1, "kernel", 0x80000000, 0x81000000 },
+    { 1, "dram", 0x80000000, 0x84000000 },
+    { 1, "ramdisk", 0x82000000, 0x82400000 },
+    { 2, "klog", 0x90000000, 0x90100000 },
+};
+
+void emu_default_config(EmuConfig_t* config)
+{
+    memset(config, 0, sizeof(EmuConfig_t));
+
+    config->vendor_id = (uint16_t)c_supported_devs[0].vendor_id;
+    config->product_id = (uint16_t)c_supported_devs[0].product_id;
+    config->pattern = EMU_PATTERN_MIXED;
+    config->devices = 1;
+
+    ProbeTable_t* probe_table = &config->probe_table;
+    probe_table->mode = MODE_64;
+    strncpy(probe_table->device_name, "EMULATOR", sizeof(probe_table->device_name) - 1);
+    probe_table->count = sizeof(c_default_entries) / sizeof(c_default_entries[0]);
+    memcpy(probe_table->entries, c_default_entries, sizeof(c_default_entries));
+}
+
+int32_t emu_load_probe_table(const char* path, ProbeTable_t* probe_table)
+{
+    FILE* file = fopen(path, "r");
+    if (!file) {
+        printf("Failed to open probe table %s\n", path);
+        return -1;
+    }
+
+    probe_table->count = 0;
+
+    char line[0x200];
+    while (fgets(line, sizeof(line), file)) {
+        char name[0x100] = { 0 };
+        char start[0x40] = { 0 };
+        char end[0x40] = { 0 };
+        char type[0x40] = { 0 };
+
+        if (line[0] == '#')
+            continue;
+
+        const int fields = sscanf(line, "%255s %63s %63s %63s", name, start, end, type);
+        if (fields <= 0)
+            continue;
+
+        if (fields == 2 && !strcmp(name, "device")) {
+            memset(probe_table->device_name, 0, sizeof(probe_table->device_name));
+            strncpy(probe_table->device_name, start, sizeof(probe_table->device_name) - 1);
+            continue;
+        }
+
+        if (fields == 2 && !strcmp(name, "layout")) {
+            probe_table->mode = (atoi(start) == 32) ? MODE_32 : MODE_64;
+            continue;
+        }
+
+        if (fields < 3 || probe_table->count >= MAX_PROBE_ENTRIES) {
+            printf("Invalid probe table line: %s", line);
+            fclose(file);
+            return -1;
+        }
+
+        ProbeTableEntry_t* entry = &probe_table->entries[probe_table->count++];
+        memset(entry, 0, sizeof(ProbeTableEntry_t));
+        strncpy(entry->name, name, sizeof(entry->name) - 1);
+        entry->start = strtoull(start, NULL, 0);
+        entry->end = strtoull(end, NULL, 0);
+        entry->type = (fields == 4) ? (uint32_t)strtoul(type, NULL, 0) : 1;
+    }
+
+    fclose(file);
+    return 0;
+}
+
+int32_t emu_parse_config(const char* spec, EmuConfig_t* config)
+{
+    char buf[0x400] = { 0 };
+    if (!spec || !*spec)
+        return 0;
+
+    if (strlen(spec) >= sizeof(buf)) {
+        printf("Emulator configuration is too long\n");
+        return -1;
+    }
+    strcpy(buf, spec);
+
+    for (char* item = strtok(buf, ","); item; item = strtok(NULL, ",")) {
+        char* value = strchr(item, '=');
+        if (!value) {
+            printf("Invalid emulator option: %s\n", item);
+            return -1;
+        }
+        *value++ = '\0';
+
+        if (!strcmp(item, "table")) {
+            if (emu_load_probe_table(value, &config->probe_table) < 0)
+                return -1;
+        } else if (!strcmp(item, "layout")) {
+            config->probe_table.mode = (atoi(value) == 32) ? MODE_32 : MODE_64;
+        } else if (!strcmp(item, "image")) {
+            // The image path has to outlive the spec buffer
+            config->image_path = strdup(value);
+        } else if (!strcmp(item, "base")) {
+            config->image_base = strtoull(value, NULL, 0);
+        } else if (!strcmp(item, "pattern")) {
+            if (!strcmp(value, "zero"))
+                config->pattern = EMU_PATTERN_ZERO;
+            else if (!strcmp(value, "address"))
+                config->pattern = EMU_PATTERN_ADDRESS;
+            else if (!strcmp(value, "mixed"))
+                config->pattern = EMU_PATTERN_MIXED;
+            else {
+                printf("Unknown emulator pattern: %s\n", value);
+                return -1;
+            }
+        } else if (!strcmp(item, "latency_us")) {
+            config->latency_us = (uint32_t)strtoul(value, NULL, 0);
+        } else if (!strcmp(item, "bandwidth_mbps")) {
+            config->bandwidth = strtoull(value, NULL, 0) * 1000 * 1000;
+        } else if (!strcmp(item, "max_block")) {
+            config->max_block = (uint32_t)strtoul(value, NULL, 0);
+        } else if (!strcmp(item, "fail_every")) {
+            config->fail_every = (uint32_t)strtoul(value, NULL, 0);
+        } else if (!strcmp(item, "devices")) {
+            config->devices = (uint32_t)strtoul(value, NULL, 0);
+            if (!config->devices) {
+                printf("Invalid emulated device count: %s\n", value);
+                return -1;
+            }
+        } else if (!strcmp(item, "pid")) {
+            config->product_id = (uint16_t)strtoul(value, NULL, 0);
+        } else {
+            printf("Unknown emulator option: %s\n", item);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+uint32_t emu_serialize_probe_table(const ProbeTable_t* probe_table,
+                                   uint8_t* packet,
+                                   uint32_t packet_size)
+{
+    const uint32_t name_len = (probe_table->mode == MODE_64) ? 20 : 16;
+    const uint32_t entry_size = (probe_table->mode == MODE_64) ? 40 : 28;
+    // Header, entries and the all-zero terminator entry
+    const uint32_t total_size = MAX_DEVICE_NAME + (probe_table->count + 1) * entry_size;
+
+    if (total_size > packet_size)
+        return 0;
+
+    memset(packet, 0, total_size);
+
+    // The first byte selects the layout, the device name follows it
+    packet[0] = (probe_table->mode == MODE_64) ? '+' : ' ';
+    strncpy((char*)packet + 1, probe_table->device_name, MAX_DEVICE_NAME - 2);
+
+    uint8_t* curr_ptr = packet + MAX_DEVICE_NAME;
+    for (uint32_t i = 0; i < probe_table->count; i++) {
+        const ProbeTableEntry_t* entry = &probe_table->entries[i];
+
+        memcpy(curr_ptr, &entry->type, sizeof(uint32_t));
+        strncpy((char*)curr_ptr + sizeof(uint32_t), entry->name, name_len - 1);
+
+        uint8_t* addr_ptr = curr_ptr + sizeof(uint32_t) + name_len;
+        if (probe_table->mode == MODE_64) {
+            memcpy(addr_ptr, &entry->start, sizeof(uint64_t));
+            memcpy(addr_ptr + sizeof(uint64_t), &entry->end, sizeof(uint64_t));
+        } else {
+            const uint32_t start = (uint32_t)entry->start;
+            const uint32_t end = (uint32_t)entry->end;
+            memcpy(addr_ptr, &start, sizeof(uint32_t));
+            memcpy(addr_ptr + sizeof(uint32_t), &end, sizeof(uint32_t));
+        }
+
+        curr_ptr += entry_size;
+    }
+
+    return total_size;
+}
+
+static uint64_t emu_mix(uint64_t x)
+{
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ull;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebull;
+    x ^= x >> 31;
+    return x;
+}
+
+static uint64_t emu_pattern_word(EmuPattern_t pattern, uint64_t word_address)
+{
+    switch (pattern) {
+        case EMU_PATTERN_ADDRESS:
+            return word_address;
+        case EMU_PATTERN_MIXED:
+            switch (emu_mix(word_address >> 16) & 3) {
+                case 0:
+                case 1:
+                    return 0;
+                case 2:
+                    return word_address;
+                default:
+                    return emu_mix(word_address);
+            }
+        case EMU_PATTERN_ZERO:
+        default:
+            return 0;
+    }
+}
+
+void emu_fill_pattern(EmuPattern_t pattern, uint64_t address, uint8_t* buf, uint64_t size)
+{
+    if (pattern == EMU_PATTERN_ZERO) {
+        memset(buf, 0, size);
+        return;
+    }
+
+    uint64_t offset = 0;
+    while (offset < size) {
+        const uint64_t curr_address = address + offset;
+        const uint64_t word_address = curr_address & ~7ull;
+        const uint64_t word = emu_pattern_word(pattern, word_address);
+
+        uint8_t bytes[8];
+        for (uint32_t i = 0; i < sizeof(bytes); i++)
+            bytes[i] = (uint8_t)(word >> (i * 8));
+
+        const uint64_t skip = curr_address - word_address;
+        const uint64_t count = min(sizeof(bytes) - skip, size - offset);
+        memcpy(buf + offset, bytes + skip, count);
+        offset += count;
+    }
+}
+
+static void emu_fill_image(Emulator_t* emu, uint64_t address, uint8_t* buf, uint64_t size)
+{
+    memset(buf, 0, size);
+
+    if (address < emu->config.image_base)
+        return;
+
+    if (emu_fseek(emu->image, (int64_t)(address - emu->config.image_base), SEEK_SET) != 0)
+        return;
+
+    // Reads past the end of the image are left zeroed
+    fread(buf, 1, size, emu->image);
+}
+
+// Accounts for the link latency and bandwidth of a single transfer
+static void emu_link_delay(Emulator_t* emu, uint64_t size)
+{
+    if (!emu->config.latency_us && !emu->config.bandwidth)
+        return;
+
+    const uint64_t now = clock_now_ns();
+    uint64_t done = (emu->link_free_ns > now) ? emu->link_free_ns : now;
+    if (!emu->pipelined)
+        done += (uint64_t)emu->config.latency_us * 1000;
+    if (emu->config.bandwidth)
+        done += size * 1000000000ull / emu->config.bandwidth;
+
+    emu->link_free_ns = done;
+    clock_sleep_until_ns(done);
+}
+
+static uint8_t* emu_reserve_response(Emulator_t* emu, uint64_t size)
+{
+    if (size > emu->response_capacity) {
+        uint8_t* response = realloc(emu->response, size);
+        if (!response)
+            return NULL;
+        emu->response = response;
+        emu->response_capacity = size;
+    }
+
+    emu->response_size = size;
+    emu->response_offset = 0;
+    emu->response_needs_zlp = (size % EMU_MAX_PACKET_SIZE) == 0;
+    emu->zlp_pending = 0;
+
+    return emu->response;
+}
+
+static void emu_queue_response(Emulator_t* emu, const void* data, uint64_t size)
+{
+    uint8_t* response = emu_reserve_response(emu, size);
+    if (response)
+        memcpy(response, data, size);
+}
+
+static void emu_queue_data(Emulator_t* emu)
+{
+    const uint64_t size = emu->high_address - emu->low_address;
+    uint8_t* response = emu_reserve_response(emu, size);
+    if (!response)
+        return;
+
+    if (emu->image)
+        emu_fill_image(emu, emu->low_address, response, size);
+    else
+        emu_fill_pattern(emu->config.pattern, emu->low_address, response, size);
+}
+
+static int emu_parse_address(const uint8_t* packet, uint32_t packet_size, uint64_t* address)
+{
+    uint32_t digits = 0;
+    while (digits < packet_size && packet[digits] && isxdigit(packet[digits]))
+        digits++;
+
+    if (!digits || digits > 16 || (digits < packet_size && packet[digits]))
+        return -1;
+
+    *address = strtoull((const char*)packet, NULL, 16);
+    return 0;
+}
+
+static int emu_is_command(const uint8_t* packet, uint32_t packet_size, const char* command)
+{
+    const size_t command_size = strlen(command) + 1;
+    return packet_size >= command_size && !memcmp(packet, command, command_size);
+}
+
+static void emu_handle_packet(Emulator_t* emu, const uint8_t* packet, uint32_t packet_size)
+{
+    uint64_t address;
+
+    // A preamble starts a new command and drops anything the host did not read
+    if (emu_is_command(packet, packet_size, c_preamble)) {
+        emu_queue_response(emu, c_acknowledgment, sizeof(c_acknowledgment));
+        emu->stage = EMU_STAGE_COMMAND;
+        return;
+    }
+
+    const EmuStage_t stage = emu->stage;
+    emu->stage = EMU_STAGE_IDLE;
+
+    switch (stage) {
+        case EMU_STAGE_COMMAND:
+            if (emu_is_command(packet, packet_size, c_probe)) {
+                uint8_t probe_packet[EMU_PROBE_PACKET_SIZE];
+                const uint32_t probe_size = emu_serialize_probe_table(
+                    &emu->config.probe_table, probe_packet, sizeof(probe_packet));
+                emu_queue_response(emu, probe_packet, probe_size);
+            } else if (emu_is_command(packet, packet_size, c_postamble)) {
+                emu_queue_response(emu, c_acknowledgment, sizeof(c_acknowledgment));
+            } else if (emu_is_command(packet, packet_size, c_powerdown)) {
+                emu_queue_response(emu, c_acknowledgment, sizeof(c_acknowledgment));
+                emu->powered_down = 1;
+            } else if (emu_parse_address(packet, packet_size, &address) == 0) {
+                emu->low_address = address;
+                emu_queue_response(emu, c_acknowledgment, sizeof(c_acknowledgment));
+                emu->stage = EMU_STAGE_HIGH_ADDRESS;
+            }
+            break;
+        case EMU_STAGE_HIGH_ADDRESS:
+            // Windows larger than the bootloader supports are never acknowledged
+            if (emu_parse_address(packet, packet_size, &address) == 0 &&
+                address > emu->low_address &&
+                (!emu->config.max_block || address - emu->low_address <= emu->config.max_block)) {
+                emu->high_address = address;
+                emu_queue_response(emu, c_acknowledgment, sizeof(c_acknowledgment));
+                emu->stage = EMU_STAGE_DATAXFER;
+            }
+            break;
+        case EMU_STAGE_DATAXFER:
+            if (!emu_is_command(packet, packet_size, c_dataxfer))
+                break;
+            // Injected link glitch: the data never arrives
+            emu->data_transfers++;
+            if (emu->config.fail_every && emu->data_transfers % emu->config.fail_every == 0)
+                break;
+            emu_queue_data(emu);
+            break;
+        case EMU_STAGE_IDLE:
+        default:
+            break;
+    }
+}
+
+static int32_t emu_send(Transport_t* transport,
+                        uint8_t* packet,
+                        uint32_t packet_size,
+                        uint32_t* transferred,
+                        uint32_t timeout_ms)
+{
+    Emulator_t* emu = transport->priv;
+
+    *transferred = 0;
+    if (emu->powered_down)
+        return LIBUSB_ERROR_NO_DEVICE;
+
+    emu_link_delay(emu, packet_size);
+    emu_handle_packet(emu, packet, packet_size);
+
+    *transferred = packet_size;
+    return LIBUSB_SUCCESS;
+}
+
+static int32_t emu_receive(Transport_t* transport,
+                           uint8_t* packet,
+                           uint32_t packet_size,
+                           uint32_t* transferred,
+                           uint32_t timeout_ms)
+{
+    Emulator_t* emu = transport->priv;
+
+    *transferred = 0;
+
+    if (emu->response_offset < emu->response_size) {
+        const uint64_t remaining = emu->response_size - emu->response_offset;
+
+        // A transfer that ends mid-response must end on a packet boundary,
+        // otherwise the next full packet overflows the host buffer
+        if (remaining > packet_size && packet_size % EMU_MAX_PACKET_SIZE != 0) {
+            emu->response_size = emu->response_offset = 0;
+            return LIBUSB_ERROR_OVERFLOW;
+        }
+
+        const uint32_t count = (uint32_t)min(remaining, (uint64_t)packet_size);
+        emu_link_delay(emu, count);
+        memcpy(packet, emu->response + emu->response_offset, count);
+        emu->response_offset += count;
+
+        if (emu->response_offset == emu->response_size) {
+            // A short transfer is terminated by the zero length packet itself,
+            // a transfer that exactly filled the buffer leaves it queued
+            emu->zlp_pending = emu->response_needs_zlp && count == packet_size;
+            emu->response_size = emu->response_offset = 0;
+        }
+
+        *transferred = count;
+        return LIBUSB_SUCCESS;
+    }
+
+    if (emu->zlp_pending) {
+        emu_link_delay(emu, 0);
+        emu->zlp_pending = 0;
+        return LIBUSB_SUCCESS;
+    }
+
+    if (emu->powered_down)
+        return LIBUSB_ERROR_NO_DEVICE;
+
+    // Nothing to send, report the timeout right away instead of stalling
+    return LIBUSB_ERROR_TIMEOUT;
+}
+
+static void emu_enqueue(TransportTransfer_t** queue, TransportTransfer_t* transfer)
+{
+    transfer->next = NULL;
+    while (*queue)
+        queue = &(*queue)->next;
+    *queue = transfer;
+}
+
+static TransportTransfer_t* emu_dequeue(TransportTransfer_t** queue)
+{
+    TransportTransfer_t* transfer = *queue;
+    if (transfer)
+        *queue = transfer->next;
+    return transfer;
+}
+
+static int32_t emu_submit(Transport_t* transport, TransportTransfer_t* transfer)
+{
+    Emulator_t* emu = transport->priv;
+
+    transfer->status = LIBUSB_SUCCESS;
+    transfer->transferred = 0;
+    if (transfer->direction == TRANSFER_IN)
+        emu_enqueue(&emu->in_queue, transfer);
+    else
+        emu_enqueue(&emu->out_queue, transfer);
+
+    return LIBUSB_SUCCESS;
+}
+
+static int32_t emu_cancel(Transport_t* transport, TransportTransfer_t* transfer)
+{
+    Emulator_t* emu = transport->priv;
+    TransportTransfer_t** queue =
+        (transfer->direction == TRANSFER_IN) ? &emu->in_queue : &emu->out_queue;
+
+    for (; *queue; queue = &(*queue)->next) {
+        if (*queue != transfer)
+            continue;
+
+        // Completed on the next handle_events call, like libusb does
+        *queue = transfer->next;
+        transfer->status = LIBUSB_ERROR_INTERRUPTED;
+        emu_enqueue(&emu->cancel_queue, transfer);
+        return LIBUSB_SUCCESS;
+    }
+
+    return LIBUSB_ERROR_NOT_FOUND;
+}
+
+static int32_t emu_handle_events(Transport_t* transport, uint32_t timeout_ms)
+{
+    Emulator_t* emu = transport->priv;
+
+    for (;;) {
+        TransportTransfer_t* transfer;
+
+        if (emu->cancel_queue) {
+            transfer = emu_dequeue(&emu->cancel_queue);
+        } else if (emu->response_offset < emu->response_size || emu->zlp_pending) {
+            // The device is blocked on its response until the host reads it
+            transfer = emu_dequeue(&emu->in_queue);
+            if (!transfer)
+                break;
+            transfer->status = emu_receive(transport,
+                                           transfer->buffer,
+                                           transfer->length,
+                                           &transfer->transferred,
+                                           transfer->timeout_ms);
+        } else if (emu->out_queue) {
+            transfer = emu_dequeue(&emu->out_queue);
+            transfer->status = emu_send(transport,
+                                        transfer->buffer,
+                                        transfer->length,
+                                        &transfer->transferred,
+                                        transfer->timeout_ms);
+        } else if (emu->in_queue) {
+            transfer = emu_dequeue(&emu->in_queue);
+            transfer->status = emu_receive(transport,
+                                           transfer->buffer,
+                                           transfer->length,
+                                           &transfer->transferred,
+                                           transfer->timeout_ms);
+        } else {
+            break;
+        }
+
+        transfer->callback(transfer);
+        emu->pipelined = 1;
+    }
+
+    emu->pipelined = 0;
+    return LIBUSB_SUCCESS;
+}
+
+static void emu_destroy(Transport_t* transport)
+{
+    Emulator_t* emu = transport->priv;
+
+    if (emu->image)
+        fclose(emu->image);
+
+    free(emu->response);
+    free(emu);
+}
+
+Transport_t* transport_emu_create(const EmuConfig_t* config)
+{
+    Emulator_t* emu = calloc(1, sizeof(Emulator_t));
+    if (!emu)
+        return NULL;
+
+    emu->config = *config;
+
+    if (config->image_path) {
+        emu->image = fopen(config->image_path, "rb");
+        if (!emu->image) {
+            printf("Failed to open emulator image %s\n", config->image_path);
+            free(emu);
+            return NULL;
+        }
+    }
+
+    emu->transport.name = "emulator";
+    emu->transport.send = emu_send;
+    emu->transport.receive = emu_receive;
+    emu->transport.submit = emu_submit;
+    emu->transport.cancel = emu_cancel;
+    emu->transport.handle_events = emu_handle_events;
+    emu->transport.destroy = emu_destroy;
+    emu->transport.priv = emu;
+
+    return &emu->transport;
+}
@@ -0,0 +1,158 @@
+#include "transport.h"
+
+#include <libusb-1.0/libusb.h>
+#include <stdlib.h>
+
+typedef struct UsbTransport
+{
+    Transport_t transport;
+    libusb_context* ctx;
+    libusb_device_handle* handle;
+    int in_endpoint;
+    int out_endpoint;
+} UsbTransport_t;
+
+static int32_t usb_send(Transport_t* transport,
+                        uint8_t* packet,
+                        uint32_t packet_size,
+                        uint32_t* transferred,
+                        uint32_t timeout_ms)
+{
+    UsbTransport_t* usb = transport->priv;
+    int actual = 0;
+
+    const int32_t result = libusb_bulk_transfer(
+        usb->handle, usb->out_endpoint, packet, (int)packet_size, &actual, timeout_ms);
+    *transferred = (uint32_t)actual;
+    return result;
+}
+
+static int32_t usb_receive(Transport_t* transport,
+                           uint8_t* packet,
+                           uint32_t packet_size,
+                           uint32_t* transferred,
+                           uint32_t timeout_ms)
+{
+    UsbTransport_t* usb = transport->priv;
+    int actual = 0;
+
+    const int32_t result = libusb_bulk_transfer(
+        usb->handle, usb->in_endpoint, packet, (int)packet_size, &actual, timeout_ms);
+    *transferred = (uint32_t)actual;
+    return result;
+}
+
+static int32_t usb_transfer_status(enum libusb_transfer_status status)
+{
+    switch (status) {
+        case LIBUSB_TRANSFER_COMPLETED:
+            return LIBUSB_SUCCESS;
+        case LIBUSB_TRANSFER_TIMED_OUT:
+            return LIBUSB_ERROR_TIMEOUT;
+        case LIBUSB_TRANSFER_CANCELLED:
+            return LIBUSB_ERROR_INTERRUPTED;
+        case LIBUSB_TRANSFER_STALL:
+            return LIBUSB_ERROR_PIPE;
+        case LIBUSB_TRANSFER_NO_DEVICE:
+            return LIBUSB_ERROR_NO_DEVICE;
+        case LIBUSB_TRANSFER_OVERFLOW:
+            return LIBUSB_ERROR_OVERFLOW;
+        case LIBUSB_TRANSFER_ERROR:
+        default:
+            return LIBUSB_ERROR_IO;
+    }
+}
+
+static void LIBUSB_CALL usb_transfer_callback(struct libusb_transfer* usb_transfer)
+{
+    TransportTransfer_t* transfer = usb_transfer->user_data;
+
+    transfer->status = usb_transfer_status(usb_transfer->status);
+    transfer->transferred = (uint32_t)usb_transfer->actual_length;
+    transfer->priv = NULL;
+    libusb_free_transfer(usb_transfer);
+
+    transfer->callback(transfer);
+}
+
+static int32_t usb_submit(Transport_t* transport, TransportTransfer_t* transfer)
+{
+    UsbTransport_t* usb = transport->priv;
+
+    struct libusb_transfer* usb_transfer = libusb_alloc_transfer(0);
+    if (!usb_transfer)
+        return LIBUSB_ERROR_NO_MEM;
+
+    const int endpoint =
+        (transfer->direction == TRANSFER_IN) ? usb->in_endpoint : usb->out_endpoint;
+    libusb_fill_bulk_transfer(usb_transfer,
+                              usb->handle,
+                              (unsigned char)endpoint,
+                              transfer->buffer,
+                              (int)transfer->length,
+                              usb_transfer_callback,
+                              transfer,
+                              transfer->timeout_ms);
+
+    transfer->status = LIBUSB_SUCCESS;
+    transfer->transferred = 0;
+    transfer->priv = usb_transfer;
+
+    const int32_t result = libusb_submit_transfer(usb_transfer);
+    if (result != LIBUSB_SUCCESS) {
+        transfer->priv = NULL;
+        libusb_free_transfer(usb_transfer);
+    }
+
+    return result;
+}
+
+static int32_t usb_cancel(Transport_t* transport, TransportTransfer_t* transfer)
+{
+    if (!transfer->priv)
+        return LIBUSB_ERROR_NOT_FOUND;
+
+    return libusb_cancel_transfer(transfer->priv);
+}
+
+static int32_t usb_handle_events(Transport_t* transport, uint32_t timeout_ms)
+{
+    UsbTransport_t* usb = transport->priv;
+    struct timeval timeout;
+
+    timeout.tv_sec = timeout_ms / 1000;
+    timeout.tv_usec = (timeout_ms % 1000) * 1000;
+
+    return libusb_handle_events_timeout_completed(usb->ctx, &timeout, NULL);
+}
+
+static void usb_destroy(Transport_t* transport)
+{
+    free(transport->priv);
+}
+
+Transport_t* transport_usb_create(libusb_context* ctx,
+                                  libusb_device_handle* handle,
+                                  int in_endpoint,
+                                  int out_endpoint)
+{
+    UsbTransport_t* usb = calloc(1, sizeof(UsbTransport_t));
+    if (!usb)
+        return NULL;
+
+    usb->ctx = ctx;
+    usb->handle = handle;
+    usb->in_endpoint = in_endpoint;
+    usb->out_endpoint = out_endpoint;
+
+    usb->transport.name = "usb";
+    usb->transport.send = usb_send;
+    usb->transport.receive = usb_receive;
+    usb->transport.submit = usb_submit;
+    usb->transport.cancel = usb_cancel;
+    usb->transport.handle_events = usb_handle_events;
+    usb->transport.destroy = usb_destroy;
+    usb->transport.priv = usb;
+
+    return &usb->transport;
+}
@@ -0,0 +1,214 @@
+#define _CRT_SECURE_NO_WARNINGS
+
+#include "tune.h"
+#include "clock.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TUNE_CACHE_FILE ".upload_dumper_tune"
+#define TUNE_CACHE_MAX_LINES 0x100
+
+static int32_t tune_discard_block(void* ctx, Block_t* block)
+{
+    block_pool_release(ctx, block);
+    return 0;
+}
+
+// Measures throughput for the current state->block_size, returns MB/s or a
+// negative value if any trial failed
+static double tune_measure(State_t* state, const ProbeTableEntry_t* window)
+{
+    const uint64_t window_size = window->end - window->start;
+    const uint64_t bytes = min(max((uint64_t)TUNE_WINDOW_BYTES,
+                                   (uint64_t)state->block_size * TUNE_MIN_BLOCKS),
+                               window_size);
+    double best = 0;
+    BlockPool_t pool;
+
+    if (init_block_pool(state, &pool, 0) < 0)
+        return -1;
+
+    for (uint32_t trial = 0; trial < TUNE_TRIALS; trial++) {
+        const uint64_t start_ns = clock_now_ns();
+        const int32_t result = read_range(
+            state, window->start, window->start + bytes, &pool, tune_discard_block, &pool);
+        if (result < 0) {
+            drain_device(state);
+            block_pool_destroy(&pool);
+            return -1;
+        }
+        const uint64_t elapsed_ns = max(clock_now_ns() - start_ns, 1ull);
+
+        const double mbps = (double)bytes / ((double)elapsed_ns / 1e9) / 1e6;
+        best = max(best, mbps);
+    }
+
+    block_pool_destroy(&pool);
+
+    return best;
+}
+
+int32_t tune_block_size(State_t* state, uint32_t* block_size, double* mbps)
+{
+    const ProbeTable_t* probe_table = state->probe_table;
+    const ProbeTableEntry_t* window = NULL;
+
+    // Measure on the largest region so that big windows fit
+    for (uint32_t i = 0; i < probe_table->count; i++) {
+        const ProbeTableEntry_t* entry = &probe_table->entries[i];
+        if (entry->end > entry->start &&
+            (!window || entry->end - entry->start > window->end - window->start))
+            window = entry;
+    }
+
+    if (!window) {
+        printf("No probe table entry to tune on\n");
+        return -1;
+    }
+
+    printf("Tuning block size on %s [0x%llX, 0x%llX]\n",
+           window->name,
+           (unsigned long long)window->start,
+           (unsigned long long)window->end);
+
+    const uint32_t original_block_size = state->block_size;
+    const uint32_t original_retries = state->retries;
+    // A rejected size is an answer here, not a glitch to retry
+    state->retries = 0;
+    uint32_t best_size = 0;
+    double best_mbps = 0;
+
+    // Grow from the default until the bootloader rejects a size, then shrink
+    for (int direction = 0; direction < 2; direction++) {
+        uint32_t size = direction ? BLOCK_SIZE / 2 : BLOCK_SIZE;
+
+        while (size >= MIN_BLOCK_SIZE && size <= MAX_BLOCK_SIZE) {
+            if (size > window->end - window->start)
+                break;
+
+            state->block_size = size;
+            const double result = tune_measure(state, window);
+            if (result < 0) {
+                printf("Block size 0x%X: rejected\n", size);
+                break;
+            }
+
+            printf("Block size 0x%X: %.2f MB/s\n", size, result);
+            if (result > best_mbps) {
+                best_mbps = result;
+                best_size = size;
+            }
+
+            size = direction ? size / 2 : size * 2;
+        }
+    }
+
+    state->block_size = original_block_size;
+    state->retries = original_retries;
+
+    if (!best_size) {
+        printf("No block size was accepted by the device\n");
+        return -1;
+    }
+
+    *block_size = best_size;
+    if (mbps)
+        *mbps = best_mbps;
+
+    return 0;
+}
+
+const char* tune_default_cache_path(void)
+{
+    static char path[0x200];
+
+#ifdef _WIN32
+    const char* home = getenv("USERPROFILE");
+#else
+    const char* home = getenv("HOME");
+#endif
+
+    if (!home)
+        return TUNE_CACHE_FILE;
+
+    snprintf(path, sizeof(path), "%s/%s", home, TUNE_CACHE_FILE);
+    return path;
+}
+
+int32_t tune_cache_load(const char* path,
+                        uint16_t vendor_id,
+                        uint16_t product_id,
+                        uint32_t* block_size)
+{
+    FILE* file = fopen(path, "r");
+    if (!file)
+        return -1;
+
+    char line[0x100];
+    int32_t result = -1;
+    while (fgets(line, sizeof(line), file)) {
+        unsigned int line_vendor_id;
+        unsigned int line_product_id;
+        unsigned int line_block_size;
+
+        if (sscanf(line, "%x:%x %x", &line_vendor_id, &line_product_id, &line_block_size) != 3)
+            continue;
+
+        if (line_vendor_id != vendor_id || line_product_id != product_id)
+            continue;
+
+        if (line_block_size < MIN_BLOCK_SIZE || line_block_size > MAX_BLOCK_SIZE)
+            continue;
+
+        *block_size = line_block_size;
+        result = 0;
+    }
+
+    fclose(file);
+    return result;
+}
+
+int32_t tune_cache_store(const char* path,
+                         uint16_t vendor_id,
+                         uint16_t product_id,
+                         uint32_t block_size,
+                         double mbps)
+{
+    char key[0x20];
+    snprintf(key, sizeof(key), "%04x:%04x ", vendor_id, product_id);
+
+    // Keep the entries of other devices
+    char(*lines)[0x100] = calloc(TUNE_CACHE_MAX_LINES, sizeof(*lines));
+    if (!lines)
+        return -1;
+
+    uint32_t count = 0;
+    FILE* file = fopen(path, "r");
+    if (file) {
+        while (count < TUNE_CACHE_MAX_LINES - 1 &&
+               fgets(lines[count], sizeof(lines[count]), file)) {
+            if (strncmp(lines[count], key, strlen(key)) != 0)
+                count++;
+        }
+        fclose(file);
+    }
+
+    snprintf(lines[count++], sizeof(lines[0]), "%s0x%X %.2f\n", key, block_size, mbps);
+
+    file = fopen(path, "w");
+    if (!file) {
+        printf("Failed to write block size cache %s\n", path);
+        free(lines);
+        return -1;
+    }
+
+    for (uint32_t i = 0; i < count; i++)
+        fputs(lines[i], file);
+
+    fclose(file);
+    free(lines);
+
+    return 0;
+}
@@ -0,0 +1,204 @@
+#define _CRT_SECURE_NO_WARNINGS
+#define _FILE_OFFSET_BITS 64
+
+#include "view.h"
+#include "hexdump.h"
+#include "journal.h"
+#include "reader.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+// Range of the dump as a whole, [start, end)
+static int32_t view_dump_range(const DumpSource_t* source,
+                               const DumpReader_t* reader,
+                               uint64_t* start,
+                               uint64_t* end)
+{
+    struct stat st;
+
+    switch (source->kind) {
+        case DUMP_KIND_RAW:
+            if (stat(source->path, &st) != 0)
+                return -1;
+            *start = source->start_address;
+            *end = source->start_address + (uint64_t)st.st_size;
+            return 0;
+        case DUMP_KIND_PACKED:
+            *start = reader->container->header.start_address;
+            *end = reader->container->header.end_address;
+            return 0;
+        case DUMP_KIND_STORED:
+            *start = source->view->start_address;
+            *end = source->view->end_address;
+            return 0;
+        default:
+            return -1;
+    }
+}
+
+#ifndef _WIN32
+// Raw dumps are hexdumped straight from the page cache
+static int32_t view_mapped(
+    const DumpSource_t* source, uint64_t start, uint64_t end, Hexdump_t* dump)
+{
+    const int fd = open(source->path, O_RDONLY);
+    if (fd < 0) {
+        printf("Failed to open %s\n", source->path);
+        return -1;
+    }
+
+    const uint64_t offset = start - source->start_address;
+    const uint64_t map_offset = offset & ~(uint64_t)(sysconf(_SC_PAGESIZE) - 1);
+    const uint64_t map_size = end - source->start_address - map_offset;
+
+    uint8_t* mapping = mmap(NULL, map_size, PROT_READ, MAP_SHARED, fd, (off_t)map_offset);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        printf("Failed to map %s\n", source->path);
+        return -1;
+    }
+    madvise(mapping, map_size, MADV_SEQUENTIAL);
+
+    const int32_t result =
+        hexdump_write(dump, mapping + (offset - map_offset), end - start, start);
+    munmap(mapping, map_size);
+
+    return result;
+}
+#endif
+
+static int32_t view_read(DumpReader_t* reader, uint64_t start, uint64_t end, Hexdump_t* dump)
+{
+    uint8_t* buf = malloc(VIEW_CHUNK_SIZE);
+    int32_t result = 0;
+
+    if (!buf) {
+        printf("Failed to allocate the view buffer\n");
+        return -1;
+    }
+
+    for (uint64_t address = start; address < end && result == 0; address += VIEW_CHUNK_SIZE) {
+        const uint64_t size = min(end - address, (uint64_t)VIEW_CHUNK_SIZE);
+
+        const uint8_t* data = dump_reader_read(reader, address, size, buf);
+        if (!data) {
+            printf("Failed to read 0x%llX bytes at 0x%llX\n", size, address);
+            result = -1;
+            break;
+        }
+
+        result = hexdump_write(dump, data, size, address);
+    }
+
+    free(buf);
+
+    return result;
+}
+
+int32_t view_file(const Options_t* options)
+{
+    DumpSource_t source;
+    DumpReader_t reader;
+    Hexdump_t dump;
+    uint64_t base = options->base_address;
+    uint64_t dump_start, dump_end;
+    uint64_t unused;
+
+    // Only raw dumps need the base, the others are detected below
+    if (!options->base_set && journal_read_range(options->input_path, &base, &unused) < 0)
+        base = 0;
+
+    if (dump_source_open(&source, options->input_path, base) < 0)
+        return -1;
+    if (dump_reader_open(&reader, &source) < 0) {
+        dump_source_close(&source);
+        return -1;
+    }
+
+    int32_t result = view_dump_range(&source, &reader, &dump_start, &dump_end);
+    uint64_t start = options->range.start_address;
+    uint64_t end = options->range.end_address;
+    if (!end) {
+        start = dump_start;
+        end = dump_end;
+    }
+
+    if (result < 0 || start < dump_start || end > dump_end || start >= end) {
+        printf("%s covers [0x%llX, 0x%llX), not [0x%llX, 0x%llX)%s\n",
+               options->input_path,
+               dump_start,
+               dump_end,
+               start,
+               end,
+               (source.kind == DUMP_KIND_RAW && !options->base_set) ? ", try --base" : "");
+        result = -1;
+    } else if ((result = hexdump_init(&dump, stdout, options->squeeze)) == 0) {
+#ifndef _WIN32
+        if (source.kind == DUMP_KIND_RAW)
+            result = view_mapped(&source, start, end, &dump);
+        else
+#endif
+            result = view_read(&reader, start, end, &dump);
+
+        if (hexdump_finish(&dump) < 0)
+            result = -1;
+    }
+
+    dump_reader_close(&reader);
+    dump_source_close(&source);
+
+    return result;
+}
+
+typedef struct ViewOutput
+{
+    Hexdump_t* dump;
+    BlockPool_t* pool;
+} ViewOutput_t;
+
+static int32_t view_block(void* ctx, Block_t* block)
+{
+    ViewOutput_t* output = ctx;
+
+    const int32_t result = hexdump_write(output->dump, block->data, block->size, block->address);
+    block_pool_release(output->pool, block);
+
+    return result;
+}
+
+int32_t view_device(State_t* state, const Options_t* options)
+{
+    Hexdump_t dump;
+    BlockPool_t pool;
+
+    if (init_block_pool(state, &pool, 2) < 0)
+        return -1;
+    if (hexdump_init(&dump, stdout, options->squeeze) < 0) {
+        block_pool_destroy(&pool);
+        return -1;
+    }
+
+    ViewOutput_t output = { &dump, &pool };
+    int32_t result = read_range(state,
+                                options->range.start_address,
+                                options->range.end_address,
+                                &pool,
+                                view_block,
+                                &output);
+
+    if (hexdump_finish(&dump) < 0)
+        result = -1;
+    block_pool_destroy(&pool);
+
+    return result;
+}
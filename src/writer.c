@@ -0,0 +1,1167 @@
+#define _CRT_SECURE_NO_WARNINGS
+#define _FILE_OFFSET_BITS 64
+#ifdef __linux__
+#define _GNU_SOURCE
+#endif
+
+#include "writer.h"
+#include "clock.h"
+#include "journal.h"
+#include "thread.h"
+#include "zero.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#define writer_fseek _fseeki64
+#define writer_ftell _ftelli64
+#else
+#define writer_fseek fseeko
+#define writer_ftell ftello
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+
+#ifdef __linux__
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#define WRITER_HAVE_URING 1
+#endif
+#endif
+
+struct Writer
+{
+    WriterBackend_t* backend;
+    BlockPool_t* pool;
+    Thread_t thread;
+    Mutex_t mutex;
+    Cond_t ready;
+
+    Block_t* queue_head;
+    Block_t* queue_tail;
+    uint32_t queue_depth;
+    int closing;
+    int failed;
+    int sparse;
+
+    // Blocks handed to the backend that it has not given back yet
+    uint32_t outstanding;
+    Journal_t* journal;
+
+    WriterStats_t stats;
+    // Time of every backend write and hole, if set
+    LatencyHistogram_t* latency;
+};
+
+#ifndef _WIN32
+
+static int32_t pwrite_all(int fd, const uint8_t* data, uint64_t size, uint64_t offset)
+{
+    while (size) {
+        const ssize_t written = pwrite(fd, data, size, (off_t)offset);
+        if (written < 0 && errno == EINTR)
+            continue;
+        if (written <= 0)
+            return -1;
+
+        data += written;
+        size -= (uint64_t)written;
+        offset += (uint64_t)written;
+    }
+
+    return 0;
+}
+
+// Finishes a vectored write that came back short
+static int32_t pwritev_remainder(
+    int fd, struct iovec* iov, uint32_t count, uint64_t offset, uint64_t written)
+{
+    for (uint32_t i = 0; i < count; i++) {
+        if (written >= iov[i].iov_len) {
+            written -= iov[i].iov_len;
+            offset += iov[i].iov_len;
+            continue;
+        }
+
+        if (pwrite_all(fd,
+                       (const uint8_t*)iov[i].iov_base + written,
+                       iov[i].iov_len - written,
+                       offset + written) < 0)
+            return -1;
+
+        offset += iov[i].iov_len;
+        written = 0;
+    }
+
+    return 0;
+}
+
+static int32_t pwrite_zeros(int fd, uint64_t offset, uint64_t size)
+{
+    static const uint8_t zeros[0x10000];
+
+    while (size) {
+        const uint64_t chunk = (size < sizeof(zeros)) ? size : sizeof(zeros);
+        if (pwrite_all(fd, zeros, chunk, offset) < 0)
+            return -1;
+        offset += chunk;
+        size -= chunk;
+    }
+
+    return 0;
+}
+
+// Makes [offset, offset + size) read back as zeros without writing them: the
+// file is extended past its end and existing data is punched out
+static int32_t fd_make_hole(int fd, uint64_t offset, uint64_t size, uint64_t* file_size)
+{
+    if (offset < *file_size) {
+        const uint64_t overlap = (size < *file_size - offset) ? size : *file_size - offset;
+        int punched = 0;
+#ifdef __linux__
+        punched = fallocate(fd,
+                            FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+                            (off_t)offset,
+                            (off_t)overlap) == 0;
+#endif
+        if (!punched && pwrite_zeros(fd, offset, overlap) < 0)
+            return -1;
+    }
+
+    if (offset + size > *file_size) {
+        if (ftruncate(fd, (off_t)(offset + size)) != 0)
+            return -1;
+        *file_size = offset + size;
+    }
+
+    return 0;
+}
+
+static uint64_t fd_size(int fd)
+{
+    struct stat st;
+    return (fstat(fd, &st) == 0) ? (uint64_t)st.st_size : 0;
+}
+
+#endif // _WIN32
+
+// Buffered stdio backend
+
+typedef struct StdioBackend
+{
+    WriterBackend_t backend;
+    FILE* file;
+    char* buffer;
+    uint64_t position;
+    uint64_t file_size;
+} StdioBackend_t;
+
+static int32_t stdio_write(WriterBackend_t* backend, Block_t** blocks, uint32_t count)
+{
+    StdioBackend_t* stdio_backend = backend->priv;
+    int32_t result = 0;
+
+    if (stdio_backend->position != blocks[0]->offset) {
+        if (writer_fseek(stdio_backend->file, (int64_t)blocks[0]->offset, SEEK_SET) != 0)
+            result = -1;
+        stdio_backend->position = blocks[0]->offset;
+    }
+
+    for (uint32_t i = 0; i < count; i++) {
+        if (!result && fwrite(blocks[i]->data, 1, blocks[i]->size, stdio_backend->file) !=
+                           blocks[i]->size)
+            result = -1;
+        stdio_backend->position += blocks[i]->size;
+        backend->done(backend->done_ctx, blocks[i], result);
+    }
+
+    if (stdio_backend->position > stdio_backend->file_size)
+        stdio_backend->file_size = stdio_backend->position;
+
+    return result;
+}
+
+static int32_t stdio_flush(WriterBackend_t* backend)
+{
+    StdioBackend_t* stdio_backend = backend->priv;
+    return fflush(stdio_backend->file) == 0 ? 0 : -1;
+}
+
+static int32_t stdio_hole(WriterBackend_t* backend, uint64_t offset, uint64_t size)
+{
+    StdioBackend_t* stdio_backend = backend->priv;
+
+#ifdef _WIN32
+    static const uint8_t zeros[0x10000];
+
+    // No sparse files through stdio here, write the zeros
+    if (writer_fseek(stdio_backend->file, (int64_t)offset, SEEK_SET) != 0)
+        return -1;
+    for (uint64_t left = size; left;) {
+        const size_t chunk = (size_t)((left < sizeof(zeros)) ? left : sizeof(zeros));
+        if (fwrite(zeros, 1, chunk, stdio_backend->file) != chunk)
+            return -1;
+        left -= chunk;
+    }
+    stdio_backend->position = offset + size;
+    if (stdio_backend->position > stdio_backend->file_size)
+        stdio_backend->file_size = stdio_backend->position;
+
+    return 0;
+#else
+    if (fflush(stdio_backend->file) != 0)
+        return -1;
+
+    return fd_make_hole(fileno(stdio_backend->file), offset, size, &stdio_backend->file_size);
+#endif
+}
+
+static int32_t stdio_close(WriterBackend_t* backend)
+{
+    StdioBackend_t* stdio_backend = backend->priv;
+    const int32_t result = fclose(stdio_backend->file) == 0 ? 0 : -1;
+
+    free(stdio_backend->buffer);
+    free(stdio_backend);
+
+    return result;
+}
+
+static WriterBackend_t* stdio_open(const char* path, int truncate)
+{
+    StdioBackend_t* stdio_backend = calloc(1, sizeof(StdioBackend_t));
+    if (!stdio_backend)
+        return NULL;
+
+    // Resumed dumps keep what is already in the file
+    stdio_backend->file = truncate ? NULL : fopen(path, "rb+");
+    if (!stdio_backend->file)
+        stdio_backend->file = fopen(path, "wb+");
+    if (!stdio_backend->file) {
+        free(stdio_backend);
+        return NULL;
+    }
+
+    if (writer_fseek(stdio_backend->file, 0, SEEK_END) == 0)
+        stdio_backend->file_size = (uint64_t)writer_ftell(stdio_backend->file);
+    stdio_backend->position = stdio_backend->file_size;
+
+    // One large buffer instead of a flush per block
+    stdio_backend->buffer = malloc(WRITER_STDIO_BUFFER_SIZE);
+    if (stdio_backend->buffer)
+        setvbuf(stdio_backend->file, stdio_backend->buffer, _IOFBF, WRITER_STDIO_BUFFER_SIZE);
+
+    stdio_backend->backend.name = "stdio";
+    stdio_backend->backend.write = stdio_write;
+    stdio_backend->backend.flush = stdio_flush;
+    stdio_backend->backend.hole = stdio_hole;
+    stdio_backend->backend.close = stdio_close;
+    stdio_backend->backend.priv = stdio_backend;
+
+    return &stdio_backend->backend;
+}
+
+#ifndef _WIN32
+
+// mmap backend. The output is preallocated to its final size and mapped, so
+// blocks can be received straight into the page cache (block_pool_place) and
+// need no write at all. Blocks that were not, like short ones at the end of a
+// range, are copied in.
+
+typedef struct MmapBackend
+{
+    WriterBackend_t backend;
+    int fd;
+    uint64_t size;
+    uint64_t file_size;
+} MmapBackend_t;
+
+static int32_t mmap_write(WriterBackend_t* backend, Block_t** blocks, uint32_t count)
+{
+    MmapBackend_t* mapped = backend->priv;
+    int32_t result = 0;
+
+    for (uint32_t i = 0; i < count; i++) {
+        uint8_t* target = backend->mapping + blocks[i]->offset;
+
+        if (blocks[i]->offset + blocks[i]->size > mapped->size)
+            result = -1;
+        else if (!result && blocks[i]->data != target)
+            memcpy(target, blocks[i]->data, blocks[i]->size);
+        backend->done(backend->done_ctx, blocks[i], result);
+    }
+
+    return result;
+}
+
+static int32_t mmap_flush(WriterBackend_t* backend)
+{
+    // Everything in the mapping already is in the page cache
+    return 0;
+}
+
+static int32_t mmap_hole(WriterBackend_t* backend, uint64_t offset, uint64_t size)
+{
+    MmapBackend_t* mapped = backend->priv;
+
+    // Zero blocks received in place still occupy pages, punch them out
+    return fd_make_hole(mapped->fd, offset, size, &mapped->file_size);
+}
+
+static int32_t mmap_close(WriterBackend_t* backend)
+{
+    MmapBackend_t* mapped = backend->priv;
+    int32_t result = 0;
+
+    if (munmap(backend->mapping, mapped->size) != 0 || close(mapped->fd) != 0)
+        result = -1;
+
+    free(mapped);
+    return result;
+}
+
+static WriterBackend_t* mmap_open(const char* path, int truncate, int sparse, uint64_t size)
+{
+    if (!size)
+        return NULL;
+
+    MmapBackend_t* mapped = calloc(1, sizeof(MmapBackend_t));
+    if (!mapped)
+        return NULL;
+
+    mapped->fd = open(path, O_RDWR | O_CREAT | (truncate ? O_TRUNC : 0), 0644);
+    if (mapped->fd < 0) {
+        free(mapped);
+        return NULL;
+    }
+
+    // Sparse outputs only get their size, the rest is allocated up front
+    mapped->size = size;
+    mapped->file_size = fd_size(mapped->fd);
+    int preallocated = mapped->file_size >= size || ftruncate(mapped->fd, (off_t)size) == 0;
+#ifdef __linux__
+    if (preallocated && !sparse)
+        preallocated = posix_fallocate(mapped->fd, 0, (off_t)size) == 0;
+#endif
+    if (mapped->file_size < size)
+        mapped->file_size = size;
+
+    void* mapping = preallocated
+                        ? mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, mapped->fd, 0)
+                        : MAP_FAILED;
+    if (mapping == MAP_FAILED) {
+        close(mapped->fd);
+        free(mapped);
+        return NULL;
+    }
+
+    mapped->backend.name = "mmap";
+    mapped->backend.write = mmap_write;
+    mapped->backend.flush = mmap_flush;
+    mapped->backend.hole = mmap_hole;
+    mapped->backend.close = mmap_close;
+    mapped->backend.mapping = mapping;
+    mapped->backend.priv = mapped;
+
+    return &mapped->backend;
+}
+
+#endif // _WIN32
+
+#ifdef __linux__
+
+// O_DIRECT backend. Page aligned blocks go straight from the pool buffers to
+// the device, unaligned tails through a second, buffered descriptor.
+
+typedef struct DirectBackend
+{
+    WriterBackend_t backend;
+    int direct_fd;
+    int buffered_fd;
+    uint64_t file_size;
+} DirectBackend_t;
+
+static int direct_eligible(const Block_t* block)
+{
+    return block->offset % POOL_ALIGNMENT == 0 && block->size % POOL_ALIGNMENT == 0;
+}
+
+static int32_t direct_write(WriterBackend_t* backend, Block_t** blocks, uint32_t count)
+{
+    DirectBackend_t* direct = backend->priv;
+    struct iovec iov[WRITER_MAX_RUN];
+    int32_t result = 0;
+
+    const Block_t* last = blocks[count - 1];
+    if (last->offset + last->size > direct->file_size)
+        direct->file_size = last->offset + last->size;
+
+    for (uint32_t i = 0; i < count;) {
+        if (!direct_eligible(blocks[i])) {
+            if (!result && pwrite_all(direct->buffered_fd,
+                                      blocks[i]->data,
+                                      blocks[i]->size,
+                                      blocks[i]->offset) < 0)
+                result = -1;
+            backend->done(backend->done_ctx, blocks[i], result);
+            i++;
+            continue;
+        }
+
+        uint32_t run = 0;
+        uint64_t run_size = 0;
+        while (i + run < count && direct_eligible(blocks[i + run])) {
+            iov[run].iov_base = blocks[i + run]->data;
+            iov[run].iov_len = blocks[i + run]->size;
+            run_size += blocks[i + run]->size;
+            run++;
+        }
+
+        if (!result) {
+            ssize_t written;
+            do {
+                written = pwritev(direct->direct_fd, iov, (int)run, (off_t)blocks[i]->offset);
+            } while (written < 0 && errno == EINTR);
+
+            if (written < 0)
+                result = -1;
+            else if ((uint64_t)written < run_size &&
+                     pwritev_remainder(
+                         direct->buffered_fd, iov, run, blocks[i]->offset, (uint64_t)written) < 0)
+                result = -1;
+        }
+
+        for (uint32_t j = 0; j < run; j++)
+            backend->done(backend->done_ctx, blocks[i + j], result);
+        i += run;
+    }
+
+    return result;
+}
+
+static int32_t direct_flush(WriterBackend_t* backend)
+{
+    return 0;
+}
+
+static int32_t direct_hole(WriterBackend_t* backend, uint64_t offset, uint64_t size)
+{
+    DirectBackend_t* direct = backend->priv;
+    return fd_make_hole(direct->buffered_fd, offset, size, &direct->file_size);
+}
+
+static int32_t direct_close(WriterBackend_t* backend)
+{
+    DirectBackend_t* direct = backend->priv;
+    int32_t result = 0;
+
+    if (close(direct->direct_fd) != 0 || close(direct->buffered_fd) != 0)
+        result = -1;
+
+    free(direct);
+    return result;
+}
+
+static WriterBackend_t* direct_open(const char* path, int truncate)
+{
+    DirectBackend_t* direct = calloc(1, sizeof(DirectBackend_t));
+    if (!direct)
+        return NULL;
+
+    direct->direct_fd =
+        open(path, O_WRONLY | O_CREAT | O_DIRECT | (truncate ? O_TRUNC : 0), 0644);
+    if (direct->direct_fd < 0) {
+        free(direct);
+        return NULL;
+    }
+
+    direct->buffered_fd = open(path, O_WRONLY);
+    if (direct->buffered_fd < 0) {
+        close(direct->direct_fd);
+        free(direct);
+        return NULL;
+    }
+    direct->file_size = fd_size(direct->buffered_fd);
+
+    direct->backend.name = "direct";
+    direct->backend.write = direct_write;
+    direct->backend.flush = direct_flush;
+    direct->backend.hole = direct_hole;
+    direct->backend.close = direct_close;
+    direct->backend.priv = direct;
+
+    return &direct->backend;
+}
+
+#endif // __linux__
+
+#ifdef WRITER_HAVE_URING
+
+// io_uring backend. Every run of contiguous blocks becomes one WRITEV request,
+// blocks go back to the pool as their completions are reaped, so the disk
+// queue stays full while the writer thread picks up the next batch.
+
+#define URING_ENTRIES 32
+
+typedef struct UringWrite
+{
+    struct iovec iov[WRITER_MAX_RUN];
+    Block_t* blocks[WRITER_MAX_RUN];
+    uint32_t count;
+    uint64_t offset;
+    uint64_t size;
+} UringWrite_t;
+
+typedef struct UringBackend
+{
+    WriterBackend_t backend;
+    int file_fd;
+    int ring_fd;
+
+    uint8_t* sq_ring;
+    size_t sq_ring_size;
+    uint8_t* cq_ring;
+    size_t cq_ring_size;
+    struct io_uring_sqe* sqes;
+    size_t sqes_size;
+
+    uint32_t* sq_tail;
+    uint32_t* sq_mask;
+    uint32_t* sq_array;
+    uint32_t* cq_head;
+    uint32_t* cq_tail;
+    uint32_t* cq_mask;
+    struct io_uring_cqe* cqes;
+
+    uint32_t entries;
+    uint32_t in_flight;
+    int failed;
+    // Includes writes that are still in flight
+    uint64_t file_size;
+} UringBackend_t;
+
+static int uring_enter(int ring_fd, uint32_t to_submit, uint32_t min_complete, uint32_t flags)
+{
+    return (int)syscall(__NR_io_uring_enter, ring_fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static void uring_complete(UringBackend_t* uring, UringWrite_t* write, int32_t res)
+{
+    if (res < 0)
+        uring->failed = 1;
+    else if ((uint64_t)res < write->size &&
+             pwritev_remainder(
+                 uring->file_fd, write->iov, write->count, write->offset, (uint64_t)res) < 0)
+        uring->failed = 1;
+
+    for (uint32_t i = 0; i < write->count; i++)
+        uring->backend.done(uring->backend.done_ctx, write->blocks[i], uring->failed ? -1 : 0);
+
+    free(write);
+    uring->in_flight--;
+}
+
+// Reaps completions, waiting until at least min_complete have arrived
+static void uring_reap(UringBackend_t* uring, uint32_t min_complete)
+{
+    uint32_t reaped = 0;
+
+    for (;;) {
+        uint32_t head = *uring->cq_head;
+        const uint32_t tail = __atomic_load_n(uring->cq_tail, __ATOMIC_ACQUIRE);
+
+        while (head != tail) {
+            const struct io_uring_cqe* cqe = &uring->cqes[head & *uring->cq_mask];
+            uring_complete(uring, (UringWrite_t*)(uintptr_t)cqe->user_data, cqe->res);
+            head++;
+            reaped++;
+        }
+        __atomic_store_n(uring->cq_head, head, __ATOMIC_RELEASE);
+
+        if (reaped >= min_complete || !uring->in_flight)
+            return;
+
+        if (uring_enter(uring->ring_fd, 0, 1, IORING_ENTER_GETEVENTS) < 0 && errno != EINTR) {
+            uring->failed = 1;
+            return;
+        }
+    }
+}
+
+static int32_t uring_write(WriterBackend_t* backend, Block_t** blocks, uint32_t count)
+{
+    UringBackend_t* uring = backend->priv;
+
+    UringWrite_t* write = calloc(1, sizeof(UringWrite_t));
+    if (!write || uring->failed) {
+        free(write);
+        for (uint32_t i = 0; i < count; i++)
+            backend->done(backend->done_ctx, blocks[i], -1);
+        return -1;
+    }
+
+    write->count = count;
+    write->offset = blocks[0]->offset;
+    for (uint32_t i = 0; i < count; i++) {
+        write->blocks[i] = blocks[i];
+        write->iov[i].iov_base = blocks[i]->data;
+        write->iov[i].iov_len = blocks[i]->size;
+        write->size += blocks[i]->size;
+    }
+
+    if (uring->in_flight >= uring->entries)
+        uring_reap(uring, 1);
+
+    if (write->offset + write->size > uring->file_size)
+        uring->file_size = write->offset + write->size;
+
+    const uint32_t tail = *uring->sq_tail;
+    const uint32_t index = tail & *uring->sq_mask;
+    struct io_uring_sqe* sqe = &uring->sqes[index];
+
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    sqe->opcode = IORING_OP_WRITEV;
+    sqe->fd = uring->file_fd;
+    sqe->addr = (uint64_t)(uintptr_t)write->iov;
+    sqe->len = count;
+    sqe->off = write->offset;
+    sqe->user_data = (uint64_t)(uintptr_t)write;
+
+    uring->sq_array[index] = index;
+    __atomic_store_n(uring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    uring->in_flight++;
+
+    int submitted;
+    do {
+        submitted = uring_enter(uring->ring_fd, 1, 0, 0);
+    } while (submitted < 0 && errno == EINTR);
+
+    if (submitted < 0) {
+        uring->failed = 1;
+        return -1;
+    }
+
+    // Recycle whatever has already finished without waiting
+    uring_reap(uring, 0);
+
+    return uring->failed ? -1 : 0;
+}
+
+static int32_t uring_flush(WriterBackend_t* backend)
+{
+    UringBackend_t* uring = backend->priv;
+
+    while (uring->in_flight && !uring->failed)
+        uring_reap(uring, 1);
+
+    return uring->failed ? -1 : 0;
+}
+
+static int32_t uring_hole(WriterBackend_t* backend, uint64_t offset, uint64_t size)
+{
+    UringBackend_t* uring = backend->priv;
+    return fd_make_hole(uring->file_fd, offset, size, &uring->file_size);
+}
+
+static void uring_unmap(UringBackend_t* uring)
+{
+    if (uring->sqes)
+        munmap(uring->sqes, uring->sqes_size);
+    if (uring->cq_ring && uring->cq_ring != uring->sq_ring)
+        munmap(uring->cq_ring, uring->cq_ring_size);
+    if (uring->sq_ring)
+        munmap(uring->sq_ring, uring->sq_ring_size);
+    if (uring->ring_fd >= 0)
+        close(uring->ring_fd);
+}
+
+static int32_t uring_close(WriterBackend_t* backend)
+{
+    UringBackend_t* uring = backend->priv;
+    int32_t result = uring_flush(backend);
+
+    uring_unmap(uring);
+    if (close(uring->file_fd) != 0)
+        result = -1;
+
+    free(uring);
+    return result;
+}
+
+static WriterBackend_t* uring_open(const char* path, int truncate)
+{
+    struct io_uring_params params;
+
+    UringBackend_t* uring = calloc(1, sizeof(UringBackend_t));
+    if (!uring)
+        return NULL;
+
+    memset(&params, 0, sizeof(params));
+    uring->ring_fd = (int)syscall(__NR_io_uring_setup, URING_ENTRIES, &params);
+    if (uring->ring_fd < 0) {
+        free(uring);
+        return NULL;
+    }
+
+    uring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+    uring->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+        uring->sq_ring_size = uring->cq_ring_size = (uring->sq_ring_size > uring->cq_ring_size)
+                                                        ? uring->sq_ring_size
+                                                        : uring->cq_ring_size;
+
+    uring->sq_ring = mmap(NULL,
+                          uring->sq_ring_size,
+                          PROT_READ | PROT_WRITE,
+                          MAP_SHARED | MAP_POPULATE,
+                          uring->ring_fd,
+                          IORING_OFF_SQ_RING);
+    if (uring->sq_ring == MAP_FAILED) {
+        uring->sq_ring = NULL;
+        goto fail;
+    }
+
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        uring->cq_ring = uring->sq_ring;
+    } else {
+        uring->cq_ring = mmap(NULL,
+                              uring->cq_ring_size,
+                              PROT_READ | PROT_WRITE,
+                              MAP_SHARED | MAP_POPULATE,
+                              uring->ring_fd,
+                              IORING_OFF_CQ_RING);
+        if (uring->cq_ring == MAP_FAILED) {
+            uring->cq_ring = NULL;
+            goto fail;
+        }
+    }
+
+    uring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    uring->sqes = mmap(NULL,
+                       uring->sqes_size,
+                       PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_POPULATE,
+                       uring->ring_fd,
+                       IORING_OFF_SQES);
+    if (uring->sqes == MAP_FAILED) {
+        uring->sqes = NULL;
+        goto fail;
+    }
+
+    uring->sq_tail = (uint32_t*)(uring->sq_ring + params.sq_off.tail);
+    uring->sq_mask = (uint32_t*)(uring->sq_ring + params.sq_off.ring_mask);
+    uring->sq_array = (uint32_t*)(uring->sq_ring + params.sq_off.array);
+    uring->cq_head = (uint32_t*)(uring->cq_ring + params.cq_off.head);
+    uring->cq_tail = (uint32_t*)(uring->cq_ring + params.cq_off.tail);
+    uring->cq_mask = (uint32_t*)(uring->cq_ring + params.cq_off.ring_mask);
+    uring->cqes = (struct io_uring_cqe*)(uring->cq_ring + params.cq_off.cqes);
+    uring->entries = params.sq_entries;
+
+    uring->file_fd = open(path, O_WRONLY | O_CREAT | (truncate ? O_TRUNC : 0), 0644);
+    if (uring->file_fd < 0)
+        goto fail;
+    uring->file_size = fd_size(uring->file_fd);
+
+    uring->backend.name = "uring";
+    uring->backend.write = uring_write;
+    uring->backend.flush = uring_flush;
+    uring->backend.hole = uring_hole;
+    uring->backend.close = uring_close;
+    uring->backend.priv = uring;
+
+    return &uring->backend;
+
+fail:
+    uring_unmap(uring);
+    free(uring);
+    return NULL;
+}
+
+#endif // WRITER_HAVE_URING
+
+// Writer thread
+
+static void writer_block_done(void* ctx, Block_t* block, int32_t status)
+{
+    Writer_t* writer = ctx;
+
+    writer->outstanding--;
+    if (status == 0 && writer->journal &&
+        journal_record(writer->journal, block->address, block->address + block->size, 0) < 0)
+        writer->failed = 1;
+
+    block_pool_release(writer->pool, block);
+}
+
+static void writer_set_failed(Writer_t* writer)
+{
+    mutex_lock(&writer->mutex);
+    writer->failed = 1;
+    mutex_unlock(&writer->mutex);
+}
+
+// Waits for the backend and records everything written so far in the journal
+static void writer_sync(Writer_t* writer)
+{
+    int32_t result = writer->backend->flush(writer->backend);
+
+    if (result == 0 && writer->journal && !writer->failed)
+        result = journal_sync(writer->journal);
+
+    if (result < 0)
+        writer_set_failed(writer);
+}
+
+static void writer_write_run(Writer_t* writer, Block_t** run, uint32_t count)
+{
+    const uint64_t start_ns = clock_now_ns();
+
+    if (writer->failed) {
+        for (uint32_t i = 0; i < count; i++)
+            block_pool_release(writer->pool, run[i]);
+    } else {
+        writer->outstanding += count;
+        if (writer->backend->write(writer->backend, run, count) < 0)
+            writer_set_failed(writer);
+    }
+
+    const uint64_t elapsed_ns = clock_now_ns() - start_ns;
+    writer->stats.write_ns += elapsed_ns;
+    writer->stats.writes++;
+    if (writer->latency)
+        latency_record(writer->latency, elapsed_ns);
+}
+
+// Zero blocks are not written at all, the range becomes a hole in the file
+static void writer_write_hole(Writer_t* writer, uint64_t address, uint64_t offset, uint64_t size)
+{
+    const uint64_t start_ns = clock_now_ns();
+
+    if (!writer->failed) {
+        if (writer->backend->hole(writer->backend, offset, size) < 0 ||
+            (writer->journal && journal_record(writer->journal, address, address + size, 1) < 0))
+            writer_set_failed(writer);
+    }
+
+    const uint64_t elapsed_ns = clock_now_ns() - start_ns;
+    writer->stats.write_ns += elapsed_ns;
+    writer->stats.hole_bytes += size;
+    if (writer->latency)
+        latency_record(writer->latency, elapsed_ns);
+}
+
+static void writer_write_batch(Writer_t* writer, Block_t* batch)
+{
+    Block_t* run[WRITER_MAX_RUN];
+    uint32_t count = 0;
+    uint64_t hole_address = 0;
+    uint64_t hole_offset = 0;
+    uint64_t hole_size = 0;
+
+    while (batch) {
+        Block_t* block = batch;
+        batch = block->next;
+        block->next = NULL;
+        writer->stats.blocks++;
+        writer->stats.bytes += block->size;
+
+        if (writer->sparse && zero_check(block->data, block->size)) {
+            if (count) {
+                writer_write_run(writer, run, count);
+                count = 0;
+            }
+
+            // Adjacent zero blocks grow a single hole
+            if (hole_size && hole_offset + hole_size != block->offset) {
+                writer_write_hole(writer, hole_address, hole_offset, hole_size);
+                hole_size = 0;
+            }
+            if (!hole_size) {
+                hole_address = block->address;
+                hole_offset = block->offset;
+            }
+            hole_size += block->size;
+
+            block_pool_release(writer->pool, block);
+            continue;
+        }
+
+        if (hole_size) {
+            writer_write_hole(writer, hole_address, hole_offset, hole_size);
+            hole_size = 0;
+        }
+
+        // Flush the run when the block doesn't continue it
+        if (count && (count == WRITER_MAX_RUN ||
+                      run[count - 1]->offset + run[count - 1]->size != block->offset)) {
+            writer_write_run(writer, run, count);
+            count = 0;
+        }
+
+        run[count++] = block;
+    }
+
+    if (count)
+        writer_write_run(writer, run, count);
+    if (hole_size)
+        writer_write_hole(writer, hole_address, hole_offset, hole_size);
+}
+
+static void writer_thread(void* arg)
+{
+    Writer_t* writer = arg;
+
+    for (;;) {
+        mutex_lock(&writer->mutex);
+
+        if (!writer->queue_head && !writer->closing && writer->outstanding) {
+            // Outstanding writes hold pool buffers the producer may be waiting for
+            mutex_unlock(&writer->mutex);
+            if (writer->backend->flush(writer->backend) < 0)
+                writer->failed = 1;
+            mutex_lock(&writer->mutex);
+        }
+
+        if (!writer->queue_head && !writer->closing) {
+            const uint64_t start_ns = clock_now_ns();
+            while (!writer->queue_head && !writer->closing)
+                cond_wait(&writer->ready, &writer->mutex);
+            writer->stats.idle_ns += clock_now_ns() - start_ns;
+        }
+
+        // Take everything that is queued so contiguous blocks coalesce
+        Block_t* batch = writer->queue_head;
+        writer->queue_head = writer->queue_tail = NULL;
+        writer->queue_depth = 0;
+        const int closing = writer->closing;
+
+        mutex_unlock(&writer->mutex);
+
+        if (!batch && closing)
+            break;
+
+        writer_write_batch(writer, batch);
+
+        if (writer->journal && writer->journal->pending_bytes >= JOURNAL_SYNC_BYTES)
+            writer_sync(writer);
+    }
+
+    writer_sync(writer);
+}
+
+Writer_t* writer_open(const char* path,
+                      WriterBackendType_t type,
+                      uint64_t size,
+                      uint32_t flags,
+                      BlockPool_t* pool,
+                      Journal_t* journal)
+{
+    WriterBackend_t* backend = NULL;
+    const int truncate = (flags & WRITER_TRUNCATE) != 0;
+
+    switch (type) {
+        case WRITER_BACKEND_DIRECT:
+#ifdef __linux__
+            backend = direct_open(path, truncate);
+#endif
+            if (!backend)
+                printf("O_DIRECT is not available for %s, using stdio\n", path);
+            break;
+        case WRITER_BACKEND_URING:
+#ifdef WRITER_HAVE_URING
+            backend = uring_open(path, truncate);
+#endif
+            if (!backend)
+                printf("io_uring is not available for %s, using stdio\n", path);
+            break;
+        case WRITER_BACKEND_MMAP:
+#ifndef _WIN32
+            backend = mmap_open(path, truncate, (flags & WRITER_SPARSE) != 0, size);
+#endif
+            if (!backend)
+                printf("mmap is not available for %s, using stdio\n", path);
+            break;
+        case WRITER_BACKEND_STDIO:
+        default:
+            break;
+    }
+
+    if (!backend)
+        backend = stdio_open(path, truncate);
+
+    if (!backend) {
+        printf("Failed to open %s\n", path);
+        return NULL;
+    }
+
+    return writer_start(backend, flags, pool, journal);
+}
+
+Writer_t* writer_start(WriterBackend_t* backend,
+                       uint32_t flags,
+                       BlockPool_t* pool,
+                       Journal_t* journal)
+{
+    Writer_t* writer = calloc(1, sizeof(Writer_t));
+    if (!writer) {
+        backend->close(backend);
+        return NULL;
+    }
+
+    writer->backend = backend;
+    writer->pool = pool;
+    writer->journal = journal;
+    writer->sparse = (flags & WRITER_SPARSE) != 0;
+    writer->stats.backend = backend->name;
+    backend->done = writer_block_done;
+    backend->done_ctx = writer;
+
+    mutex_init(&writer->mutex);
+    cond_init(&writer->ready);
+
+    if (thread_create(&writer->thread, writer_thread, writer) < 0) {
+        printf("Failed to start writer thread\n");
+        backend->close(backend);
+        mutex_destroy(&writer->mutex);
+        cond_destroy(&writer->ready);
+        free(writer);
+        return NULL;
+    }
+
+    return writer;
+}
+
+uint8_t* writer_mapping(const Writer_t* writer)
+{
+    return writer->backend->mapping;
+}
+
+void writer_record_latency(Writer_t* writer, LatencyHistogram_t* histogram)
+{
+    mutex_lock(&writer->mutex);
+    writer->latency = histogram;
+    mutex_unlock(&writer->mutex);
+}
+
+int32_t writer_submit(Writer_t* writer, Block_t* block)
+{
+    mutex_lock(&writer->mutex);
+
+    if (writer->failed) {
+        mutex_unlock(&writer->mutex);
+        block_pool_release(writer->pool, block);
+        return -1;
+    }
+
+    block->next = NULL;
+    if (writer->queue_tail)
+        writer->queue_tail->next = block;
+    else
+        writer->queue_head = block;
+    writer->queue_tail = block;
+
+    writer->queue_depth++;
+    if (writer->queue_depth > writer->stats.max_queue_depth)
+        writer->stats.max_queue_depth = writer->queue_depth;
+    writer->stats.queue_depth_sum += writer->queue_depth;
+    writer->stats.queue_samples++;
+
+    cond_signal(&writer->ready);
+    mutex_unlock(&writer->mutex);
+
+    return 0;
+}
+
+int32_t writer_close(Writer_t* writer, WriterStats_t* stats)
+{
+    mutex_lock(&writer->mutex);
+    writer->closing = 1;
+    cond_signal(&writer->ready);
+    mutex_unlock(&writer->mutex);
+
+    thread_join(&writer->thread);
+
+    int32_t result = writer->failed ? -1 : 0;
+    if (writer->backend->close(writer->backend) < 0)
+        result = -1;
+
+    if (stats) {
+        *stats = writer->stats;
+        stats->producer_wait_ns = writer->pool->wait_ns;
+        stats->producer_waits = writer->pool->waits;
+    }
+
+    mutex_destroy(&writer->mutex);
+    cond_destroy(&writer->ready);
+    free(writer);
+
+    return result;
+}
+
+int32_t writer_parse_backend(const char* name, WriterBackendType_t* type)
+{
+    if (!strcmp(name, "stdio"))
+        *type = WRITER_BACKEND_STDIO;
+    else if (!strcmp(name, "direct"))
+        *type = WRITER_BACKEND_DIRECT;
+    else if (!strcmp(name, "uring"))
+        *type = WRITER_BACKEND_URING;
+    else if (!strcmp(name, "mmap"))
+        *type = WRITER_BACKEND_MMAP;
+    else
+        return -1;
+
+    return 0;
+}
+
+void writer_print_stats(const char* output_path, const WriterStats_t* stats)
+{
+    printf("%s : %.2f MiB in %llu writes (%s), %.2f MiB sparse, queue depth avg %.1f max %u, "
+           "USB waited %.1f ms for buffers (%llu times), writer idle %.1f ms, busy %.1f ms\n",
+           output_path,
+           (double)stats->bytes / (1024 * 1024),
+           (unsigned long long)stats->writes,
+           stats->backend,
+           (double)stats->hole_bytes / (1024 * 1024),
+           stats->queue_samples ? (double)stats->queue_depth_sum / stats->queue_samples : 0.0,
+           stats->max_queue_depth,
+           (double)stats->producer_wait_ns / 1e6,
+           (unsigned long long)stats->producer_waits,
+           (double)stats->idle_ns / 1e6,
+           (double)stats->write_ns / 1e6);
+}
+
+int32_t writer_clone(const char* source_path, uint64_t offset, uint64_t size, const char* path)
+{
+#if defined(__linux__) && defined(FICLONERANGE)
+    const int source_fd = open(source_path, O_RDONLY);
+    if (source_fd < 0)
+        return -1;
+
+    const int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        close(source_fd);
+        return -1;
+    }
+
+    struct file_clone_range range = { source_fd, offset, size, 0 };
+    // Fails unless the file system shares extents and the range is block aligned
+    const int result = ioctl(fd, FICLONERANGE, &range);
+
+    close(fd);
+    close(source_fd);
+
+    return result == 0 ? 0 : -1;
+#else
+    return -1;
+#endif
+}
@@ -0,0 +1,151 @@
+#include "xxh64.h"
+
+#include <string.h>
+
+#define XXH64_PRIME1 0x9E3779B185EBCA87ull
+#define XXH64_PRIME2 0xC2B2AE3D27D4EB4Full
+#define XXH64_PRIME3 0x165667B19E3779F9ull
+#define XXH64_PRIME4 0x85EBCA77C2B2AE63ull
+#define XXH64_PRIME5 0x27D4EB2F165667C5ull
+
+static uint64_t xxh64_rotl(uint64_t x, uint32_t n)
+{
+    return (x << n) | (x >> (64 - n));
+}
+
+// Little-endian hosts only, like the rest of the dump formats
+static uint64_t xxh64_read64(const uint8_t* p)
+{
+    uint64_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+static uint32_t xxh64_read32(const uint8_t* p)
+{
+    uint32_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+static uint64_t xxh64_round(uint64_t acc, uint64_t input)
+{
+    acc += input * XXH64_PRIME2;
+    acc = xxh64_rotl(acc, 31);
+    return acc * XXH64_PRIME1;
+}
+
+static uint64_t xxh64_merge_round(uint64_t acc, uint64_t value)
+{
+    acc ^= xxh64_round(0, value);
+    return acc * XXH64_PRIME1 + XXH64_PRIME4;
+}
+
+static const uint8_t* xxh64_stripes(uint64_t* v, const uint8_t* p, size_t stripes)
+{
+    uint64_t v1 = v[0], v2 = v[1], v3 = v[2], v4 = v[3];
+
+    for (; stripes; stripes--, p += 32) {
+        v1 = xxh64_round(v1, xxh64_read64(p));
+        v2 = xxh64_round(v2, xxh64_read64(p + 8));
+        v3 = xxh64_round(v3, xxh64_read64(p + 16));
+        v4 = xxh64_round(v4, xxh64_read64(p + 24));
+    }
+
+    v[0] = v1;
+    v[1] = v2;
+    v[2] = v3;
+    v[3] = v4;
+
+    return p;
+}
+
+void xxh64_init(Xxh64_t* ctx, uint64_t seed)
+{
+    memset(ctx, 0, sizeof(Xxh64_t));
+    ctx->seed = seed;
+    ctx->v[0] = seed + XXH64_PRIME1 + XXH64_PRIME2;
+    ctx->v[1] = seed + XXH64_PRIME2;
+    ctx->v[2] = seed;
+    ctx->v[3] = seed - XXH64_PRIME1;
+}
+
+void xxh64_update(Xxh64_t* ctx, const void* data, size_t size)
+{
+    const uint8_t* p = data;
+
+    ctx->length += size;
+
+    if (ctx->buffered) {
+        const size_t count = (size < 32 - ctx->buffered) ? size : 32 - ctx->buffered;
+        memcpy(ctx->buffer + ctx->buffered, p, count);
+        ctx->buffered += count;
+        p += count;
+        size -= count;
+
+        if (ctx->buffered < 32)
+            return;
+
+        xxh64_stripes(ctx->v, ctx->buffer, 1);
+        ctx->buffered = 0;
+    }
+
+    p = xxh64_stripes(ctx->v, p, size / 32);
+    size %= 32;
+
+    memcpy(ctx->buffer, p, size);
+    ctx->buffered = size;
+}
+
+uint64_t xxh64_final(const Xxh64_t* ctx)
+{
+    uint64_t h;
+
+    if (ctx->length >= 32) {
+        h = xxh64_rotl(ctx->v[0], 1) + xxh64_rotl(ctx->v[1], 7) + xxh64_rotl(ctx->v[2], 12) +
+            xxh64_rotl(ctx->v[3], 18);
+        for (uint32_t i = 0; i < 4; i++)
+            h = xxh64_merge_round(h, ctx->v[i]);
+    } else {
+        h = ctx->seed + XXH64_PRIME5;
+    }
+
+    h += ctx->length;
+
+    const uint8_t* p = ctx->buffer;
+    size_t size = ctx->buffered;
+
+    for (; size >= 8; size -= 8, p += 8) {
+        h ^= xxh64_round(0, xxh64_read64(p));
+        h = xxh64_rotl(h, 27) * XXH64_PRIME1 + XXH64_PRIME4;
+    }
+    if (size >= 4) {
+        h ^= (uint64_t)xxh64_read32(p) * XXH64_PRIME1;
+        h = xxh64_rotl(h, 23) * XXH64_PRIME2 + XXH64_PRIME3;
+        p += 4;
+        size -= 4;
+    }
+    for (; size; size--, p++) {
+        h ^= *p * XXH64_PRIME5;
+        h = xxh64_rotl(h, 11) * XXH64_PRIME1;
+    }
+
+    // Avalanche
+    h ^= h >> 33;
+    h *= XXH64_PRIME2;
+    h ^= h >> 29;
+    h *= XXH64_PRIME3;
+    h ^= h >> 32;
+
+    return h;
+}
+
+uint64_t xxh64(const void* data, size_t size, uint64_t seed)
+{
+    Xxh64_t ctx;
+
+    xxh64_init(&ctx, seed);
+    xxh64_update(&ctx, data, size);
+
+    return xxh64_final(&ctx);
+}
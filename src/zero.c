@@ -0,0 +1,139 @@
+#include "zero.h"
+
+#include <string.h>
+
+#if defined(__x86_64__) || defined(_M_X64) || (defined(__i386__) && defined(__SSE2__))
+#include <emmintrin.h>
+#define ZERO_HAVE_SSE2 1
+#if defined(__GNUC__) || defined(__clang__)
+#include <immintrin.h>
+#define ZERO_HAVE_AVX2 1
+#endif
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#include <arm_neon.h>
+#define ZERO_HAVE_NEON 1
+#endif
+
+// Most blocks that hold data fail within the first bytes, check those before
+// setting up the vector loop
+#define ZERO_PREFIX_SIZE 0x40
+
+typedef int (*ZeroCheck_t)(const uint8_t* data, uint64_t size);
+
+static int zero_check_scalar(const uint8_t* data, uint64_t size)
+{
+    uint64_t acc = 0;
+    uint64_t i = 0;
+
+    for (; i + 4 * sizeof(uint64_t) <= size; i += 4 * sizeof(uint64_t)) {
+        uint64_t words[4];
+        memcpy(words, data + i, sizeof(words));
+        acc |= words[0] | words[1] | words[2] | words[3];
+        if (acc)
+            return 0;
+    }
+
+    for (; i < size; i++)
+        acc |= data[i];
+
+    return acc == 0;
+}
+
+#ifdef ZERO_HAVE_SSE2
+static int zero_check_sse2(const uint8_t* data, uint64_t size)
+{
+    const __m128i zero = _mm_setzero_si128();
+    uint64_t i = 0;
+
+    for (; i + 64 <= size; i += 64) {
+        __m128i acc = _mm_loadu_si128((const __m128i*)(data + i));
+        acc = _mm_or_si128(acc, _mm_loadu_si128((const __m128i*)(data + i + 16)));
+        acc = _mm_or_si128(acc, _mm_loadu_si128((const __m128i*)(data + i + 32)));
+        acc = _mm_or_si128(acc, _mm_loadu_si128((const __m128i*)(data + i + 48)));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(acc, zero)) != 0xFFFF)
+            return 0;
+    }
+
+    return zero_check_scalar(data + i, size - i);
+}
+#endif
+
+#ifdef ZERO_HAVE_AVX2
+__attribute__((target("avx2"))) static int zero_check_avx2(const uint8_t* data, uint64_t size)
+{
+    uint64_t i = 0;
+
+    for (; i + 128 <= size; i += 128) {
+        __m256i acc = _mm256_loadu_si256((const __m256i*)(data + i));
+        acc = _mm256_or_si256(acc, _mm256_loadu_si256((const __m256i*)(data + i + 32)));
+        acc = _mm256_or_si256(acc, _mm256_loadu_si256((const __m256i*)(data + i + 64)));
+        acc = _mm256_or_si256(acc, _mm256_loadu_si256((const __m256i*)(data + i + 96)));
+        if (!_mm256_testz_si256(acc, acc))
+            return 0;
+    }
+
+    return zero_check_scalar(data + i, size - i);
+}
+#endif
+
+#ifdef ZERO_HAVE_NEON
+static int zero_check_neon(const uint8_t* data, uint64_t size)
+{
+    uint64_t i = 0;
+
+    for (; i + 64 <= size; i += 64) {
+        uint8x16_t acc = vld1q_u8(data + i);
+        acc = vorrq_u8(acc, vld1q_u8(data + i + 16));
+        acc = vorrq_u8(acc, vld1q_u8(data + i + 32));
+        acc = vorrq_u8(acc, vld1q_u8(data + i + 48));
+        if (vmaxvq_u8(acc))
+            return 0;
+    }
+
+    return zero_check_scalar(data + i, size - i);
+}
+#endif
+
+static ZeroCheck_t zero_select(const char** name)
+{
+#ifdef ZERO_HAVE_AVX2
+    if (__builtin_cpu_supports("avx2")) {
+        *name = "avx2";
+        return zero_check_avx2;
+    }
+#endif
+#ifdef ZERO_HAVE_SSE2
+    *name = "sse2";
+    return zero_check_sse2;
+#elif defined(ZERO_HAVE_NEON)
+    *name = "neon";
+    return zero_check_neon;
+#else
+    *name = "scalar";
+    return zero_check_scalar;
+#endif
+}
+
+static ZeroCheck_t g_zero_check;
+static const char* g_zero_check_name;
+
+int zero_check(const uint8_t* data, uint64_t size)
+{
+    // Selecting twice from different threads is harmless
+    if (!g_zero_check)
+        g_zero_check = zero_select(&g_zero_check_name);
+
+    const uint64_t prefix = (size < ZERO_PREFIX_SIZE) ? size : ZERO_PREFIX_SIZE;
+    if (!zero_check_scalar(data, prefix))
+        return 0;
+
+    return g_zero_check(data + prefix, size - prefix);
+}
+
+const char* zero_check_impl(void)
+{
+    if (!g_zero_check)
+        g_zero_check = zero_select(&g_zero_check_name);
+
+    return g_zero_check_name;
+}